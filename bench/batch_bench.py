@@ -0,0 +1,96 @@
+#! /usr/bin/env python
+
+# Compare the cost of running N separate ocijail commands with running the
+# same N commands in a single batch. The state database is seeded with
+# containers as create leaves them, whose process is a sleep started by the
+# benchmark, and the commands are state and kill against those containers.
+# Kill sends SIGCONT, which is harmless, so the benchmark can run without
+# root.
+
+import argparse
+import json
+import os
+import os.path
+import signal
+import subprocess
+import tempfile
+import time
+
+cmd = "ocijail/ocijail"
+seed = "test/seed_state"
+
+# The number of containers in the state database
+CONTAINERS = 10
+
+def commands(n):
+    res = []
+    for i in range(n):
+        id = f"bench_{i % CONTAINERS}"
+        if i % 2 == 0:
+            res.append(["state", id])
+        else:
+            res.append(["kill", id, str(int(signal.SIGCONT))])
+    return res
+
+def run_separate(root, cmds):
+    start = time.perf_counter()
+    for args in cmds:
+        res = subprocess.run(
+            args=[cmd, "--root", root] + args,
+            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        if res.returncode != 0:
+            raise RuntimeError(f"{args[0]} failed")
+    return time.perf_counter() - start
+
+def run_batch(root, cmds):
+    lines = "".join(
+        json.dumps({"command": args[0], "args": args[1:]}) + "\n"
+        for args in cmds)
+    start = time.perf_counter()
+    res = subprocess.run(
+        args=[cmd, "--root", root, "batch"],
+        input=lines.encode(), stdout=subprocess.PIPE,
+        stderr=subprocess.DEVNULL)
+    elapsed = time.perf_counter() - start
+    results = res.stdout.decode().splitlines()
+    if len(results) != len(cmds):
+        raise RuntimeError(
+            f"expected {len(cmds)} batch results, got {len(results)}")
+    for line in results:
+        if json.loads(line)["status"] != 0:
+            raise RuntimeError(f"batch command failed: {line}")
+    return elapsed
+
+def main():
+    global cmd, seed
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("-n", type=int, default=500,
+                        help="number of commands")
+    parser.add_argument("--ocijail", default=cmd,
+                        help="path to the ocijail binary")
+    parser.add_argument("--seed-state", default=seed,
+                        help="path to the seed_state binary")
+    args = parser.parse_args()
+    cmd = args.ocijail
+    seed = args.seed_state
+
+    proc = subprocess.Popen(["sleep", "3600"])
+    try:
+        with tempfile.TemporaryDirectory() as tmp:
+            root = os.path.join(tmp, "state")
+            ids = [f"bench_{i}" for i in range(CONTAINERS)]
+            subprocess.run([seed, root, str(proc.pid)] + ids, check=True)
+            cmds = commands(args.n)
+
+            separate = run_separate(root, cmds)
+            batch = run_batch(root, cmds)
+    finally:
+        proc.kill()
+        proc.wait()
+    print(f"{args.n} commands:")
+    print(f"  separate: {separate:8.3f}s {1e6 * separate / args.n:10.1f}us/op")
+    print(f"  batch:    {batch:8.3f}s {1e6 * batch / args.n:10.1f}us/op")
+    print(f"  speedup:  {separate / batch:8.1f}x")
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,298 @@
+// Microbenchmarks for the runtime's hot paths which don't need FreeBSD, for
+// tracking performance regressions:
+//
+// - parsing ociVersion
+// - validating a bundle config, as create does for a new config, and the
+//   parsing and compiling steps separately
+// - splitting mount options, which happens while validating the mounts
+// - ingesting a large bundle config: parsing the whole document and writing
+//   it back out, reading only the used members with read_config while
+//   copying the document as is, and finding the compiled config in the
+//   config store as a repeated create does
+// - resolving mount destinations in a root with many symbolic links, with
+//   the log level at INFO, where the debug messages should cost nothing,
+//   and at DEBUG with the log going to /dev/null
+// - saving, loading and reporting the container state
+// - building the parameter list for jail_set
+//
+// See bench_harness for how the benchmarks are measured and reported.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <memory_resource>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "bench/harness.h"
+#include "ocijail/config_store.h"
+#include "ocijail/container_path.h"
+#include "ocijail/jail.h"
+#include "ocijail/log.h"
+#include "ocijail/runtime_state.h"
+#include "ocijail/spec.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+using namespace ocijail;
+
+// Results are added here so that the compiler can't discard the work
+static size_t sink;
+
+static json make_config(int entries, int mounts, int options) {
+    json config = {
+        {"ociVersion", "1.0.2"},
+        {"process",
+         {{"args", {"sh", "-c", "true"}},
+          {"cwd", "/"},
+          {"env", json::array()},
+          {"user", {{"uid", 0}, {"gid", 0}, {"additionalGids", {5, 20}}}}}},
+        {"root", {{"path", "/tmp"}}},
+        {"hostname", "bench"},
+        {"annotations",
+         {{"org.freebsd.jail.ip4.addr", "10.0.0.1,10.0.0.2"},
+          {"org.freebsd.jail.allow.mlock", "true"}}},
+        {"mounts", json::array()},
+    };
+    auto& env = config["process"]["env"];
+    for (int i = 0; i < entries; i++) {
+        env.push_back("VAR_" + std::to_string(i) + "=value " +
+                      std::to_string(i));
+    }
+    for (int i = 0; i < mounts; i++) {
+        json opts = json::array();
+        for (int j = 0; j < options; j++) {
+            if (j % 2) {
+                opts.push_back("option" + std::to_string(j) + "=value");
+            } else {
+                opts.push_back("flag" + std::to_string(j));
+            }
+        }
+        config["mounts"].push_back({
+            {"destination", "/data/volume" + std::to_string(i)},
+            {"type", "nullfs"},
+            {"source", "/var/volumes/" + std::to_string(i)},
+            {"options", opts},
+        });
+    }
+    for (auto phase : hook_phase_names) {
+        config["hooks"][phase].push_back(
+            {{"path", "/usr/local/bin/hook"}, {"args", {"hook", phase}}});
+    }
+    return config;
+}
+
+// Write a bundle config with many env entries and annotations and a large
+// linux section, giving a document of several megabytes for the largest n
+static void write_large_config(const fs::path& path, int n) {
+    json config = {
+        {"ociVersion", "1.0.2"},
+        {"process", {{"args", {"sh"}}, {"cwd", "/"}}},
+        {"root", {{"path", "/tmp"}}},
+    };
+    auto& env = config["process"]["env"];
+    auto& annotations = config["annotations"];
+    auto& syscalls = config["linux"]["seccomp"]["syscalls"];
+    for (int i = 0; i < n; i++) {
+        auto s = std::to_string(i);
+        env.push_back("GENERATED_VARIABLE_" + s + "=some value for " + s);
+        annotations["io.example.generated." + s] = "annotation value " + s;
+        syscalls.push_back({{"names", {"syscall_" + s, "other_" + s}},
+                            {"action", "SCMP_ACT_ALLOW"},
+                            {"args", {{{"index", 0}, {"value", i}}}}});
+    }
+    std::ofstream{path} << config;
+}
+
+static std::string read_file(const fs::path& path) {
+    std::ifstream in{path, std::ios::binary};
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// Make a container root where each destination goes through a chain of
+// symbolic links, some absolute and some relative, and return the
+// destinations
+static std::vector<std::string> make_root(const fs::path& root,
+                                          int count,
+                                          int depth) {
+    std::vector<std::string> destinations;
+    for (int i = 0; i < count; i++) {
+        auto s = std::to_string(i);
+        fs::create_directories(root / "data" / s / "volume");
+        auto target = "/data/" + s;
+        for (int j = 0; j < depth; j++) {
+            auto link = "link" + s + "_" + std::to_string(j);
+            if (j % 2) {
+                fs::create_symlink(target, root / link);
+            } else {
+                fs::create_symlink("." + target, root / link);
+            }
+            target = "/" + link;
+        }
+        destinations.push_back(target + "/volume/../volume/mnt");
+    }
+    return destinations;
+}
+
+static jail::config make_jail_config() {
+    jail::config jconf;
+    jconf.set("name", std::string{"bench-container"});
+    jconf.set("persist");
+    jconf.set("enforce_statfs", 1u);
+    jconf.set("allow.raw_sockets");
+    jconf.set("allow.chflags");
+    jconf.set("allow.mlock");
+    jconf.set("sysvmsg", jail::NEW);
+    jconf.set("sysvsem", jail::NEW);
+    jconf.set("sysvshm", jail::NEW);
+    jconf.set("path", std::string{"/var/lib/containers/storage/rootfs"});
+    jconf.set("ip4", jail::INHERIT);
+    jconf.set("ip4.addr", std::vector<uint8_t>{10, 0, 0, 1, 10, 0, 0, 2});
+    jconf.set("ip6", jail::INHERIT);
+    jconf.set("host.hostname", std::string{"bench"});
+    jconf.set("host", jail::NEW);
+    return jconf;
+}
+
+int main(int argc, char** argv) {
+    bench_harness bench{argc, argv};
+
+    bench.run("parse_version", [] {
+        sink += parse_version("1.0.2").patch.size();
+        sink += parse_version("1.1.0-rc.1").patch.size();
+    });
+
+    for (int n : {10, 100, 1000}) {
+        auto text = make_config(n, n / 10, 3).dump();
+        auto config = json::parse(text);
+        auto suffix = "/" + std::to_string(n);
+        bench.run("validate_config" + suffix, [&] {
+            sink += oci_spec::compile(read_config(text)).mounts.size();
+        });
+        bench.run("parse_config" + suffix,
+                  [&] { sink += json::parse(text).size(); });
+        bench.run("compile_config" + suffix, [&] {
+            sink += oci_spec::compile(config).mounts.size();
+        });
+    }
+
+    // The same mounts with few and many options, so that the difference is
+    // the cost of splitting the options
+    for (int options : {0, 16}) {
+        auto config = make_config(0, 100, options);
+        bench.run("mount_options/100x" + std::to_string(options), [&] {
+            sink += oci_spec::compile(config).mounts.size();
+        });
+    }
+
+    auto dir = fs::temp_directory_path() / ("ocijail_bench." +
+                                            std::to_string(::getpid()));
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    auto bundle_config = dir / "config.json";
+    auto state_config = dir / "state_config.json";
+    for (int n : {1000, 10000, 50000}) {
+        auto suffix = "/" + std::to_string(n);
+        if (!bench.selected("config_ingest/dom" + suffix) &&
+            !bench.selected("config_ingest/sax" + suffix) &&
+            !bench.selected("config_ingest/store" + suffix)) {
+            continue;
+        }
+        write_large_config(bundle_config, n);
+        bench.run("config_ingest/dom" + suffix, [&] {
+            json config;
+            std::ifstream{bundle_config} >> config;
+            sink += oci_spec::compile(config).process.env.size();
+            std::ofstream{state_config} << config.dump();
+        });
+        bench.run("config_ingest/sax" + suffix, [&] {
+            std::ifstream in{bundle_config};
+            sink += oci_spec::compile(read_config(in)).process.env.size();
+            fs::copy_file(bundle_config,
+                          state_config,
+                          fs::copy_options::overwrite_existing);
+        });
+
+        // A repeated create finds the compiled config in the store
+        config_store store{dir};
+        auto text = read_file(bundle_config);
+        auto entry = store.find(text);
+        entry.spec = std::make_shared<const oci_spec>(
+            oci_spec::compile(read_config(text)));
+        fs::create_directories(dir / "first");
+        store.add(entry, text, dir / "first");
+        bench.run("config_ingest/store" + suffix, [&] {
+            auto entry = store.find(read_file(bundle_config));
+            sink += entry.spec != nullptr;
+        });
+        fs::remove_all(dir / "first");
+        store.release(entry.hash);
+    }
+
+    logger log;
+    log.fd = ::open("/dev/null", O_WRONLY);
+    for (auto [depth, level] : {std::pair{0, log_level::INFO},
+                                {8, log_level::INFO},
+                                {8, log_level::DEBUG}}) {
+        auto name = "resolve_path/symlinks" + std::to_string(depth);
+        if (level == log_level::DEBUG) {
+            name += "/debug";
+        }
+        if (!bench.selected(name)) {
+            continue;
+        }
+        log.level = level;
+        auto root = dir / name;
+        auto destinations = make_root(root, 50, depth);
+
+        // Like create, use a monotonic arena for the working strings
+        std::array<std::byte, 16384> buffer;
+        std::pmr::monotonic_buffer_resource arena{buffer.data(),
+                                                  buffer.size()};
+        bench.run(name, [&] {
+            for (auto& destination : destinations) {
+                sink += resolve_container_path(log, &arena, root, destination)
+                            .native()
+                            .size();
+            }
+            arena.release();
+        });
+    }
+    ::close(log.fd);
+
+    {
+        std::string id = "bench";
+        runtime_state state{dir / "state" / id, id};
+        auto lk = state.create();
+        state.set_bundle("/var/lib/containers/storage/bundle");
+        state.set_pid(1234);
+        state.set_jid(12);
+        state.set_status(container_status::RUNNING);
+        state.save();
+        bench.run("state/save", [&] { state.save(); });
+        bench.run("state/load", [&] {
+            state.load();
+            sink += state.generation();
+        });
+        bench.run("state/report", [&] { sink += state.report().size(); });
+    }
+
+    auto jconf = make_jail_config();
+    bench.run("jail_iovec", [&] {
+        std::array<char, 1024> errbuf;
+        sink += jail::get_iovec(jconf, errbuf).size();
+    });
+
+    fs::remove_all(dir);
+    return sink == 0;
+}
@@ -0,0 +1,60 @@
+#include <cstdio>
+
+#include "nlohmann/json.hpp"
+
+#include "bench/harness.h"
+
+using nlohmann::json;
+
+namespace ocijail {
+
+bench_harness::bench_harness(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg{argv[i]};
+        if (arg == "--json") {
+            as_json_ = true;
+        } else {
+            filters_.emplace_back(arg);
+        }
+    }
+    if (!as_json_) {
+        std::printf("%-32s %12s %12s %12s %10s %12s\n",
+                    "benchmark",
+                    "iterations",
+                    "ns/op",
+                    "min ns/op",
+                    "allocs/op",
+                    "bytes/op");
+    }
+}
+
+bool bench_harness::selected(std::string_view name) const {
+    return filters_.empty() ||
+           std::any_of(filters_.begin(), filters_.end(), [&](auto& f) {
+               return name.find(f) != std::string_view::npos;
+           });
+}
+
+void bench_harness::report(const result& r) const {
+    if (as_json_) {
+        json j;
+        j["name"] = r.name;
+        j["iterations"] = r.iterations;
+        j["ns_per_op"] = r.ns;
+        j["min_ns_per_op"] = r.min_ns;
+        j["allocs_per_op"] = r.allocs;
+        j["bytes_per_op"] = r.bytes;
+        std::printf("%s\n", j.dump().c_str());
+    } else {
+        std::printf("%-32s %12zu %12.1f %12.1f %10.2f %12.0f\n",
+                    r.name.c_str(),
+                    r.iterations,
+                    r.ns,
+                    r.min_ns,
+                    r.allocs,
+                    r.bytes);
+    }
+    std::fflush(stdout);
+}
+
+}  // namespace ocijail
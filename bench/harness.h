@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ocijail/arena.h"
+
+namespace ocijail {
+
+// Runs microbenchmarks and reports their results. Each benchmark is run in
+// batches which take about 10ms and the time per operation is the median
+// over the batches, which is much less affected by other activity on the
+// host than the mean. Heap allocations per operation are counted exactly by
+// the runtime's replacement for operator new.
+//
+// With --json, each result is written as a JSON object on its own line.
+// Other arguments select the benchmarks whose names contain them.
+class bench_harness {
+   public:
+    bench_harness(int argc, char** argv);
+
+    // Measure a benchmark, if it is selected, and report the result
+    template <typename F>
+    void run(std::string name, F&& f) {
+        if (selected(name)) {
+            report(measure(std::move(name), f));
+        }
+    }
+
+    bool selected(std::string_view name) const;
+
+   private:
+    static constexpr auto BATCH_TIME = std::chrono::milliseconds{10};
+    static constexpr int BATCHES = 15;
+    static constexpr size_t MAX_BATCH = size_t{1} << 30;
+
+    struct result {
+        std::string name;
+        size_t iterations;
+        double ns;
+        double min_ns;
+        double allocs;
+        double bytes;
+    };
+
+    template <typename F>
+    static std::chrono::nanoseconds time_batch(size_t n, F& f) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n; i++) {
+            f();
+        }
+        return std::chrono::steady_clock::now() - start;
+    }
+
+    template <typename F>
+    static result measure(std::string name, F& f) {
+        // Warm up and find a batch size which takes long enough to time
+        size_t n = 1;
+        while (time_batch(n, f) < BATCH_TIME && n < MAX_BATCH) {
+            n *= 2;
+        }
+        std::vector<double> times;
+        alloc_counters allocs;
+        for (int i = 0; i < BATCHES; i++) {
+            auto start = heap_counters();
+            auto t = time_batch(n, f);
+            auto end = heap_counters();
+            allocs = {end.count - start.count, end.bytes - start.bytes};
+            times.push_back(double(t.count()) / n);
+        }
+        std::sort(times.begin(), times.end());
+        return {std::move(name),
+                n,
+                times[times.size() / 2],
+                times[0],
+                double(allocs.count) / n,
+                double(allocs.bytes) / n};
+    }
+
+    void report(const result& r) const;
+
+    bool as_json_{false};
+    std::vector<std::string> filters_;
+};
+
+}  // namespace ocijail
@@ -0,0 +1,356 @@
+// Measure how many create, start and delete cycles per second the runtime
+// can sustain, and how that scales with the number of concurrent clients
+// and the number of mounts per container.
+//
+// The commands run in-process through the same dispatcher as batch mode,
+// against sim_platform, which models jails and the mount table in memory
+// and can add latency to each kernel operation. Everything else is real:
+// the state database, the config store, the forked container process,
+// which runs /bin/true on the host, and the start handshake. This needs no
+// FreeBSD kernel, so it can run on a Linux host. It must run as root since
+// the container process sets its credentials.
+//
+// For each combination of mount count and concurrency, each client is a
+// separate process which runs its share of the cycles against a shared
+// state database. The report gives the throughput and the median and 99th
+// percentile latency of each command and of the whole cycle. Clients check
+// that delete left no jails or mounts behind in their model.
+
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/dispatch.h"
+#include "ocijail/main.h"
+#include "ocijail/sim_platform.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+using namespace ocijail;
+
+using clock_type = std::chrono::steady_clock;
+
+struct options {
+    int cycles{200};
+    std::vector<int> concurrency{1, 2, 4, 8};
+    std::vector<int> mounts{0, 4, 16};
+    unsigned jail_latency{0};
+    unsigned mount_latency{0};
+    fs::path dir;
+    bool as_json{false};
+};
+
+static void usage() {
+    std::fprintf(stderr,
+                 "usage: ocijail-bench [--cycles N] [--concurrency N,...] "
+                 "[--mounts N,...]\n"
+                 "                     [--jail-latency USEC] "
+                 "[--mount-latency USEC] [--dir DIR]\n"
+                 "                     [--json]\n");
+    ::exit(2);
+}
+
+static std::vector<int> parse_list(const std::string& value) {
+    std::vector<int> res;
+    std::stringstream ss{value};
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        res.push_back(std::stoi(item));
+    }
+    return res;
+}
+
+static options parse_options(int argc, char** argv) {
+    options opts;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg{argv[i]};
+        if (arg == "--json") {
+            opts.as_json = true;
+            continue;
+        }
+        if (i + 1 == argc) {
+            usage();
+        }
+        std::string value{argv[++i]};
+        if (arg == "--cycles") {
+            opts.cycles = std::stoi(value);
+        } else if (arg == "--concurrency") {
+            opts.concurrency = parse_list(value);
+        } else if (arg == "--mounts") {
+            opts.mounts = parse_list(value);
+        } else if (arg == "--jail-latency") {
+            opts.jail_latency = std::stoul(value);
+        } else if (arg == "--mount-latency") {
+            opts.mount_latency = std::stoul(value);
+        } else if (arg == "--dir") {
+            opts.dir = value;
+        } else {
+            usage();
+        }
+    }
+    return opts;
+}
+
+// Make a bundle for a client with the given number of nullfs mounts. Each
+// client has its own container root so that concurrent containers don't
+// share mount points.
+static fs::path make_bundle(const fs::path& dir, int mounts) {
+    auto bundle = dir / "bundle";
+    auto root = dir / "root";
+    fs::create_directories(bundle);
+    fs::create_directories(root);
+    json config = {
+        {"ociVersion", "1.0.2"},
+        {"process",
+         {{"args", {"/bin/true"}},
+          {"cwd", "/"},
+          {"user", {{"uid", 0}, {"gid", 0}}}}},
+        {"root", {{"path", root}}},
+        {"hostname", "bench"},
+        {"mounts", json::array()},
+    };
+    for (int i = 0; i < mounts; i++) {
+        auto source = dir / "volumes" / std::to_string(i);
+        fs::create_directories(source);
+        config["mounts"].push_back(
+            {{"destination", "/data/volume" + std::to_string(i)},
+             {"type", "nullfs"},
+             {"source", source},
+             {"options", {"rw", "nosuid"}}});
+    }
+    std::ofstream{bundle / "config.json"} << config;
+    return bundle;
+}
+
+using samples = std::map<std::string, std::vector<double>>;
+
+// Run a client's cycles, returning the latency of each step in
+// milliseconds
+static samples run_client(const sim_platform& sim,
+                          const fs::path& state_db,
+                          const fs::path& bundle,
+                          const std::string& prefix,
+                          int cycles) {
+    main_app settings{"ocijail-bench"};
+    dispatcher d{settings};
+    samples res;
+    auto options = json::array({"--root", state_db});
+    auto run = [&](const char* command, json args) {
+        json request;
+        request["command"] = command;
+        request["options"] = options;
+        request["args"] = args;
+        auto start = clock_type::now();
+        auto reply = d.run(request);
+        std::chrono::duration<double, std::milli> t =
+            clock_type::now() - start;
+        if (reply["status"] != 0) {
+            throw std::runtime_error{std::string{command} + ": " +
+                                     reply.value("error", "failed")};
+        }
+        res[command].push_back(t.count());
+        return t.count();
+    };
+    for (int i = 0; i < cycles; i++) {
+        auto id = prefix + "-" + std::to_string(i);
+        auto t = run("create", {"--bundle", bundle, id});
+        t += run("start", {id});
+        t += run("delete", {"--force", id});
+        res["cycle"].push_back(t);
+
+        // Reap the container process
+        while (::waitpid(-1, nullptr, WNOHANG) > 0) {
+        }
+    }
+    if (!sim.jails().empty() || !sim.mounts().empty()) {
+        throw std::runtime_error{
+            std::to_string(sim.jails().size()) + " jails and " +
+            std::to_string(sim.mounts().size()) + " mounts left behind"};
+    }
+    return res;
+}
+
+static double percentile(std::vector<double>& v, double p) {
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, size_t(p * v.size()))];
+}
+
+static json run_level(const options& opts,
+                      const sim_platform& sim,
+                      int mounts,
+                      int clients) {
+    auto dir = opts.dir / ("m" + std::to_string(mounts) + "_c" +
+                           std::to_string(clients));
+    auto state_db = dir / "state";
+    fs::create_directories(state_db);
+    std::vector<fs::path> bundles;
+    for (int c = 0; c < clients; c++) {
+        bundles.push_back(make_bundle(dir / std::to_string(c), mounts));
+    }
+
+    // Clients wait for the pipe to close so that they start together
+    int go[2];
+    if (::pipe(go) < 0) {
+        throw std::system_error{errno, std::system_category(), "pipe"};
+    }
+    std::vector<pid_t> pids;
+    for (int c = 0; c < clients; c++) {
+        auto pid = ::fork();
+        if (pid == 0) {
+            ::close(go[1]);
+            char ch;
+            ::read(go[0], &ch, 1);
+            int status = 0;
+            try {
+                auto cycles = opts.cycles / clients +
+                              (c < opts.cycles % clients ? 1 : 0);
+                auto res = run_client(sim,
+                                      state_db,
+                                      bundles[c],
+                                      "c" + std::to_string(c),
+                                      cycles);
+                std::ofstream{dir / std::to_string(c) / "samples.json"}
+                    << json(res);
+            } catch (const std::exception& e) {
+                std::fprintf(stderr, "client %d: %s\n", c, e.what());
+                status = 1;
+            }
+            ::_exit(status);
+        }
+        pids.push_back(pid);
+    }
+    ::close(go[0]);
+    auto start = clock_type::now();
+    ::close(go[1]);
+    bool failed = false;
+    for (auto pid : pids) {
+        int status;
+        ::waitpid(pid, &status, 0);
+        failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    if (failed) {
+        throw std::runtime_error{"a client failed"};
+    }
+
+    samples all;
+    for (int c = 0; c < clients; c++) {
+        std::ifstream in{dir / std::to_string(c) / "samples.json"};
+        auto res = json::parse(in).get<samples>();
+        for (auto& [step, v] : res) {
+            all[step].insert(all[step].end(), v.begin(), v.end());
+        }
+    }
+    json res;
+    res["mounts"] = mounts;
+    res["concurrency"] = clients;
+    res["cycles"] = all["cycle"].size();
+    res["seconds"] = elapsed.count();
+    res["cycles_per_second"] = all["cycle"].size() / elapsed.count();
+    for (auto& [step, v] : all) {
+        res[step] = {{"p50_ms", percentile(v, 0.5)},
+                     {"p99_ms", percentile(v, 0.99)}};
+    }
+    fs::remove_all(dir);
+    return res;
+}
+
+int main(int argc, char** argv) {
+    auto opts = parse_options(argc, argv);
+    if (::geteuid() != 0) {
+        std::fprintf(stderr, "ocijail-bench: must be run as root\n");
+        return 1;
+    }
+    bool remove_dir = false;
+    if (opts.dir.empty()) {
+        std::string base = "/tmp";
+        if (auto p = ::getenv("TMPDIR")) {
+            base = p;
+        }
+        auto tmpl = base + "/ocijail_bench.XXXXXX";
+        if (::mkdtemp(tmpl.data()) == nullptr) {
+            std::perror("mkdtemp");
+            return 1;
+        }
+        opts.dir = tmpl;
+        remove_dir = true;
+    }
+
+    sim_platform sim;
+    for (auto op : {sim_op::SET_JAIL,
+                    sim_op::GET_JAIL,
+                    sim_op::ATTACH_JAIL,
+                    sim_op::REMOVE_JAIL}) {
+        sim.set_latency(op, std::chrono::microseconds{opts.jail_latency});
+    }
+    for (auto op : {sim_op::MOUNT, sim_op::UNMOUNT, sim_op::DEVFS}) {
+        sim.set_latency(op, std::chrono::microseconds{opts.mount_latency});
+    }
+    set_platform(&sim);
+
+    if (!opts.as_json) {
+        std::printf("%6s %7s %7s %9s %15s %15s %15s %15s\n",
+                    "mounts",
+                    "clients",
+                    "cycles",
+                    "cycles/s",
+                    "create p50/p99",
+                    "start p50/p99",
+                    "delete p50/p99",
+                    "cycle p50/p99");
+    }
+    int status = 0;
+    for (auto mounts : opts.mounts) {
+        for (auto clients : opts.concurrency) {
+            json res;
+            try {
+                res = run_level(opts, sim, mounts, clients);
+            } catch (const std::exception& e) {
+                std::fprintf(stderr, "ocijail-bench: %s\n", e.what());
+                status = 1;
+                continue;
+            }
+            if (opts.as_json) {
+                std::printf("%s\n", res.dump().c_str());
+            } else {
+                auto ms = [&](const char* step) {
+                    char buf[32];
+                    std::snprintf(buf,
+                                  sizeof(buf),
+                                  "%.2f/%.2f",
+                                  res[step]["p50_ms"].get<double>(),
+                                  res[step]["p99_ms"].get<double>());
+                    return std::string{buf};
+                };
+                std::printf("%6d %7d %7zu %9.1f %15s %15s %15s %15s\n",
+                            mounts,
+                            clients,
+                            res["cycles"].get<size_t>(),
+                            res["cycles_per_second"].get<double>(),
+                            ms("create").c_str(),
+                            ms("start").c_str(),
+                            ms("delete").c_str(),
+                            ms("cycle").c_str());
+            }
+            std::fflush(stdout);
+        }
+    }
+    if (remove_dir) {
+        fs::remove_all(opts.dir);
+    }
+    return status;
+}
@@ -0,0 +1,294 @@
+#! /usr/bin/env python
+
+# Replay invocations recorded with OCIJAIL_RECORD against a test state
+# database, keeping their original inter-arrival times and so their
+# concurrency, e.g. state polls during create, bursts of health check execs
+# or storms of delete --force. Paths in the arguments are rewritten to
+# files in a work directory: bundles are made from the recorded configs,
+# exec processes from the recorded processes, and console sockets are
+# answered by the replay. The report compares the recorded and replayed
+# latency of each command.
+
+import argparse
+import array
+import json
+import os
+import os.path
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+cmd = "ocijail/ocijail"
+
+COMMANDS = {
+    "create", "start", "delete", "exec", "kill", "state", "list",
+    "features", "events", "batch", "serve", "wait", "flight",
+}
+
+# Global options which take a value
+GLOBAL_OPTIONS = {
+    "--root", "--testing", "--log-format", "--log-level", "--log",
+    "--trace", "--record-threshold", "--lock-timeout",
+}
+
+def split_option(arg):
+    "Split --name=value into its name and value"
+    if arg.startswith("--") and "=" in arg:
+        name, value = arg.split("=", 1)
+        return name, value
+    return arg, None
+
+def command_of(args):
+    i = 0
+    while i < len(args):
+        name, value = split_option(args[i])
+        if name in COMMANDS:
+            return name
+        if name in GLOBAL_OPTIONS and value is None:
+            i += 1
+        i += 1
+    return None
+
+class console_server:
+    "Accept console sockets, keeping the terminals open until closed"
+
+    def __init__(self, path):
+        self.path = path
+        self.fds = []
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.bind(path)
+        self.sock.listen(64)
+        threading.Thread(target=self.serve, daemon=True).start()
+
+    def serve(self):
+        while True:
+            try:
+                conn, _ = self.sock.accept()
+            except OSError:
+                return
+            with conn:
+                fds = array.array("i")
+                try:
+                    _, ancdata, _, _ = conn.recvmsg(
+                        1024, socket.CMSG_LEN(fds.itemsize))
+                except OSError:
+                    continue
+                for level, kind, data in ancdata:
+                    if level == socket.SOL_SOCKET and \
+                       kind == socket.SCM_RIGHTS:
+                        fds.frombytes(data[:len(data) - len(data) %
+                                           fds.itemsize])
+                self.fds.extend(fds)
+
+    def close(self):
+        self.sock.close()
+        for fd in self.fds:
+            os.close(fd)
+
+class replay:
+    def __init__(self, args, work):
+        # Commands run in the work directory
+        self.root = os.path.abspath(args.root)
+        self.rootfs = args.rootfs and os.path.abspath(args.rootfs)
+        self.work = work
+        self.console = console_server(os.path.join(work, "console.sock"))
+        for d in ["bundles", "processes", "pids", "logs"]:
+            os.mkdir(os.path.join(work, d))
+
+    def bundle(self, n, record):
+        "Make a bundle from a recorded config"
+        bundle = os.path.join(self.work, "bundles", str(n))
+        os.mkdir(bundle)
+        config = record["config"]
+        root = config.setdefault("root", {})
+        if self.rootfs:
+            root["path"] = self.rootfs
+        elif not os.path.isabs(root.get("path", "root")):
+            os.makedirs(os.path.join(bundle, root.get("path", "root")))
+        with open(os.path.join(bundle, "config.json"), "w") as f:
+            json.dump(config, f)
+        return bundle
+
+    def process(self, n, record):
+        "Make an exec process file from a recorded process"
+        path = os.path.join(self.work, "processes", f"{n}.json")
+        with open(path, "w") as f:
+            json.dump(record["process"], f)
+        return path
+
+    def rewrite(self, n, record):
+        "Rewrite a recorded invocation's arguments to use the work directory"
+        res = ["--root", self.root]
+        has_bundle = False
+        args = record["args"]
+        i = 0
+        while i < len(args):
+            name, value = split_option(args[i])
+            takes_value = name in GLOBAL_OPTIONS or name in {
+                "--bundle", "-b", "--process", "--pid-file",
+                "--console-socket", "--preserve-fds",
+            }
+            if takes_value and value is None:
+                i += 1
+                value = args[i] if i < len(args) else None
+            i += 1
+            if name in {"--root", "--trace", "--preserve-fds"}:
+                continue
+            if name in {"--bundle", "-b"}:
+                has_bundle = True
+                if "config" in record:
+                    value = self.bundle(n, record)
+            elif name == "--process" and "process" in record:
+                value = self.process(n, record)
+            elif name == "--pid-file":
+                value = os.path.join(self.work, "pids", f"{n}.pid")
+            elif name == "--console-socket":
+                value = self.console.path
+            elif name == "--log":
+                value = os.path.join(self.work, "logs", f"{n}.log")
+            if takes_value and value is None:
+                continue
+            res.append(name)
+            if takes_value:
+                res.append(value)
+        if command_of(args) == "create" and not has_bundle and \
+           "config" in record:
+            res[-1:-1] = ["--bundle", self.bundle(n, record)]
+        return res
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(p * len(values)))]
+
+def peak_concurrency(intervals):
+    events = sorted([(s, 1) for s, e in intervals] +
+                    [(e, -1) for s, e in intervals])
+    res = n = 0
+    for _, d in events:
+        n += d
+        res = max(res, n)
+    return res
+
+def main():
+    global cmd
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("trace", help="file recorded with OCIJAIL_RECORD")
+    parser.add_argument("--root", required=True,
+                        help="state database to replay against")
+    parser.add_argument("--ocijail", default=cmd,
+                        help="path to the ocijail binary")
+    parser.add_argument("--speed", type=float, default=1.0,
+                        help="replay this many times faster")
+    parser.add_argument("--rootfs",
+                        help="use this container root for all bundles")
+    parser.add_argument("--record",
+                        help="record the replayed invocations to this file")
+    parser.add_argument("--json", action="store_true",
+                        help="report as JSON")
+    args = parser.parse_args()
+    cmd = os.path.abspath(args.ocijail)
+    if os.path.abspath(args.root) == "/var/run/ocijail":
+        sys.exit("replay: refusing to replay against the default state "
+                 "database")
+
+    with open(args.trace) as f:
+        records = [json.loads(line) for line in f if line.strip()]
+    records.sort(key=lambda r: r["start"])
+    if not records:
+        sys.exit("replay: no invocations recorded")
+
+    env = dict(os.environ)
+    env.pop("OCIJAIL_RECORD", None)
+    env.pop("OCIJAIL_FORWARD", None)
+    if args.record:
+        env["OCIJAIL_RECORD"] = os.path.abspath(args.record)
+
+    work = tempfile.mkdtemp(prefix="ocijail_replay.")
+    try:
+        r = replay(args, work)
+        runs = [(record, r.rewrite(n, record))
+                for n, record in enumerate(records)]
+        results = [None] * len(runs)
+
+        def run(n, argv):
+            start = time.perf_counter()
+            res = subprocess.run([cmd] + argv, env=env, cwd=work,
+                                 stdin=subprocess.DEVNULL,
+                                 stdout=subprocess.DEVNULL,
+                                 stderr=subprocess.DEVNULL)
+            results[n] = (start, time.perf_counter(), res.returncode)
+
+        first = records[0]["start"]
+        t0 = time.perf_counter()
+        lag = []
+        threads = []
+        for n, (record, argv) in enumerate(runs):
+            due = t0 + (record["start"] - first) / 1e9 / args.speed
+            now = time.perf_counter()
+            if due > now:
+                time.sleep(due - now)
+            lag.append(max(0, time.perf_counter() - due))
+            t = threading.Thread(target=run, args=(n, argv))
+            t.start()
+            threads.append(t)
+        for t in threads:
+            t.join()
+        elapsed = time.perf_counter() - t0
+        r.console.close()
+    finally:
+        shutil.rmtree(work, ignore_errors=True)
+
+    commands = {}
+    for (record, _), (start, end, status) in zip(runs, results):
+        c = commands.setdefault(command_of(record["args"]) or "?", {
+            "count": 0, "recorded": [], "replayed": [], "mismatches": 0})
+        c["count"] += 1
+        c["recorded"].append(record["duration"] / 1e6)
+        c["replayed"].append((end - start) * 1e3)
+        if status != record["status"]:
+            c["mismatches"] += 1
+    report = {
+        "invocations": len(records),
+        "seconds": elapsed,
+        "recorded_seconds": (max(r["start"] + r["duration"]
+                                 for r in records) - first) / 1e9,
+        "recorded_peak_concurrency": peak_concurrency(
+            [(r["start"] / 1e9, (r["start"] + r["duration"]) / 1e9)
+             for r in records]),
+        "replayed_peak_concurrency": peak_concurrency(
+            [(s, e) for s, e, _ in results]),
+        "launch_lag_p99_ms": percentile(lag, 0.99) * 1e3,
+        "commands": {},
+    }
+    for name, c in sorted(commands.items()):
+        report["commands"][name] = {
+            "count": c["count"],
+            "status_mismatches": c["mismatches"],
+            "recorded_p50_ms": percentile(c["recorded"], 0.5),
+            "recorded_p99_ms": percentile(c["recorded"], 0.99),
+            "replayed_p50_ms": percentile(c["replayed"], 0.5),
+            "replayed_p99_ms": percentile(c["replayed"], 0.99),
+        }
+
+    if args.json:
+        print(json.dumps(report))
+        return
+    print(f"{report['invocations']} invocations in {elapsed:.2f}s "
+          f"(recorded {report['recorded_seconds']:.2f}s), "
+          f"peak concurrency {report['replayed_peak_concurrency']} "
+          f"(recorded {report['recorded_peak_concurrency']}), "
+          f"launch lag p99 {report['launch_lag_p99_ms']:.2f}ms")
+    print(f"{'command':10} {'count':>6} {'mismatch':>8} "
+          f"{'recorded p50/p99':>18} {'replayed p50/p99':>18}")
+    for name, c in report["commands"].items():
+        recorded = f"{c['recorded_p50_ms']:.2f}/{c['recorded_p99_ms']:.2f}"
+        replayed = f"{c['replayed_p50_ms']:.2f}/{c['replayed_p99_ms']:.2f}"
+        print(f"{name:10} {c['count']:6} {c['status_mismatches']:8} "
+              f"{recorded:>18} {replayed:>18}")
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,543 @@
+// Simulate a state database with many containers and measure the latency of
+// list, state and delete against it, first one command at a time and then
+// with concurrent readers and writers.
+//
+// The database is populated directly with the runtime_state library: each
+// container gets a jail, a status record, runtime details and a config from
+// the shared config store, as create leaves them. A fraction of the
+// containers have live pids and the rest have pids of processes which have
+// exited, and most have a monitor. The list, state and delete commands run
+// in-process through the same dispatcher as batch mode, against
+// sim_platform, so no FreeBSD kernel is needed and this runs on any host,
+// ideally with the database on a tmpfs. The containers' volumes are not
+// modelled, so delete has no mounts to undo, but it does run each
+// container's poststop hook.
+//
+// State is run against live containers and delete against stopped ones.
+// While measuring concurrent access, writers delete containers and create
+// stopped replacements so that the number of containers stays the same.
+//
+// The report gives latency percentiles for each command in microseconds,
+// together with the layout versions and size of the database, so that
+// reports from different versions can be compared. With --json, the report
+// is written as a single JSON object.
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/config_store.h"
+#include "ocijail/dispatch.h"
+#include "ocijail/jail.h"
+#include "ocijail/runtime_state.h"
+#include "ocijail/sim_platform.h"
+#include "ocijail/state_index.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+using namespace ocijail;
+
+using clock_type = std::chrono::steady_clock;
+
+struct options {
+    int containers{10000};
+    int configs{20};
+    double live{0.5};
+    double monitored{0.9};
+    int readers{4};
+    int writers{2};
+    int list_runs{20};
+    int state_runs{2000};
+    int delete_runs{500};
+    double seconds{5};
+    fs::path root;
+    bool as_json{false};
+};
+
+static void usage() {
+    std::fprintf(stderr,
+                 "usage: state_scale [--containers N] [--configs N] "
+                 "[--live FRACTION]\n"
+                 "                   [--monitored FRACTION] [--readers N] "
+                 "[--writers N]\n"
+                 "                   [--list-runs N] [--state-runs N] "
+                 "[--delete-runs N]\n"
+                 "                   [--seconds S] [--root DIR] [--json]\n");
+    ::exit(2);
+}
+
+static options parse_options(int argc, char** argv) {
+    options opts;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg{argv[i]};
+        if (arg == "--json") {
+            opts.as_json = true;
+            continue;
+        }
+        if (i + 1 == argc) {
+            usage();
+        }
+        std::string value{argv[++i]};
+        if (arg == "--containers") {
+            opts.containers = std::stoi(value);
+        } else if (arg == "--configs") {
+            opts.configs = std::max(1, std::stoi(value));
+        } else if (arg == "--live") {
+            opts.live = std::stod(value);
+        } else if (arg == "--monitored") {
+            opts.monitored = std::stod(value);
+        } else if (arg == "--readers") {
+            opts.readers = std::stoi(value);
+        } else if (arg == "--writers") {
+            opts.writers = std::stoi(value);
+        } else if (arg == "--list-runs") {
+            opts.list_runs = std::stoi(value);
+        } else if (arg == "--state-runs") {
+            opts.state_runs = std::stoi(value);
+        } else if (arg == "--delete-runs") {
+            opts.delete_runs = std::stoi(value);
+        } else if (arg == "--seconds") {
+            opts.seconds = std::stod(value);
+        } else if (arg == "--root") {
+            opts.root = value;
+        } else {
+            usage();
+        }
+    }
+    return opts;
+}
+
+// A config of the size typically generated by podman for an image with a
+// few volumes
+static std::string make_config(int variant) {
+    json config = {
+        {"ociVersion", "1.0.2"},
+        {"process",
+         {{"args", {"/usr/local/bin/server", "--port", "8080"}},
+          {"cwd", "/"},
+          {"env", json::array()},
+          {"user", {{"uid", 0}, {"gid", 0}, {"additionalGids", {5, 20}}}},
+          {"terminal", false}}},
+        {"root", {{"path", "/var/db/containers/storage/rootfs"}}},
+        {"hostname", "container" + std::to_string(variant)},
+        {"annotations",
+         {{"org.freebsd.jail.allow.mlock", "true"},
+          {"io.podman.annotations.autoremove", "FALSE"},
+          {"org.opencontainers.image.stopSignal", "15"}}},
+        {"mounts", json::array()},
+    };
+    auto& env = config["process"]["env"];
+    env.push_back("PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin");
+    env.push_back("HOSTNAME=container" + std::to_string(variant));
+    for (int i = 0; i < 30; i++) {
+        env.push_back("APP_SETTING_" + std::to_string(i) + "=" +
+                      std::string(20, 'a' + i % 26));
+    }
+    for (auto dest : {"/dev", "/dev/fd", "/tmp", "/var/run"}) {
+        config["mounts"].push_back(
+            {{"destination", dest}, {"type", "devfs"}, {"source", "devfs"}});
+    }
+    for (int i = 0; i < 4; i++) {
+        config["mounts"].push_back(
+            {{"destination", "/data/volume" + std::to_string(i)},
+             {"type", "nullfs"},
+             {"source", "/var/db/containers/storage/volumes/" +
+                            std::to_string(variant) + "_" +
+                            std::to_string(i)},
+             {"options", {"rw", "nosuid"}}});
+    }
+    config["hooks"]["poststop"].push_back(
+        {{"path", "/usr/bin/true"}, {"args", {"hook", "poststop"}}});
+    return config.dump();
+}
+
+// Podman style container ids
+static std::string make_id(std::mt19937_64& rng) {
+    char buf[65];
+    for (int i = 0; i < 4; i++) {
+        std::snprintf(buf + 16 * i,
+                      17,
+                      "%016llx",
+                      static_cast<unsigned long long>(rng()));
+    }
+    return buf;
+}
+
+// The pid of a process which has exited
+static int dead_pid() {
+    auto pid = ::fork();
+    if (pid == 0) {
+        ::_exit(0);
+    }
+    if (pid < 0) {
+        throw std::system_error{errno, std::system_category(), "fork"};
+    }
+    ::waitpid(pid, nullptr, 0);
+    return pid;
+}
+
+struct population {
+    population(const options& opts)
+        : opts_(opts),
+          store_(opts.root),
+          live_pid_(::getpid()),
+          dead_pid_(dead_pid()),
+          rng_(1) {
+        for (int i = 0; i < opts.configs; i++) {
+            configs_.push_back(make_config(i));
+        }
+    }
+
+    // Decide whether a new container's process is still running
+    bool pick_live() {
+        std::lock_guard lk{mu_};
+        return std::uniform_real_distribution{}(rng_) < opts_.live;
+    }
+
+    // Create a container as create leaves it, returning its id
+    std::string create(bool live) {
+        std::string id;
+        int variant;
+        bool monitored;
+        {
+            std::lock_guard lk{mu_};
+            id = make_id(rng_);
+            variant = rng_() % configs_.size();
+            monitored =
+                std::uniform_real_distribution{}(rng_) < opts_.monitored;
+        }
+        auto& text = configs_[variant];
+        runtime_state state{opts_.root / id, id};
+        auto entry = store_.find(text);
+        std::optional<json> config;
+        if (!entry.spec) {
+            config = read_config(text);
+            entry.spec =
+                std::make_shared<const oci_spec>(oci_spec::compile(*config));
+        }
+        jail::config jconf;
+        jconf.set("name", id);
+        jconf.set("persist");
+        auto j = jail::create(jconf);
+        state["root_path"] = "/var/db/containers/storage/rootfs/" + id;
+        state["root_readonly"] = false;
+        state["mount_plan"] = json::array();
+        state.set_bundle("/var/db/containers/storage/overlay-containers/" +
+                         id + "/userdata");
+        state.set_status(live ? container_status::RUNNING
+                              : container_status::CREATED);
+        state.set_hook_mask(entry.spec->hook_mask());
+        auto lk = state.create();
+        state.save_config(entry, text, config ? &*config : nullptr);
+        state.set_jid(j.jid());
+        state.set_pid(live ? live_pid_ : dead_pid_);
+        if (monitored) {
+            state.add_flags(status_record::MONITORED);
+            if (!live) {
+                state.set_exited(0);
+            }
+        }
+        state.save_details();
+        state.save();
+        return id;
+    }
+
+    void add(std::string id, bool live) {
+        std::lock_guard lk{mu_};
+        (live ? live_ids_ : stopped_ids_).push_back(std::move(id));
+    }
+
+    // Pick a live container, or a stopped one to be deleted
+    std::optional<std::string> pick(bool remove) {
+        std::lock_guard lk{mu_};
+        auto& ids = remove ? stopped_ids_ : live_ids_;
+        if (ids.empty()) {
+            return std::nullopt;
+        }
+        auto i = rng_() % ids.size();
+        auto id = ids[i];
+        if (remove) {
+            ids[i] = std::move(ids.back());
+            ids.pop_back();
+        }
+        return id;
+    }
+
+    const options& opts_;
+    config_store store_;
+    int live_pid_;
+    int dead_pid_;
+    std::vector<std::string> configs_;
+    std::mutex mu_;
+    std::mt19937_64 rng_;
+    std::vector<std::string> live_ids_;
+    std::vector<std::string> stopped_ids_;
+};
+
+// Run a command through the dispatcher, failing if it fails
+static void run_command(dispatcher& d, const char* command, json args) {
+    json request;
+    request["command"] = command;
+    request["args"] = std::move(args);
+    auto reply = d.run(request);
+    if (reply["status"] != 0) {
+        throw std::runtime_error{std::string{command} + ": " +
+                                 reply.value("error", "failed")};
+    }
+}
+
+struct latencies {
+    std::map<std::string, std::vector<double>> samples;
+    std::map<std::string, size_t> errors;
+
+    template <typename F>
+    void time(const std::string& op, F&& f) {
+        auto start = clock_type::now();
+        try {
+            f();
+        } catch (const std::exception&) {
+            errors[op]++;
+            return;
+        }
+        std::chrono::duration<double, std::micro> t = clock_type::now() - start;
+        samples[op].push_back(t.count());
+    }
+
+    void merge(latencies&& other) {
+        for (auto& [op, v] : other.samples) {
+            auto& s = samples[op];
+            s.insert(s.end(), v.begin(), v.end());
+        }
+        for (auto& [op, n] : other.errors) {
+            errors[op] += n;
+        }
+    }
+
+    json report() {
+        json res = json::object();
+        for (auto& [op, v] : samples) {
+            std::sort(v.begin(), v.end());
+            auto pct = [&](double p) {
+                return v[std::min(v.size() - 1, size_t(p * v.size()))];
+            };
+            double sum = 0;
+            for (auto t : v) {
+                sum += t;
+            }
+            res[op] = {
+                {"count", v.size()},
+                {"errors", errors[op]},
+                {"mean_us", sum / v.size()},
+                {"p50_us", pct(0.5)},
+                {"p90_us", pct(0.9)},
+                {"p99_us", pct(0.99)},
+                {"max_us", v.back()},
+            };
+        }
+        return res;
+    }
+};
+
+static latencies run_sequential(population& pop, const main_app& settings) {
+    auto& opts = pop.opts_;
+    dispatcher d{settings, false};
+    latencies res;
+    for (int i = 0; i < opts.list_runs; i++) {
+        res.time("list", [&] { run_command(d, "list", {"--format", "json"}); });
+    }
+    for (int i = 0; i < opts.state_runs; i++) {
+        if (auto id = pop.pick(false)) {
+            res.time("state", [&] { run_command(d, "state", {*id}); });
+        }
+    }
+    for (int i = 0; i < opts.delete_runs; i++) {
+        if (auto id = pop.pick(true)) {
+            res.time("delete", [&] { run_command(d, "delete", {*id}); });
+        }
+        res.time("create", [&] { pop.add(pop.create(false), false); });
+    }
+    return res;
+}
+
+static latencies run_concurrent(population& pop, const main_app& settings) {
+    auto& opts = pop.opts_;
+    auto deadline =
+        clock_type::now() +
+        std::chrono::duration_cast<clock_type::duration>(
+            std::chrono::duration<double>{opts.seconds});
+    std::vector<latencies> results(opts.readers + opts.writers);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opts.readers + opts.writers; i++) {
+        threads.emplace_back([&, i] {
+            dispatcher d{settings, false};
+            auto& res = results[i];
+            bool writer = i >= opts.readers;
+            for (int n = 0; clock_type::now() < deadline; n++) {
+                if (writer) {
+                    if (auto id = pop.pick(true)) {
+                        res.time("delete",
+                                 [&] { run_command(d, "delete", {*id}); });
+                    }
+                    res.time("create",
+                             [&] { pop.add(pop.create(false), false); });
+                } else if (n % 50 == 0) {
+                    res.time("list", [&] {
+                        run_command(d, "list", {"--format", "json"});
+                    });
+                } else if (auto id = pop.pick(false)) {
+                    res.time("state", [&] { run_command(d, "state", {*id}); });
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    latencies res;
+    for (auto& r : results) {
+        res.merge(std::move(r));
+    }
+    return res;
+}
+
+// Files linked from the config store are only counted once
+static json database_size(const fs::path& root) {
+    size_t files = 0, dirs = 0, bytes = 0;
+    std::set<std::pair<dev_t, ino_t>> seen;
+    for (auto& e : fs::recursive_directory_iterator{root}) {
+        struct ::stat st;
+        if (::lstat(e.path().c_str(), &st) < 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            dirs++;
+        } else if (S_ISREG(st.st_mode) &&
+                   seen.emplace(st.st_dev, st.st_ino).second) {
+            files++;
+            bytes += st.st_size;
+        }
+    }
+    return {{"directories", dirs}, {"files", files}, {"bytes", bytes}};
+}
+
+static void print_table(const char* title, const json& ops) {
+    std::printf("\n%s\n", title);
+    std::printf("%-8s %8s %8s %10s %10s %10s %10s %10s\n",
+                "command",
+                "count",
+                "errors",
+                "mean us",
+                "p50 us",
+                "p90 us",
+                "p99 us",
+                "max us");
+    for (auto& [op, r] : ops.items()) {
+        std::printf("%-8s %8zu %8zu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                    op.c_str(),
+                    r["count"].get<size_t>(),
+                    r["errors"].get<size_t>(),
+                    r["mean_us"].get<double>(),
+                    r["p50_us"].get<double>(),
+                    r["p90_us"].get<double>(),
+                    r["p99_us"].get<double>(),
+                    r["max_us"].get<double>());
+    }
+}
+
+int main(int argc, char** argv) {
+    auto opts = parse_options(argc, argv);
+    bool remove_root = false;
+    if (opts.root.empty()) {
+        // Prefer a tmpfs so that we measure the runtime rather than the disk
+        std::string base = fs::is_directory("/dev/shm") ? "/dev/shm" : "/tmp";
+        if (auto p = ::getenv("TMPDIR")) {
+            base = p;
+        }
+        auto tmpl = base + "/state_scale.XXXXXX";
+        if (::mkdtemp(tmpl.data()) == nullptr) {
+            std::perror("mkdtemp");
+            return 1;
+        }
+        opts.root = tmpl;
+        remove_root = true;
+    }
+    fs::create_directories(opts.root);
+
+    sim_platform sim;
+    set_platform(&sim);
+    main_app settings{"state_scale"};
+    settings.set_state_db(opts.root);
+
+    population pop{opts};
+    auto start = clock_type::now();
+    for (int i = 0; i < opts.containers; i++) {
+        auto live = pop.pick_live();
+        pop.add(pop.create(live), live);
+    }
+    std::chrono::duration<double> populate = clock_type::now() - start;
+
+    json report;
+    report["status_record_version"] = status_record::VERSION;
+    report["state_index_version"] = state_index::VERSION;
+    report["options"] = {
+        {"containers", opts.containers},
+        {"configs", opts.configs},
+        {"live", opts.live},
+        {"monitored", opts.monitored},
+        {"readers", opts.readers},
+        {"writers", opts.writers},
+        {"seconds", opts.seconds},
+    };
+    report["populate_seconds"] = populate.count();
+    report["sequential"] = run_sequential(pop, settings).report();
+    report["concurrent"] = run_concurrent(pop, settings).report();
+    report["database"] = database_size(opts.root);
+
+    if (opts.as_json) {
+        std::printf("%s\n", report.dump(4).c_str());
+    } else {
+        auto& db = report["database"];
+        std::printf(
+            "%d containers with %d configs, populated in %.2fs\n"
+            "database: %zu directories, %zu files, %zu bytes\n",
+            opts.containers,
+            opts.configs,
+            populate.count(),
+            db["directories"].get<size_t>(),
+            db["files"].get<size_t>(),
+            db["bytes"].get<size_t>());
+        print_table("one command at a time", report["sequential"]);
+        char title[80];
+        std::snprintf(title,
+                      sizeof(title),
+                      "%d readers and %d writers for %gs",
+                      opts.readers,
+                      opts.writers,
+                      opts.seconds);
+        print_table(title, report["concurrent"]);
+    }
+    if (remove_root) {
+        fs::remove_all(opts.root);
+    }
+    set_platform(nullptr);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+#include "ocijail/arena.h"
+
+namespace {
+
+std::atomic<size_t> heap_count{0};
+std::atomic<size_t> heap_bytes{0};
+
+}  // namespace
+
+// Replace the global allocator so that --stats can report how much each
+// command allocates. This only adds two relaxed atomic increments to each
+// allocation. Array, nothrow and sized variants all end up here or in the
+// matching delete.
+void* operator new(size_t size) {
+    auto p = ::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc{};
+    }
+    heap_count.fetch_add(1, std::memory_order_relaxed);
+    heap_bytes.fetch_add(size, std::memory_order_relaxed);
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    ::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    ::free(p);
+}
+
+namespace ocijail {
+
+alloc_counters heap_counters() {
+    return {heap_count.load(std::memory_order_relaxed),
+            heap_bytes.load(std::memory_order_relaxed)};
+}
+
+void* counting_resource::do_allocate(size_t bytes, size_t alignment) {
+    auto p = upstream_->allocate(bytes, alignment);
+    counters_.count++;
+    counters_.bytes += bytes;
+    return p;
+}
+
+void counting_resource::do_deallocate(void* p,
+                                      size_t bytes,
+                                      size_t alignment) {
+    upstream_->deallocate(p, bytes, alignment);
+}
+
+}  // namespace ocijail
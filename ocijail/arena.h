@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+
+namespace ocijail {
+
+struct alloc_counters {
+    size_t count{0};
+    size_t bytes{0};
+};
+
+// Return the number and total size of heap allocations made by this process
+// so far. These are counted by our replacement for the global operator new,
+// which is shared by all threads.
+alloc_counters heap_counters();
+
+// A memory resource which counts allocations before passing them on to
+// another resource
+class counting_resource : public std::pmr::memory_resource {
+   public:
+    explicit counting_resource(std::pmr::memory_resource* upstream)
+        : upstream_(upstream) {}
+
+    auto counters() const { return counters_; }
+
+   private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(
+        const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource* upstream_;
+    alloc_counters counters_;
+};
+
+// A per-command arena for the short-lived structures built while running a
+// command, such as jail parameters and mount options. Nothing is freed until
+// the arena is destroyed, at which point everything is released at once. The
+// first few kilobytes come from the arena itself so small commands don't
+// touch the heap at all.
+class arena {
+   public:
+    arena() = default;
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    std::pmr::memory_resource* resource() { return &front_; }
+
+    // Allocations made from the arena
+    alloc_counters used() const { return front_.counters(); }
+
+    // Memory which the arena took from the heap
+    alloc_counters reserved() const { return upstream_.counters(); }
+
+   private:
+    static constexpr size_t INITIAL_SIZE = 4096;
+
+    std::array<std::byte, INITIAL_SIZE> initial_;
+    counting_resource upstream_{std::pmr::new_delete_resource()};
+    std::pmr::monotonic_buffer_resource buffer_{
+        initial_.data(), initial_.size(), &upstream_};
+    counting_resource front_{&buffer_};
+};
+
+}  // namespace ocijail
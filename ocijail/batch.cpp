@@ -0,0 +1,43 @@
+#include <iostream>
+
+#include "ocijail/batch.h"
+#include "ocijail/dispatch.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+namespace ocijail {
+
+void batch::init(main_app& app) {
+    app.add_command(std::shared_ptr<batch>{new batch{app}});
+}
+
+batch::batch(main_app& app) : app_(app) {
+    auto sub = app.add_subcommand(
+        "batch",
+        "Run commands read from stdin, one JSON object per line, writing one "
+        "JSON result per line to stdout. Each command is an object like "
+        "{\"command\": \"kill\", \"args\": [\"my-id\", \"TERM\"]} where args "
+        "are the command's usual command line arguments and an optional "
+        "\"options\" array holds global options. Supported commands "
+        "are create, start, state, kill, delete and list. Containers "
+        "created in batch mode should use --console-socket or redirect "
+        "their stdio since they inherit the batch process' stdin and "
+        "stdout.");
+    sub->final_callback([this] { run(); });
+}
+
+void batch::run() {
+    app_.set_long_running();
+    dispatcher d{app_};
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        app_.out() << d.run(line) << "\n" << std::flush;
+    }
+}
+
+}  // namespace ocijail
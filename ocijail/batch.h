@@ -0,0 +1,17 @@
+#pragma once
+
+#include "ocijail/main.h"
+
+namespace ocijail {
+
+struct batch {
+    static void init(main_app& app);
+
+   private:
+    batch(main_app& app);
+    void run();
+
+    main_app& app_;
+};
+
+}  // namespace ocijail
@@ -0,0 +1,173 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <vector>
+
+#include "ocijail/config_store.h"
+#include "ocijail/sha256.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+namespace ocijail {
+
+// The files in each entry, using the same names as in the state directory.
+// The config is linked first and unlinked last so that it is present
+// whenever any of the others are.
+static constexpr const char* CONFIG = "config.json";
+static constexpr const char* ANNOTATIONS = "annotations.json";
+static constexpr const char* SPEC = "spec";
+
+// Give up if concurrent deletes keep removing the entry we want to use
+static constexpr int MAX_ATTEMPTS = 10;
+
+static void write_file(const fs::path& path, std::string_view data) {
+    auto fd =
+        ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw std::system_error(
+            errno, std::system_category(), "opening " + path.native());
+    }
+    while (data.size() > 0) {
+        auto n = ::write(fd, data.data(), data.size());
+        if (n < 0) {
+            auto saved_errno = errno;
+            ::close(fd);
+            throw std::system_error(saved_errno,
+                                    std::system_category(),
+                                    "writing " + path.native());
+        }
+        data = data.substr(n);
+    }
+    ::close(fd);
+}
+
+std::shared_ptr<const oci_spec> config_store::load(const fs::path& dir) {
+    std::ifstream in{dir / SPEC, std::ios::binary};
+    if (!in) {
+        return nullptr;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    auto spec = oci_spec::decode(ss.str());
+    if (!spec) {
+        return nullptr;
+    }
+    return std::make_shared<const oci_spec>(std::move(*spec));
+}
+
+bool config_store::link(const fs::path& dir, const fs::path& state_dir) {
+    std::vector<fs::path> linked;
+    for (auto name : {CONFIG, ANNOTATIONS, SPEC}) {
+        std::error_code ec;
+        fs::create_hard_link(dir / name, state_dir / name, ec);
+        if (ec == std::errc::no_such_file_or_directory &&
+            name == ANNOTATIONS) {
+            // The config has no annotations. If the entry is being removed,
+            // linking the spec will fail.
+            continue;
+        }
+        if (ec) {
+            for (auto& path : linked) {
+                fs::remove(path);
+            }
+            if (ec == std::errc::no_such_file_or_directory) {
+                return false;
+            }
+            throw std::system_error(
+                ec, "linking " + (state_dir / name).native());
+        }
+        linked.push_back(state_dir / name);
+    }
+    return true;
+}
+
+config_store::entry config_store::find(std::string_view text) {
+    entry res;
+    res.hash = sha256::hex(text);
+    res.spec = load(dir_ / res.hash);
+    res.stored = res.spec != nullptr;
+    return res;
+}
+
+void config_store::add(const entry& e,
+                       std::string_view text,
+                       const fs::path& state_dir,
+                       const json* config) {
+    auto dir = dir_ / e.hash;
+    if (!e.stored && fs::exists(dir / CONFIG)) {
+        // The entry was written by a different version of the runtime.
+        // Replace the compiled form in place, unless the entry is removed
+        // while we do that.
+        auto tmp_path = dir / SPEC;
+        tmp_path += ".new";
+        try {
+            write_file(tmp_path, e.spec->encode());
+            fs::rename(tmp_path, dir / SPEC);
+        } catch (const std::system_error&) {
+        }
+    }
+
+    json read;
+    for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+        if (link(dir, state_dir)) {
+            return;
+        }
+        if (!config) {
+            read = read_config(text);
+            config = &read;
+        }
+
+        // Build the entry in a temporary directory and rename it into place
+        // so that an entry is always complete.
+        fs::create_directories(dir_);
+        auto tmpl = (dir_ / ".new.XXXXXX").native();
+        if (::mkdtemp(tmpl.data()) == nullptr) {
+            throw std::system_error(
+                errno, std::system_category(), "mkdtemp " + tmpl);
+        }
+        fs::path tmp_dir{tmpl};
+        write_file(tmp_dir / CONFIG, text);
+        if (auto it = config->find("annotations"); it != config->end()) {
+            write_file(tmp_dir / ANNOTATIONS, it->dump());
+        }
+        write_file(tmp_dir / SPEC, e.spec->encode());
+        if (::rename(tmp_dir.c_str(), dir.c_str()) < 0) {
+            auto saved_errno = errno;
+            fs::remove_all(tmp_dir);
+            // Another create may have added the same config first
+            if (saved_errno != EEXIST && saved_errno != ENOTEMPTY) {
+                throw std::system_error(saved_errno,
+                                        std::system_category(),
+                                        "renaming " + tmp_dir.native());
+            }
+        }
+    }
+    throw std::runtime_error("config store entry " + e.hash +
+                             " keeps being removed");
+}
+
+void config_store::release(std::string_view hash) {
+    // The hash comes from the container state - make sure that it can only
+    // name an entry in the store
+    if (hash.size() != 64 || hash.find_first_not_of("0123456789abcdef") !=
+                                 std::string_view::npos) {
+        return;
+    }
+    auto dir = dir_ / hash;
+    struct ::stat st;
+    if (::stat((dir / CONFIG).c_str(), &st) < 0 || st.st_nlink > 1) {
+        return;
+    }
+    // Remove the config last so that a concurrent create which has just
+    // linked the other files either sees the whole entry or retries.
+    fs::remove(dir / SPEC);
+    fs::remove(dir / ANNOTATIONS);
+    fs::remove_all(dir);
+}
+
+}  // namespace ocijail
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/spec.h"
+
+namespace ocijail {
+
+// A content-addressed store of bundle configs, shared by the containers in a
+// state database. Containers created from the same image usually have
+// identical configs so each distinct config is stored once, named by the
+// SHA-256 hash of its text, together with its compiled oci_spec. A repeated
+// create loads the compiled form instead of parsing and validating the
+// config again.
+//
+// Each container's state directory holds hard links to the files of its
+// entry, so the link count of an entry's config.json is one more than the
+// number of containers using it. An entry is removed when the last
+// container which uses it is deleted.
+class config_store {
+   public:
+    explicit config_store(const std::filesystem::path& root)
+        : dir_(root / ".configs") {}
+
+    struct entry {
+        std::string hash;
+        // Null if the config is not in the store
+        std::shared_ptr<const oci_spec> spec;
+        // True if the spec was loaded from the store
+        bool stored{false};
+    };
+
+    // Look up a config, given its text
+    entry find(std::string_view text);
+
+    // Add a config to the store if it is not there already and link the
+    // entry's files into a container's state directory. The entry's spec
+    // must be set to the compiled config. The parsed config may be given to
+    // avoid reading it again.
+    void add(const entry& e,
+             std::string_view text,
+             const std::filesystem::path& state_dir,
+             const nlohmann::json* config = nullptr);
+
+    // Remove an entry if no container links to it
+    void release(std::string_view hash);
+
+   private:
+    std::shared_ptr<const oci_spec> load(const std::filesystem::path& dir);
+    bool link(const std::filesystem::path& dir,
+              const std::filesystem::path& state_dir);
+
+    std::filesystem::path dir_;
+};
+
+}  // namespace ocijail
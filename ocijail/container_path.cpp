@@ -0,0 +1,100 @@
+#include <sys/param.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <string>
+#include <system_error>
+
+#include "ocijail/container_path.h"
+
+namespace fs = std::filesystem;
+
+namespace ocijail {
+
+// Resolve path within the container, appending its elements to resolved,
+// which starts with root_path. Both are plain strings so that walking a
+// path doesn't create an fs::path for each element.
+static void resolve_container_path_impl(const logger& log,
+                                        std::string_view root_path,
+                                        std::pmr::string& resolved,
+                                        std::string_view path,
+                                        int depth) {
+    log_entry{log, log_level::DEBUG}
+        << "depth: " << depth << ", root_path: " << root_path
+        << ", resolved_path: " << resolved << ", path: " << path;
+    if (depth >= MAXSYMLINKS) {
+        throw std::system_error{
+            ELOOP, std::system_category(), "resolving mount path"};
+    }
+
+    // We need to resolve any symbolic links on the path within the given root
+    // so that containers cannot mount anything outside root_path
+    if (path.starts_with('/')) {
+        resolved.resize(root_path.size());
+    }
+    while (path.size() > 0) {
+        auto sep = path.find('/');
+        auto element = path.substr(0, sep);
+        path = sep == std::string_view::npos ? "" : path.substr(sep + 1);
+        log_entry{log, log_level::DEBUG}
+            << "resolved_path: " << resolved << ", element: " << element;
+        if (element.empty() || element == ".") {
+            continue;
+        }
+        if (element == "..") {
+            // Don't allow ".." past root
+            if (resolved.size() > root_path.size()) {
+                resolved.resize(
+                    std::max(resolved.rfind('/'), root_path.size()));
+            }
+            continue;
+        }
+        auto parent_size = resolved.size();
+        resolved += '/';
+        resolved += element;
+        struct ::stat st;
+        if (::lstat(resolved.c_str(), &st) == 0 && S_ISLNK(st.st_mode)) {
+            std::array<char, MAXPATHLEN> target;
+            auto n =
+                ::readlink(resolved.c_str(), target.data(), target.size());
+            if (n < 0) {
+                throw std::system_error{
+                    errno,
+                    std::system_category(),
+                    "reading link " + std::string{resolved}};
+            }
+            // Absolute targets are relative to root_path
+            resolved.resize(parent_size);
+            resolve_container_path_impl(
+                log,
+                root_path,
+                resolved,
+                std::string_view{target.data(), size_t(n)},
+                depth + 1);
+        }
+    }
+    assert(resolved.starts_with(root_path));
+}
+
+fs::path resolve_container_path(const logger& log,
+                                std::pmr::memory_resource* mr,
+                                const fs::path& root_path,
+                                std::string_view path) {
+    // Trim any trailing separator so that elements are appended as "/name"
+    std::string_view root{root_path.native()};
+    while (root.ends_with('/')) {
+        root.remove_suffix(1);
+    }
+    std::pmr::string resolved{root, mr};
+    resolved.reserve(root.size() + path.size() + 1);
+    resolve_container_path_impl(log, root, resolved, path, 0);
+    if (resolved.empty()) {
+        return fs::path{"/"};
+    }
+    return fs::path{std::string_view{resolved}};
+}
+
+}  // namespace ocijail
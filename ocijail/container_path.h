@@ -0,0 +1,21 @@
+#pragma once
+
+#include <filesystem>
+#include <memory_resource>
+#include <string_view>
+
+#include "ocijail/log.h"
+
+namespace ocijail {
+
+// Resolve a path within a container whose root is root_path. Symbolic links
+// are followed relative to root_path and ".." stops at the root so that the
+// result cannot be outside root_path. Memory for walking the path comes from
+// mr.
+std::filesystem::path resolve_container_path(
+    const logger& log,
+    std::pmr::memory_resource* mr,
+    const std::filesystem::path& root_path,
+    std::string_view path);
+
+}  // namespace ocijail
@@ -1,19 +1,21 @@
 #include <fcntl.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <sys/mount.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <climits>
 #include <iostream>
 #include <sstream>
-#include <unordered_map>
-#include <unordered_set>
 
+#include "ocijail/config_store.h"
 #include "ocijail/create.h"
+#include "ocijail/exec_block.h"
 #include "ocijail/hook.h"
+#include "ocijail/invocation.h"
 #include "ocijail/jail.h"
+#include "ocijail/kqueue.h"
+#include "ocijail/monitor.h"
 #include "ocijail/mount.h"
 #include "ocijail/process.h"
 #include "ocijail/tty.h"
@@ -22,50 +24,79 @@ namespace fs = std::filesystem;
 
 using nlohmann::json;
 
-namespace {
-
-struct oci_version {
-    std::string major;
-    std::string minor;
-    std::string patch;
-};
-
-oci_version parse_version(std::string ociver) {
-    std::vector<std::string_view> parts;
-    auto tmp = std::string_view{ociver};
-    // Trim off any -rc.x or -dev suffix first
-    auto i = tmp.find_first_of("-");
-    if (i != std::string_view::npos) {
-        auto suffix = tmp.substr(i + 1);
-        if (suffix.substr(0, 3) != "rc." && suffix != "dev") {
-            throw std::runtime_error("malformed ociVersion " +
-                                     std::string(ociver));
-        }
-        tmp = tmp.substr(0, i);
-    }
-    while (tmp.size() > 0) {
-        auto i = tmp.find_first_of(".");
-        if (i != std::string_view::npos) {
-            parts.push_back(tmp.substr(0, i));
-            tmp = tmp.substr(i + 1);
-        } else {
-            parts.push_back(tmp);
-            tmp = "";
-        }
-    }
-    if (parts.size() != 3) {
-        throw std::runtime_error("malformed ociVersion " + std::string(ociver));
+namespace ocijail {
+
+static jail::ns to_jail_ns(ns_mode mode) {
+    switch (mode) {
+    case ns_mode::DISABLED:
+        return jail::DISABLED;
+    case ns_mode::NEW:
+        return jail::NEW;
+    case ns_mode::INHERIT:
+        return jail::INHERIT;
     }
-    return oci_version{
-        std::string{parts[0]}, std::string{parts[1]}, std::string{parts[2]}};
+    return jail::INHERIT;
 }
 
-}  // namespace
+// Start a process which waits for the container process to exit and records
+// its exit status. The monitor is detached from us so that it outlives
+// create. Returns false if the monitor could not start watching the
+// container process.
+static bool start_monitor(runtime_state& state, pid_t pid) {
+    int ready[2];
+    if (::pipe2(ready, O_CLOEXEC) < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "creating monitor pipe"};
+    }
+    auto child = recorded(flight_op::FORK, [] { return ::fork(); });
+    if (child < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "forking monitor"};
+    }
+    if (child == 0) {
+        // Fork again so that the monitor is not our child, then drop
+        // everything we inherited apart from the ready pipe.
+        ::setsid();
+        if (::fork() != 0) {
+            ::_exit(0);
+        }
+        auto devnull = ::open("/dev/null", O_RDWR);
+        if (devnull >= 0) {
+            ::dup2(devnull, 0);
+            ::dup2(devnull, 1);
+            ::dup2(devnull, 2);
+        }
+        ::dup2(ready[1], 3);
+        ::close_range(4, INT_MAX, 0);
+        try {
+            // The monitor outlives create so it should not keep the
+            // bundle busy or hold on to memory create has finished with.
+            runtime_state monitored{fs::absolute(state.get_state_dir()),
+                                    state.get_id()};
+            ::chdir("/");
+            release_free_memory();
+            kqueue_event_source source;
+            monitor_exit(monitored, source, pid, [] {
+                char ch = 1;
+                ::write(3, &ch, 1);
+                ::close(3);
+            });
+        } catch (const std::exception&) {
+        }
+        ::_exit(0);
+    }
 
-namespace ocijail {
+    ::close(ready[1]);
+    int status;
+    ::waitpid(child, &status, 0);
+    char ch;
+    auto n = ::read(ready[0], &ch, 1);
+    ::close(ready[0]);
+    return n == 1;
+}
 
 void create::init(main_app& app) {
-    static create instance{app};
+    app.add_command(std::shared_ptr<create>{new create{app}});
 }
 
 create::create(main_app& app) : app_(app) {
@@ -95,7 +126,39 @@ create::create(main_app& app) : app_(app) {
 }
 
 void create::run() {
+    // In the container's process, prepare returns once the process is ready
+    // to wait for start. Everything else that prepare used has been freed
+    // by then, so the parked process holds little more than the exec block.
+    auto parked = prepare();
+    if (!parked) {
+        return;
+    }
+    release_free_memory();
+
+    // Finished coordinating with parent - now we wait until
+    // signalled by start.
+    char ch;
+    auto n = ::read(parked->start_wait_fd, &ch, 1);
+    if (n < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "read from start fifo"};
+    }
+    ::close(parked->start_wait_fd);
+
+    // Run startContainer hooks inside the jail.
+    parked->block.run_hooks();
+
+    // Execute the requested process inside the jail.
+    parked->block.exec(parked->stdin_fd,
+                       parked->stdout_fd,
+                       parked->stderr_fd,
+                       preserve_fds_);
+}
+
+std::optional<create::parked> create::prepare() {
+    app_.recorder().set_id(id_);
     auto state = app_.get_runtime_state(id_);
+    state.set_time(CREATE_BEGIN);
 
     if (app_.get_test_mode() == test_mode::NONE && state.exists()) {
         throw std::runtime_error{"container " + id_ + " exists"};
@@ -113,42 +176,39 @@ void create::run() {
         throw std::runtime_error{
             "create: bundle directory must contain config.json"};
     }
-    json config;
-    std::ifstream{config_path} >> config;
-
-    if (!config.contains("ociVersion")) {
-        malformed_config("no ociVersion");
-    }
-    if (!config["ociVersion"].is_string()) {
-        malformed_config("ociVersion must be a string");
-    }
-    // Allow 1.0.x, 1.1.x and 1.2.x
-    auto ver = parse_version(config["ociVersion"]);
-    if (ver.major != "1" || !(ver.minor == "0" || ver.minor == "1" || ver.minor == "2")) {
-        throw std::runtime_error{"create: unsupported OCI version " +
-                                 std::string{config["ociVersion"]}};
-    }
-
-    if (!config.contains("process")) {
-        malformed_config("no process");
+    // Configs are kept in a store shared by all containers, along with
+    // their compiled form. If this config has been used before, we can skip
+    // parsing and validating it. Otherwise only the members used by the
+    // runtime are parsed into memory.
+    std::string config_text;
+    config_store store{app_.get_state_db()};
+    config_store::entry entry;
+    std::optional<json> config;
+    {
+        flight_phase phase{flight_op::CONFIG};
+        std::ifstream config_file{config_path, std::ios::binary};
+        std::stringstream ss;
+        ss << config_file.rdbuf();
+        config_text = ss.str();
+        record_input_text("config", config_text);
+        entry = store.find(config_text);
+        if (!entry.spec) {
+            config = read_config(config_text);
+            entry.spec =
+                std::make_shared<const oci_spec>(oci_spec::compile(*config));
+        }
     }
+    auto& spec = *entry.spec;
 
-    auto& config_process = config["process"];
-    process proc{config_process, console_socket_, true, preserve_fds_};
+    process proc{spec.process, console_socket_, true, preserve_fds_};
 
     // If the config contains a root path, use that, otherwise the
     // bundle directory must have a subdirectory named "root"
-    bool root_readonly = false;
+    bool root_readonly = spec.root_readonly;
     auto root_path = bundle_path_ / "root";
     auto readonly_root_path = state.get_state_dir() / "readonly_root";
-    if (config.contains("root")) {
-        auto& config_root = config["root"];
-        if (config["root"].contains("path")) {
-            root_path = fs::path{config_root["path"]};
-        }
-        if (config_root.contains("readonly") && config_root["readonly"]) {
-            root_readonly = true;
-        }
+    if (spec.root_path) {
+        root_path = fs::path{*spec.root_path};
     }
     if (!fs::is_directory(root_path)) {
         std::stringstream ss;
@@ -156,153 +216,22 @@ void create::run() {
         throw std::runtime_error{ss.str()};
     }
 
-    // Validate mounts if present
-    auto& config_mounts = config["mounts"];
-    if (!config_mounts.is_null()) {
-        if (!config_mounts.is_array()) {
-            malformed_config("mounts must be an array");
-        }
-        for (auto& mount : config_mounts) {
-            if (!mount.is_object()) {
-                malformed_config("mounts must be an array of objects");
-            }
-            if (!mount["destination"].is_string()) {
-                malformed_config("mount destination must be a string");
-            }
-            if (mount.contains("source")) {
-                if (!mount["source"].is_string()) {
-                    malformed_config(
-                        "if present, mount source must be a string");
-                }
-            }
-            if (mount.contains("type")) {
-                if (!mount["type"].is_string()) {
-                    malformed_config("if present, mount type must be a string");
-                }
-            }
-            if (mount.contains("options")) {
-                if (!mount["options"].is_array()) {
-                    malformed_config(
-                        "if present, mount options must be an array");
-                }
-                for (auto& opt : mount["options"]) {
-                    if (!opt.is_string()) {
-                        malformed_config(
-                            "if present, mount options must be an array of "
-                            "strings");
-                    }
-                }
-            }
-        }
-    }
-
-    // Validate hooks, if present
-    auto& config_hooks = config["hooks"];
-    if (!config_hooks.is_null()) {
-        if (!config_hooks.is_object()) {
-            malformed_config("hooks must be an object");
-        }
-
-        hook::validate_hooks(app_, config_hooks, "prestart");
-        hook::validate_hooks(app_, config_hooks, "createRuntime");
-        hook::validate_hooks(app_, config_hooks, "createContainer");
-        hook::validate_hooks(app_, config_hooks, "startContainer");
-        hook::validate_hooks(app_, config_hooks, "poststart");
-        hook::validate_hooks(app_, config_hooks, "poststop");
-    }
-
     // Default to setting allow.chflags but disable if we have a
     // parent jail where this is not set.
     bool allow_chflags = true;
-
-    // Get the parent jail name and requested vnet type (if any)
-    std::optional<std::string> parent_jail;
-    auto vnet = jail::INHERIT;
-    std::optional<std::string> ip4_addr;
-    std::optional<std::string> ip6_addr;
-    std::vector<std::string> allow_params;
-
-    std::unordered_map<std::string, std::optional<jail::ns>> known_ns_params = {
-        {"org.freebsd.jail.vnet", std::nullopt},
-        {"org.freebsd.jail.sysvmsg", std::nullopt},
-        {"org.freebsd.jail.sysvsem", std::nullopt},
-        {"org.freebsd.jail.sysvshm", std::nullopt},
-    };
-    if (config.contains("annotations")) {
-        auto config_annotations = config["annotations"];
-        if (config_annotations.contains("org.freebsd.parentJail")) {
-            parent_jail = config_annotations["org.freebsd.parentJail"];
-            auto pj = jail::find(*parent_jail);
-            allow_chflags = pj.get<bool>("allow.chflags");
-        }
-
-        for (auto& [key, nsvalue] : known_ns_params) {
-            if (config_annotations.contains(key)) {
-                std::string val = config_annotations[key];
-                if (val == "new") {
-                    nsvalue = jail::NEW;
-                } else if (val == "inherit") {
-                    nsvalue = jail::INHERIT;
-                } else if (val == "disable") {
-                    nsvalue = jail::DISABLED;
-                } else {
-                    throw std::runtime_error(
-                        "bad value for " + key + ": " + val);
-                }
-            }
-        }
-
-        vnet = known_ns_params["org.freebsd.jail.vnet"].value_or(vnet);
-        if (vnet == jail::INHERIT) {
-            if (config_annotations.contains("org.freebsd.jail.ip4.addr")) {
-                ip4_addr = config_annotations["org.freebsd.jail.ip4.addr"];
-            }
-            if (config_annotations.contains("org.freebsd.jail.ip6.addr")) {
-                ip6_addr = config_annotations["org.freebsd.jail.ip6.addr"];
-            } else if (config_annotations.contains("org.freebsd.jail.ip6.add")) {
-                ip6_addr = config_annotations["org.freebsd.jail.ip6.add"];
-            }
-        } else if (vnet == jail::DISABLED) {
-            throw std::runtime_error(
-                "bad value for org.freebsd.jail.vnet: disable");
-        }
-
-        // Check for allow.* annotations (e.g., org.freebsd.jail.allow.mlock).
-        // Only parameters known to the FreeBSD jail subsystem are accepted;
-        // unknown parameters are logged and ignored. The kernel remains the
-        // final authority and will reject any parameter it does not recognise.
-        static const std::unordered_set<std::string> known_allow_params = {
-            "allow.adjtime",       "allow.chflags",
-            "allow.extattr",       "allow.mlock",
-            "allow.mount",         "allow.mount.devfs",
-            "allow.mount.fdescfs", "allow.mount.nullfs",
-            "allow.mount.procfs",  "allow.mount.tmpfs",
-            "allow.mount.zfs",     "allow.nfsd",
-            "allow.quotas",        "allow.raw_sockets",
-            "allow.read_msgbuf",   "allow.reserved_ports",
-            "allow.routing",       "allow.set_hostname",
-            "allow.setaudit",      "allow.settime",
-            "allow.socket_af",     "allow.suser",
-            "allow.sysvipc",       "allow.unprivileged_parent_tampering",
-            "allow.unprivileged_proc_debug",
-        };
-        const std::string allow_prefix = "org.freebsd.jail.allow.";
-        for (auto& [key, value] : config_annotations.items()) {
-            if (key.starts_with(allow_prefix) && value.is_string()) {
-                std::string param = "allow." + key.substr(allow_prefix.size());
-                std::string val = value;
-                if (!known_allow_params.count(param)) {
-                    app_.log() << "warning: unknown jail allow annotation '"
-                               << key << "', ignoring";
-                } else if (val == "true" || val == "1") {
-                    allow_params.push_back(param);
-                }
-            }
-        }
+    auto& annotations = spec.annotations;
+    auto& parent_jail = annotations.parent_jail;
+    if (parent_jail) {
+        auto pj = jail::find(*parent_jail);
+        allow_chflags = pj.get<bool>("allow.chflags");
+    }
+    for (auto& key : annotations.unknown_allow) {
+        app_.log() << "warning: unknown jail allow annotation '" << key
+                   << "', ignoring";
     }
 
     // Create a jail config from the OCI config
-    jail::config jconf;
+    jail::config jconf{app_.memory()};
     if (parent_jail) {
         jconf.set("name", *parent_jail + "." + id_);
     } else {
@@ -314,16 +243,16 @@ void create::run() {
     if (allow_chflags) {
         jconf.set("allow.chflags");
     }
-    if (known_ns_params["org.freebsd.jail.sysvmsg"]) {
-        jconf.set("sysvmsg", *known_ns_params["org.freebsd.jail.sysvmsg"]);
+    if (annotations.sysvmsg) {
+        jconf.set("sysvmsg", to_jail_ns(*annotations.sysvmsg));
     }
-    if (known_ns_params["org.freebsd.jail.sysvsem"]) {
-        jconf.set("sysvsem", *known_ns_params["org.freebsd.jail.sysvsem"]);
+    if (annotations.sysvsem) {
+        jconf.set("sysvsem", to_jail_ns(*annotations.sysvsem));
     }
-    if (known_ns_params["org.freebsd.jail.sysvshm"]) {
-        jconf.set("sysvshm", *known_ns_params["org.freebsd.jail.sysvshm"]);
+    if (annotations.sysvshm) {
+        jconf.set("sysvshm", to_jail_ns(*annotations.sysvshm));
     }
-    for (const auto& param : allow_params) {
+    for (const auto& param : annotations.allow_params) {
         jconf.set(param);
     }
     if (root_readonly) {
@@ -331,68 +260,20 @@ void create::run() {
     } else {
         jconf.set("path", root_path);
     }
-    if (vnet == jail::NEW) {
-        jconf.set("vnet", vnet);
+    if (annotations.vnet == ns_mode::NEW) {
+        jconf.set("vnet", jail::NEW);
     } else {
-        if (ip4_addr) {
-            std::vector<uint8_t> addrs;
-            std::string::size_type start = 0;
-            while (start < ip4_addr->size()) {
-                auto end = ip4_addr->find(',', start);
-                auto token = ip4_addr->substr(
-                    start, end == std::string::npos ? std::string::npos
-                                                    : end - start);
-                if (!token.empty()) {
-                    in_addr addr{};
-                    if (inet_pton(AF_INET, token.c_str(), &addr) != 1) {
-                        throw std::runtime_error(
-                            "bad value for org.freebsd.jail.ip4.addr: " +
-                            token);
-                    }
-                    auto* p = reinterpret_cast<uint8_t*>(&addr);
-                    addrs.insert(addrs.end(), p, p + sizeof(addr));
-                }
-                if (end == std::string::npos) {
-                    break;
-                }
-                start = end + 1;
-            }
-            jconf.set("ip4", jail::INHERIT);
-            jconf.set("ip4.addr", addrs);
-        } else {
-            jconf.set("ip4", jail::INHERIT);
+        jconf.set("ip4", jail::INHERIT);
+        if (annotations.ip4_addrs) {
+            jconf.set("ip4.addr", *annotations.ip4_addrs);
         }
-        if (ip6_addr) {
-            std::vector<uint8_t> addrs;
-            std::string::size_type start = 0;
-            while (start < ip6_addr->size()) {
-                auto end = ip6_addr->find(',', start);
-                auto token = ip6_addr->substr(
-                    start, end == std::string::npos ? std::string::npos
-                                                    : end - start);
-                if (!token.empty()) {
-                    in6_addr addr{};
-                    if (inet_pton(AF_INET6, token.c_str(), &addr) != 1) {
-                        throw std::runtime_error(
-                            "bad value for org.freebsd.jail.ip6.addr: " +
-                            token);
-                    }
-                    auto* p = reinterpret_cast<uint8_t*>(&addr);
-                    addrs.insert(addrs.end(), p, p + sizeof(addr));
-                }
-                if (end == std::string::npos) {
-                    break;
-                }
-                start = end + 1;
-            }
-            jconf.set("ip6", jail::INHERIT);
-            jconf.set("ip6.addr", addrs);
-        } else {
-            jconf.set("ip6", jail::INHERIT);
+        jconf.set("ip6", jail::INHERIT);
+        if (annotations.ip6_addrs) {
+            jconf.set("ip6.addr", *annotations.ip6_addrs);
         }
     }
-    if (config.contains("hostname")) {
-        jconf.set("host.hostname", config["hostname"].get<std::string>());
+    if (spec.hostname) {
+        jconf.set("host.hostname", *spec.hostname);
         jconf.set("host", jail::NEW);
     } else {
         jconf.set("host", jail::INHERIT);
@@ -400,20 +281,22 @@ void create::run() {
 
     // Unit tests for config validation stop here.
     if (app_.get_test_mode() == test_mode::VALIDATION) {
-        return;
+        return std::nullopt;
     }
 
     // Create a state object with initial fields from the config
     state["root_path"] = root_path;
-    state["bundle"] = bundle_path_;
-    state["config"] = config;
-    state["status"] = "created";
     if (parent_jail) {
         state["parent_jail"] = *parent_jail;
     }
+    state.set_bundle(bundle_path_);
+    state.set_status(container_status::CREATED);
+    state.set_hook_mask(spec.hook_mask());
 
-    // Create the state here in case we have a readonly root
+    // Create the state here in case we have a readonly root. The config is
+    // written once here and only read back on demand by delete and the hooks.
     auto lk = state.create();
+    state.save_config(entry, config_text, config ? &*config : nullptr);
 
     // Mount filesystems if requested and record unmount actions in the
     // state.
@@ -423,14 +306,13 @@ void create::run() {
     // read-only alias.
     state["root_readonly"] = false;
     if (root_readonly) {
-        if (config_mounts.is_array()) {
-            mount_volumes(app_, state, root_path, true, config_mounts);
-        }
+        mount_volumes(app_, state, root_path, true, spec.mounts);
+        flight_phase phase{flight_op::READONLY_ROOT};
         fs::create_directory(readonly_root_path);
-        std::vector<std::tuple<std::string, std::string>> mount_opts;
+        mount_options mount_opts{app_.memory()};
         mount_opts.emplace_back("fstype", "nullfs");
-        mount_opts.emplace_back("fspath", readonly_root_path);
-        mount_opts.emplace_back("target", root_path);
+        mount_opts.emplace_back("fspath", readonly_root_path.native());
+        mount_opts.emplace_back("target", root_path.native());
         if (do_mount(mount_opts, MNT_RDONLY) < 0) {
             throw std::system_error(errno,
                                     std::system_category(),
@@ -440,9 +322,8 @@ void create::run() {
         state["root_readonly"] = true;
         state["readonly_root_path"] = readonly_root_path;
     }
-    if (config_mounts.is_array()) {
-        mount_volumes(app_, state, root_path, false, config_mounts);
-    }
+    mount_volumes(app_, state, root_path, false, spec.mounts);
+    state.set_time(MOUNTS_DONE);
 
     // Create the jail for our container. If we have a parent, attach
     // to that first.
@@ -464,6 +345,7 @@ void create::run() {
     }
 
     auto j = jail::create(jconf);
+    state.set_time(JAIL_CREATED);
 
     // We record the container state including the bundle config. We
     // need to create the start fifo before forking - this will be
@@ -475,55 +357,79 @@ void create::run() {
             errno, std::system_category(), "error creating start fifo"};
     }
 
-    auto pid = ::fork();
+    // The child appends its own spans to the trace
+    app_.flush_trace();
+    auto pid = recorded(flight_op::FORK, [] { return ::fork(); });
     if (pid) {
         // Parent process - write to pid file if requested
         if (pid_file_) {
             std::ofstream{*pid_file_} << pid;
         }
-        state["jid"] = j.jid();
-        state["pid"] = pid;
+        state.set_jid(j.jid());
+        state.set_pid(pid);
+        if (start_monitor(state, pid)) {
+            state.add_flags(status_record::MONITORED);
+        }
+        state.save_details();
         state.save();
 
-        hook::run_hooks(app_, config_hooks, "createRuntime", state);
+        hook::run_hooks(app_, spec, CREATE_RUNTIME, state);
 
         lk.unlock();
 
-        // Signal the child to execute any hooks and validate that the
-        // container process can be found.
-        char ch = 1;
-        auto n = ::write(create_sock[0], &ch, 1);
-        if (n < 0) {
-            throw std::system_error{
-                errno, std::system_category(), "write to create socket"};
-        }
-
-        // Read back the child's status - this is our exit status. The
-        // child will have already written to stderr if necessary.
         char status;
-        n = ::read(create_sock[0], &status, 1);
-        if (n < 0) {
-            throw std::system_error{
-                errno, std::system_category(), "read from create socket"};
+        {
+            flight_phase phase{flight_op::HANDSHAKE};
+
+            // Signal the child to execute any hooks and validate that the
+            // container process can be found.
+            char ch = 1;
+            auto n = ::write(create_sock[0], &ch, 1);
+            if (n < 0) {
+                throw std::system_error{
+                    errno, std::system_category(), "write to create socket"};
+            }
+
+            // Read back the child's status - this is our exit status. The
+            // child will have already written to stderr if necessary.
+            n = ::read(create_sock[0], &status, 1);
+            if (n < 0) {
+                throw std::system_error{
+                    errno, std::system_category(), "read from create socket"};
+            }
         }
+        ::close(create_sock[0]);
+        ::close(create_sock[1]);
         if (status != 0) {
             // If the create failed, we need to clean up: unmount the volumes and
             // delete the state.
             j.remove();
-            if (config_mounts.is_array()) {
-                unmount_volumes(app_, state, root_path, config_mounts);
-            }
+            unmount_volumes(state);
             if (root_readonly) {
-                if (::unmount(root_path.c_str(), MNT_FORCE) > 0) {
+                if (do_unmount(root_path, MNT_FORCE) < 0) {
                     throw std::system_error{errno,
                                             std::system_category(),
                                             "unmounting " + root_path.native()};
                 }
             }
             state.remove_all();
+            throw exit_status{status};
+        }
+
+        // The container is ready to start. Record when create returned
+        // unless the container was deleted in the meantime.
+        auto returned = lifecycle_time::now();
+        lk.lock();
+        if (state.exists()) {
+            state.load();
+            state.set_time(CREATE_RETURNED, returned);
+            state.save();
         }
-        ::exit(status);
     } else {
+        // The state lock belongs to our parent, which unlocks it and takes
+        // it again while we wait for start
+        lk.release();
+
         // Perform the console-socket hand off if process.terminal is true.
         auto [stdin_fd, stdout_fd, stderr_fd] = proc.pre_start();
 
@@ -562,7 +468,7 @@ void create::run() {
                     std::system_category(),
                     "error changing directory to" + root_path.string()};
             }
-            hook::run_hooks(app_, config_hooks, "createContainer", state);
+            hook::run_hooks(app_, spec, CREATE_CONTAINER, state);
 
             // Enter the jail and set the requested working directory.
             j.attach();
@@ -584,25 +490,25 @@ void create::run() {
         ::close(create_sock[1]);
 
         // If validate failed, don't wait for a start signal, just stop here.
+        app_.flush_trace();
         if (status != 0) {
             ::exit(status);
         }
 
-        // Finished coordinating with parent - now we wait until
-        // signalled by start.
-        n = ::read(start_wait_fd, &ch, 1);
-        if (n < 0) {
-            throw std::system_error{
-                errno, std::system_category(), "read from start fifo"};
-        }
-        ::close(start_wait_fd);
-
-        // Run startContainer hooks inside the jail.
-        hook::run_hooks(app_, config_hooks, "startContainer", state);
-
-        // Execute the requested process inside the jail.
-        proc.exec(stdin_fd, stdout_fd, stderr_fd);
-    }
+        // Pack what we need after start, including the state for the
+        // startContainer hooks. Our parent records our pid after the fork so
+        // fill that in here.
+        state.set_pid(::getpid());
+        std::stringstream ss;
+        ss << state.report();
+        return parked{
+            exec_block{proc.spec(), spec.hooks[START_CONTAINER], ss.str()},
+            start_wait_fd,
+            stdin_fd,
+            stdout_fd,
+            stderr_fd};
+    }
+    return std::nullopt;
 }
 
 }  // namespace ocijail
@@ -5,6 +5,7 @@
 
 #include "nlohmann/json.hpp"
 
+#include "ocijail/exec_block.h"
 #include "ocijail/main.h"
 #include "ocijail/process.h"
 
@@ -16,8 +17,21 @@ struct create {
    private:
     create(main_app& app);
 
+    // The container process, waiting in the create child for start
+    struct parked {
+        exec_block block;
+        int start_wait_fd;
+        int stdin_fd;
+        int stdout_fd;
+        int stderr_fd;
+    };
+
     void run();
 
+    // Create the container. Returns nothing except in the container's
+    // process, which returns the parked process.
+    std::optional<parked> prepare();
+
     main_app& app_;
     std::filesystem::path bundle_path_{"."};
     std::string id_;
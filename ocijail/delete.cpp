@@ -1,5 +1,4 @@
 #include <signal.h>
-#include <sys/mount.h>
 #include <unistd.h>
 #include <iostream>
 
@@ -9,6 +8,7 @@
 #include "hook.h"
 #include "jail.h"
 #include "mount.h"
+#include "timing_log.h"
 
 namespace fs = std::filesystem;
 
@@ -17,7 +17,7 @@ using nlohmann::json;
 namespace ocijail {
 
 void delete_::init(main_app& app) {
-    static delete_ instance{app};
+    app.add_command(std::shared_ptr<delete_>{new delete_{app}});
 }
 
 delete_::delete_(main_app& app) : app_(app) {
@@ -30,6 +30,7 @@ delete_::delete_(main_app& app) : app_(app) {
 }
 
 void delete_::run() {
+    app_.recorder().set_id(id_);
     auto state = app_.get_runtime_state(id_);
 
     // If some other process has already deleted the state, just return.
@@ -43,8 +44,8 @@ void delete_::run() {
     auto lk = state.lock();
     state.load();
 
-    // update state
-    state.check_status();
+    // update state, probing the process in case its monitor has gone
+    state.check_status(true);
 
     // The specification limits delete to just containers in "stopped" state. In
     // practice, both runc and crun relax this requirement:
@@ -55,23 +56,28 @@ void delete_::run() {
     //   force flag is set, send it a KILL signal and delete it.
     //
     // We follow the more restrictive crun behaviour.
-    if (state["status"] == "stopped") {
+    if (state.status() == container_status::STOPPED) {
         // Nothing to do here
-    } else if (state["status"] == "created") {
-        ::kill(state["pid"], SIGKILL);
-    } else if (state["status"] == "running" && force_) {
-        ::kill(state["pid"], SIGKILL);
+    } else if (state.status() == container_status::CREATED) {
+        ::kill(state.pid(), SIGKILL);
+    } else if (state.status() == container_status::RUNNING && force_) {
+        ::kill(state.pid(), SIGKILL);
     } else {
         std::stringstream ss;
         ss << "delete: container not in \"stopped\" or \"created\" state "
-              "(currently "
-           << state["status"] << ")";
+              "(currently \""
+           << to_string(state.status()) << "\")";
         throw std::runtime_error(ss.str());
     }
 
-    auto j = jail::find(int(state["jid"]));
+    auto j = jail::find(state.jid());
     j.remove();
 
+    // Only delete needs the runtime bookkeeping. The mounts are undone from
+    // the plan recorded by create so the bundle config is only read if there
+    // are poststop hooks, or for containers created by older versions.
+    state.load_details();
+
     bool root_readonly = false;
     if (state.contains("root_readonly")) {
         root_readonly = state["root_readonly"];
@@ -80,21 +86,30 @@ void delete_::run() {
     if (root_readonly) {
         root_path = fs::path{state["readonly_root_path"]};
     }
-    if (state["config"].contains("mounts") &&
-        !state["config"]["mounts"].is_null()) {
-        unmount_volumes(app_, state, root_path, state["config"]["mounts"]);
+    if (!state.contains("mount_plan")) {
+        plan_legacy_mounts(app_, state, root_path, state.spec().mounts);
     }
+    unmount_volumes(state);
     if (root_readonly) {
-        if (::unmount(root_path.c_str(), MNT_FORCE) > 0) {
+        if (do_unmount(root_path, MNT_FORCE) < 0) {
             throw std::system_error{errno,
                                     std::system_category(),
                                     "unmounting " + root_path.native()};
         }
     }
 
-    hook::run_hooks(app_, state["config"]["hooks"], "poststop", state);
+    hook::run_hooks(app_, POSTSTOP, state);
 
     state.remove_all();
+
+    // The container's timings outlive it in the state database's timing
+    // log
+    state.set_time(DELETE_DONE);
+    try {
+        timing_log{app_.get_state_db()}.append(timing_log::entry(state));
+    } catch (const std::exception& e) {
+        app_.log() << "warning: recording timings: " << e.what();
+    }
 }
 
 }  // namespace ocijail
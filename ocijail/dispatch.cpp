@@ -0,0 +1,269 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <algorithm>
+#include <set>
+
+#include "ocijail/create.h"
+#include "ocijail/delete.h"
+#include "ocijail/dispatch.h"
+#include "ocijail/invocation.h"
+#include "ocijail/kill.h"
+#include "ocijail/list.h"
+#include "ocijail/start.h"
+#include "ocijail/state.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+namespace ocijail {
+
+dispatcher::dispatcher(const main_app& settings, bool allow_create)
+    : base_("ocijail"), allow_create_(allow_create) {
+    ignore_inputs();
+    base_.inherit(settings);
+    pid_ = ::getpid();
+    cwd_ = ::open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cwd_ < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "opening current directory"};
+    }
+    umask_ = ::umask(0);
+    ::umask(umask_);
+}
+
+dispatcher::~dispatcher() {
+    ::close(cwd_);
+}
+
+bool dispatcher::supported(std::string_view command) {
+    static const std::set<std::string_view> commands{
+        "create", "start", "state", "kill", "delete", "list"};
+    return commands.contains(command);
+}
+
+std::optional<int> dispatcher::global_option(std::string_view arg) {
+    static const std::set<std::string_view> with_value{"--root",
+                                                       "--testing",
+                                                       "--log-format",
+                                                       "--log-level",
+                                                       "--log",
+                                                       "--trace",
+                                                       "--record-threshold",
+                                                       "--lock-timeout"};
+    if (arg == "--stats") {
+        return 0;
+    }
+    auto eq = arg.find('=');
+    if (with_value.contains(arg.substr(0, eq))) {
+        return eq == std::string_view::npos ? 1 : 0;
+    }
+    return std::nullopt;
+}
+
+void dispatcher::add_commands(main_app& app) {
+    create::init(app);
+    start::init(app);
+    state::init(app);
+    kill::init(app);
+    delete_::init(app);
+    list::init(app);
+}
+
+std::vector<std::string> dispatcher::get_args(const json& request,
+                                              bool with_options) {
+    if (!request.is_object() || !request.contains("command") ||
+        !request["command"].is_string()) {
+        throw std::runtime_error{"request: command must be a string"};
+    }
+    std::string command = request["command"];
+    if (!supported(command)) {
+        throw std::runtime_error{"request: unsupported command " + command};
+    }
+    auto get_strings = [&](const char* key, std::vector<std::string>& res) {
+        if (!request.contains(key)) {
+            return;
+        }
+        auto& value = request[key];
+        if (!value.is_array()) {
+            throw std::runtime_error{std::string{"request: "} + key +
+                                     " must be an array"};
+        }
+        for (auto& arg : value) {
+            if (!arg.is_string()) {
+                throw std::runtime_error{std::string{"request: "} + key +
+                                         " must be an array of strings"};
+            }
+            res.push_back(arg);
+        }
+    };
+    std::vector<std::string> args;
+    if (with_options) {
+        // Only global options may come before the command, so that the
+        // command can't be replaced by another one
+        get_strings("options", args);
+        int values = 0;
+        for (auto& arg : args) {
+            if (values > 0) {
+                values--;
+            } else if (auto n = global_option(arg)) {
+                values = *n;
+            } else {
+                throw std::runtime_error{"request: unsupported option " + arg};
+            }
+        }
+        if (values > 0) {
+            throw std::runtime_error{"request: option " + args.back() +
+                                     " needs a value"};
+        }
+    }
+    args.push_back(command);
+    get_strings("args", args);
+    return args;
+}
+
+// Create changes the working directory and umask
+void dispatcher::restore_process_state() {
+    if (::fchdir(cwd_) < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "restoring current directory"};
+    }
+    ::umask(umask_);
+}
+
+json dispatcher::run(const std::string& line) {
+    json request;
+    try {
+        request = json::parse(line);
+    } catch (const std::exception& e) {
+        base_.log_error(e);
+        json res;
+        res["status"] = 1;
+        res["error"] = e.what();
+        return res;
+    }
+    return run(request);
+}
+
+json dispatcher::run(const json& request) {
+    json res;
+    std::stringstream out;
+    try {
+        auto args = get_args(request, true);
+        res["command"] = request["command"];
+
+        // Each command gets a fresh set of options but shares the state
+        // index and cache with the other commands.
+        main_app app{"ocijail", base_};
+        app.set_out(out);
+        add_commands(app);
+
+        // Decide whether create is allowed from the command which was
+        // parsed, before it runs
+        bool creating = false;
+        app.on_parsed([&] {
+            creating = app.got_subcommand("create");
+            if (creating && !allow_create_) {
+                throw std::runtime_error{
+                    "request: create is not supported here"};
+            }
+        });
+
+        // CLI11 expects arguments in reverse order
+        std::reverse(args.begin(), args.end());
+        try {
+            try {
+                app.parse(args);
+            } catch (...) {
+                if (creating) {
+                    restore_process_state();
+                }
+                throw;
+            }
+            if (creating) {
+                restore_process_state();
+            }
+        } catch (const CLI::ParseError&) {
+            throw;
+        } catch (const exit_status& e) {
+            app.finish(e.status);
+            throw;
+        } catch (const lock_timeout& e) {
+            app.finish(EX_TEMPFAIL, &e);
+            throw;
+        } catch (const std::exception& e) {
+            app.finish(1, &e);
+            throw;
+        }
+        app.finish(0);
+        res["status"] = 0;
+    } catch (const CLI::ParseError& e) {
+        res["status"] = e.get_exit_code();
+        res["error"] = e.what();
+    } catch (const exit_status& e) {
+        res["status"] = e.status;
+    } catch (const lock_timeout& e) {
+        base_.log_error(e);
+        res["status"] = EX_TEMPFAIL;
+        res["error"] = e.what();
+    } catch (const std::exception& e) {
+        base_.log_error(e);
+        res["status"] = 1;
+        res["error"] = e.what();
+    }
+
+    // If a forked child of create returns here, it failed before it could
+    // exec the container process and must not carry on as the caller.
+    if (::getpid() != pid_) {
+        ::_exit(res["status"].get<int>());
+    }
+
+    auto output = out.str();
+    if (!output.empty()) {
+        res["output"] = json::parse(output, nullptr, false);
+        if (res["output"].is_discarded()) {
+            res["output"] = output;
+        }
+    }
+    return res;
+}
+
+std::optional<std::string> dispatcher::container_id(const json& request) {
+    std::vector<std::string> args;
+    try {
+        args = get_args(request, false);
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+
+    // The container id is always the first positional argument. Use the
+    // command's option definitions to skip over option values.
+    main_app app{"ocijail"};
+    add_commands(app);
+    auto sub = app.get_subcommand(args[0]);
+    for (size_t i = 1; i < args.size(); i++) {
+        auto& arg = args[i];
+        if (arg == "--") {
+            if (i + 1 < args.size()) {
+                return args[i + 1];
+            }
+            break;
+        }
+        if (arg.size() > 1 && arg[0] == '-') {
+            if (arg.find('=') != std::string::npos) {
+                continue;
+            }
+            auto opt = sub->get_option_no_throw(arg);
+            if (opt && opt->get_expected_min() > 0) {
+                i++;
+            }
+            continue;
+        }
+        return arg;
+    }
+    return std::nullopt;
+}
+
+}  // namespace ocijail
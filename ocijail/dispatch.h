@@ -0,0 +1,63 @@
+#pragma once
+
+#include <sys/types.h>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/main.h"
+
+namespace ocijail {
+
+// Run runtime commands described by JSON requests within this process. A
+// request is an object like:
+//
+//     {"command": "kill", "args": ["my-id", "TERM"], "options": ["--log", "x"]}
+//
+// where args are the command's usual command line arguments and options are
+// global options, other than --version. The result is an object with the command's exit
+// status, its output (parsed as JSON if possible) and any error message.
+//
+// Supported commands are create, start, state, kill, delete and list. This
+// is shared by batch mode and the daemon.
+//
+// Create forks, changes the working directory and sets the umask, all of
+// which affect the whole process. It is only allowed if the dispatcher is
+// the only thread running commands, and the working directory and umask are
+// restored after each create.
+class dispatcher {
+   public:
+    dispatcher(const main_app& settings, bool allow_create = true);
+    ~dispatcher();
+
+    static bool supported(std::string_view command);
+
+    // If arg is a global option which may be given in a request, return the
+    // number of following words which hold its value: 1 for an option which
+    // takes a value and 0 for a flag or an option written as --name=value
+    static std::optional<int> global_option(std::string_view arg);
+
+    nlohmann::json run(const nlohmann::json& request);
+    nlohmann::json run(const std::string& line);
+
+    // Return the id of the container a request operates on, if it names one
+    static std::optional<std::string> container_id(
+        const nlohmann::json& request);
+
+   private:
+    static void add_commands(main_app& app);
+    static std::vector<std::string> get_args(const nlohmann::json& request,
+                                             bool with_options);
+    void restore_process_state();
+
+    main_app base_;
+    bool allow_create_;
+    pid_t pid_;
+    int cwd_;
+    mode_t umask_;
+};
+
+}  // namespace ocijail
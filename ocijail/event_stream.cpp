@@ -0,0 +1,168 @@
+#include <sys/wait.h>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/event_stream.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+namespace ocijail {
+
+static std::string event_timestamp() {
+    auto now = std::chrono::system_clock::now();
+    auto t = std::chrono::system_clock::to_time_t(now);
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                  now.time_since_epoch())
+                  .count() %
+              1000000;
+    struct std::tm tm;
+    gmtime_r(&t, &tm);
+    std::stringstream ss;
+    ss << std::put_time(&tm, "%Y-%m-%dT%H:%M:%S") << "." << std::setw(6)
+       << std::setfill('0') << us << "Z";
+    return ss.str();
+}
+
+static std::optional<int> exit_status(const status_record& record) {
+    if (record.flags & status_record::HAS_EXIT_STATUS) {
+        return record.exit_status;
+    }
+    return std::nullopt;
+}
+
+event_stream::event_stream(const fs::path& root,
+                           event_source& source,
+                           std::ostream& out,
+                           std::optional<std::string> id)
+    : root_(root), index_(root), source_(source), out_(out), id_(id) {}
+
+void event_stream::start() {
+    // The index is touched each time a container's status changes. Watching
+    // the root as well lets us see the index being replaced by a rebuild, or
+    // created by the first scan. The root must exist to be watched.
+    fs::create_directories(root_);
+    source_.watch_path(root_);
+    source_.watch_path(root_ / "index");
+    scan(false);
+}
+
+void event_stream::step() {
+    auto n = source_.wait();
+    for (auto& exit : n.exits) {
+        handle_exit(exit);
+    }
+    scan(true);
+    out_.flush();
+}
+
+void event_stream::run() {
+    start();
+    for (;;) {
+        step();
+    }
+}
+
+void event_stream::scan(bool emit_events) {
+    auto entries = index_.entries();
+
+    std::map<std::string, const status_record*> current;
+    for (auto& entry : entries) {
+        if (!id_ || entry.id == *id_) {
+            current[entry.id] = &entry.record;
+        }
+    }
+
+    for (auto& [id, record] : current) {
+        auto it = containers_.find(id);
+        if (it == containers_.end()) {
+            container c{record->status,
+                        record->pid,
+                        record->status == container_status::STOPPED};
+            containers_[id] = c;
+            watch(id, c);
+            if (emit_events) {
+                emit("create", id, {container_status::CREATED, c.pid, false});
+                if (c.status != container_status::CREATED) {
+                    emit("start", id, {container_status::RUNNING, c.pid, false});
+                }
+                if (c.stopped) {
+                    emit("stop", id, c, exit_status(*record));
+                }
+            }
+            continue;
+        }
+
+        auto& c = it->second;
+        auto prev = c.status;
+        c.pid = record->pid;
+        if (!c.stopped) {
+            c.status = record->status;
+        }
+        if (prev == container_status::CREATED &&
+            record->status == container_status::RUNNING) {
+            emit("start", id, {container_status::RUNNING, c.pid, false});
+        }
+        if (record->status == container_status::STOPPED && !c.stopped) {
+            c.stopped = true;
+            emit("stop", id, c, exit_status(*record));
+        }
+    }
+
+    for (auto it = containers_.begin(); it != containers_.end();) {
+        auto& [id, c] = *it;
+        if (current.contains(id)) {
+            ++it;
+            continue;
+        }
+        if (!c.stopped) {
+            c.status = container_status::STOPPED;
+            c.stopped = true;
+            emit("stop", id, c);
+        }
+        emit("delete", id, c);
+        it = containers_.erase(it);
+    }
+}
+
+void event_stream::handle_exit(const process_exit& exit) {
+    for (auto& [id, c] : containers_) {
+        if (c.pid == exit.pid && !c.stopped) {
+            c.status = container_status::STOPPED;
+            c.stopped = true;
+            emit("stop", id, c, exit.status);
+        }
+    }
+}
+
+void event_stream::watch(const std::string& id, const container& c) {
+    if (!c.stopped && c.pid > 0) {
+        source_.watch_process(c.pid);
+    }
+}
+
+void event_stream::emit(std::string_view type,
+                        const std::string& id,
+                        const container& c,
+                        std::optional<int> wait_status) {
+    json ev;
+    ev["type"] = type;
+    ev["id"] = id;
+    ev["status"] = to_string(c.status);
+    ev["pid"] = c.pid;
+    if (wait_status) {
+        if (WIFEXITED(*wait_status)) {
+            ev["exitStatus"] = WEXITSTATUS(*wait_status);
+        } else if (WIFSIGNALED(*wait_status)) {
+            ev["exitSignal"] = WTERMSIG(*wait_status);
+        }
+    }
+    ev["time"] = event_timestamp();
+    out_ << ev << "\n";
+}
+
+}  // namespace ocijail
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <sys/types.h>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ocijail/runtime_state.h"
+#include "ocijail/state_index.h"
+
+namespace ocijail {
+
+struct process_exit {
+    pid_t pid;
+    // The wait status of the process, if the notification source knows it
+    std::optional<int> status;
+};
+
+struct notification {
+    // Something in a watched path changed
+    bool changed{false};
+    std::vector<process_exit> exits;
+    // Watched processes which executed a new program
+    std::vector<pid_t> execs;
+};
+
+// A source of file change and process exit notifications. The runtime uses
+// kqueue - tests can substitute their own implementation.
+class event_source {
+   public:
+    virtual ~event_source() = default;
+
+    // Report changes to a file or directory
+    virtual void watch_path(const std::filesystem::path& path) = 0;
+    virtual void unwatch_path(const std::filesystem::path& path) = 0;
+
+    // Report when a process exits. If the process has already exited, this
+    // is reported by the next call to wait.
+    virtual void watch_process(pid_t pid) = 0;
+
+    // Also report when a watched process executes a new program. Sources
+    // which can't see this never report it.
+    virtual void watch_exec(pid_t pid) {}
+
+    // Block until at least one watched path changes or process exits
+    virtual notification wait() = 0;
+};
+
+// Generate a stream of container lifecycle events, one JSON object per line,
+// by comparing successive snapshots of the state index each time the event
+// source reports a change.
+class event_stream {
+   public:
+    event_stream(const std::filesystem::path& root,
+                 event_source& source,
+                 std::ostream& out,
+                 std::optional<std::string> id = std::nullopt);
+
+    // Start watching the state database. Containers which already exist are
+    // treated as the starting point and don't generate events.
+    void start();
+
+    // Wait for the next notification and write any resulting events
+    void step();
+
+    // Write events until the process is killed
+    void run();
+
+   private:
+    struct container {
+        container_status status;
+        pid_t pid;
+        // Set when we have already reported the container stopping
+        bool stopped;
+    };
+
+    void scan(bool emit_events);
+    void handle_exit(const process_exit& exit);
+    void watch(const std::string& id, const container& c);
+    void emit(std::string_view type,
+              const std::string& id,
+              const container& c,
+              std::optional<int> wait_status = std::nullopt);
+
+    std::filesystem::path root_;
+    state_index index_;
+    event_source& source_;
+    std::ostream& out_;
+    std::optional<std::string> id_;
+    std::map<std::string, container> containers_;
+};
+
+}  // namespace ocijail
@@ -0,0 +1,34 @@
+#include "ocijail/event_stream.h"
+#include "ocijail/events.h"
+#include "ocijail/kqueue.h"
+
+namespace fs = std::filesystem;
+
+namespace ocijail {
+
+void events::init(main_app& app) {
+    app.add_command(std::shared_ptr<events>{new events{app}});
+}
+
+events::events(main_app& app) : app_(app) {
+    auto sub = app.add_subcommand(
+        "events",
+        "Stream container lifecycle events as JSON, one object per line");
+    sub->add_option("container-id",
+                    id_,
+                    "Only report events for the container with this id");
+    sub->final_callback([this] { run(); });
+}
+
+void events::run() {
+    app_.set_long_running();
+    kqueue_event_source source;
+    event_stream stream{app_.get_state_db(),
+                        source,
+                        app_.out(),
+                        id_.empty() ? std::nullopt
+                                    : std::optional<std::string>{id_}};
+    stream.run();
+}
+
+}  // namespace ocijail
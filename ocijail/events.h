@@ -0,0 +1,20 @@
+#pragma once
+
+#include <optional>
+
+#include "ocijail/main.h"
+
+namespace ocijail {
+
+struct events {
+    static void init(main_app& app);
+
+   private:
+    events(main_app& app);
+    void run();
+
+    main_app& app_;
+    std::string id_;
+};
+
+}  // namespace ocijail
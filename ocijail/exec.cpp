@@ -6,6 +6,7 @@
 #include "nlohmann/json.hpp"
 
 #include "ocijail/exec.h"
+#include "ocijail/invocation.h"
 #include "ocijail/jail.h"
 #include "ocijail/process.h"
 
@@ -16,7 +17,7 @@ using nlohmann::json;
 namespace ocijail {
 
 void exec::init(main_app& app) {
-    static exec instance{app};
+    app.add_command(std::shared_ptr<exec>{new exec{app}});
 }
 
 exec::exec(main_app& app) : app_(app) {
@@ -51,6 +52,7 @@ exec::exec(main_app& app) : app_(app) {
 void exec::run() {
     json process_json;
     std::ifstream{process_} >> process_json;
+    record_input("process", process_json);
     if (tty_) {
         process_json["terminal"] = *tty_;
     }
@@ -65,7 +67,7 @@ void exec::run() {
     auto lk = state.lock();
     state.load();
 
-    auto j = jail::find(int(state["jid"]));
+    auto j = jail::find(state.jid());
 
     if (detach_) {
         // Create a socket pair for coordinating create activities with
@@ -104,7 +106,7 @@ void exec::run() {
                                         std::system_category(),
                                         "read from exec create socket"};
             }
-            ::exit(status);
+            throw exit_status{status};
         } else {
             // Setup the tty if requested
             auto [stdin_fd, stdout_fd, stderr_fd] = proc.pre_start();
@@ -155,6 +157,8 @@ void exec::run() {
         auto [stdin_fd, stdout_fd, stderr_fd] = proc.pre_start();
         j.attach();
         proc.validate();
+        // The process replaces us, so this is as far as we can time
+        end_invocation(0);
         proc.exec(stdin_fd, stdout_fd, stderr_fd);
     }
 }
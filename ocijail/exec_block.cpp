@@ -0,0 +1,353 @@
+#include <sys/cdefs.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <grp.h>
+#ifdef __FreeBSD__
+#include <malloc_np.h>
+#else
+#include <malloc.h>
+#endif
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <system_error>
+#include <utility>
+
+#include "ocijail/exec_block.h"
+
+extern "C" char** environ;
+
+namespace ocijail {
+
+int run_hook(const char* path,
+             char* const argv[],
+             char* const envp[],
+             std::string_view state) {
+    int stdin[2];
+    if (::pipe(stdin) < 0) {
+        throw std::system_error{errno,
+                                std::system_category(),
+                                "error creating pipe for executing hook"};
+    }
+
+    auto pid = ::fork();
+    if (pid) {
+        // Parent process - write the state json
+        auto len = state.size();
+        auto p = state.data();
+        while (len > 0) {
+            auto n = ::write(stdin[1], p, len);
+            if (n < 0) {
+                throw std::system_error{errno,
+                                        std::system_category(),
+                                        "error writing state to hook"};
+            }
+            len -= n;
+            p += n;
+        }
+        if (::close(stdin[0]) < 0 || ::close(stdin[1]) < 0) {
+            throw std::system_error{
+                errno, std::system_category(), "error closing hook stdin pipe"};
+        }
+        int status;
+        // TODO: timeout
+        auto res = ::waitpid(pid, &status, 0);
+        if (res < 0) {
+            throw std::system_error{
+                errno, std::system_category(), "error waiting for hook"};
+        }
+        int ret =
+            WIFEXITED(status) ? WEXITSTATUS(status) : 127 + WTERMSIG(status);
+        return ret;
+    } else {
+        // Child process - setup descriptors and go
+        ::dup2(stdin[0], 0);
+        ::close(stdin[1]);
+        ::close_range(3, INT_MAX, CLOSE_RANGE_CLOEXEC);
+        // Don't override environment unless it was in the config
+        // The path should be absolute - no PATH lookup is needed
+        ::execve(path, argv, envp ? envp : environ);
+        throw std::system_error{errno,
+                                std::system_category(),
+                                "error executing hook" + std::string{path}};
+    }
+}
+
+void release_free_memory() {
+#ifdef __FreeBSD__
+    ::mallctl("arena." __XSTRING(MALLCTL_ARENAS_ALL) ".purge",
+              nullptr,
+              nullptr,
+              nullptr,
+              0);
+#else
+    ::malloc_trim(0);
+#endif
+}
+
+struct exec_block::packed_hook {
+    char* path;
+    char** argv;
+    // Null to inherit our environment
+    char** envp;
+};
+
+struct exec_block::header {
+    char** argv;
+    char** envp;
+    char* cwd;
+    uid_t uid;
+    gid_t gid;
+    mode_t umask;
+    size_t num_gids;
+    gid_t* gids;
+    size_t num_hooks;
+    packed_hook* hooks;
+    char* state;
+    size_t state_size;
+};
+
+namespace {
+
+// Lay out objects in a block of memory. With a null base, this only
+// computes the size of the block.
+class packer {
+   public:
+    explicit packer(char* base = nullptr) : base_(base) {}
+
+    size_t size() const { return used_; }
+
+    template <typename T>
+    T* alloc(size_t n = 1) {
+        used_ = (used_ + alignof(T) - 1) & ~(alignof(T) - 1);
+        auto p = base_ ? reinterpret_cast<T*>(base_ + used_) : nullptr;
+        used_ += n * sizeof(T);
+        return p;
+    }
+
+    char* string(std::string_view s) {
+        auto p = alloc<char>(s.size() + 1);
+        if (p) {
+            std::memcpy(p, s.data(), s.size());
+            p[s.size()] = '\0';
+        }
+        return p;
+    }
+
+    template <typename R>
+    char** strings(const R& strs, size_t n) {
+        auto res = alloc<char*>(n + 1);
+        size_t i = 0;
+        for (std::string_view s : strs) {
+            auto p = string(s);
+            if (res) {
+                res[i] = p;
+            }
+            i++;
+        }
+        if (res) {
+            res[n] = nullptr;
+        }
+        return res;
+    }
+
+   private:
+    char* base_;
+    size_t used_{0};
+};
+
+}  // namespace
+
+// Return the process environment, making sure that HOME is set and is not
+// empty
+static std::vector<std::string_view> exec_env(const process_spec& proc) {
+    std::vector<std::string_view> env;
+    bool has_home = false;
+    for (std::string_view s : proc.env) {
+        auto key = s.substr(0, s.find('='));
+        if (key == "HOME") {
+            if (s.size() <= key.size() + 1) {
+                continue;
+            }
+            has_home = true;
+        }
+        env.push_back(s);
+    }
+    if (!has_home) {
+        env.push_back("HOME=/");
+    }
+    return env;
+}
+
+static exec_block::header* pack(packer& p,
+                                const process_spec& proc,
+                                const std::vector<std::string_view>& env,
+                                const std::vector<hook_spec>& hooks,
+                                std::string_view state) {
+    auto h = p.alloc<exec_block::header>();
+    auto argv = p.strings(proc.args, proc.args.size());
+    auto envp = p.strings(env, env.size());
+    auto cwd = p.string(proc.cwd);
+    auto gids = p.alloc<gid_t>(proc.gids.size());
+    auto packed_hooks = p.alloc<exec_block::packed_hook>(hooks.size());
+    for (size_t i = 0; i < hooks.size(); i++) {
+        auto& hook = hooks[i];
+        // The hook's argv is its path followed by its args
+        std::vector<std::string_view> args{hook.path};
+        if (hook.args) {
+            args.insert(args.end(), hook.args->begin(), hook.args->end());
+        }
+        auto path = p.string(hook.path);
+        auto hook_argv = p.strings(args, args.size());
+        char** hook_envp = nullptr;
+        if (hook.env) {
+            hook_envp = p.strings(*hook.env, hook.env->size());
+        }
+        if (packed_hooks) {
+            packed_hooks[i] = {path, hook_argv, hook_envp};
+        }
+    }
+    auto state_copy = p.string(state);
+    if (h) {
+        std::copy(proc.gids.begin(), proc.gids.end(), gids);
+        *h = {argv,
+              envp,
+              cwd,
+              proc.uid,
+              proc.gid,
+              proc.umask,
+              proc.gids.size(),
+              gids,
+              hooks.size(),
+              packed_hooks,
+              state_copy,
+              state.size()};
+    }
+    return h;
+}
+
+exec_block::exec_block(const process_spec& proc,
+                       const std::vector<hook_spec>& hooks,
+                       std::string_view state) {
+    auto env = exec_env(proc);
+    packer sizer;
+    pack(sizer, proc, env, hooks, state);
+    size_ = sizer.size();
+    auto base = ::mmap(nullptr,
+                       size_,
+                       PROT_READ | PROT_WRITE,
+                       MAP_ANON | MAP_PRIVATE,
+                       -1,
+                       0);
+    if (base == MAP_FAILED) {
+        throw std::system_error{
+            errno, std::system_category(), "mapping exec block"};
+    }
+    packer writer{static_cast<char*>(base)};
+    header_ = pack(writer, proc, env, hooks, state);
+}
+
+exec_block::exec_block(exec_block&& other) noexcept
+    : header_(std::exchange(other.header_, nullptr)),
+      size_(std::exchange(other.size_, 0)) {}
+
+exec_block::~exec_block() {
+    if (header_) {
+        ::munmap(header_, size_);
+    }
+}
+
+char* const* exec_block::argv() const {
+    return header_->argv;
+}
+
+char* const* exec_block::envp() const {
+    return header_->envp;
+}
+
+std::string_view exec_block::cwd() const {
+    return header_->cwd;
+}
+
+void exec_block::run_hooks() const {
+    std::string_view state{header_->state, header_->state_size};
+    for (size_t i = 0; i < header_->num_hooks; i++) {
+        auto& hook = header_->hooks[i];
+        run_hook(hook.path, hook.argv, hook.envp, state);
+    }
+}
+
+static void reset_signals() {
+    ::sigset_t mask;
+    ::sigfillset(&mask);
+    if (::sigprocmask(SIG_UNBLOCK, &mask, nullptr) < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "setting signal mask"};
+    }
+    struct sigaction sa;
+    sa.sa_handler = SIG_DFL;
+    sa.sa_flags = 0;
+    ::sigemptyset(&sa.sa_mask);
+    for (int sig = 0; sig < NSIG; sig++) {
+        if (::sigaction(sig, &sa, nullptr) < 0 && errno != EINVAL) {
+            throw std::system_error{
+                errno, std::system_category(), "setting signal handler"};
+        }
+    }
+}
+
+void exec_block::exec(int stdin_fd,
+                      int stdout_fd,
+                      int stderr_fd,
+                      int preserve_fds) const {
+    auto& h = *header_;
+    environ = h.envp;
+
+    // Set the requested working directory.
+    if (chdir(h.cwd) < 0) {
+        throw std::system_error{
+            errno,
+            std::system_category(),
+            "error changing directory to" + std::string{h.cwd}};
+    }
+
+    // Unblock signals
+    reset_signals();
+
+    // Set the uid, gid etc.
+    if (::setgroups(h.num_gids, h.gids) < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "error calling setgroups"};
+    }
+    if (::setgid(h.gid) < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "error calling getgid"};
+    }
+    if (::setuid(h.uid) < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "error calling setuid"};
+    }
+    ::umask(h.umask);
+
+    // Setup stdin, stdout and stderr. Close everything else.
+    if (stdin_fd != 0) {
+        ::dup2(stdin_fd, 0);
+    }
+    if (stdout_fd != 1) {
+        ::dup2(stdout_fd, 1);
+    }
+    if (stderr_fd != 2) {
+        ::dup2(stderr_fd, 2);
+    }
+    ::close_range(3 + preserve_fds, INT_MAX, CLOSE_RANGE_CLOEXEC);
+
+    // exec the requested command.
+    ::execvp(h.argv[0], h.argv);
+    ::err(1, "error executing container command");
+}
+
+}  // namespace ocijail
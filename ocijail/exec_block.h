@@ -0,0 +1,66 @@
+#pragma once
+
+#include <sys/types.h>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "ocijail/spec.h"
+
+namespace ocijail {
+
+// Run a hook executable with the container state on its stdin and return
+// its exit status. If envp is null, the hook inherits our environment.
+int run_hook(const char* path,
+             char* const argv[],
+             char* const envp[],
+             std::string_view state);
+
+// Return free heap pages to the system
+void release_free_memory();
+
+// The container process and its startContainer hooks packed into a single
+// mapping, with argv and envp arrays ready for exec. The create child builds
+// one before it waits for start so that it can free everything else it
+// inherited from create.
+class exec_block {
+   public:
+    // Pack a process along with hooks to run before it and the state to
+    // pass to them. If the environment does not set HOME, it is set to "/".
+    exec_block(const process_spec& proc,
+               const std::vector<hook_spec>& hooks = {},
+               std::string_view state = {});
+    exec_block(exec_block&& other) noexcept;
+    exec_block(const exec_block&) = delete;
+    exec_block& operator=(const exec_block&) = delete;
+    ~exec_block();
+
+    // The arguments and environment for exec, each terminated by nullptr
+    char* const* argv() const;
+    char* const* envp() const;
+    std::string_view cwd() const;
+
+    // The size of the mapping
+    size_t size() const { return size_; }
+
+    // Run the packed hooks
+    void run_hooks() const;
+
+    // Change to the working directory, set credentials and stdio and
+    // execute the process. Descriptors from 3 to 3 + preserve_fds - 1 are
+    // kept open.
+    [[noreturn]] void exec(int stdin_fd,
+                           int stdout_fd,
+                           int stderr_fd,
+                           int preserve_fds) const;
+
+    // The layout of the block
+    struct packed_hook;
+    struct header;
+
+   private:
+    header* header_{nullptr};
+    size_t size_{0};
+};
+
+}  // namespace ocijail
@@ -12,7 +12,7 @@ using nlohmann::json;
 namespace ocijail {
 
 void features::init(main_app& app) {
-    static features instance{app};
+    app.add_command(std::shared_ptr<features>{new features{app}});
 }
 
 features::features(main_app& app) {
@@ -0,0 +1,45 @@
+#include <algorithm>
+
+#include "ocijail/flight.h"
+#include "ocijail/recorder.h"
+
+namespace fs = std::filesystem;
+
+namespace ocijail {
+
+void flight::init(main_app& app) {
+    app.add_command(std::shared_ptr<flight>{new flight{app}});
+}
+
+flight::flight(main_app& app) : app_(app) {
+    auto sub = app.add_subcommand(
+        "flight",
+        "Print flight records saved by commands which failed or were slow");
+    sub->add_option("files",
+                    files_,
+                    "Flight records to print, by default all of those in the "
+                    "state database");
+    sub->final_callback([this] { run(); });
+}
+
+void flight::run() {
+    auto files = files_;
+    if (files.empty()) {
+        auto dir = app_.get_state_db() / ".flight";
+        std::error_code ec;
+        for (const auto& it : fs::directory_iterator{dir, ec}) {
+            if (it.path().extension() == ".flight") {
+                files.push_back(it.path());
+            }
+        }
+        std::sort(files.begin(), files.end());
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        if (i > 0) {
+            app_.out() << "\n";
+        }
+        print_flight_dump(app_.out(), read_flight_dump(files[i]));
+    }
+}
+
+}  // namespace ocijail
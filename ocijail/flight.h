@@ -0,0 +1,21 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include "ocijail/main.h"
+
+namespace ocijail {
+
+struct flight {
+    static void init(main_app& app);
+
+   private:
+    flight(main_app& app);
+    void run();
+
+    main_app& app_;
+    std::vector<std::filesystem::path> files_;
+};
+
+}  // namespace ocijail
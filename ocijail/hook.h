@@ -3,36 +3,33 @@
 #include "nlohmann/json.hpp"
 
 #include "ocijail/main.h"
+#include "ocijail/spec.h"
 
 namespace ocijail {
 
 class main_app;
 
 struct hook {
-    // initialise with a json describing the hook from the config
-    hook(const nlohmann::json& hook_config);
-
-    // Given a hooks object, validate that each hook in the given
-    // phase is well-formed
-    static void validate_hooks(main_app& app,
-                               const nlohmann::json& hooks,
-                               const char* phase);
+    // initialise with a hook from the compiled config
+    hook(const hook_spec& spec) : spec_(spec) {}
 
     // Run all the hooks for a phase
     static void run_hooks(main_app& app,
-                          const nlohmann::json& hooks,
-                          const char* phase,
+                          const oci_spec& spec,
+                          hook_phase phase,
+                          const runtime_state& state);
+
+    // Run all the hooks for a phase, reading the config from the container
+    // state only if the phase has hooks
+    static void run_hooks(main_app& app,
+                          hook_phase phase,
                           const runtime_state& state);
 
     // Run this hook
     int run(main_app& app, const runtime_state& state);
 
    private:
-    // Copied out from the json during parsing
-    std::string path_;
-    std::optional<std::vector<std::string>> args_;
-    std::optional<std::vector<std::string>> env_;
-    std::optional<int> timeout_;
+    const hook_spec& spec_;
 };
 
 }  // namespace ocijail
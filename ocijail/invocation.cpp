@@ -0,0 +1,130 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "ocijail/invocation.h"
+
+using nlohmann::json;
+
+namespace ocijail {
+
+namespace {
+
+struct invocation {
+    std::string path;
+    pid_t pid;
+    std::chrono::system_clock::time_point start;
+    std::chrono::steady_clock::time_point steady_start;
+    json record;
+};
+
+std::optional<invocation> current;
+std::atomic<bool> inputs_ignored{false};
+
+// Remove values which may be secret: environment variables keep their names
+// and annotations keep their keys
+void sanitize(json& value) {
+    if (value.is_array()) {
+        for (auto& item : value) {
+            sanitize(item);
+        }
+        return;
+    }
+    if (!value.is_object()) {
+        return;
+    }
+    for (auto& [key, item] : value.items()) {
+        if (key == "env" && item.is_array()) {
+            for (auto& var : item) {
+                if (var.is_string()) {
+                    auto s = var.get<std::string>();
+                    var = s.substr(0, s.find('=') + 1);
+                }
+            }
+        } else if (key == "annotations" && item.is_object()) {
+            for (auto& [name, v] : item.items()) {
+                v = "";
+            }
+        } else {
+            sanitize(item);
+        }
+    }
+}
+
+}  // namespace
+
+void begin_invocation(int argc, char** argv) {
+    auto path = ::getenv("OCIJAIL_RECORD");
+    if (!path || !*path) {
+        return;
+    }
+    current.emplace();
+    current->path = path;
+    current->pid = ::getpid();
+    current->start = std::chrono::system_clock::now();
+    current->steady_start = std::chrono::steady_clock::now();
+    auto& record = current->record;
+    record["args"] = json::array();
+    for (int i = 1; i < argc; i++) {
+        record["args"].push_back(argv[i]);
+    }
+    std::error_code ec;
+    record["cwd"] = std::filesystem::current_path(ec).native();
+}
+
+void end_invocation(int status) {
+    if (!current || current->pid != ::getpid()) {
+        return;
+    }
+    auto& record = current->record;
+    record["pid"] = current->pid;
+    record["ppid"] = ::getppid();
+    record["start"] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          current->start.time_since_epoch())
+                          .count();
+    record["duration"] =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - current->steady_start)
+            .count();
+    record["status"] = status;
+    auto text = record.dump() + "\n";
+    auto fd = ::open(
+        current->path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+        // A single write so that concurrent invocations don't interleave
+        ::write(fd, text.data(), text.size());
+        ::close(fd);
+    }
+    current.reset();
+}
+
+void record_input(const char* name, const json& value) {
+    if (!current || inputs_ignored) {
+        return;
+    }
+    auto& input = current->record[name];
+    input = value;
+    sanitize(input);
+}
+
+void record_input_text(const char* name, std::string_view text) {
+    if (!current || inputs_ignored) {
+        return;
+    }
+    auto value = json::parse(text, nullptr, false);
+    if (!value.is_discarded()) {
+        record_input(name, value);
+    }
+}
+
+void ignore_inputs() {
+    inputs_ignored = true;
+}
+
+}  // namespace ocijail
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string_view>
+
+#include "nlohmann/json.hpp"
+
+namespace ocijail {
+
+// If OCIJAIL_RECORD names a file, each invocation of the runtime appends a
+// line of JSON to it with its arguments, working directory, start time,
+// duration and exit status, and the inputs which commands add below. The
+// file can be replayed with //bench:replay to reproduce the load from a
+// container engine offline. Recording errors are ignored so that they
+// never fail a command.
+//
+// The record is written by end_invocation, only from the process which
+// called begin_invocation.
+void begin_invocation(int argc, char** argv);
+void end_invocation(int status);
+
+// Add a command's input, such as the bundle config for create or the
+// process for exec, to the record. Environment variable values and
+// annotations are removed. Text is only parsed if recording.
+void record_input(const char* name, const nlohmann::json& value);
+void record_input_text(const char* name, std::string_view text);
+
+// Stop recording inputs. Commands run by batch or serve are not the
+// invocation being recorded, and those of serve run concurrently, so a
+// dispatcher calls this before running any.
+void ignore_inputs();
+
+}  // namespace ocijail
@@ -1,7 +1,5 @@
 #include <sys/param.h>
 
-#include <sys/jail.h>
-#include <cassert>
 #include <iomanip>
 #include <string>
 #include <system_error>
@@ -9,33 +7,18 @@
 #include <iostream>
 
 #include "ocijail/jail.h"
+#include "ocijail/platform.h"
+#include "ocijail/recorder.h"
 
 namespace ocijail {
 
-void jail::config::set(const std::string& key, const value& val) {
-    // Validate parameter types
-    if (key == "jid" || key == "devfs_ruleset" || key == "enforce_statfs") {
-        assert(std::holds_alternative<uint32_t>(val));
-    } else if (key == "ip4" || key == "ip6" || key == "sysvmsg" ||
-               key == "sysvsem" || key == "sysvshm") {
-        assert(std::holds_alternative<ns>(val));
-    } else if (key == "ip4.addr" || key == "ip6.addr") {
-        assert(std::holds_alternative<std::vector<uint8_t>>(val));
-    } else if (key == "host" || key == "vnet") {
-        assert(std::holds_alternative<ns>(val) &&
-               std::get<ns>(val) != DISABLED);
-    } else if (key == "persist" || key.starts_with("allow.")) {
-        assert(std::holds_alternative<std::monostate>(val));
-    } else {
-        assert(std::holds_alternative<std::string>(val));
-    }
-    params_[key] = val;
-}
-
 jail jail::create(config& jconf) {
     std::array<char, 1024> errbuf;
     auto jiov = get_iovec(jconf, errbuf);
-    int32_t jid = jail_set(&jiov[0], jiov.size(), JAIL_CREATE);
+    int32_t jid = recorded(flight_op::JAIL_SET, [&] {
+        return current_platform().jail_set(
+            &jiov[0], jiov.size(), JAIL_CREATE);
+    });
     if (jid < 0) {
         throw std::system_error{
             errno, std::system_category(), "error calling jail_set: " + get_errmsg(jiov)};
@@ -48,7 +31,7 @@ jail jail::find(const std::string& name) {
     jconf.set("name", name);
     std::array<char, 1024> errbuf;
     auto jiov = get_iovec(jconf, errbuf);
-    int32_t jid = jail_get(&jiov[0], jiov.size(), 0);
+    int32_t jid = current_platform().jail_get(&jiov[0], jiov.size(), 0);
     if (jid < 0) {
         throw std::system_error{
             errno, std::system_category(), "error calling jail_get: " + get_errmsg(jiov)};
@@ -57,14 +40,14 @@ jail jail::find(const std::string& name) {
 }
 
 void jail::attach() {
-    if (jail_attach(jid_) < 0) {
+    if (current_platform().jail_attach(jid_) < 0) {
         throw std::system_error{
             errno, std::system_category(), "error calling jail_attach"};
     }
 }
 
 void jail::remove() {
-    if (jail_remove(jid_) < 0) {
+    if (current_platform().jail_remove(jid_) < 0) {
         // If errno is EINVAL, jail is already removed
         if (errno != EINVAL) {
             throw std::system_error{
@@ -76,7 +59,7 @@ void jail::remove() {
 void jail::_get(config& jconf) {
     std::array<char, 1024> errbuf;
     auto jiov = get_iovec(jconf, errbuf);
-    if (jail_get(&jiov[0], jiov.size(), 0) < 0) {
+    if (current_platform().jail_get(&jiov[0], jiov.size(), 0) < 0) {
         throw std::system_error{
             errno, std::system_category(), "error calling jail_get: " + get_errmsg(jiov)};
     }
@@ -85,49 +68,14 @@ void jail::_get(config& jconf) {
 void jail::_set(config& jconf) {
     std::array<char, 1024> errbuf;
     auto jiov = get_iovec(jconf, errbuf);
-    if (jail_set(&jiov[0], jiov.size(), JAIL_UPDATE) < 0) {
+    auto res = recorded(flight_op::JAIL_SET, [&] {
+        return current_platform().jail_set(
+            &jiov[0], jiov.size(), JAIL_UPDATE);
+    });
+    if (res < 0) {
         throw std::system_error{
             errno, std::system_category(), "error calling jail_set: " + get_errmsg(jiov)};
     }
 }
 
-static iovec string_to_iovec(const char *s) {
-    return {reinterpret_cast<void*>(const_cast<char*>(s)),
-            strlen(s) + 1};
-}
-
-static iovec string_to_iovec(const std::string& s) {
-    return {reinterpret_cast<void*>(const_cast<char*>(s.c_str())),
-            s.size() + 1};
-}
-
-std::vector<iovec> jail::get_iovec(config& jconf, std::array<char, 1024>& errbuf) {
-    std::vector<iovec> jiov;
-    jiov.reserve(2 * jconf.params_.size() + 2);
-    for (auto& [key, val] : jconf.params_) {
-        jiov.emplace_back(string_to_iovec(key));
-        if (auto p = std::get_if<std::string>(&val)) {
-            jiov.emplace_back(string_to_iovec(*p));
-        } else if (auto p = std::get_if<uint32_t>(&val)) {
-            jiov.emplace_back(
-                iovec{reinterpret_cast<void*>(p), sizeof(uint32_t)});
-        } else if (auto p = std::get_if<int32_t>(&val)) {
-            jiov.emplace_back(
-                iovec{reinterpret_cast<void*>(p), sizeof(int32_t)});
-        } else if (std::holds_alternative<std::monostate>(val)) {
-            jiov.emplace_back(iovec{nullptr, 0});
-        } else if (auto p = std::get_if<ns>(&val)) {
-            jiov.emplace_back(
-                iovec{reinterpret_cast<void*>(p), sizeof(uint32_t)});
-        } else if (auto p = std::get_if<std::vector<uint8_t>>(&val)) {
-            jiov.emplace_back(iovec{reinterpret_cast<void*>(p->data()),
-                                    static_cast<size_t>(p->size())});
-        }
-    }
-    jiov.emplace_back(string_to_iovec("errmsg"));
-    jiov.emplace_back(reinterpret_cast<void*>(errbuf.data()), errbuf.size());
-    
-    return jiov;
-}
-
 }  // namespace ocijail
@@ -2,10 +2,16 @@
 
 #include <sys/uio.h>
 #include <array>
+#include <cstdint>
 #include <cstring>
 #include <map>
-#include <map>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <variant>
+#include <vector>
 
 namespace ocijail {
 
@@ -19,10 +25,22 @@ struct jail {
     struct config {
         using value = std::variant<std::monostate, std::string, uint32_t,
                                    int32_t, ns, std::vector<uint8_t>>;
-        void set(const std::string& key, const value& value = std::monostate{});
-        value& at(const std::string& key) { return params_.at(key); }
 
-        std::map<std::string, value> params_;
+        // Parameters are allocated from mr, usually the command's arena
+        explicit config(std::pmr::memory_resource* mr =
+                            std::pmr::get_default_resource())
+            : params_(mr) {}
+
+        void set(std::string_view key, const value& value = std::monostate{});
+        value& at(std::string_view key) {
+            auto it = params_.find(key);
+            if (it == params_.end()) {
+                throw std::out_of_range{"jail parameter " + std::string{key}};
+            }
+            return it->second;
+        }
+
+        std::pmr::map<std::pmr::string, value, std::less<>> params_;
     };
 
     static jail create(config& jconf);
@@ -37,32 +55,33 @@ struct jail {
 
     template <typename T>
     T get(const std::string& key) {
-        config jconf;
-        jconf.set("jid", jid_);
-        jconf.set(key, T{});
-        _get(jconf);
-        return std::get<T>(jconf.at(key));
-    }
-
-    template <>
-    bool get<bool>(const std::string& key) {
-        auto val = get<uint32_t>(key);
-        return !!val;
+        if constexpr (std::is_same_v<T, bool>) {
+            return !!get<uint32_t>(key);
+        } else {
+            config jconf;
+            jconf.set("jid", uint32_t(jid_));
+            jconf.set(key, T{});
+            _get(jconf);
+            return std::get<T>(jconf.at(key));
+        }
     }
 
     template <typename T>
     void set(const std::string& key, T val) {
         config jconf;
-        jconf.set("jid", jid_);
+        jconf.set("jid", uint32_t(jid_));
         jconf.set(key, val);
         _set(jconf);
     }
 
+    // Build the parameter list for jail_set or jail_get, ending with an
+    // errmsg parameter which points at errbuf
+    static std::vector<iovec> get_iovec(config& jconf, std::array<char, 1024>& errbuf);
+
    private:
     jail(int jid) : jid_(jid) {}
     void _get(config& jconf);
     void _set(config& jconf);
-    static std::vector<iovec> get_iovec(config& jconf, std::array<char, 1024>& errbuf);
     static std::string get_errmsg(const std::vector<iovec>& jiov) {
         const auto& err = jiov.back();
         auto msg = reinterpret_cast<const char*>(err.iov_base);
@@ -0,0 +1,81 @@
+// The parts of jail which don't call into the kernel, kept apart from
+// jail.cpp so that they can be built and measured on any host.
+
+#include <cassert>
+#include <cstring>
+
+#include "ocijail/jail.h"
+
+namespace ocijail {
+
+void jail::config::set(std::string_view key, const value& val) {
+    // Validate parameter types
+    if (key == "jid" || key == "devfs_ruleset" || key == "enforce_statfs" ||
+        key.starts_with("children.")) {
+        assert(std::holds_alternative<uint32_t>(val));
+    } else if (key == "ip4" || key == "ip6" || key == "sysvmsg" ||
+               key == "sysvsem" || key == "sysvshm") {
+        assert(std::holds_alternative<ns>(val));
+    } else if (key == "ip4.addr" || key == "ip6.addr") {
+        assert(std::holds_alternative<std::vector<uint8_t>>(val));
+    } else if (key == "host" || key == "vnet") {
+        assert(std::holds_alternative<ns>(val) &&
+               std::get<ns>(val) != DISABLED);
+    } else if (key == "persist") {
+        assert(std::holds_alternative<std::monostate>(val));
+    } else if (key.starts_with("allow.")) {
+        // Flags are set by name and read back as numbers
+        assert(std::holds_alternative<std::monostate>(val) ||
+               std::holds_alternative<uint32_t>(val));
+    } else {
+        assert(std::holds_alternative<std::string>(val));
+    }
+    params_.insert_or_assign(
+        std::pmr::string{key, params_.get_allocator()}, val);
+}
+
+static iovec string_to_iovec(const char *s) {
+    return {reinterpret_cast<void*>(const_cast<char*>(s)),
+            strlen(s) + 1};
+}
+
+static iovec string_to_iovec(const std::pmr::string& s) {
+    return {reinterpret_cast<void*>(const_cast<char*>(s.c_str())),
+            s.size() + 1};
+}
+
+static iovec string_to_iovec(const std::string& s) {
+    return {reinterpret_cast<void*>(const_cast<char*>(s.c_str())),
+            s.size() + 1};
+}
+
+std::vector<iovec> jail::get_iovec(config& jconf, std::array<char, 1024>& errbuf) {
+    std::vector<iovec> jiov;
+    jiov.reserve(2 * jconf.params_.size() + 2);
+    for (auto& [key, val] : jconf.params_) {
+        jiov.emplace_back(string_to_iovec(key));
+        if (auto p = std::get_if<std::string>(&val)) {
+            jiov.emplace_back(string_to_iovec(*p));
+        } else if (auto p = std::get_if<uint32_t>(&val)) {
+            jiov.emplace_back(
+                iovec{reinterpret_cast<void*>(p), sizeof(uint32_t)});
+        } else if (auto p = std::get_if<int32_t>(&val)) {
+            jiov.emplace_back(
+                iovec{reinterpret_cast<void*>(p), sizeof(int32_t)});
+        } else if (std::holds_alternative<std::monostate>(val)) {
+            jiov.emplace_back(iovec{nullptr, 0});
+        } else if (auto p = std::get_if<ns>(&val)) {
+            jiov.emplace_back(
+                iovec{reinterpret_cast<void*>(p), sizeof(uint32_t)});
+        } else if (auto p = std::get_if<std::vector<uint8_t>>(&val)) {
+            jiov.emplace_back(iovec{reinterpret_cast<void*>(p->data()),
+                                    static_cast<size_t>(p->size())});
+        }
+    }
+    jiov.emplace_back(string_to_iovec("errmsg"));
+    jiov.emplace_back(reinterpret_cast<void*>(errbuf.data()), errbuf.size());
+    
+    return jiov;
+}
+
+}  // namespace ocijail
@@ -5,6 +5,7 @@
 #include "nlohmann/json.hpp"
 
 #include "kill.h"
+#include "ocijail/platform.h"
 
 namespace fs = std::filesystem;
 
@@ -13,7 +14,7 @@ using nlohmann::json;
 namespace ocijail {
 
 void kill::init(main_app& app) {
-    static kill instance{app};
+    app.add_command(std::shared_ptr<kill>{new kill{app}});
 }
 
 kill::kill(main_app& app) : app_(app) {
@@ -30,6 +31,7 @@ kill::kill(main_app& app) : app_(app) {
 }
 
 void kill::run() {
+    app_.recorder().set_id(id_);
     int signum = 0;
     if (signame_) {
         // This can be either the signal number or its name. Try the
@@ -43,8 +45,9 @@ void kill::run() {
             len = 0;
         }
         if (len != signame_->size()) {
-            for (int i = 0; i < sys_nsig; i++) {
-                if (sys_signame[i] && *signame_ == sys_signame[i]) {
+            for (int i = 1; i < NSIG; i++) {
+                auto name = current_platform().signal_name(i);
+                if (name && *signame_ == name) {
                     signum = i;
                     break;
                 }
@@ -58,16 +61,15 @@ void kill::run() {
     }
 
     auto state = app_.get_runtime_state(id_);
-    auto lk = state.lock();
     state.load();
 
-    if (state["status"] == "created" || state["status"] == "running") {
-        if (::kill(state["pid"], signum) < 0 && errno != ESRCH) {
+    if (state.status() == container_status::CREATED ||
+        state.status() == container_status::RUNNING) {
+        if (::kill(state.pid(), signum) < 0 && errno != ESRCH) {
             throw std::system_error(
                 errno,
                 std::system_category(),
-                "sending signal to pid " +
-                    std::to_string(state["pid"].get<int>()));
+                "sending signal to pid " + std::to_string(state.pid()));
         }
     }
 }
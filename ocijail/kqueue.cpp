@@ -0,0 +1,190 @@
+#include <sys/types.h>
+#ifdef __FreeBSD__
+#include <sys/event.h>
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <array>
+#include <system_error>
+
+#include "ocijail/kqueue.h"
+
+namespace fs = std::filesystem;
+
+namespace ocijail {
+
+#ifdef __FreeBSD__
+
+kqueue_event_source::kqueue_event_source() {
+    kq_ = ::kqueue();
+    if (kq_ < 0) {
+        throw std::system_error{errno, std::system_category(), "kqueue"};
+    }
+}
+
+kqueue_event_source::~kqueue_event_source() {
+    for (auto& [fd, _] : fds_) {
+        ::close(fd);
+    }
+    ::close(kq_);
+}
+
+void kqueue_event_source::open_path(const fs::path& path) {
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        // The path may not exist yet - we will retry when its parent
+        // directory changes.
+        if (errno == ENOENT) {
+            return;
+        }
+        throw std::system_error{
+            errno, std::system_category(), "open " + path.native()};
+    }
+    struct kevent kev;
+    EV_SET(&kev,
+           fd,
+           EVFILT_VNODE,
+           EV_ADD | EV_CLEAR,
+           NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME,
+           0,
+           nullptr);
+    if (::kevent(kq_, &kev, 1, nullptr, 0, nullptr) < 0) {
+        auto saved_errno = errno;
+        ::close(fd);
+        throw std::system_error{
+            saved_errno, std::system_category(), "kevent " + path.native()};
+    }
+    paths_[path] = fd;
+    fds_[fd] = path;
+}
+
+void kqueue_event_source::watch_path(const fs::path& path) {
+    if (!paths_.contains(path)) {
+        paths_[path] = -1;
+        open_path(path);
+    }
+}
+
+void kqueue_event_source::unwatch_path(const fs::path& path) {
+    auto it = paths_.find(path);
+    if (it != paths_.end()) {
+        if (it->second >= 0) {
+            // Closing the descriptor removes it from the kqueue
+            fds_.erase(it->second);
+            ::close(it->second);
+        }
+        paths_.erase(it);
+    }
+}
+
+void kqueue_event_source::watch_process(pid_t pid) {
+    struct kevent kev;
+    EV_SET(&kev, pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, nullptr);
+    if (::kevent(kq_, &kev, 1, nullptr, 0, nullptr) < 0) {
+        if (errno == ESRCH) {
+            // Already gone - we don't know its exit status
+            pending_exits_.push_back({pid, std::nullopt});
+            return;
+        }
+        throw std::system_error{errno, std::system_category(), "kevent"};
+    }
+}
+
+void kqueue_event_source::watch_exec(pid_t pid) {
+    // This replaces the one-shot exit filter added by watch_process. The
+    // kernel still removes the filter when the process exits.
+    struct kevent kev;
+    EV_SET(&kev,
+           pid,
+           EVFILT_PROC,
+           EV_ADD | EV_CLEAR,
+           NOTE_EXIT | NOTE_EXEC,
+           0,
+           nullptr);
+    if (::kevent(kq_, &kev, 1, nullptr, 0, nullptr) < 0) {
+        if (errno == ESRCH) {
+            // Already gone - watch_process has reported this
+            return;
+        }
+        throw std::system_error{errno, std::system_category(), "kevent"};
+    }
+}
+
+notification kqueue_event_source::wait() {
+    notification res;
+    res.exits = std::move(pending_exits_);
+    pending_exits_.clear();
+    if (!res.exits.empty()) {
+        res.changed = true;
+        return res;
+    }
+
+    std::array<struct kevent, 32> events;
+    int n;
+    do {
+        n = ::kevent(kq_, nullptr, 0, events.data(), events.size(), nullptr);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        throw std::system_error{errno, std::system_category(), "kevent"};
+    }
+
+    std::vector<fs::path> reopen;
+    for (int i = 0; i < n; i++) {
+        auto& kev = events[i];
+        if (kev.filter == EVFILT_PROC) {
+            auto pid = static_cast<pid_t>(kev.ident);
+            if (kev.fflags & NOTE_EXEC) {
+                res.execs.push_back(pid);
+            }
+            if (kev.fflags & NOTE_EXIT) {
+                res.exits.push_back({pid, static_cast<int>(kev.data)});
+            }
+        } else if (kev.filter == EVFILT_VNODE) {
+            res.changed = true;
+            if (kev.fflags & (NOTE_DELETE | NOTE_RENAME)) {
+                auto it = fds_.find(kev.ident);
+                if (it != fds_.end()) {
+                    reopen.push_back(it->second);
+                }
+            }
+        }
+    }
+
+    // Follow watched paths which were replaced. Any directory change might
+    // also mean that a missing path now exists.
+    for (auto& path : reopen) {
+        unwatch_path(path);
+        paths_[path] = -1;
+    }
+    if (res.changed) {
+        for (auto& [path, fd] : paths_) {
+            if (fd < 0) {
+                open_path(path);
+            }
+        }
+    }
+    return res;
+}
+
+#else
+
+// Other hosts don't have kqueue so there is no event source and commands
+// which need one fail
+kqueue_event_source::kqueue_event_source() : kq_(-1) {
+    throw std::system_error{ENOSYS, std::system_category(), "kqueue"};
+}
+
+kqueue_event_source::~kqueue_event_source() {}
+void kqueue_event_source::open_path(const fs::path&) {}
+void kqueue_event_source::watch_path(const fs::path&) {}
+void kqueue_event_source::unwatch_path(const fs::path&) {}
+void kqueue_event_source::watch_process(pid_t) {}
+void kqueue_event_source::watch_exec(pid_t) {}
+
+notification kqueue_event_source::wait() {
+    return {};
+}
+
+#endif
+
+}  // namespace ocijail
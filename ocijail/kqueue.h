@@ -0,0 +1,35 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <vector>
+
+#include "ocijail/event_stream.h"
+
+namespace ocijail {
+
+// An event source using kqueue. Paths are watched with EVFILT_VNODE and
+// re-opened if they are replaced by a rename. Processes are watched with
+// EVFILT_PROC which also gives us their exit status and, if asked, tells us
+// when they exec.
+class kqueue_event_source : public event_source {
+   public:
+    kqueue_event_source();
+    ~kqueue_event_source() override;
+
+    void watch_path(const std::filesystem::path& path) override;
+    void unwatch_path(const std::filesystem::path& path) override;
+    void watch_process(pid_t pid) override;
+    void watch_exec(pid_t pid) override;
+    notification wait() override;
+
+   private:
+    void open_path(const std::filesystem::path& path);
+
+    int kq_;
+    std::map<std::filesystem::path, int> paths_;
+    std::map<int, std::filesystem::path> fds_;
+    std::vector<process_exit> pending_exits_;
+};
+
+}  // namespace ocijail
@@ -4,7 +4,8 @@
 
 #include "nlohmann/json.hpp"
 
-#include "list.h"
+#include "ocijail/list.h"
+#include "ocijail/state_index.h"
 
 namespace fs = std::filesystem;
 
@@ -13,7 +14,7 @@ using nlohmann::json;
 namespace ocijail {
 
 void list::init(main_app& app) {
-    static list instance{app};
+    app.add_command(std::shared_ptr<list>{new list{app}});
 }
 
 list::list(main_app& app) : app_(app) {
@@ -35,47 +36,47 @@ void list::run() {
     std::map<std::string, runtime_state> states;
     int max_id_width = 1;
 
-    for (const auto& it : fs::directory_iterator{app_.get_state_db()}) {
-        auto id = it.path().filename().native();
+    // Everything we need is in the state index - we only look at the
+    // per-container state if the container seems to have stopped.
+    auto entries = app_.get_state_index().entries();
+    for (const auto& entry : entries) {
+        const auto& id = entry.id;
         if (id.size() > max_id_width) {
             max_id_width = id.size();
         }
         auto state = app_.get_runtime_state(id);
-        if (state.exists()) {
-            auto lk = state.lock();
-            state.load();
-            state.check_status();
-            if (state["status"] == "stopped") {
-                state["pid"] = 0;
-            }
-            states.emplace(id, state);
+        state.set_record(entry.record);
+        state.check_status();
+        if (state.status() == container_status::STOPPED) {
+            state.set_pid(0);
         }
+        states.emplace(id, state);
     }
 
     if (format_ == list_format::LIST_TABLE) {
-        std::cout << std::left << std::setw(max_id_width) << "ID"
-                  << " " << std::setw(10) << "PID"
-                  << " " << std::setw(8) << "STATUS"
-                  << " " << std::setw(40) << "BUNDLE"
-                  << "\n";
+        app_.out() << std::left << std::setw(max_id_width) << "ID"
+                   << " " << std::setw(10) << "PID"
+                   << " " << std::setw(8) << "STATUS"
+                   << " " << std::setw(40) << "BUNDLE"
+                   << "\n";
         for (const auto& [id, state] : states) {
-            std::cout << std::left << std::setw(max_id_width) << id << " "
-                      << std::setw(10) << state["pid"].get<int>() << " "
-                      << std::setw(8) << state["status"].get<std::string>()
-                      << " " << std::setw(40)
-                      << state["bundle"].get<std::string>() << "\n";
+            app_.out() << std::left << std::setw(max_id_width) << id << " "
+                       << std::setw(10) << state.pid() << " "
+                       << std::setw(8) << to_string(state.status()) << " "
+                       << std::setw(40) << state.bundle().native() << "\n";
         }
     } else {
         json res;
         for (const auto& [id, state] : states) {
             json entry;
             entry["id"] = id;
-            entry["pid"] = state["pid"];
-            entry["status"] = state["status"];
-            entry["bundle"] = state["bundle"];
+            entry["pid"] = state.pid();
+            entry["status"] = to_string(state.status());
+            entry["bundle"] = state.bundle();
+            entry["timings"] = state.timings();
             res.push_back(entry);
         }
-        std::cout << res;
+        app_.out() << res;
     }
 }
 
@@ -0,0 +1,64 @@
+#include <sys/time.h>
+#include <unistd.h>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/log.h"
+
+using nlohmann::json;
+
+namespace ocijail {
+
+static std::string log_timestamp() {
+    struct ::timeval tv;
+    struct std::tm now;
+    gettimeofday(&tv, nullptr);
+    gmtime_r(&tv.tv_sec, &now);
+    std::stringstream ss;
+    ss << std::put_time(&now, "%Y-%m-%dT%H:%M:%S");
+    ss << std::setw(9) << std::setfill('0') << tv.tv_usec << "Z";
+    return ss.str();
+}
+
+static const char* level_name(log_level l) {
+    switch (l) {
+    case log_level::ERROR:
+        return "error";
+    case log_level::INFO:
+        return "info";
+    case log_level::WARN:
+        return "warn";
+    case log_level::DEBUG:
+        return "debug";
+    }
+    return "error";
+}
+
+void logger::write(log_level l, std::string_view msg) const {
+    std::stringstream ss;
+    switch (format) {
+    case log_format::TEXT:
+        ss << log_timestamp() << ": " << msg << "\n";
+        break;
+    case log_format::JSON: {
+        json entry;
+        entry["msg"] = msg;
+        entry["level"] = level_name(l);
+        entry["time"] = log_timestamp();
+        ss << entry << "\n";
+        break;
+    }
+    }
+    auto s = ss.str();
+    ::write(fd, s.data(), s.size());
+
+    if (fd != 2 && l == log_level::ERROR) {
+        // Copy to stderr
+        std::cerr << "Error: " << msg << "\n";
+    }
+}
+
+}  // namespace ocijail
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <optional>
+#include <sstream>
+#include <string_view>
+
+namespace ocijail {
+
+enum class log_format {
+    TEXT,
+    JSON,
+};
+
+// Messages are written if their level is no greater than the configured
+// level. Errors are always written.
+enum class log_level {
+    ERROR,
+    INFO,
+    WARN,
+    DEBUG,
+};
+
+struct logger {
+    bool enabled(log_level l) const { return l <= level; }
+
+    // Write a message to the log. If the log is not stderr, errors are also
+    // copied there.
+    void write(log_level l, std::string_view msg) const;
+
+    log_format format{log_format::TEXT};
+    log_level level{log_level::INFO};
+    int fd{2};
+};
+
+// A log message which is written when it goes out of scope. If its level is
+// not enabled, nothing is formatted and no memory is allocated.
+class log_entry {
+   public:
+    log_entry(const logger& log, log_level level) : log_(log), level_(level) {
+        if (log_.enabled(level_)) {
+            ss_.emplace();
+        }
+    }
+    log_entry(const log_entry&) = delete;
+    log_entry& operator=(const log_entry&) = delete;
+    ~log_entry() {
+        if (ss_) {
+            log_.write(level_, ss_->str());
+        }
+    }
+
+    template <typename T>
+    const log_entry& operator<<(const T& t) const {
+        if (ss_) {
+            *ss_ << t;
+        }
+        return *this;
+    }
+
+   private:
+    const logger& log_;
+    log_level level_;
+    mutable std::optional<std::stringstream> ss_;
+};
+
+}  // namespace ocijail
@@ -1,156 +1,29 @@
 #include <fcntl.h>
 #include <signal.h>
-#include <sys/time.h>
 #include <unistd.h>
-#include <ctime>
-#include <iomanip>
-
-#include "ocijail/create.h"
-#include "ocijail/delete.h"
-#include "ocijail/exec.h"
-#include "ocijail/features.h"
-#include "ocijail/kill.h"
-#include "ocijail/list.h"
+#include <set>
+
 #include "ocijail/main.h"
-#include "ocijail/start.h"
-#include "ocijail/state.h"
+#include "ocijail/metrics.h"
+#include "ocijail/state_index.h"
+#include "ocijail/trace.h"
 
 using namespace ocijail;
 using nlohmann::json;
 
 static const char* version = "0.6.0-dev";
 
-int main(int argc, char** argv) {
-    main_app app{"ocijail: Yet another OCI runtime"};
-
-    create::init(app);
-    start::init(app);
-    delete_::init(app);
-    exec::init(app);
-    kill::init(app);
-    state::init(app);
-    list::init(app);
-    features::init(app);
-
-    try {
-        app.parse(argc, argv);
-    } catch (const CLI::ParseError& e) {
-        return app.exit(e);
-    } catch (const std::exception& e) {
-        app.log_error(e);
-        return 1;
-    }
-
-    return 0;
+// Commands which only read the state database. Podman polls state for
+// containers which may have been deleted, so their failures are routine and
+// not worth a flight record unless they are slow.
+static bool read_only(std::string_view command) {
+    static const std::set<std::string_view> commands{
+        "state", "list", "features", "events", "wait", "flight"};
+    return commands.contains(command);
 }
 
 namespace ocijail {
 
-void malformed_config(std::string_view message) {
-    std::stringstream ss;
-    ss << "create: malformed config: " << message;
-    throw std::runtime_error(ss.str());
-}
-
-runtime_state::locked_state::~locked_state() {
-    if (locked_) {
-        unlock();
-    }
-}
-
-void runtime_state::locked_state::unlock() {
-    assert(locked_);
-    locked_ = false;
-    if (::flock(fd_, LOCK_UN) < 0) {
-        throw std::system_error(
-            errno, std::system_category(), "unlocking state lock");
-    }
-}
-
-void runtime_state::locked_state::lock() {
-    assert(!locked_);
-    if (::flock(fd_, LOCK_EX) < 0) {
-        throw std::system_error(
-            errno, std::system_category(), "locking state lock");
-    }
-    locked_ = true;
-}
-
-runtime_state::locked_state runtime_state::create() {
-    std::filesystem::remove_all(state_dir_);
-    std::filesystem::create_directories(state_dir_);
-    auto fd = ::open(state_lock_.c_str(), O_RDWR | O_CREAT | O_EXLOCK);
-    if (fd < 0) {
-        throw std::system_error(
-            errno, std::system_category(), "opening state lock");
-    }
-    return {true, fd};
-}
-
-void runtime_state::remove_all() {
-    std::filesystem::remove_all(state_dir_);
-}
-
-void runtime_state::load() {
-    if (!std::filesystem::is_directory(state_dir_)) {
-        std::stringstream ss;
-        ss << "container " << id_ << " not found";
-        throw std::runtime_error(ss.str());
-    }
-    std::ifstream{state_json_} >> state_;
-}
-
-void runtime_state::save() {
-    std::ofstream{state_json_} << state_;
-}
-
-json runtime_state::report() const {
-    json res;
-    res["ociVersion"] = "1.0.2";
-    res["id"] = id_;
-    res["status"] = state_["status"];
-    if (state_["status"] != "stopped") {
-        if (state_.contains("pid")) {
-            res["pid"] = state_["pid"];
-        } else {
-            res["pid"] = -1;
-        }
-    }
-    res["bundle"] = state_["bundle"];
-    if (state_["config"].contains("annotations")) {
-        res["annotations"] = state_["config"]["annotations"];
-    }
-    if (state_.contains("jid")) {
-        if (!res.contains("annotations")) {
-            res["annotations"] = json::object();
-        }
-        res["annotations"]["org.freebsd.jail.jid"] = std::to_string(int(state_["jid"]));
-    }
-    return res;
-}
-
-runtime_state::locked_state runtime_state::lock() {
-    auto fd = ::open(state_lock_.c_str(), O_RDWR | O_CREAT);
-    if (fd < 0) {
-        throw std::system_error(
-            errno, std::system_category(), "opening state lock");
-    }
-    if (::flock(fd, LOCK_EX) < 0) {
-        throw std::system_error(
-            errno, std::system_category(), "locking state lock");
-    }
-    return {true, fd};
-}
-
-void runtime_state::check_status() {
-    if (state_["status"] == "created" || state_["status"] == "running") {
-        if (::kill(state_["pid"], 0) < 0 && errno == ESRCH) {
-            state_["status"] = "stopped";
-            save();
-        }
-    }
-}
-
 main_app::main_app(const std::string& title) : CLI::App(title) {
     add_option(
         "--root", state_db_, "Override default location for state database");
@@ -174,70 +47,182 @@ main_app::main_app(const std::string& title) : CLI::App(title) {
         {"text", log_format::TEXT},
         {"json", log_format::JSON},
     };
-    add_option("--log-format", log_format_, "Log format")
+    add_option("--log-format", logger_.format, "Log format")
         ->transform(CLI::CheckedTransformer(log_formats, CLI::ignore_case));
     std::map<std::string, log_level> log_levels{
         {"info", log_level::INFO},
         {"warn", log_level::WARN},
         {"debug", log_level::DEBUG},
     };
-    add_option("--log-level", log_level_, "Log level")
+    add_option("--log-level", logger_.level, "Log level")
         ->transform(CLI::CheckedTransformer(log_levels, CLI::ignore_case));
     add_option("--log", log_file_, "Log file");
+    add_flag("--stats",
+             stats_,
+             "Report heap allocations made by the command on stderr");
+    add_option("--trace",
+               trace_file_,
+               "Append timing spans for the command to a file in Chrome trace "
+               "event format");
+    add_option("--record-threshold",
+               record_threshold_,
+               "Save the flight recorder if a command fails or takes longer "
+               "than this many milliseconds");
+    add_option("--lock-timeout",
+               lock_timeout_,
+               "Fail if a container's state lock can't be taken within this "
+               "many milliseconds (default: wait forever)");
 
     require_subcommand(1);
 
     parse_complete_callback([this] {
         if (log_file_) {
-            log_fd_ =
+            logger_.fd =
                 ::open(log_file_->c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
         }
+        auto subcommands = get_subcommands();
+        if (subcommands.size() > 0) {
+            recorder_.set_command(subcommands[0]->get_name());
+        }
+        if (trace_file_) {
+            recorder_.keep_events();
+        }
+        recorder_.begin(flight_op::COMMAND);
+        if (on_parsed_) {
+            on_parsed_();
+        }
     });
 }
 
-static std::string log_timestamp() {
-    struct ::timeval tv;
-    struct std::tm now;
-    gettimeofday(&tv, nullptr);
-    gmtime_r(&tv.tv_sec, &now);
-    std::stringstream ss;
-    ss << std::put_time(&now, "%Y-%m-%dT%H:%M:%S");
-    ss << std::setw(9) << std::setfill('0') << tv.tv_usec << "Z";
-    return ss.str();
+main_app::main_app(const std::string& title, main_app& parent)
+    : main_app(title) {
+    parent_ = &parent;
+    inherit(parent);
 }
 
-log_entry::~log_entry() {
-    if (level_ <= app_.get_log_level()) {
-        app_.log_message(ss_.str());
+main_app::~main_app() {
+    // Only close the log if we opened it
+    if (log_file_ && logger_.fd >= 0 && logger_.fd != 2) {
+        ::close(logger_.fd);
     }
 }
 
-void main_app::log_error(const std::exception& e) {
-    log_message(e.what());
+void main_app::inherit(const main_app& other) {
+    state_db_ = other.state_db_;
+    test_mode_ = other.test_mode_;
+    logger_ = other.logger_;
+    stats_ = other.stats_;
+    record_threshold_ = other.record_threshold_;
+    lock_timeout_ = other.lock_timeout_;
+    trace_file_ = other.trace_file_;
+    state_cache_ = other.state_cache_;
+}
+
+state_index& main_app::get_state_index() {
+    // Share the parent's mapping unless this command overrode --root
+    if (parent_ && parent_->state_db_ == state_db_) {
+        return parent_->get_state_index();
+    }
+    if (!state_index_) {
+        state_index_ = std::make_shared<state_index>(state_db_);
+    }
+    return *state_index_;
+}
+
+void main_app::report_stats() {
+    if (!stats_) {
+        return;
+    }
+    // Take the counts before building the report
+    auto heap = heap_counters();
+    auto used = arena_.used();
+    auto reserved = arena_.reserved();
+    json stats;
+    auto subcommands = get_subcommands();
+    if (subcommands.size() > 0) {
+        stats["command"] = subcommands[0]->get_name();
+    }
+    stats["allocations"] = heap.count - start_counters_.count;
+    stats["bytes"] = heap.bytes - start_counters_.bytes;
+    stats["arena_allocations"] = used.count;
+    stats["arena_bytes"] = used.bytes;
+    stats["arena_reserved"] = reserved.bytes;
+    std::cerr << stats << "\n";
+}
+
+// Log how long the command waited for and held container state locks
+void main_app::report_locks() {
+    auto& totals = recorder_.totals();
+    auto& wait = totals.ops[size_t(flight_op::LOCK_WAIT)];
+    auto& hold = totals.ops[size_t(flight_op::LOCK_HOLD)];
+    if (wait.count == 0) {
+        return;
+    }
+    log_debug() << recorder_.command() << ": took state locks " << wait.count
+                << " times, waited " << wait.sum / 1e6 << "ms, held "
+                << hold.sum / 1e6 << "ms";
 }
 
-void main_app::log_message(const std::string& msg) {
-    std::stringstream ss;
-    switch (log_format_) {
-    case log_format::TEXT:
-        ss << log_timestamp() << ": " << msg << "\n";
-        break;
-    case log_format::JSON: {
-        json err;
-        err["msg"] = msg;
-        err["level"] = "error";
-        err["time"] = log_timestamp();
-        ss << err << "\n";
-        break;
+void main_app::finish(int status, const std::exception* error) {
+    report_stats();
+    report_locks();
+    if (error) {
+        auto e = dynamic_cast<const std::system_error*>(error);
+        recorder_.error(e ? e->code().value() : 0);
     }
+    recorder_.end(flight_op::COMMAND, 0, 0, status);
+    flush_trace();
+
+    // Unit tests for config validation don't use the state database.
+    // Flight records and metrics are only kept for a state database which
+    // exists, so that commands like features don't create one.
+    std::error_code ec;
+    if (test_mode_ != test_mode::NONE ||
+        !std::filesystem::is_directory(state_db_, ec)) {
+        return;
+    }
+    auto slow = !long_running_ &&
+                recorder_.now() >= record_threshold_ * 1000000ull;
+    if ((status != 0 && !read_only(recorder_.command())) || slow) {
+        save_flight_record(status);
     }
-    auto s = ss.str();
-    ::write(log_fd_, s.data(), s.size());
+    update_metrics(status);
+}
 
-    if (log_fd_ != 2) {
-        // Copy to stderr
-        std::cerr << "Error: " << msg << "\n";
+void main_app::flush_trace() {
+    if (!trace_file_) {
+        return;
+    }
+    try {
+        append_trace(*trace_file_, recorder_, recorder_.take_events());
+    } catch (const std::exception& e) {
+        log() << "writing trace: " << e.what();
     }
 }
 
+// Flight records are kept with the state so that they survive the failed
+// create which they describe
+void main_app::save_flight_record(int status) {
+    try {
+        auto path = recorder_.save(state_db_ / ".flight", status);
+        log_debug() << "flight record saved to " << path.native();
+    } catch (const std::exception& e) {
+        log() << "saving flight record: " << e.what();
+    }
+}
+
+void main_app::update_metrics(int status) {
+    try {
+        metrics_store metrics{state_db_};
+        metrics.add(recorder_.command(), status, recorder_.totals());
+        metrics.publish();
+    } catch (const std::exception& e) {
+        log() << "updating metrics: " << e.what();
+    }
+}
+
+void main_app::log_error(const std::exception& e) {
+    logger_.write(log_level::ERROR, e.what());
+}
+
 }  // namespace ocijail
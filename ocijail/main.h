@@ -1,114 +1,127 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#include <vector>
 
 #include "CLI/CLI.hpp"
 #include "nlohmann/json.hpp"
 
-namespace ocijail {
-
-enum class log_format {
-    TEXT,
-    JSON,
-};
+#include "ocijail/arena.h"
+#include "ocijail/log.h"
+#include "ocijail/recorder.h"
+#include "ocijail/runtime_state.h"
+#include "ocijail/spec.h"
 
-enum class log_level {
-    INFO,
-    WARN,
-    DEBUG,
-};
+namespace ocijail {
 
 enum class test_mode {
     NONE,        // not testing
     VALIDATION,  // test config validation
 };
 
-class runtime_state {
-    struct locked_state {
-        ~locked_state();
-        void unlock();
-        void lock();
-        bool locked_;
-        int fd_;
-    };
-
-   public:
-    runtime_state(const std::filesystem::path& dir, std::string_view id)
-        : id_(id),
-          state_dir_(dir),
-          state_json_(dir / "state.json"),
-          state_lock_(dir / "state.lock") {}
-
-    bool contains(auto&& key) { return state_.contains(key); }
-    auto& operator[](auto&& key) { return state_[key]; }
-    const auto& operator[](auto&& key) const { return state_[key]; }
-    auto get_id() const { return id_; }
-    auto exists() const {
-        return std::filesystem::is_regular_file(state_json_);
-    }
-    auto& get_state_dir() const { return state_dir_; }
-    void check_status();
-
-    locked_state create();
-    void remove_all();
-    void load();
-    void save();
-    nlohmann::json report() const;
-    locked_state lock();
-
-   private:
-    std::string_view id_;
-    nlohmann::json state_;
-    std::filesystem::path state_dir_;
-    std::filesystem::path state_json_;
-    std::filesystem::path state_lock_;
-    // int lock_fd_{-1};
-};
-
 class main_app;
+class state_cache;
+class state_index;
 
-struct log_entry {
-    log_entry(main_app& app, log_level level) : app_(app), level_(level) {}
-    ~log_entry();
-
-    template <typename T>
-    friend std::ostream& operator<<(const log_entry& log, T t) {
-        return log.ss_ << t;
-    }
-
-    main_app& app_;
-    log_level level_;
-
-    mutable std::stringstream ss_;
+// Thrown to finish a command with the given exit status. Any error has
+// already been reported.
+struct exit_status {
+    int status;
 };
 
 class main_app : public CLI::App {
    public:
     main_app(const std::string& title);
+
+    // Create an app which shares global options, logging and the state index
+    // with its parent. This is used to run each command in batch mode.
+    main_app(const std::string& title, main_app& parent);
+    ~main_app();
+
+    // Copy global options, logging and the state cache from another app
+    void inherit(const main_app& other);
+
+    // Keep a command alive for as long as the app which runs it
+    void add_command(std::shared_ptr<void> command) {
+        commands_.push_back(std::move(command));
+    }
+
     runtime_state get_runtime_state(std::string_view id) {
-        return {state_db_ / id, id};
+        runtime_state state{state_db_ / id, id};
+        state.set_cache(state_cache_);
+        state.set_index(&get_state_index());
+        state.set_lock_policy({lock_timeout_, recorder_.command(), &logger_});
+        return state;
     }
+    void set_state_cache(state_cache* cache) { state_cache_ = cache; }
+    void set_state_db(const std::filesystem::path& path) { state_db_ = path; }
     auto get_state_db() const { return state_db_; }
+    state_index& get_state_index();
+    std::ostream& out() { return *out_; }
+    void set_out(std::ostream& out) { out_ = &out; }
     auto get_test_mode() const { return test_mode_; }
-    auto get_log_level() const { return log_level_; }
-    log_entry log() { return log_entry{*this, log_level::INFO}; }
-    log_entry log_debug() { return log_entry{*this, log_level::DEBUG}; }
-    void log_error(const std::system_error& e);
+    auto get_log_level() const { return logger_.level; }
+    const logger& get_logger() const { return logger_; }
+    log_entry log() const { return log_entry{logger_, log_level::INFO}; }
+    log_entry log_debug() const { return log_entry{logger_, log_level::DEBUG}; }
     void log_error(const std::exception& e);
-    void log_message(const std::string& msg);
+
+    // Memory for data which is only needed while this app runs its command
+    std::pmr::memory_resource* memory() { return arena_.resource(); }
+
+    // The flight recorder for this app's command
+    flight_recorder& recorder() { return recorder_; }
+
+    // If --trace was given, append the events recorded since the last call
+    // to the trace file. Commands call this before forking a process which
+    // also writes to the trace.
+    void flush_trace();
+
+    // Call a function once the command line has been parsed, just before
+    // the command runs. It may throw to stop the command.
+    void on_parsed(std::function<void()> f) { on_parsed_ = std::move(f); }
+
+    // Commands which run until they are stopped call this so that they are
+    // not recorded as slow
+    void set_long_running() { long_running_ = true; }
+
+    // Called when the command has finished with the given exit status and
+    // the error which ended it, if any. Reports statistics if requested and
+    // saves the flight recorder if the command was slow, or failed and could
+    // have changed a container.
+    void finish(int status, const std::exception* error = nullptr);
 
    private:
+    // If --stats was given, write the allocation counts for the command to
+    // stderr
+    void report_stats();
+    void report_locks();
+    void save_flight_record(int status);
+    void update_metrics(int status);
+
     std::filesystem::path state_db_{"/var/run/ocijail"};
     test_mode test_mode_{test_mode::NONE};
-    log_format log_format_{log_format::TEXT};
-    log_level log_level_{log_level::INFO};
+    logger logger_;
     std::optional<std::filesystem::path> log_file_;
-    int log_fd_{2};
+    std::optional<std::filesystem::path> trace_file_;
+    std::ostream* out_{&std::cout};
+    main_app* parent_{nullptr};
+    state_cache* state_cache_{nullptr};
+    std::shared_ptr<state_index> state_index_;
+    std::vector<std::shared_ptr<void>> commands_;
+    std::function<void()> on_parsed_;
+    bool stats_{false};
+    unsigned record_threshold_{1000};
+    unsigned lock_timeout_{0};
+    bool long_running_{false};
+    alloc_counters start_counters_{heap_counters()};
+    arena arena_;
+    flight_recorder recorder_;
 };
 
-void malformed_config(std::string_view message);
-
 }  // namespace ocijail
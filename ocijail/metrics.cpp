@@ -0,0 +1,440 @@
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <system_error>
+
+#include "ocijail/metrics.h"
+
+namespace fs = std::filesystem;
+
+namespace ocijail {
+
+// Metrics are kept for these commands and any others are counted as "other"
+static constexpr std::string_view COMMANDS[] = {
+    "create", "start", "delete", "kill",  "state", "exec",  "list",
+    "features", "events", "batch", "serve", "wait", "flight", "other",
+};
+static constexpr size_t NUM_COMMANDS = std::size(COMMANDS);
+
+// A process which keeps finding new updates after publishing gives up after
+// this many passes, leaving the rest to the next command
+static constexpr int MAX_PUBLISH_PASSES = 4;
+
+// The text file is rewritten at most once in this many nanoseconds, since
+// doing so costs more system calls than the rest of a command like state
+static constexpr uint64_t PUBLISH_INTERVAL = 1000000000;
+
+// Failures are counted by errno, with zero for failures which were not
+// caused by a system error and larger values counted with MAX_ERRNO
+static constexpr size_t MAX_ERRNO = 127;
+
+struct metrics_store::counters {
+    static constexpr uint32_t MAGIC = 0x4d4a434f;  // "OCJM"
+    static constexpr uint32_t VERSION = 3;
+
+    struct command {
+        uint64_t succeeded;
+        uint64_t failed;
+        flight_totals::op_totals ops[NUM_FLIGHT_OPS];
+        uint64_t errors[MAX_ERRNO + 1];
+    };
+
+    uint32_t magic;
+    uint32_t version;
+    // Incremented after each update so that the process publishing the
+    // text file can tell if it missed one
+    uint64_t generation;
+    // When the text file was last rewritten, in steady clock nanoseconds
+    uint64_t published_at;
+    command commands[NUM_COMMANDS];
+};
+
+// Replace a file with new contents by writing a temporary file and renaming
+// it, so that the collector never reads a partial file
+static void publish_text(const fs::path& path, std::string_view text) {
+    auto tmp_path = path;
+    tmp_path += ".new";
+    auto fd = ::open(
+        tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::system_error(
+            errno, std::system_category(), "opening " + tmp_path.native());
+    }
+    auto n = ::write(fd, text.data(), text.size());
+    auto saved_errno = errno;
+    ::close(fd);
+    if (n != ssize_t(text.size())) {
+        throw std::system_error(saved_errno,
+                                std::system_category(),
+                                "writing " + tmp_path.native());
+    }
+    fs::rename(tmp_path, path);
+}
+
+static void add_to(uint64_t& counter, uint64_t n) {
+    if (n) {
+        std::atomic_ref{counter}.fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+static uint64_t load(const uint64_t& counter) {
+    return std::atomic_ref{const_cast<uint64_t&>(counter)}.load(
+        std::memory_order_relaxed);
+}
+
+static uint64_t steady_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+metrics_store::metrics_store(const fs::path& root)
+    : dir_(root / ".metrics"), text_path_(root / "ocijail.prom") {
+    fs::create_directories(dir_);
+    auto path = dir_ / ("counters." + std::to_string(counters::VERSION));
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd_ < 0) {
+        throw std::system_error(
+            errno, std::system_category(), "opening " + path.native());
+    }
+
+    // Extending the file fills it with zeros so if several processes create
+    // it at once, they all see the same initial counters.
+    struct ::stat st;
+    if (::fstat(fd_, &st) < 0 ||
+        (st.st_size < off_t(sizeof(counters)) &&
+         ::ftruncate(fd_, sizeof(counters)) < 0)) {
+        auto saved_errno = errno;
+        ::close(fd_);
+        throw std::system_error(
+            saved_errno, std::system_category(), "sizing " + path.native());
+    }
+    auto p = ::mmap(nullptr,
+                    sizeof(counters),
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED,
+                    fd_,
+                    0);
+    if (p == MAP_FAILED) {
+        auto saved_errno = errno;
+        ::close(fd_);
+        throw std::system_error(
+            saved_errno, std::system_category(), "mapping " + path.native());
+    }
+    counters_ = static_cast<counters*>(p);
+
+    uint32_t expected = 0;
+    if (std::atomic_ref{counters_->magic}.compare_exchange_strong(
+            expected, counters::MAGIC)) {
+        counters_->version = counters::VERSION;
+    }
+}
+
+metrics_store::~metrics_store() {
+    ::munmap(counters_, sizeof(counters));
+    ::close(fd_);
+}
+
+void metrics_store::add(std::string_view command,
+                        int status,
+                        const flight_totals& totals) {
+    size_t i = 0;
+    while (i < NUM_COMMANDS - 1 && COMMANDS[i] != command) {
+        i++;
+    }
+    auto& c = counters_->commands[i];
+    if (status == 0) {
+        add_to(c.succeeded, 1);
+    } else {
+        add_to(c.failed, 1);
+        size_t error = std::clamp(totals.error, 0, int(MAX_ERRNO));
+        add_to(c.errors[error], 1);
+    }
+    for (size_t op = 0; op < NUM_FLIGHT_OPS; op++) {
+        auto& from = totals.ops[op];
+        auto& to = c.ops[op];
+        if (from.count == 0) {
+            continue;
+        }
+        add_to(to.count, from.count);
+        add_to(to.errors, from.errors);
+        add_to(to.sum, from.sum);
+        for (size_t b = 0; b < flight_totals::NUM_BUCKETS; b++) {
+            add_to(to.buckets[b], from.buckets[b]);
+        }
+    }
+    std::atomic_ref{counters_->generation}.fetch_add(
+        1, std::memory_order_release);
+}
+
+namespace {
+
+// Writes the samples of one metric family, with its HELP and TYPE lines
+// before the first sample
+class family {
+   public:
+    family(std::ostream& out,
+           const char* name,
+           const char* type,
+           const char* help)
+        : out_(out), name_(name), type_(type), help_(help) {}
+
+    void sample(std::string_view labels, uint64_t value) {
+        sample("", labels, value);
+    }
+
+    void histogram(std::string_view labels,
+                   const flight_totals::op_totals& t) {
+        uint64_t count = 0;
+        for (size_t b = 0; b < flight_totals::NUM_BUCKETS; b++) {
+            count += load(t.buckets[b]);
+            std::stringstream le;
+            if (b < flight_totals::BOUNDS.size()) {
+                le << flight_totals::BOUNDS[b] / 1e9;
+            } else {
+                le << "+Inf";
+            }
+            sample("_bucket",
+                   std::string{labels} + ",le=\"" + le.str() + "\"",
+                   count);
+        }
+        out_ << name_ << "_sum{" << labels << "} " << std::fixed
+             << std::setprecision(9) << load(t.sum) / 1e9 << std::defaultfloat
+             << "\n";
+        sample("_count", labels, count);
+    }
+
+   private:
+    void sample(const char* suffix, std::string_view labels, uint64_t value) {
+        if (!started_) {
+            out_ << "# HELP " << name_ << " " << help_ << "\n";
+            out_ << "# TYPE " << name_ << " " << type_ << "\n";
+            started_ = true;
+        }
+        out_ << name_ << suffix << "{" << labels << "} " << value << "\n";
+    }
+
+    std::ostream& out_;
+    const char* name_;
+    const char* type_;
+    const char* help_;
+    bool started_{false};
+};
+
+std::string label(const char* name, std::string_view value) {
+    return std::string{name} + "=\"" + std::string{value} + "\"";
+}
+
+}  // namespace
+
+void metrics_store::write(std::ostream& out) const {
+    // Each family's samples must be together so we make a pass over the
+    // commands for each of them
+    auto for_each_command = [&](auto f) {
+        for (size_t i = 0; i < NUM_COMMANDS; i++) {
+            auto& c = counters_->commands[i];
+            if (load(c.succeeded) + load(c.failed) > 0) {
+                f(label("command", COMMANDS[i]), c);
+            }
+        }
+    };
+    using command = counters::command;
+    auto totals = [](const command& c, flight_op op) -> auto& {
+        return c.ops[size_t(op)];
+    };
+
+    family commands{out,
+                    "ocijail_commands_total",
+                    "counter",
+                    "Commands run, by result"};
+    for_each_command([&](const std::string& labels, const command& c) {
+        commands.sample(labels + ",result=\"ok\"", load(c.succeeded));
+        commands.sample(labels + ",result=\"error\"", load(c.failed));
+    });
+
+    family failures{out,
+                    "ocijail_command_failures_total",
+                    "counter",
+                    "Failed commands, by errno or 0 if not a system error"};
+    for_each_command([&](const std::string& labels, const command& c) {
+        for (size_t e = 0; e <= MAX_ERRNO; e++) {
+            if (auto n = load(c.errors[e])) {
+                failures.sample(
+                    labels + "," + label("errno", std::to_string(e)), n);
+            }
+        }
+    });
+
+    family durations{out,
+                     "ocijail_command_duration_seconds",
+                     "histogram",
+                     "Time taken by commands"};
+    for_each_command([&](const std::string& labels, const command& c) {
+        durations.histogram(labels, totals(c, flight_op::COMMAND));
+    });
+
+    // Phases and system calls, apart from hooks and locks which have their
+    // own metrics
+    auto for_each_op = [&](bool calls, auto f) {
+        for_each_command([&](const std::string& labels, const command& c) {
+            for (size_t i = 1; i < NUM_FLIGHT_OPS; i++) {
+                auto op = flight_op(i);
+                if (is_call(op) != calls || op == flight_op::HOOK ||
+                    op == flight_op::LOCK_WAIT || op == flight_op::LOCK_HOLD ||
+                    load(totals(c, op).count) == 0) {
+                    continue;
+                }
+                auto name = label(calls ? "call" : "phase", to_string(op));
+                f(labels + "," + name, totals(c, op));
+            }
+        });
+    };
+    family phases{out,
+                  "ocijail_phase_duration_seconds",
+                  "histogram",
+                  "Time taken by each phase of a command"};
+    for_each_op(false, [&](const std::string& labels, const auto& t) {
+        phases.histogram(labels, t);
+    });
+    family calls{out,
+                 "ocijail_syscall_duration_seconds",
+                 "histogram",
+                 "Time taken by system calls"};
+    for_each_op(true, [&](const std::string& labels, const auto& t) {
+        calls.histogram(labels, t);
+    });
+    family call_errors{out,
+                       "ocijail_syscall_errors_total",
+                       "counter",
+                       "System calls which failed"};
+    for_each_op(true, [&](const std::string& labels, const auto& t) {
+        call_errors.sample(labels, load(t.errors));
+    });
+
+    family mounts{out,
+                  "ocijail_mounts_total",
+                  "counter",
+                  "Filesystems mounted"};
+    for_each_command([&](const std::string& labels, const command& c) {
+        auto& t = totals(c, flight_op::NMOUNT);
+        if (load(t.count) > 0) {
+            mounts.sample(labels, load(t.count) - load(t.errors));
+        }
+    });
+    family copies{out,
+                  "ocijail_file_mount_copies_total",
+                  "counter",
+                  "File mounts emulated by copying the file"};
+    for_each_command([&](const std::string& labels, const command& c) {
+        if (auto n = load(totals(c, flight_op::FILE_COPY).count)) {
+            copies.sample(labels, n);
+        }
+    });
+    family hooks{out,
+                 "ocijail_hook_duration_seconds",
+                 "histogram",
+                 "Time taken by each hook executed"};
+    for_each_command([&](const std::string& labels, const command& c) {
+        auto& t = totals(c, flight_op::HOOK);
+        if (load(t.count) > 0) {
+            hooks.histogram(labels, t);
+        }
+    });
+    family locks{out,
+                 "ocijail_lock_wait_seconds",
+                 "histogram",
+                 "Time spent waiting for container state locks"};
+    for_each_command([&](const std::string& labels, const command& c) {
+        auto& t = totals(c, flight_op::LOCK_WAIT);
+        if (load(t.count) > 0) {
+            locks.histogram(labels, t);
+        }
+    });
+    family holds{out,
+                 "ocijail_lock_hold_seconds",
+                 "histogram",
+                 "Time for which container state locks were held"};
+    for_each_command([&](const std::string& labels, const command& c) {
+        auto& t = totals(c, flight_op::LOCK_HOLD);
+        if (load(t.count) > 0) {
+            holds.histogram(labels, t);
+        }
+    });
+}
+
+namespace {
+
+// Held by the process which is rewriting the text file. Other processes
+// don't wait for it.
+class publish_lock {
+   public:
+    explicit publish_lock(const fs::path& path) {
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd_ < 0) {
+            throw std::system_error(
+                errno, std::system_category(), "opening " + path.native());
+        }
+        if (::flock(fd_, LOCK_EX | LOCK_NB) < 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+    publish_lock(const publish_lock&) = delete;
+    publish_lock& operator=(const publish_lock&) = delete;
+    ~publish_lock() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    bool locked() const { return fd_ >= 0; }
+
+   private:
+    int fd_;
+};
+
+}  // namespace
+
+void metrics_store::publish(bool force) {
+    auto& generation = counters_->generation;
+    auto& published_at = counters_->published_at;
+    auto now = steady_now();
+    auto last = std::atomic_ref{published_at}.load(std::memory_order_relaxed);
+    if (!force && now - last < PUBLISH_INTERVAL) {
+        return;
+    }
+    for (int pass = 0; pass < MAX_PUBLISH_PASSES; pass++) {
+        uint64_t published;
+        {
+            // If another process holds the lock, it will see our update
+            // when it checks the generation below
+            publish_lock lk{dir_ / "publish.lock"};
+            if (!lk.locked()) {
+                return;
+            }
+            published =
+                std::atomic_ref{generation}.load(std::memory_order_acquire);
+            std::atomic_ref{published_at}.store(now,
+                                                std::memory_order_relaxed);
+            std::stringstream ss;
+            write(ss);
+            publish_text(text_path_, ss.str());
+        }
+
+        // An update made after we took our snapshot, including one which
+        // found the lock held, is left to us
+        if (std::atomic_ref{generation}.load(std::memory_order_acquire) ==
+            published) {
+            return;
+        }
+    }
+}
+
+}  // namespace ocijail
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <filesystem>
+#include <ostream>
+#include <string_view>
+
+#include "ocijail/recorder.h"
+
+namespace ocijail {
+
+// Counters and latency histograms for the commands run against a state
+// database, in the text format read by the Prometheus node exporter's
+// textfile collector.
+//
+// The totals are kept in a file of counters which every ocijail process maps
+// and updates with atomic adds, so adding a command's totals never waits
+// for another process. The text file is then rewritten from the counters
+// and renamed into place, at most once a second so that frequent commands
+// stay cheap; updates made in between are published by the next command
+// after that. Only one process rewrites it at a time: a process which finds
+// another one doing so leaves it to that process, which checks for new
+// totals before it finishes.
+class metrics_store {
+   public:
+    // Map the counters for a state database, creating them if necessary
+    explicit metrics_store(const std::filesystem::path& root);
+    metrics_store(const metrics_store&) = delete;
+    metrics_store& operator=(const metrics_store&) = delete;
+    ~metrics_store();
+
+    // Add the totals of a finished command with the given exit status
+    void add(std::string_view command, int status, const flight_totals& totals);
+
+    // Write the metrics in Prometheus text format
+    void write(std::ostream& out) const;
+
+    // Rewrite the text file, unless another process is doing so or, unless
+    // forced, it was rewritten less than a second ago
+    void publish(bool force = false);
+
+    // The text file which is read by the collector
+    const std::filesystem::path& path() const { return text_path_; }
+
+    struct counters;
+
+   private:
+    std::filesystem::path dir_;
+    std::filesystem::path text_path_;
+    int fd_{-1};
+    counters* counters_{nullptr};
+};
+
+}  // namespace ocijail
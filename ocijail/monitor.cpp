@@ -0,0 +1,105 @@
+#include "ocijail/monitor.h"
+
+namespace ocijail {
+
+// Change the container's status record under the state lock, unless the
+// container has been deleted or replaced. The change returns false if there
+// is nothing to save.
+static void update_record(runtime_state& state, pid_t pid, auto&& change) {
+    // If the container is being deleted, we wait for the lock and then
+    // find that the state has gone.
+    try {
+        auto lk = state.lock();
+        state.load();
+        if (state.pid() == pid && change()) {
+            state.save();
+        }
+    } catch (const std::exception&) {
+        return;
+    }
+}
+
+void monitor_exit(runtime_state& state,
+                  event_source& source,
+                  pid_t pid,
+                  std::function<void()> ready) {
+    source.watch_process(pid);
+    source.watch_exec(pid);
+    if (ready) {
+        ready();
+    }
+
+    // The container process first execs when start releases it, so its
+    // first exec confirms that the container started.
+    std::optional<int> wait_status;
+    lifecycle_time stopped;
+    bool confirmed = false;
+    for (bool exited = false; !exited;) {
+        auto n = source.wait();
+        for (auto exec : n.execs) {
+            if (exec == pid && !confirmed) {
+                confirmed = true;
+                auto now = lifecycle_time::now();
+                update_record(state, pid, [&] {
+                    if (state.time(EXEC_CONFIRMED)) {
+                        return false;
+                    }
+                    state.set_time(EXEC_CONFIRMED, now);
+                    return true;
+                });
+            }
+        }
+        for (auto& exit : n.exits) {
+            if (exit.pid == pid) {
+                wait_status = exit.status;
+                stopped = lifecycle_time::now();
+                exited = true;
+            }
+        }
+    }
+
+    update_record(state, pid, [&] {
+        if (state.status() == container_status::STOPPED &&
+            (state.exit_status() || !wait_status)) {
+            return false;
+        }
+        state.set_exited(wait_status);
+        state.set_time(STOP_OBSERVED, stopped);
+        return true;
+    });
+}
+
+std::optional<int> wait_exit(runtime_state& state, event_source& source) {
+    bool watching = false;
+    bool exited = false;
+    for (;;) {
+        state.load();
+        if (exited) {
+            // The monitor may have been killed, in which case nobody else
+            // will record the exit and there are no more events to wait for
+            state.check_status(true);
+        }
+        if (state.status() == container_status::STOPPED) {
+            return state.exit_status();
+        }
+
+        // Status changes are published by renaming a new file into the
+        // state directory.
+        if (!watching) {
+            source.watch_path(state.get_state_dir());
+            source.watch_process(state.pid());
+            watching = true;
+        }
+        auto n = source.wait();
+        for (auto& exit : n.exits) {
+            if (exit.pid == state.pid()) {
+                if (exit.status) {
+                    return exit.status;
+                }
+                exited = true;
+            }
+        }
+    }
+}
+
+}  // namespace ocijail
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <sys/types.h>
+#include <functional>
+#include <optional>
+
+#include "ocijail/event_stream.h"
+#include "ocijail/runtime_state.h"
+
+namespace ocijail {
+
+// Wait for a container process to exit and record its exit status and stop
+// time in the container state, along with the time it first execs. This is
+// run by the monitor process which create leaves behind. The ready callback
+// is called once the process is being watched.
+void monitor_exit(runtime_state& state,
+                  event_source& source,
+                  pid_t pid,
+                  std::function<void()> ready = nullptr);
+
+// Block until the container stops and return its wait status, if known.
+// Once the process has exited, the stopped status is published if nobody
+// has recorded it yet. Throws if the container is deleted while waiting.
+std::optional<int> wait_exit(runtime_state& state, event_source& source);
+
+}  // namespace ocijail
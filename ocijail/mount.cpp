@@ -1,15 +1,13 @@
 #include <sys/param.h>
 
-#include <spawn.h>
-#include <sys/mount.h>
 #include <sys/uio.h>
-#include <sys/wait.h>
+#include <algorithm>
 #include <iostream>
 
+#include "ocijail/container_path.h"
 #include "ocijail/main.h"
 #include "ocijail/mount.h"
-
-extern "C" char** environ;
+#include "ocijail/recorder.h"
 
 using namespace std::literals::string_literals;
 namespace fs = std::filesystem;
@@ -107,141 +105,9 @@ struct tmpcopyup_option : pseudo_option {
     fs::path tmp_copy;
 } tmpcopyup_handler{"tmpfs", "tmpcopyup"};
 
-struct devfs_rule_option : pseudo_option {
-    using pseudo_option::pseudo_option;
-
-    void before_mount(const fs::path& destination,
-                      std::string_view optval) override {}
-
-    void after_mount(const fs::path& destination,
-                     std::string_view rule) override {
-        std::vector<std::string> args;
-        std::vector<char*> argv;
-
-        args.emplace_back("devfs");
-        args.emplace_back("-m");
-        args.emplace_back(destination);
-        args.emplace_back("rule");
-        args.emplace_back("apply");
-        while (rule.size() > 0) {
-            auto sep = rule.find(' ');
-            args.emplace_back(rule.substr(0, sep));
-            if (sep != std::string_view::npos) {
-                rule = rule.substr(sep);
-                while (rule.size() > 0 && rule[0] == ' ') {
-                    rule = rule.substr(1);
-                }
-            } else {
-                rule = "";
-            }
-        }
-        for (auto& arg : args) {
-            argv.push_back(const_cast<char*>(arg.c_str()));
-        }
-        argv.push_back(nullptr);
-
-        pid_t pid;
-        auto res = ::posix_spawn(
-            &pid, "/sbin/devfs", nullptr, nullptr, &argv[0], environ);
-        if (res != 0) {
-            throw std::system_error{res, std::system_category(), "posix_spawn"};
-        }
-
-        int status;
-        if (::waitpid(pid, &status, 0) < 0) {
-            throw std::system_error{errno, std::system_category(), "waitpid"};
-        }
-
-        if (status != 0) {
-            throw std::runtime_error{"devfs exited with error " +
-                                     std::to_string(status)};
-        }
-    }
-
-    fs::path tmp_copy;
-} devfs_rule_handler{"devfs", "rule"};
-
-static std::tuple<std::string_view, std::string_view> split_option(
-    std::string_view option) {
-    auto sep = option.find_first_of("=");
-    if (sep == std::string::npos) {
-        return std::make_tuple(option, "");
-    }
-    return {option.substr(0, sep), option.substr(sep + 1)};
-}
-
-static std::tuple<fs::path, fs::path> get_save_path(
-    const runtime_state& state,
-    const fs::path& destination) {
-    auto save_dir =
-        destination.parent_path() / (".save-"s + std::string{state.get_id()});
-    auto save_path = save_dir / destination.filename();
-    return std::make_tuple(save_dir, save_path);
-}
-
-static fs::path resolve_container_path_impl(main_app& app,
-                                            const fs::path& root_path,
-                                            fs::path resolved_path,
-                                            const fs::path& path,
-                                            int depth) {
-    app.log_debug() << "depth: " << depth << ", root_path: " << root_path
-                    << ", resolved_path: " << resolved_path
-                    << ", path: " << path;
-    if (depth >= MAXSYMLINKS) {
-        throw std::system_error{
-            ELOOP, std::system_category(), "resolving mount path"};
-    }
-
-    // We need to resolve any symbolic links on the path within the given root
-    // so that containers cannot mount anything outside root_path
-    for (const auto& element : path) {
-        app.log_debug() << "resolved_path: " << resolved_path
-                        << ", element: " << element;
-        if (element.is_absolute()) {
-            resolved_path = root_path;
-        } else {
-            fs::path tmp_path;
-            if (element.string() == "..") {
-                if (resolved_path == root_path) {
-                    // Don't allow ".." past root
-                    tmp_path = resolved_path;
-                } else {
-                    tmp_path = resolved_path.parent_path();
-                }
-            } else {
-                tmp_path = resolved_path / element;
-            }
-            if (fs::is_symlink(tmp_path)) {
-                auto target = fs::read_symlink(tmp_path);
-                if (target.is_absolute()) {
-                    while (target.is_absolute()) {
-                        target = fs::path{target.string().substr(1)};
-                    }
-                    resolved_path = resolve_container_path_impl(
-                        app, root_path, root_path, target, depth + 1);
-                } else {
-                    resolved_path = resolve_container_path_impl(
-                        app, root_path, resolved_path, target, depth + 1);
-                }
-            } else {
-                resolved_path = tmp_path;
-            }
-        }
-    }
-    assert(resolved_path.string().starts_with(root_path.string()));
-
-    return resolved_path;
-}
-
-static fs::path resolve_container_path(main_app& app,
-                                       const fs::path& root_path,
-                                       const json& mount) {
-    fs::path path{mount["destination"]};
-    return resolve_container_path_impl(
-        app, root_path, root_path, fs::path{mount["destination"]}, 0);
-}
-
-void apply_devfs_rule(const fs::path& destination, std::string_view rule) {
+// Apply a devfs rule to the devfs mounted at destination
+static void apply_devfs_rule(const fs::path& destination,
+                             std::string_view rule) {
     std::vector<std::string> args;
     std::vector<char*> argv;
 
@@ -267,41 +133,109 @@ void apply_devfs_rule(const fs::path& destination, std::string_view rule) {
     }
     argv.push_back(nullptr);
 
-    pid_t pid;
-    auto res =
-        ::posix_spawn(&pid, "/sbin/devfs", nullptr, nullptr, &argv[0], environ);
-    if (res != 0) {
-        throw std::system_error{res, std::system_category(), "posix_spawn"};
-    }
-
-    int status;
-    if (::waitpid(pid, &status, 0) < 0) {
-        throw std::system_error{errno, std::system_category(), "waitpid"};
+    auto status = current_platform().devfs(&argv[0]);
+    if (status < 0) {
+        throw std::system_error{errno, std::system_category(), "devfs"};
     }
-
     if (status != 0) {
         throw std::runtime_error{"devfs exited with error " +
                                  std::to_string(status)};
     }
 }
 
-// Similar to fs::create_directories but track our actions in the
-// runtime state.
+struct devfs_rule_option : pseudo_option {
+    using pseudo_option::pseudo_option;
+
+    void before_mount(const fs::path& destination,
+                      std::string_view optval) override {}
+
+    void after_mount(const fs::path& destination,
+                     std::string_view rule) override {
+        apply_devfs_rule(destination, rule);
+    }
+} devfs_rule_handler{"devfs", "rule"};
+
+static std::tuple<fs::path, fs::path> get_save_path(
+    const runtime_state& state,
+    const fs::path& destination) {
+    auto save_dir =
+        destination.parent_path() / (".save-"s + std::string{state.get_id()});
+    auto save_path = save_dir / destination.filename();
+    return std::make_tuple(save_dir, save_path);
+}
+
+static json to_json(const mount_step& step) {
+    json res = {
+        {"destination", step.destination},
+        {"fspath", step.fspath},
+        {"fstype", step.fstype},
+        {"flags", step.flags},
+        {"options", step.options},
+        {"pseudo_options", step.pseudo_options},
+        {"file_mount", step.file_mount},
+        {"mounted", step.mounted},
+        {"copied", step.copied},
+        {"created", step.created},
+    };
+    if (!step.saved.empty()) {
+        res["saved"] = step.saved;
+    }
+    return res;
+}
+
+static mount_step mount_step_from_json(const json& j) {
+    mount_step step;
+    step.destination = j["destination"];
+    step.fspath = j["fspath"].get<std::string>();
+    step.fstype = j["fstype"];
+    step.flags = j["flags"];
+    for (auto& opt : j["options"]) {
+        step.options.emplace_back(opt[0], opt[1]);
+    }
+    for (auto& opt : j["pseudo_options"]) {
+        step.pseudo_options.emplace_back(opt[0], opt[1]);
+    }
+    step.file_mount = j["file_mount"];
+    step.mounted = j["mounted"];
+    step.copied = j["copied"];
+    if (j.contains("saved")) {
+        step.saved = j["saved"].get<std::string>();
+    }
+    for (auto& path : j["created"]) {
+        step.created.emplace_back(path.get<std::string>());
+    }
+    return step;
+}
+
+static mount_plan load_mount_plan(const runtime_state& state) {
+    mount_plan plan;
+    for (auto& j : state["mount_plan"]) {
+        plan.push_back(mount_step_from_json(j));
+    }
+    return plan;
+}
+
+static void save_mount_plan(runtime_state& state, const mount_plan& plan) {
+    auto res = json::array();
+    for (auto& step : plan) {
+        res.push_back(to_json(step));
+    }
+    state["mount_plan"] = std::move(res);
+}
+
+// Similar to fs::create_directories but record the directories created
 static void create_directories(const fs::path& root_path,
                                const fs::path& path,
-                               runtime_state& state) {
+                               std::vector<fs::path>& created) {
     if (path == root_path || fs::exists(path)) {
         return;
     }
-    // Make sure that directories are removed in reverse order
-    state["remove_on_unmount"].push_back(path);
-    create_directories(root_path, path.parent_path(), state);
+    create_directories(root_path, path.parent_path(), created);
     fs::create_directory(path);
+    created.push_back(path);
 }
 
-int do_mount(
-    const std::vector<std::tuple<std::string, std::string>>& mount_opts,
-    int mount_flags) {
+int do_mount(const mount_options& mount_opts, int mount_flags) {
     std::vector<iovec> iov;
     iov.reserve(2 * mount_opts.size());
     for (auto& [key, val] : mount_opts) {
@@ -312,16 +246,60 @@ int do_mount(
             iovec{reinterpret_cast<void*>(const_cast<char*>(val.c_str())),
                   val.size() + 1});
     }
-    return nmount(&iov[0], iov.size(), mount_flags | MNT_IGNORE);
+    return recorded(flight_op::NMOUNT, [&] {
+        return current_platform().nmount(
+            &iov[0], iov.size(), mount_flags | MNT_IGNORE);
+    });
 }
 
-static bool create_mount_point(runtime_state& state,
-                               const fs::path& root_path,
-                               const fs::path& destination,
-                               bool is_file_mount) {
+int do_unmount(const fs::path& path, int flags) {
+    return recorded(flight_op::UNMOUNT, [&] {
+        return current_platform().unmount(path.c_str(), flags);
+    });
+}
+
+// Resolve the mount's destination and sort its options into flags, nmount
+// options and pseudo-options. This validates the mount before we perform
+// any actions.
+static mount_step compile_mount(main_app& app,
+                                const fs::path& root_path,
+                                const mount_spec& mount) {
+    mount_step step;
+    step.destination = mount.destination;
+    step.fspath = resolve_container_path(
+        app.get_logger(), app.memory(), root_path, mount.destination);
+    step.fstype = mount.type;
+    step.file_mount =
+        mount.type == "nullfs" && fs::is_regular_file(mount.source);
+
+    step.options.emplace_back("fstype", mount.type);
+    step.options.emplace_back("fspath", step.fspath.native());
+    if (mount.type == "nullfs") {
+        step.options.emplace_back("target", mount.source);
+    }
+    for (auto& [key, val] : mount.options) {
+        auto it = name_to_flag.find(key);
+        if (it != name_to_flag.end()) {
+            auto flag = it->second;
+            if (flag > 0) {
+                step.flags |= flag;
+            } else if (flag < 0) {
+                step.flags &= ~(-flag);
+            }
+        } else if (pseudo_option::lookup(mount.type, key) != nullptr) {
+            step.pseudo_options.emplace_back(key, val);
+        } else {
+            step.options.emplace_back(key, val);
+        }
+    }
+    return step;
+}
+
+static bool create_mount_point(const fs::path& root_path, mount_step& step) {
+    auto& destination = step.fspath;
     auto destination_exists = fs::exists(destination);
     if (destination_exists) {
-        if (is_file_mount) {
+        if (step.file_mount) {
             if (!fs::is_regular_file(destination)) {
                 throw std::runtime_error(
                     "destination for file mount exists and is not a file");
@@ -334,148 +312,117 @@ static bool create_mount_point(runtime_state& state,
             }
         }
     } else {
-        if (is_file_mount) {
+        if (step.file_mount) {
             // Create parent directories if necessary and create an
             // empty file to mount over
-            state["remove_on_unmount"].push_back(destination);
-            create_directories(root_path, destination.parent_path(), state);
+            create_directories(
+                root_path, destination.parent_path(), step.created);
             std::ofstream{destination} << "";
+            step.created.push_back(destination);
         } else {
-            create_directories(root_path, destination, state);
+            create_directories(root_path, destination, step.created);
         }
     }
     return destination_exists;
 }
 
+static void run_pseudo_options(const mount_step& step, bool after) {
+    for (auto& [key, val] : step.pseudo_options) {
+        auto h = pseudo_option::lookup(step.fstype, key);
+        if (after) {
+            h->after_mount(step.fspath, val);
+        } else {
+            h->before_mount(step.fspath, val);
+        }
+    }
+}
+
 // If prepare_only is true, validate the mount and create the mount point if
 // necessary but don't actually mount. This is used to support read-only roots
 // where we need to prepare mount points in the read-write rootfs before we make
-// a read-only alias using nullfs.
+// a read-only alias using nullfs. The step keeps the paths created by an
+// earlier prepare pass.
 static bool mount_volume(main_app& app,
                          bool file_mount_supported,
                          runtime_state& state,
                          const fs::path& root_path,
                          bool prepare_only,
-                         const json& mount) {
-    auto destination = resolve_container_path(app, root_path, mount);
-
-    std::string type = mount.contains("type") ? mount["type"] : "nullfs";
-    if (type == "bind") {
-        // TODO: remove this when podman syncs with buildah fixes to
-        // avoid using "bind" on FreeBSD.
-        type = "nullfs";
-    }
-    bool is_file_mount =
-        type == "nullfs" && fs::is_regular_file(mount["source"]);
-
-    // Validate mount options before we perform any actions
-    std::vector<std::tuple<pseudo_option*, std::string>> pseudo_opts;
-    std::vector<std::tuple<std::string, std::string>> mount_opts;
-    int mount_flags = 0;
-    mount_opts.emplace_back("fstype", type);
-    mount_opts.emplace_back("fspath", destination);
-    if (type == "nullfs") {
-        mount_opts.emplace_back("target", mount["source"]);
-    }
-    if (mount.contains("options")) {
-        for (auto& opt : mount["options"]) {
-            // Copy the string out of json to make life simpler
-            std::string optstring{opt};
-            auto [key, val] = split_option(optstring);
-
-            auto it = name_to_flag.find(key);
-            if (it != name_to_flag.end()) {
-                auto flag = it->second;
-                if (flag > 0) {
-                    mount_flags |= flag;
-                } else if (flag < 0) {
-                    mount_flags &= ~(-flag);
-                }
-                continue;
-            } else {
-                auto h = pseudo_option::lookup(type, key);
-                if (h != nullptr) {
-                    pseudo_opts.emplace_back(h, val);
-                    continue;
-                }
-                mount_opts.emplace_back(key, val);
-            }
-        }
-    }
+                         const mount_spec& mount,
+                         mount_step& step) {
+    auto compiled = compile_mount(app, root_path, mount);
+    compiled.created = std::move(step.created);
+    step = std::move(compiled);
 
-    auto destination_exists =
-        create_mount_point(state, root_path, destination, is_file_mount);
+    auto destination_exists = create_mount_point(root_path, step);
 
     if (prepare_only) {
         return file_mount_supported;
     }
 
-    for (auto& entry : pseudo_opts) {
-        std::get<0>(entry)->before_mount(destination, std::get<1>(entry));
-    }
+    run_pseudo_options(step, false);
 
 retry:
-    if (is_file_mount && !file_mount_supported) {
+    if (step.file_mount && !file_mount_supported) {
         // Mimic real file mounts by moving the original to a subdirectory if it
         // existed and copying the source
+        flight_phase phase{flight_op::FILE_COPY};
         if (destination_exists) {
-            auto [save_dir, save_path] = get_save_path(state, destination);
+            auto [save_dir, save_path] = get_save_path(state, step.fspath);
             if (!fs::exists(save_dir)) {
-                fs::create_directories(save_dir);
-                state["remove_on_unmount"].push_back(save_dir);
+                fs::create_directory(save_dir);
+                step.created.push_back(save_dir);
             }
-            fs::rename(destination, save_path);
+            fs::rename(step.fspath, save_path);
+            step.saved = save_path;
         }
         fs::copy_file(
-            mount["source"], destination, fs::copy_options::overwrite_existing);
+            mount.source, step.fspath, fs::copy_options::overwrite_existing);
+        step.copied = true;
     } else {
         // Otherwise perform the actual mount.
-        if (do_mount(mount_opts, mount_flags) < 0) {
-            if (is_file_mount && errno == ENOTDIR) {
+        mount_options mount_opts{app.memory()};
+        for (auto& [key, val] : step.options) {
+            mount_opts.emplace_back(key, val);
+        }
+        if (do_mount(mount_opts, step.flags) < 0) {
+            if (step.file_mount && errno == ENOTDIR) {
                 file_mount_supported = false;
                 goto retry;
             }
-            std::stringstream ss;
-            ss << mount;
             throw std::system_error(
-                errno, std::system_category(), "mounting " + ss.str());
+                errno, std::system_category(), "mounting " + step.destination);
         }
+        step.mounted = true;
     }
 
-    for (auto& entry : pseudo_opts) {
-        std::get<0>(entry)->after_mount(destination, std::get<1>(entry));
-    }
+    run_pseudo_options(step, true);
 
     return file_mount_supported;
 }
 
-static void unmount_volume(main_app& app,
-                           bool file_mount_supported,
-                           runtime_state& state,
-                           const fs::path& root_path,
-                           const json& mount) {
-    auto destination = resolve_container_path(app, root_path, mount);
-
-    std::string type = mount.contains("type") ? mount["type"] : "nullfs";
-    bool is_file_mount =
-        type == "nullfs" && fs::is_regular_file(mount["source"]);
-
-    if (is_file_mount && !file_mount_supported) {
+// Undo a mount and remove the paths created for it. Mounts are undone in
+// reverse order so that a mount point is removed after everything mounted
+// beneath it and a parent directory after the other mount points in it.
+static void unmount_volume(const mount_step& step) {
+    if (step.copied) {
         // Restore the saved path if it exists
-        auto [_, save_path] = get_save_path(state, destination);
-        if (fs::exists(save_path)) {
-            fs::rename(save_path, destination);
+        if (!step.saved.empty() && fs::exists(step.saved)) {
+            fs::rename(step.saved, step.fspath);
         }
-    } else {
-        if (::unmount(destination.c_str(), MNT_FORCE) < 0) {
+    } else if (step.mounted) {
+        if (do_unmount(step.fspath, MNT_FORCE) < 0) {
             // unmount will return EINVAL if the mount doesn't exist
-            if (errno == EINVAL) {
-                return;
+            if (errno != EINVAL) {
+                throw std::system_error{
+                    errno,
+                    std::system_category(),
+                    "unmounting " + step.destination};
             }
-            throw std::system_error{
-                errno,
-                std::system_category(),
-                "unmounting " + mount["destination"].get<std::string>()};
+        }
+    }
+    for (auto it = step.created.rbegin(); it != step.created.rend(); ++it) {
+        if (fs::exists(*it)) {
+            fs::remove(*it);
         }
     }
 }
@@ -484,70 +431,94 @@ void mount_volumes(main_app& app,
                    runtime_state& state,
                    const fs::path& root_path,
                    bool prepare_only,
-                   const json& mounts) {
+                   const std::vector<mount_spec>& mounts) {
+    flight_phase phase{flight_op::MOUNTS, prepare_only};
     bool file_mount_supported = true;
 
+    mount_plan plan;
+    if (state.contains("mount_plan")) {
+        plan = load_mount_plan(state);
+    }
+    plan.resize(mounts.size());
+
     try {
-        for (auto& mount : mounts) {
+        for (size_t i = 0; i < mounts.size(); i++) {
             file_mount_supported = mount_volume(app,
                                                 file_mount_supported,
                                                 state,
                                                 root_path,
                                                 prepare_only,
-                                                mount);
+                                                mounts[i],
+                                                plan[i]);
         }
     } catch (const std::exception& e) {
         // Attempt to clean up in case we mounted something
+        save_mount_plan(state, plan);
         try {
-            unmount_volumes(app, state, root_path, mounts);
+            unmount_volumes(state);
         } catch (...) {
         }
         throw;
     }
-    state["file_mount_supported"] = file_mount_supported;
+    save_mount_plan(state, plan);
 }
 
-void unmount_volumes(main_app& app,
-                     runtime_state& state,
-                     const fs::path& root_path,
-                     const json& mounts) {
-    bool file_mount_supported = state["file_mount_supported"];
+void plan_legacy_mounts(main_app& app,
+                        runtime_state& state,
+                        const fs::path& root_path,
+                        const std::vector<mount_spec>& mounts) {
+    bool file_mount_supported = true;
+    if (state.contains("file_mount_supported")) {
+        file_mount_supported = state["file_mount_supported"];
+    }
+
+    // Older versions removed the paths they created after undoing every
+    // mount, subdirectories before their parents. The first step, which is
+    // undone last, does the same.
+    mount_plan plan;
+    mount_step cleanup;
+    if (state.contains("remove_on_unmount")) {
+        std::vector<std::string> paths;
+        for (auto& path : state["remove_on_unmount"]) {
+            paths.push_back(path);
+        }
+        std::sort(paths.begin(), paths.end());
+        cleanup.created.assign(paths.begin(), paths.end());
+    }
+    plan.push_back(std::move(cleanup));
 
-    // Remember the first exception (if any) but try to unmount
-    // everything
-    std::exception_ptr eptr{nullptr};
     for (auto& mount : mounts) {
+        auto step = compile_mount(app, root_path, mount);
+        if (step.file_mount && !file_mount_supported) {
+            step.copied = true;
+            auto [_, save_path] = get_save_path(state, step.fspath);
+            step.saved = save_path;
+        } else {
+            step.mounted = true;
+        }
+        plan.push_back(std::move(step));
+    }
+    save_mount_plan(state, plan);
+}
+
+void unmount_volumes(runtime_state& state) {
+    flight_phase phase{flight_op::UNMOUNTS};
+    if (!state.contains("mount_plan")) {
+        return;
+    }
+    auto plan = load_mount_plan(state);
+
+    // Remember the first exception (if any) but try to undo everything
+    std::exception_ptr eptr{nullptr};
+    for (auto it = plan.rbegin(); it != plan.rend(); ++it) {
         try {
-            unmount_volume(app, file_mount_supported, state, root_path, mount);
+            unmount_volume(*it);
         } catch (const std::exception&) {
             if (!eptr) {
                 eptr = std::current_exception();
             }
         }
     }
-    try {
-        // We need to remove subdirectories before parents. The ordering
-        // recorded in create_directories is not enough - if two mounts are made
-        // to the same parent directory (e.g. /data/foo, /data/bar), then the
-        // parent removal needs to happen after both subdirectories are removed.
-        //
-        // We sort the list in descending order since subdictories paths are
-        // lexically greater than parent paths.
-        std::vector<std::string> paths;
-        for (auto& dir : state["remove_on_unmount"]) {
-            paths.push_back(dir);
-        }
-        std::sort(paths.begin(), paths.end(), std::greater<std::string>());
-        for (auto& dir : paths) {
-            if (fs::exists(dir)) {
-                fs::remove(dir);
-            }
-        }
-    } catch (...) {
-        if (!eptr) {
-            eptr = std::current_exception();
-        }
-    }
     if (eptr) {
         std::rethrow_exception(eptr);
     }
@@ -1,26 +1,77 @@
 #pragma once
 
 #include <filesystem>
+#include <memory_resource>
+#include <string>
+#include <tuple>
+#include <vector>
 
-#include "nlohmann/json.hpp"
+#include "ocijail/platform.h"
+#include "ocijail/spec.h"
 
 namespace ocijail {
 
+class main_app;
 class runtime_state;
 
-int do_mount(
-    const std::vector<std::tuple<std::string, std::string>>& mount_opts,
-    int mount_flags);
+// Key-value pairs passed to nmount, usually allocated from the command's
+// arena
+using mount_options =
+    std::pmr::vector<std::tuple<std::pmr::string, std::pmr::string>>;
 
+int do_mount(const mount_options& mount_opts, int mount_flags);
+int do_unmount(const std::filesystem::path& path, int flags);
+
+// A mount as compiled by create, together with what was done to make it.
+// The plan is kept in the container state so that delete can undo each
+// mount exactly, without resolving paths in a rootfs which the container
+// may have changed or looking at the mount's source again.
+struct mount_step {
+    // The destination given in the config, for error messages
+    std::string destination;
+    // The resolved mount point
+    std::filesystem::path fspath;
+    std::string fstype;
+    int flags{0};
+    // The key-value pairs passed to nmount, starting with fstype and fspath
+    std::vector<std::tuple<std::string, std::string>> options;
+    // Options handled by the runtime before and after mounting
+    std::vector<std::tuple<std::string, std::string>> pseudo_options;
+    // A nullfs mount of a regular file
+    bool file_mount{false};
+    // Set once nmount succeeds
+    bool mounted{false};
+    // Set if the kernel doesn't support file mounts and the source was
+    // copied over the mount point instead
+    bool copied{false};
+    // Where a file at the mount point was moved while the copy is in place,
+    // if there was one
+    std::filesystem::path saved;
+    // Files and directories created for the mount, parents first
+    std::vector<std::filesystem::path> created;
+};
+
+using mount_plan = std::vector<mount_step>;
+
+// Compile the mounts, create their mount points and mount them, recording
+// the plan in the state. If prepare_only is true, only the mount points are
+// created, e.g. in a rootfs which is then aliased read-only, and a later
+// call mounts them in the alias.
 void mount_volumes(main_app& app,
                    runtime_state& state,
                    const std::filesystem::path& root_path,
-                   bool root_read_only,
-                   const nlohmann::json& mounts);
+                   bool prepare_only,
+                   const std::vector<mount_spec>& mounts);
+
+// Undo the mounts recorded in the state, in reverse order
+void unmount_volumes(runtime_state& state);
 
-void unmount_volumes(main_app& app,
-                     runtime_state& state,
-                     const std::filesystem::path& root_path,
-                     const nlohmann::json& mounts);
+// Record a mount plan for a container created by an older version of the
+// runtime, which only recorded the paths it created. Its mounts have to be
+// resolved again.
+void plan_legacy_mounts(main_app& app,
+                        runtime_state& state,
+                        const std::filesystem::path& root_path,
+                        const std::vector<mount_spec>& mounts);
 
 }  // namespace ocijail
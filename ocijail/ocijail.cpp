@@ -0,0 +1,129 @@
+#include <sysexits.h>
+#include <set>
+
+#include "ocijail/batch.h"
+#include "ocijail/create.h"
+#include "ocijail/delete.h"
+#include "ocijail/dispatch.h"
+#include "ocijail/events.h"
+#include "ocijail/exec.h"
+#include "ocijail/features.h"
+#include "ocijail/flight.h"
+#include "ocijail/invocation.h"
+#include "ocijail/kill.h"
+#include "ocijail/list.h"
+#include "ocijail/main.h"
+#include "ocijail/serve.h"
+#include "ocijail/server.h"
+#include "ocijail/start.h"
+#include "ocijail/state.h"
+#include "ocijail/wait.h"
+
+using namespace ocijail;
+using nlohmann::json;
+
+// If OCIJAIL_FORWARD names the socket of a running daemon, send commands
+// which don't need our stdio to it. Only global options may come before the
+// command. Returns the exit status, or nothing if the command should run
+// locally.
+static std::optional<int> forward(const char* path, int argc, char** argv) {
+    static const std::set<std::string_view> forwarded{
+        "start", "state", "kill", "delete"};
+    json request;
+    request["options"] = json::array();
+    request["args"] = json::array();
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg{argv[i]};
+        if (arg == "-h" || arg == "--help") {
+            return std::nullopt;
+        }
+        if (request.contains("command")) {
+            request["args"].push_back(arg);
+        } else if (forwarded.contains(arg)) {
+            request["command"] = arg;
+        } else if (auto values = dispatcher::global_option(arg)) {
+            request["options"].push_back(arg);
+            for (int j = 0; j < *values && i + 1 < argc; j++) {
+                request["options"].push_back(argv[++i]);
+            }
+        } else {
+            return std::nullopt;
+        }
+    }
+    if (!request.contains("command")) {
+        return std::nullopt;
+    }
+
+    std::optional<json> res;
+    try {
+        res = call_server(path, request);
+    } catch (const std::exception& e) {
+        return std::nullopt;
+    }
+    if (!res) {
+        return std::nullopt;
+    }
+    if (res->contains("output")) {
+        auto& output = (*res)["output"];
+        if (output.is_string()) {
+            std::cout << output.get<std::string>();
+        } else {
+            std::cout << output;
+        }
+    }
+    if (res->contains("error")) {
+        std::cerr << "Error: " << (*res)["error"].get<std::string>() << "\n";
+    }
+    return res->value("status", 1);
+}
+
+static int run(int argc, char** argv) {
+    if (auto path = ::getenv("OCIJAIL_FORWARD")) {
+        if (auto status = forward(path, argc, argv)) {
+            return *status;
+        }
+    }
+
+    main_app app{"ocijail: Yet another OCI runtime"};
+
+    create::init(app);
+    start::init(app);
+    delete_::init(app);
+    exec::init(app);
+    kill::init(app);
+    state::init(app);
+    list::init(app);
+    features::init(app);
+    events::init(app);
+    batch::init(app);
+    serve::init(app);
+    wait::init(app);
+    flight::init(app);
+
+    try {
+        app.parse(argc, argv);
+        app.finish(0);
+    } catch (const CLI::ParseError& e) {
+        return app.exit(e);
+    } catch (const exit_status& e) {
+        app.finish(e.status);
+        return e.status;
+    } catch (const lock_timeout& e) {
+        app.log_error(e);
+        app.finish(EX_TEMPFAIL, &e);
+        return EX_TEMPFAIL;
+    } catch (const std::exception& e) {
+        app.log_error(e);
+        app.finish(1, &e);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    begin_invocation(argc, argv);
+    auto status = run(argc, argv);
+    end_invocation(status);
+    return status;
+}
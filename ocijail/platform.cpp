@@ -0,0 +1,87 @@
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <cerrno>
+
+#include "ocijail/platform.h"
+
+extern "C" char** environ;
+
+namespace ocijail {
+
+const char* platform::signal_name(int sig) {
+#ifdef __FreeBSD__
+    return sig >= 0 && sig < sys_nsig ? sys_signame[sig] : nullptr;
+#else
+    return ::sigabbrev_np(sig);
+#endif
+}
+
+namespace {
+
+// The system calls, which only exist on FreeBSD
+class native_platform : public platform {
+   public:
+#ifdef __FreeBSD__
+    int jail_set(iovec* iov, unsigned niov, int flags) override {
+        return ::jail_set(iov, niov, flags);
+    }
+    int jail_get(iovec* iov, unsigned niov, int flags) override {
+        return ::jail_get(iov, niov, flags);
+    }
+    int jail_attach(int jid) override { return ::jail_attach(jid); }
+    int jail_remove(int jid) override { return ::jail_remove(jid); }
+    int nmount(iovec* iov, unsigned niov, int flags) override {
+        return ::nmount(iov, niov, flags);
+    }
+    int unmount(const char* path, int flags) override {
+        return ::unmount(path, flags);
+    }
+#else
+    int jail_set(iovec*, unsigned, int) override { return unsupported(); }
+    int jail_get(iovec*, unsigned, int) override { return unsupported(); }
+    int jail_attach(int) override { return unsupported(); }
+    int jail_remove(int) override { return unsupported(); }
+    int nmount(iovec*, unsigned, int) override { return unsupported(); }
+    int unmount(const char*, int) override { return unsupported(); }
+#endif
+
+    int devfs(char* const argv[]) override {
+        pid_t pid;
+        auto res =
+            ::posix_spawn(&pid, "/sbin/devfs", nullptr, nullptr, argv, environ);
+        if (res != 0) {
+            errno = res;
+            return -1;
+        }
+        int status;
+        if (::waitpid(pid, &status, 0) < 0) {
+            return -1;
+        }
+        return status;
+    }
+
+#ifndef __FreeBSD__
+   private:
+    static int unsupported() {
+        errno = ENOSYS;
+        return -1;
+    }
+#endif
+};
+
+native_platform native;
+platform* current = &native;
+
+}  // namespace
+
+platform& current_platform() {
+    return *current;
+}
+
+void set_platform(platform* p) {
+    current = p ? p : &native;
+}
+
+}  // namespace ocijail
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#ifdef __FreeBSD__
+#include <sys/jail.h>
+#include <sys/mount.h>
+#else
+// The runtime can be built on other hosts to run against a stand-in
+// platform, e.g. for benchmarks. These are FreeBSD's values.
+#define JAIL_CREATE 0x01
+#define JAIL_UPDATE 0x02
+#define JAIL_ATTACH 0x04
+#define JAIL_DYING 0x08
+
+#define MNT_RDONLY 0x0000000000000001ULL
+#define MNT_SYNCHRONOUS 0x0000000000000002ULL
+#define MNT_NOEXEC 0x0000000000000004ULL
+#define MNT_NOSUID 0x0000000000000008ULL
+#define MNT_NFS4ACLS 0x0000000000000010ULL
+#define MNT_UNION 0x0000000000000020ULL
+#define MNT_ASYNC 0x0000000000000040ULL
+#define MNT_UPDATE 0x0000000000010000ULL
+#define MNT_FORCE 0x0000000000080000ULL
+#define MNT_SUIDDIR 0x0000000000100000ULL
+#define MNT_NOSYMFOLLOW 0x0000000000400000ULL
+#define MNT_IGNORE 0x0000000000800000ULL
+#define MNT_SNAPSHOT 0x0000000001000000ULL
+#define MNT_MULTILABEL 0x0000000004000000ULL
+#define MNT_ACLS 0x0000000008000000ULL
+#define MNT_NOATIME 0x0000000010000000ULL
+#define MNT_NOCLUSTERR 0x0000000040000000ULL
+#define MNT_NOCLUSTERW 0x0000000080000000ULL
+#define MNT_AUTOMOUNTED 0x0000000200000000ULL
+#define MNT_UNTRUSTED 0x0000000800000000ULL
+#define MNT_NOCOVER 0x0000001000000000ULL
+#define MNT_EMPTYDIR 0x0000002000000000ULL
+#endif
+
+namespace ocijail {
+
+// The operations which create and remove jails, mount filesystems and set
+// up their devices. The kernel operations take the same arguments as the
+// system calls and return -1 with errno set on failure. The runtime uses
+// the native implementation unless another platform is installed, such as
+// sim_platform.
+class platform {
+   public:
+    virtual ~platform() = default;
+
+    virtual int jail_set(iovec* iov, unsigned niov, int flags) = 0;
+    virtual int jail_get(iovec* iov, unsigned niov, int flags) = 0;
+    virtual int jail_attach(int jid) = 0;
+    virtual int jail_remove(int jid) = 0;
+    virtual int nmount(iovec* iov, unsigned niov, int flags) = 0;
+    virtual int unmount(const char* path, int flags) = 0;
+
+    // Run devfs(8) with the given null terminated arguments and return its
+    // wait status, or -1 with errno set if it could not be run
+    virtual int devfs(char* const argv[]) = 0;
+
+    // The name of a signal without its SIG prefix, or null if it has none.
+    // By default these are the host's names.
+    virtual const char* signal_name(int sig);
+};
+
+// The platform used by the runtime
+platform& current_platform();
+
+// Use another platform, or the native one if p is null. This should be
+// called before running any commands and the platform must outlive them.
+void set_platform(platform* p);
+
+}  // namespace ocijail
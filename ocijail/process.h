@@ -3,17 +3,25 @@
 #include "nlohmann/json.hpp"
 
 #include "ocijail/main.h"
+#include "ocijail/spec.h"
 
 namespace ocijail {
 
 struct process {
-    // initialise with a json from either create or exec - this will
-    // validate the input, throwing an error if necessary.
+    // initialise with a json from exec - this will validate the input,
+    // throwing an error if necessary.
     process(const nlohmann::json& process,
             std::optional<std::filesystem::path> console_socket,
             bool detach,
             int preserve_fds);
 
+    // initialise with the process from a compiled config, throwing an error
+    // if the console socket options don't match
+    process(process_spec spec,
+            std::optional<std::filesystem::path> console_socket,
+            bool detach,
+            int preserve_fds);
+
     // Like std::getenv but using the env list from this process
     std::optional<std::string_view> getenv(std::string_view key);
 
@@ -26,25 +34,16 @@ struct process {
     // Call this before start - return value is three file descriptors for
     // stdin, stdout, stderr
     std::tuple<int, int, int> pre_start();
-    void exec(int stdin_fd, int stdout_fd, int stderr_fd);
+    [[noreturn]] void exec(int stdin_fd, int stdout_fd, int stderr_fd);
 
-   private:
-    void reset_signals();
-    void set_uid_gid();
+    const process_spec& spec() const { return spec_; }
 
+   private:
     std::optional<std::filesystem::path> console_socket_;
     bool detach_;
     int preserve_fds_;
 
-    // Copied out from the json during parsing
-    std::string cwd_;
-    std::vector<std::string> args_;
-    std::vector<std::string> env_;
-    std::vector<gid_t> gids_;
-    uid_t uid_;
-    gid_t gid_;
-    mode_t umask_{077};
-    bool terminal_{false};
+    process_spec spec_;
 };
 
 }  // namespace ocijail
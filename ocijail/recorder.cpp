@@ -0,0 +1,264 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <iomanip>
+#include <system_error>
+
+#include "ocijail/recorder.h"
+
+namespace fs = std::filesystem;
+
+namespace ocijail {
+
+// The number of dumps kept in a dump directory
+static constexpr size_t MAX_DUMPS = 32;
+
+static thread_local flight_recorder* current_recorder = nullptr;
+
+const char* to_string(flight_op op) {
+    switch (op) {
+    case flight_op::COMMAND:
+        return "command";
+    case flight_op::CONFIG:
+        return "config";
+    case flight_op::MOUNTS:
+        return "mounts";
+    case flight_op::READONLY_ROOT:
+        return "readonly_root";
+    case flight_op::HOOKS:
+        return "hooks";
+    case flight_op::HANDSHAKE:
+        return "handshake";
+    case flight_op::START_SIGNAL:
+        return "start_signal";
+    case flight_op::UNMOUNTS:
+        return "unmounts";
+    case flight_op::NMOUNT:
+        return "nmount";
+    case flight_op::UNMOUNT:
+        return "unmount";
+    case flight_op::JAIL_SET:
+        return "jail_set";
+    case flight_op::FORK:
+        return "fork";
+    case flight_op::HOOK:
+        return "hook";
+    case flight_op::FILE_COPY:
+        return "file_copy";
+    case flight_op::LOCK_WAIT:
+        return "lock_wait";
+    case flight_op::LOCK_HOLD:
+        return "lock_hold";
+    case flight_op::NUM_FLIGHT_OPS:
+        break;
+    }
+    return "unknown";
+}
+
+bool is_call(flight_op op) {
+    switch (op) {
+    case flight_op::NMOUNT:
+    case flight_op::UNMOUNT:
+    case flight_op::JAIL_SET:
+    case flight_op::FORK:
+    case flight_op::LOCK_WAIT:
+    case flight_op::LOCK_HOLD:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void copy_name(char* dst, size_t size, std::string_view src) {
+    auto n = std::min(src.size(), size - 1);
+    std::memcpy(dst, src.data(), n);
+    dst[n] = 0;
+}
+
+flight_recorder::flight_recorder()
+    : start_(std::chrono::steady_clock::now()),
+      wall_time_(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count()),
+      previous_(current_recorder) {
+    current_recorder = this;
+}
+
+flight_recorder::~flight_recorder() {
+    if (current_recorder == this) {
+        current_recorder = previous_;
+    }
+}
+
+flight_recorder* flight_recorder::current() {
+    return current_recorder;
+}
+
+void flight_recorder::set_command(std::string_view command) {
+    copy_name(command_, sizeof(command_), command);
+}
+
+void flight_recorder::set_id(std::string_view id) {
+    copy_name(id_, sizeof(id_), id);
+}
+
+std::vector<flight_event> flight_recorder::events() const {
+    std::vector<flight_event> res;
+    auto first = next_ - std::min<uint64_t>(next_, CAPACITY);
+    res.reserve(next_ - first);
+    for (auto i = first; i < next_; i++) {
+        res.push_back(ring_[i % CAPACITY]);
+    }
+    return res;
+}
+
+fs::path flight_recorder::save(const fs::path& dir, int status) const {
+    auto events = this->events();
+    flight_header header{};
+    header.magic = flight_header::MAGIC;
+    header.version = flight_header::VERSION;
+    header.wall_time = wall_time_;
+    header.duration = now();
+    header.pid = ::getpid();
+    header.status = status;
+    header.count = events.size();
+    header.dropped = dropped();
+    std::memcpy(header.command, command_, sizeof(command_));
+    std::memcpy(header.id, id_, sizeof(id_));
+
+    // Names sort in the order the commands started
+    fs::create_directories(dir);
+    auto path = dir / (std::to_string(wall_time_) + "-" +
+                       std::to_string(header.pid) + ".flight");
+    auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "creating " + path.native()};
+    }
+    auto events_size = events.size() * sizeof(flight_event);
+    if (::write(fd, &header, sizeof(header)) != sizeof(header) ||
+        ::write(fd, events.data(), events_size) !=
+            static_cast<ssize_t>(events_size)) {
+        auto saved_errno = errno;
+        ::close(fd);
+        throw std::system_error{
+            saved_errno, std::system_category(), "writing " + path.native()};
+    }
+    ::close(fd);
+
+    // Remove the oldest dumps. Another command may be doing the same so
+    // ignore errors.
+    std::vector<fs::path> dumps;
+    std::error_code ec;
+    for (const auto& it : fs::directory_iterator{dir, ec}) {
+        if (it.path().extension() == ".flight") {
+            dumps.push_back(it.path());
+        }
+    }
+    if (dumps.size() > MAX_DUMPS) {
+        std::sort(dumps.begin(), dumps.end());
+        for (size_t i = 0; i < dumps.size() - MAX_DUMPS; i++) {
+            fs::remove(dumps[i], ec);
+        }
+    }
+    return path;
+}
+
+flight_phase::flight_phase(flight_op op, int64_t arg)
+    : recorder_(flight_recorder::current()),
+      op_(op),
+      arg_(arg),
+      exceptions_(std::uncaught_exceptions()) {
+    if (recorder_) {
+        start_ = recorder_->now();
+        recorder_->begin(op_, arg_);
+    }
+}
+
+flight_phase::~flight_phase() {
+    if (recorder_) {
+        auto failed = std::uncaught_exceptions() > exceptions_;
+        recorder_->end(op_, start_, failed ? errno : 0, arg_);
+    }
+}
+
+flight_dump read_flight_dump(const fs::path& path) {
+    auto fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "opening " + path.native()};
+    }
+    flight_dump dump;
+    auto n = ::read(fd, &dump.header, sizeof(dump.header));
+    if (n != sizeof(dump.header) ||
+        dump.header.magic != flight_header::MAGIC ||
+        dump.header.version != flight_header::VERSION ||
+        dump.header.count > flight_recorder::CAPACITY) {
+        ::close(fd);
+        throw std::runtime_error{path.native() + ": not a flight record"};
+    }
+    dump.events.resize(dump.header.count);
+    auto size = dump.events.size() * sizeof(flight_event);
+    n = ::read(fd, dump.events.data(), size);
+    ::close(fd);
+    if (n != static_cast<ssize_t>(size)) {
+        throw std::runtime_error{path.native() + ": truncated flight record"};
+    }
+    dump.header.command[sizeof(dump.header.command) - 1] = 0;
+    dump.header.id[sizeof(dump.header.id) - 1] = 0;
+    return dump;
+}
+
+// Write a duration in nanoseconds as milliseconds
+static std::ostream& ms(std::ostream& out, uint64_t ns, int width = 10) {
+    return out << std::fixed << std::setprecision(3) << std::setw(width)
+               << ns / 1e6 << "ms";
+}
+
+void print_flight_dump(std::ostream& out, const flight_dump& dump) {
+    auto& header = dump.header;
+    std::time_t secs = header.wall_time / 1000000000;
+    struct std::tm tm;
+    gmtime_r(&secs, &tm);
+    out << std::put_time(&tm, "%Y-%m-%dT%H:%M:%SZ") << " " << header.command;
+    if (header.id[0]) {
+        out << " " << header.id;
+    }
+    out << ": pid " << header.pid << ", status " << header.status << ", ";
+    ms(out, header.duration, 0) << ", " << header.count << " events";
+    if (header.dropped) {
+        out << " (" << header.dropped << " dropped)";
+    }
+    out << "\n";
+
+    static const char* kinds[] = {"begin", "end", "call", "error"};
+    for (auto& ev : dump.events) {
+        ms(out, ev.time) << "  ";
+        auto kind = ev.kind < std::size(kinds) ? kinds[ev.kind] : "?";
+        auto timed =
+            ev.kind == flight_event::END || ev.kind == flight_event::CALL;
+        out << std::left << std::setw(6) << kind;
+        if (timed) {
+            out << std::setw(14);
+        }
+        out << to_string(static_cast<flight_op>(ev.op)) << std::right;
+        if (timed) {
+            ms(out, ev.duration);
+        }
+        if (ev.kind == flight_event::CALL) {
+            out << "  result " << ev.arg;
+        } else if (ev.arg) {
+            out << "  arg " << ev.arg;
+        }
+        if (ev.error) {
+            out << "  errno " << ev.error << " ("
+                << std::generic_category().message(ev.error) << ")";
+        }
+        out << "\n";
+    }
+}
+
+}  // namespace ocijail
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ocijail {
+
+// The operations recorded by the flight recorder. Phases are the steps of a
+// command and calls are the system calls which are most likely to be slow or
+// to fail. Values are stored in dumps and metrics so new operations must be
+// added at the end.
+enum class flight_op : uint16_t {
+    COMMAND,
+    CONFIG,
+    MOUNTS,
+    READONLY_ROOT,
+    HOOKS,
+    HANDSHAKE,
+    START_SIGNAL,
+    UNMOUNTS,
+    NMOUNT,
+    UNMOUNT,
+    JAIL_SET,
+    FORK,
+    HOOK,
+    FILE_COPY,
+    LOCK_WAIT,
+    LOCK_HOLD,
+    NUM_FLIGHT_OPS,
+};
+
+constexpr size_t NUM_FLIGHT_OPS = size_t(flight_op::NUM_FLIGHT_OPS);
+
+const char* to_string(flight_op op);
+
+// True for operations which are recorded as calls rather than phases
+bool is_call(flight_op op);
+
+// A recorded event. Times are in nanoseconds since the recorder started.
+struct flight_event {
+    enum kind_t : uint16_t {
+        BEGIN,  // a phase started
+        END,    // a phase finished, with its duration
+        CALL,   // a system call returned, with its duration and result
+        ERROR,  // the command failed
+    };
+    uint64_t time;
+    uint64_t duration;
+    uint16_t kind;
+    uint16_t op;
+    int32_t error;
+    int64_t arg;
+};
+static_assert(sizeof(flight_event) == 32);
+
+// The start of a dump, followed by count events, oldest first
+struct flight_header {
+    static constexpr uint32_t MAGIC = 0x52464a4f;  // "OJFR"
+    static constexpr uint32_t VERSION = 1;
+    uint32_t magic;
+    uint32_t version;
+    int64_t wall_time;  // nanoseconds since the epoch when recording started
+    uint64_t duration;  // nanoseconds from the start of recording to the dump
+    int32_t pid;
+    int32_t status;  // exit status of the command
+    uint32_t count;
+    uint32_t dropped;  // events overwritten by later ones
+    char command[16];
+    char id[64];
+};
+
+// Counts and latency histograms for each operation recorded by a flight
+// recorder, which unlike the ring cover the whole command
+struct flight_totals {
+    // Upper bounds of the latency buckets in nanoseconds. There is one more
+    // bucket for longer latencies.
+    static constexpr std::array<uint64_t, 12> BOUNDS{
+        1000000,     // 1ms
+        5000000,     // 5ms
+        10000000,    // 10ms
+        25000000,    // 25ms
+        50000000,    // 50ms
+        100000000,   // 100ms
+        250000000,   // 250ms
+        500000000,   // 500ms
+        1000000000,  // 1s
+        2500000000,  // 2.5s
+        5000000000,  // 5s
+        10000000000  // 10s
+    };
+    static constexpr size_t NUM_BUCKETS = BOUNDS.size() + 1;
+
+    struct op_totals {
+        uint64_t count;
+        uint64_t errors;
+        uint64_t sum;  // total nanoseconds
+        std::array<uint64_t, NUM_BUCKETS> buckets;
+    };
+
+    void add(flight_op op, uint64_t duration, int error) {
+        auto& t = ops[size_t(op)];
+        t.count++;
+        t.errors += error != 0;
+        t.sum += duration;
+        size_t i = 0;
+        while (i < BOUNDS.size() && duration > BOUNDS[i]) {
+            i++;
+        }
+        t.buckets[i]++;
+    }
+
+    std::array<op_totals, NUM_FLIGHT_OPS> ops{};
+    // The errno of the failure which ended the command, if it had one
+    int error{0};
+};
+
+// A fixed size ring of events for one command. Unless events are kept for a
+// trace, recording an event does not allocate or make system calls, so the
+// recorder is always on. The events are only written out if the command
+// fails or is slow.
+class flight_recorder {
+   public:
+    static constexpr size_t CAPACITY = 512;
+    static constexpr size_t MAX_KEPT = 65536;
+
+    // The recorder becomes the current recorder for this thread until it is
+    // destroyed
+    flight_recorder();
+    flight_recorder(const flight_recorder&) = delete;
+    flight_recorder& operator=(const flight_recorder&) = delete;
+    ~flight_recorder();
+
+    // The recorder for the command running on this thread, if any
+    static flight_recorder* current();
+
+    // Nanoseconds since the recorder started
+    uint64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - start_)
+            .count();
+    }
+
+    void set_command(std::string_view command);
+    void set_id(std::string_view id);
+    std::string_view command() const { return command_; }
+    std::string_view id() const { return id_; }
+
+    // Nanoseconds since the epoch when the recorder started
+    int64_t wall_time() const { return wall_time_; }
+
+    // Keep every event from now on, as well as recording it in the ring,
+    // until it is taken. This is used to write traces. At most MAX_KEPT
+    // events are kept between takes, so that a long running command like
+    // events doesn't grow without bound.
+    void keep_events() { keep_ = true; }
+    std::vector<flight_event> take_events() {
+        return std::exchange(kept_, {});
+    }
+
+    void begin(flight_op op, int64_t arg = 0) {
+        add(flight_event::BEGIN, op, now(), 0, 0, arg);
+    }
+    void end(flight_op op, uint64_t start, int error = 0, int64_t arg = 0) {
+        auto t = now();
+        add(flight_event::END, op, t, t - start, error, arg);
+    }
+    void call(flight_op op, uint64_t start, int64_t result, int error) {
+        auto t = now();
+        add(flight_event::CALL, op, t, t - start, error, result);
+    }
+    void error(int error) {
+        add(flight_event::ERROR, flight_op::COMMAND, now(), 0, error, 0);
+    }
+
+    const flight_totals& totals() const { return totals_; }
+
+    // The recorded events, oldest first
+    std::vector<flight_event> events() const;
+    size_t dropped() const {
+        return next_ > CAPACITY ? next_ - CAPACITY : 0;
+    }
+
+    // Write the events to a new file in dir and return its path. Only the
+    // most recent dumps are kept.
+    std::filesystem::path save(const std::filesystem::path& dir,
+                               int status) const;
+
+   private:
+    void add(flight_event::kind_t kind,
+             flight_op op,
+             uint64_t time,
+             uint64_t duration,
+             int error,
+             int64_t arg) {
+        flight_event ev{
+            time, duration, kind, static_cast<uint16_t>(op), error, arg};
+        ring_[next_++ % CAPACITY] = ev;
+        if (kind == flight_event::END || kind == flight_event::CALL) {
+            totals_.add(op, duration, error);
+        } else if (kind == flight_event::ERROR) {
+            totals_.error = error;
+        }
+        if (keep_ && kept_.size() < MAX_KEPT) {
+            kept_.push_back(ev);
+        }
+    }
+
+    std::array<flight_event, CAPACITY> ring_;
+    uint64_t next_{0};
+    flight_totals totals_;
+    std::chrono::steady_clock::time_point start_;
+    int64_t wall_time_;
+    char command_[16]{};
+    char id_[64]{};
+    bool keep_{false};
+    std::vector<flight_event> kept_;
+    flight_recorder* previous_;
+};
+
+// Record a phase of a command with the current recorder. If the phase is
+// left by an exception, its end event records errno.
+class flight_phase {
+   public:
+    explicit flight_phase(flight_op op, int64_t arg = 0);
+    flight_phase(const flight_phase&) = delete;
+    flight_phase& operator=(const flight_phase&) = delete;
+    ~flight_phase();
+
+   private:
+    flight_recorder* recorder_;
+    flight_op op_;
+    int64_t arg_;
+    uint64_t start_{0};
+    int exceptions_;
+};
+
+// Call f, which makes a system call returning a negative value on error, and
+// record the call with the current recorder. Returns the result of f with
+// errno preserved.
+template <typename F>
+auto recorded(flight_op op, F&& f) {
+    auto recorder = flight_recorder::current();
+    if (!recorder) {
+        return f();
+    }
+    auto start = recorder->now();
+    auto res = f();
+    auto saved_errno = errno;
+    recorder->call(op, start, res, res < 0 ? saved_errno : 0);
+    errno = saved_errno;
+    return res;
+}
+
+// A dump read back from a file
+struct flight_dump {
+    flight_header header;
+    std::vector<flight_event> events;
+};
+
+flight_dump read_flight_dump(const std::filesystem::path& path);
+
+// Print a dump with one line per event
+void print_flight_dump(std::ostream& out, const flight_dump& dump);
+
+}  // namespace ocijail
@@ -0,0 +1,594 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+#include "ocijail/recorder.h"
+#include "ocijail/runtime_state.h"
+#include "ocijail/state_cache.h"
+#include "ocijail/state_index.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+namespace ocijail {
+
+std::string_view to_string(container_status status) {
+    switch (status) {
+    case container_status::CREATED:
+        return "created";
+    case container_status::RUNNING:
+        return "running";
+    case container_status::STOPPED:
+        return "stopped";
+    }
+    return "unknown";
+}
+
+const char* const lifecycle_event_names[NUM_LIFECYCLE_EVENTS] = {
+    "createBegin",
+    "mountsDone",
+    "jailCreated",
+    "createReturned",
+    "startRequested",
+    "execConfirmed",
+    "stopObserved",
+    "deleteDone",
+};
+
+lifecycle_time lifecycle_time::now() {
+    using namespace std::chrono;
+    return {duration_cast<nanoseconds>(system_clock::now().time_since_epoch())
+                .count(),
+            duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+                .count()};
+}
+
+static std::optional<lock_holder> read_holder(int fd) {
+    lock_holder holder;
+    if (::pread(fd, &holder, sizeof(holder), 0) != sizeof(holder) ||
+        holder.pid <= 0) {
+        return std::nullopt;
+    }
+    holder.command[sizeof(holder.command) - 1] = 0;
+    return holder;
+}
+
+// The holder is only used in reports so it doesn't matter if this fails
+static void write_holder(int fd, const lock_policy& policy) {
+    lock_holder holder;
+    holder.pid = ::getpid();
+    auto n = std::min(policy.command.size(), sizeof(holder.command) - 1);
+    std::copy_n(policy.command.data(), n, holder.command);
+    holder.since = lifecycle_time::now().wall;
+    ::pwrite(fd, &holder, sizeof(holder), 0);
+}
+
+static std::string describe(std::string_view id,
+                            const std::optional<lock_holder>& holder) {
+    std::stringstream ss;
+    ss << "state lock of container " << id;
+    if (holder) {
+        ss << " held by pid " << holder->pid;
+        if (holder->command[0]) {
+            ss << " (" << holder->command << ")";
+        }
+        auto held = lifecycle_time::now().wall - holder->since;
+        if (holder->since > 0 && held >= 0) {
+            ss << " for " << std::fixed << std::setprecision(3) << held / 1e9
+               << "s";
+        }
+    }
+    return ss.str();
+}
+
+// Take the lock on a state lock file and record ourselves as its holder.
+// Returns the flight recorder time when the lock was taken.
+static uint64_t acquire(int fd,
+                        std::string_view id,
+                        const lock_policy& policy) {
+    using namespace std::chrono;
+    auto rec = flight_recorder::current();
+    auto start = rec ? rec->now() : 0;
+    auto res = ::flock(fd, LOCK_EX | LOCK_NB);
+    if (res < 0 && errno == EWOULDBLOCK) {
+        if (policy.log) {
+            log_entry{*policy.log, log_level::INFO}
+                << "waiting for " << describe(id, read_holder(fd));
+        }
+        if (policy.timeout == 0) {
+            res = ::flock(fd, LOCK_EX);
+        } else {
+            // Poll rather than interrupting flock with a timer signal, which
+            // would not work for the threads of serve
+            auto deadline = steady_clock::now() + milliseconds{policy.timeout};
+            auto delay = milliseconds{1};
+            for (;;) {
+                auto now = steady_clock::now();
+                if (now >= deadline) {
+                    errno = ETIMEDOUT;
+                    break;
+                }
+                std::this_thread::sleep_for(
+                    std::min<steady_clock::duration>(delay, deadline - now));
+                res = ::flock(fd, LOCK_EX | LOCK_NB);
+                if (res == 0 || errno != EWOULDBLOCK) {
+                    break;
+                }
+                delay = std::min(2 * delay, milliseconds{50});
+            }
+        }
+    }
+    auto saved_errno = errno;
+    if (rec) {
+        rec->call(flight_op::LOCK_WAIT, start, res, res < 0 ? saved_errno : 0);
+    }
+    if (res < 0) {
+        if (saved_errno == ETIMEDOUT) {
+            throw lock_timeout{"timed out waiting for " +
+                               describe(id, read_holder(fd))};
+        }
+        throw std::system_error(
+            saved_errno, std::system_category(), "locking state lock");
+    }
+    write_holder(fd, policy);
+    return rec ? rec->now() : 0;
+}
+
+runtime_state::locked_state::~locked_state() {
+    if (locked_) {
+        unlock();
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void runtime_state::locked_state::unlock() {
+    assert(locked_);
+    locked_ = false;
+    if (auto rec = flight_recorder::current()) {
+        rec->call(flight_op::LOCK_HOLD, acquired_, 0, 0);
+    }
+    if (::flock(fd_, LOCK_UN) < 0) {
+        throw std::system_error(
+            errno, std::system_category(), "unlocking state lock");
+    }
+}
+
+void runtime_state::locked_state::lock() {
+    assert(!locked_);
+    acquired_ = acquire(fd_, id_, policy_);
+    locked_ = true;
+}
+
+void runtime_state::locked_state::release() {
+    locked_ = false;
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+runtime_state::locked_state runtime_state::create() {
+    fs::remove_all(state_dir_);
+    fs::create_directories(state_dir_);
+    if (!time(CREATE_BEGIN)) {
+        set_time(CREATE_BEGIN);
+    }
+    return lock();
+}
+
+void runtime_state::remove_all() {
+    fs::remove_all(state_dir_);
+    if (details_.contains("config_hash")) {
+        config_store{state_dir_.parent_path()}.release(
+            details_["config_hash"].get<std::string>());
+    }
+    if (index_) {
+        index_->remove(id_);
+    } else {
+        state_index{state_dir_.parent_path()}.remove(id_);
+    }
+    if (cache_) {
+        cache_->erase(id_);
+    }
+}
+
+void runtime_state::set_bundle(const fs::path& bundle) {
+    auto& s = bundle.native();
+    if (s.size() >= sizeof(record_.bundle)) {
+        throw std::runtime_error("bundle path too long: " + s);
+    }
+    std::fill_n(record_.bundle, sizeof(record_.bundle), 0);
+    std::copy(s.begin(), s.end(), record_.bundle);
+}
+
+// Publish the contents of a file atomically by writing to a temporary file
+// and renaming it over the original. Callers must hold the state lock so that
+// there is only one writer for each file. Returns the stamp of the new file.
+static file_stamp publish(const fs::path& path, std::string_view data) {
+    auto tmp_path = path;
+    tmp_path += ".new";
+    auto fd = ::open(
+        tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw std::system_error(
+            errno, std::system_category(), "opening " + tmp_path.native());
+    }
+    while (data.size() > 0) {
+        auto n = ::write(fd, data.data(), data.size());
+        if (n < 0) {
+            auto saved_errno = errno;
+            ::close(fd);
+            throw std::system_error(saved_errno,
+                                    std::system_category(),
+                                    "writing " + tmp_path.native());
+        }
+        data = data.substr(n);
+    }
+    struct ::stat st;
+    if (::fstat(fd, &st) < 0) {
+        auto saved_errno = errno;
+        ::close(fd);
+        throw std::system_error(
+            saved_errno, std::system_category(), "stat " + tmp_path.native());
+    }
+    ::close(fd);
+    if (::rename(tmp_path.c_str(), path.c_str()) < 0) {
+        throw std::system_error(
+            errno, std::system_category(), "renaming " + tmp_path.native());
+    }
+    return file_stamp::of(st);
+}
+
+static file_stamp publish_json(const fs::path& path, const json& value) {
+    return publish(path, value.dump());
+}
+
+// The state.json of a container created before the status record was split
+// out, which holds its status, bundle config and runtime bookkeeping
+static std::optional<json> read_legacy(const fs::path& state_json) {
+    std::ifstream in{state_json};
+    if (!in) {
+        return std::nullopt;
+    }
+    auto res = json::parse(in, nullptr, false);
+    if (!res.is_object() || !res.contains("status") ||
+        !res["status"].is_string()) {
+        return std::nullopt;
+    }
+    return res;
+}
+
+bool runtime_state::has_legacy_record() const {
+    return fs::is_regular_file(state_json_) && read_legacy(state_json_);
+}
+
+bool runtime_state::load_legacy() {
+    auto legacy = read_legacy(state_json_);
+    if (!legacy) {
+        return false;
+    }
+    static const std::map<std::string, container_status, std::less<>>
+        statuses = {
+            {"created", container_status::CREATED},
+            {"running", container_status::RUNNING},
+            {"stopped", container_status::STOPPED},
+        };
+    auto it = statuses.find((*legacy)["status"].get<std::string>());
+    if (it == statuses.end()) {
+        return false;
+    }
+    record_ = status_record{};
+    record_.status = it->second;
+    record_.pid = legacy->value("pid", -1);
+    record_.jid = legacy->value("jid", -1);
+    set_bundle(legacy->value("bundle", std::string{}));
+
+    auto config = std::make_shared<json>(
+        legacy->contains("config") ? (*legacy)["config"] : json::object());
+    if (config->contains("annotations")) {
+        record_.flags |= status_record::HAS_ANNOTATIONS;
+    }
+    spec_ = std::make_shared<const oci_spec>(oci_spec::compile(*config));
+    record_.hook_mask = spec_->hook_mask();
+    config_ = std::move(config);
+
+    // Everything else is runtime bookkeeping
+    legacy->erase("status");
+    legacy->erase("pid");
+    legacy->erase("jid");
+    legacy->erase("bundle");
+    legacy->erase("config");
+    details_ = std::move(*legacy);
+    legacy_ = true;
+    return true;
+}
+
+void runtime_state::load() {
+    auto not_found = [this] {
+        std::stringstream ss;
+        ss << "container " << id_ << " not found";
+        return std::runtime_error(ss.str());
+    };
+
+    struct ::stat st;
+    if (cache_) {
+        if (::stat(status_path_.c_str(), &st) < 0) {
+            if (errno == ENOENT) {
+                if (load_legacy()) {
+                    return;
+                }
+                throw not_found();
+            }
+            throw std::system_error(
+                errno, std::system_category(), "stat container status");
+        }
+        if (auto record = cache_->get_record(id_, file_stamp::of(st))) {
+            record_ = *record;
+            return;
+        }
+    }
+
+    auto fd = ::open(status_path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            if (load_legacy()) {
+                return;
+            }
+            throw not_found();
+        }
+        throw std::system_error(
+            errno, std::system_category(), "opening container status");
+    }
+    auto n = ::pread(fd, &record_, sizeof(record_), 0);
+    auto saved_errno = errno;
+    auto have_stamp = cache_ && ::fstat(fd, &st) == 0;
+    ::close(fd);
+    if (n < 0) {
+        throw std::system_error(
+            saved_errno, std::system_category(), "reading container status");
+    }
+    if (n != sizeof(record_) || record_.magic != status_record::MAGIC ||
+        record_.version != status_record::VERSION) {
+        std::stringstream ss;
+        ss << "container " << id_ << " has malformed status";
+        throw std::runtime_error(ss.str());
+    }
+    if (have_stamp) {
+        cache_->put_record(id_, file_stamp::of(st), record_);
+    }
+}
+
+void runtime_state::save() {
+    if (legacy_) {
+        save_config(*config_);
+    }
+    record_.generation++;
+    auto stamp =
+        publish(status_path_,
+                std::string_view{reinterpret_cast<const char*>(&record_),
+                                 sizeof(record_)});
+    if (cache_) {
+        cache_->put_record(id_, stamp, record_);
+    }
+    if (index_) {
+        index_->update(id_, record_);
+    } else {
+        state_index{state_dir_.parent_path()}.update(id_, record_);
+    }
+    if (legacy_) {
+        legacy_ = false;
+        save_details();
+    }
+}
+
+void runtime_state::load_details() {
+    if (legacy_) {
+        return;
+    }
+    std::ifstream{state_json_} >> details_;
+}
+
+void runtime_state::save_details() {
+    publish_json(state_json_, details_);
+}
+
+void runtime_state::save_config(const json& config) {
+    auto stamp = publish_json(config_json_, config);
+    if (config.contains("annotations")) {
+        publish_json(annotations_json_, config["annotations"]);
+        record_.flags |= status_record::HAS_ANNOTATIONS;
+    }
+    config_ = std::make_shared<const json>(config);
+    spec_.reset();
+    if (cache_) {
+        cache_->put_config(id_, stamp, config_);
+    }
+}
+
+void runtime_state::save_config(const config_store::entry& entry,
+                                std::string_view text,
+                                const json* config) {
+    config_store{state_dir_.parent_path()}.add(entry, text, state_dir_, config);
+    details_["config_hash"] = entry.hash;
+    if (fs::exists(annotations_json_)) {
+        record_.flags |= status_record::HAS_ANNOTATIONS;
+    }
+    config_.reset();
+    spec_ = entry.spec;
+}
+
+const json& runtime_state::config() const {
+    if (!config_) {
+        // The config is never rewritten so it can't change between the
+        // stat and reading it.
+        struct ::stat st;
+        auto cached = cache_ && ::stat(config_json_.c_str(), &st) == 0;
+        if (cached) {
+            config_ = cache_->get_config(id_, file_stamp::of(st));
+            if (config_) {
+                return *config_;
+            }
+        }
+        auto config = std::make_shared<json>();
+        std::ifstream{config_json_} >> *config;
+        config_ = config;
+        if (cached) {
+            cache_->put_config(id_, file_stamp::of(st), config_);
+        }
+    }
+    return *config_;
+}
+
+const oci_spec& runtime_state::spec() const {
+    if (!spec_) {
+        if (config_) {
+            spec_ = std::make_shared<const oci_spec>(
+                oci_spec::compile(*config_));
+            return *spec_;
+        }
+        std::stringstream ss;
+        ss << std::ifstream{spec_path_, std::ios::binary}.rdbuf();
+        if (auto spec = oci_spec::decode(ss.str())) {
+            spec_ = std::make_shared<const oci_spec>(std::move(*spec));
+        } else {
+            std::ifstream in{config_json_};
+            spec_ = std::make_shared<const oci_spec>(
+                oci_spec::compile(read_config(in)));
+        }
+    }
+    return *spec_;
+}
+
+json runtime_state::report() const {
+    json res;
+    res["ociVersion"] = "1.0.2";
+    res["id"] = id_;
+    res["status"] = to_string(status());
+    if (status() != container_status::STOPPED) {
+        res["pid"] = pid();
+    }
+    res["bundle"] = record_.bundle;
+    if (record_.flags & status_record::HAS_ANNOTATIONS) {
+        if (legacy_) {
+            res["annotations"] = (*config_)["annotations"];
+        } else {
+            std::ifstream{annotations_json_} >> res["annotations"];
+        }
+    }
+    if (jid() >= 0) {
+        if (!res.contains("annotations")) {
+            res["annotations"] = json::object();
+        }
+        res["annotations"]["org.freebsd.jail.jid"] = std::to_string(jid());
+    }
+    return res;
+}
+
+json runtime_state::timings() const {
+    auto res = json::object();
+    for (unsigned ev = 0; ev < NUM_LIFECYCLE_EVENTS; ev++) {
+        auto& t = record_.times[ev];
+        if (t) {
+            res[lifecycle_event_names[ev]] = {{"wall", t.wall},
+                                              {"monotonic", t.monotonic}};
+        }
+    }
+    return res;
+}
+
+runtime_state::locked_state runtime_state::lock() {
+    auto fd = ::open(state_lock_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw std::system_error(
+            errno, std::system_category(), "opening state lock");
+    }
+    try {
+        auto acquired = acquire(fd, id_, lock_policy_);
+        return {fd, id_, lock_policy_, acquired};
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+std::optional<runtime_state::locked_state> runtime_state::try_lock() {
+    auto fd = ::open(state_lock_.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+    if (::flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        ::close(fd);
+        return std::nullopt;
+    }
+    write_holder(fd, lock_policy_);
+    auto rec = flight_recorder::current();
+    return locked_state{fd, id_, lock_policy_, rec ? rec->now() : 0};
+}
+
+std::optional<lock_holder> runtime_state::get_lock_holder() const {
+    auto fd = ::open(state_lock_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+    auto holder = read_holder(fd);
+    ::close(fd);
+    return holder;
+}
+
+void runtime_state::set_exited(std::optional<int> wait_status) {
+    set_status(container_status::STOPPED);
+    if (wait_status) {
+        record_.exit_status = *wait_status;
+        record_.flags |= status_record::HAS_EXIT_STATUS;
+    }
+    set_time(STOP_OBSERVED);
+}
+
+void runtime_state::check_status(bool probe) {
+    if ((record_.flags & status_record::MONITORED) && !probe) {
+        return;
+    }
+    if (status() == container_status::CREATED ||
+        status() == container_status::RUNNING) {
+        if (::kill(pid(), 0) < 0 && errno == ESRCH) {
+            set_status(container_status::STOPPED);
+
+            // Publish the new status if nobody else is modifying the
+            // container. We reload under the lock in case the status changed
+            // since we read it.
+            auto lk = try_lock();
+            if (lk) {
+                auto observed = record_;
+                try {
+                    load();
+                } catch (const std::runtime_error&) {
+                    // The container was deleted while we were looking at it
+                    record_ = observed;
+                    return;
+                }
+                if (record_.pid == observed.pid &&
+                    (record_.status == container_status::CREATED ||
+                     record_.status == container_status::RUNNING)) {
+                    set_exited(std::nullopt);
+                    save();
+                }
+            }
+        }
+    }
+}
+
+}  // namespace ocijail
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <limits.h>
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/config_store.h"
+#include "ocijail/log.h"
+#include "ocijail/spec.h"
+
+namespace ocijail {
+
+enum class container_status : uint32_t {
+    CREATED = 1,
+    RUNNING = 2,
+    STOPPED = 3,
+};
+
+std::string_view to_string(container_status status);
+
+// Points in a container's lifecycle whose times are kept in its status
+// record, so that start latency can be measured for each container
+enum lifecycle_event : unsigned {
+    CREATE_BEGIN,
+    MOUNTS_DONE,
+    JAIL_CREATED,
+    CREATE_RETURNED,
+    START_REQUESTED,
+    EXEC_CONFIRMED,
+    STOP_OBSERVED,
+    DELETE_DONE,
+    NUM_LIFECYCLE_EVENTS,
+};
+
+extern const char* const lifecycle_event_names[NUM_LIFECYCLE_EVENTS];
+
+// The wall clock and monotonic clock times of a lifecycle event in
+// nanoseconds, both zero if it has not happened. The monotonic clock is
+// shared by all processes so intervals between events recorded by different
+// commands are not affected by changes to the wall clock.
+struct lifecycle_time {
+    int64_t wall{0};
+    int64_t monotonic{0};
+
+    static lifecycle_time now();
+    explicit operator bool() const { return monotonic != 0; }
+};
+
+class state_cache;
+class state_index;
+
+// How a command takes container state locks
+struct lock_policy {
+    // Give up waiting for a lock after this many milliseconds, or wait
+    // forever if zero
+    unsigned timeout{0};
+    // The command taking the lock, which is recorded for anyone waiting
+    // behind it
+    std::string_view command;
+    // Report waits here, if set
+    const logger* log{nullptr};
+};
+
+// The process holding a container's state lock. This is written to the
+// lock file each time the lock is taken so that commands waiting for it can
+// say what they are waiting for.
+struct lock_holder {
+    int32_t pid{0};
+    char command[16]{};
+    // Wall clock time in nanoseconds since the epoch
+    int64_t since{0};
+};
+
+// Thrown when a state lock is not taken within the lock timeout. Commands
+// which fail this way exit with EX_TEMPFAIL so that callers can retry.
+class lock_timeout : public std::system_error {
+   public:
+    explicit lock_timeout(const std::string& what)
+        : std::system_error(ETIMEDOUT, std::system_category(), what) {}
+};
+
+// The frequently read and updated part of the container state. This is
+// stored in binary form in a fixed-size file so that commands which only need
+// the status (state, kill, start, list) can read and rewrite it without
+// parsing the bundle config.
+//
+// Each save publishes a complete new copy of the record by renaming a
+// temporary file over the old one so that readers always see a consistent
+// snapshot without taking the state lock. Only mutators take the lock.
+struct status_record {
+    static constexpr uint32_t MAGIC = 0x6f636a73;  // "ocjs"
+    static constexpr uint32_t VERSION = 3;
+
+    // Values for flags
+    static constexpr uint32_t HAS_ANNOTATIONS = 1;
+    // A monitor process will record the container process' exit
+    static constexpr uint32_t MONITORED = 2;
+    // The exit_status field holds the container process' wait status
+    static constexpr uint32_t HAS_EXIT_STATUS = 4;
+
+    uint32_t magic{MAGIC};
+    uint32_t version{VERSION};
+    // Incremented each time the record is published
+    uint64_t generation{0};
+    container_status status{container_status::CREATED};
+    int32_t pid{-1};
+    int32_t jid{-1};
+    uint32_t flags{0};
+    // Bitmask of hook phases which have at least one hook, indexed by
+    // hook_phase
+    uint32_t hook_mask{0};
+    int32_t exit_status{0};
+    lifecycle_time times[NUM_LIFECYCLE_EVENTS]{};
+    char bundle[PATH_MAX]{};
+};
+
+class runtime_state {
+    struct locked_state {
+        locked_state(int fd,
+                     std::string_view id,
+                     const lock_policy& policy,
+                     uint64_t acquired)
+            : locked_(true),
+              fd_(fd),
+              id_(id),
+              policy_(policy),
+              acquired_(acquired) {}
+        locked_state(locked_state&& other)
+            : locked_(std::exchange(other.locked_, false)),
+              fd_(std::exchange(other.fd_, -1)),
+              id_(other.id_),
+              policy_(other.policy_),
+              acquired_(other.acquired_) {}
+        locked_state(const locked_state&) = delete;
+        ~locked_state();
+        void unlock();
+        void lock();
+        // Close the lock file without unlocking it. A forked process calls
+        // this to drop its copy of its parent's lock, which shares the
+        // parent's open file description.
+        void release();
+        bool locked_;
+        int fd_;
+        std::string_view id_;
+        lock_policy policy_;
+        // When the lock was taken, in flight recorder time
+        uint64_t acquired_;
+    };
+
+   public:
+    runtime_state(const std::filesystem::path& dir, std::string_view id)
+        : id_(id),
+          state_dir_(dir),
+          status_path_(dir / "status"),
+          state_json_(dir / "state.json"),
+          config_json_(dir / "config.json"),
+          annotations_json_(dir / "annotations.json"),
+          spec_path_(dir / "spec"),
+          state_lock_(dir / "state.lock") {}
+
+    auto get_id() const { return id_; }
+    // Containers created by older versions of the runtime have no status
+    // record, only a legacy state.json holding all of their state
+    auto exists() const {
+        return std::filesystem::is_regular_file(status_path_) ||
+               has_legacy_record();
+    }
+    auto& get_state_dir() const { return state_dir_; }
+
+    // Use a cache shared with other commands in this process to avoid
+    // re-reading state files which have not changed.
+    void set_cache(state_cache* cache) { cache_ = cache; }
+
+    // Update the state index through a mapping shared with other commands
+    // in this process rather than mapping it for each change.
+    void set_index(state_index* index) { index_ = index; }
+
+    // Set the timeout and reporting for the state lock
+    void set_lock_policy(const lock_policy& policy) { lock_policy_ = policy; }
+
+    // Check whether the container process has exited. This is safe to call
+    // without holding the state lock - the stopped status is only published
+    // if the lock can be taken without waiting.
+    //
+    // If the container has a monitor, its status record is up to date and
+    // we only probe the process if asked to, e.g. in case the monitor was
+    // killed.
+    void check_status(bool probe = false);
+
+    // Record that the container process has exited with the given wait
+    // status, if known.
+    void set_exited(std::optional<int> wait_status);
+
+    // Accessors for the status record
+    auto status() const { return record_.status; }
+    void set_status(container_status status) { record_.status = status; }
+    auto pid() const { return record_.pid; }
+    void set_pid(int pid) { record_.pid = pid; }
+    auto jid() const { return record_.jid; }
+    void set_jid(int jid) { record_.jid = jid; }
+    std::filesystem::path bundle() const { return record_.bundle; }
+    void set_bundle(const std::filesystem::path& bundle);
+    auto generation() const { return record_.generation; }
+    auto& record() const { return record_; }
+    void set_record(const status_record& record) { record_ = record; }
+    auto hook_mask() const { return record_.hook_mask; }
+    void set_hook_mask(uint32_t mask) { record_.hook_mask = mask; }
+    auto flags() const { return record_.flags; }
+    void add_flags(uint32_t flags) { record_.flags |= flags; }
+    std::optional<int> exit_status() const {
+        if (record_.flags & status_record::HAS_EXIT_STATUS) {
+            return record_.exit_status;
+        }
+        return std::nullopt;
+    }
+    auto& time(lifecycle_event ev) const { return record_.times[ev]; }
+    void set_time(lifecycle_event ev,
+                  lifecycle_time time = lifecycle_time::now()) {
+        record_.times[ev] = time;
+    }
+
+    // Runtime bookkeeping such as the root path and the actions needed to
+    // unmount volumes. This is only read by delete so it is stored separately
+    // from the status record.
+    bool contains(auto&& key) { return details_.contains(key); }
+    auto& operator[](auto&& key) { return details_[key]; }
+    const auto& operator[](auto&& key) const { return details_[key]; }
+
+    locked_state create();
+
+    // Remove the state directory and the container's state index entry and
+    // release its config, if the details are loaded
+    void remove_all();
+
+    // Load or save the status record. Loading does not require the state
+    // lock but save must only be called while holding it. Saving also
+    // updates the state index.
+    //
+    // If the container only has a legacy state.json, load reads the status,
+    // details and config from it into memory. The first save converts the
+    // container, writing its config, then its status record and then its
+    // details, so that lock-free readers see either the legacy record or a
+    // complete status record.
+    void load();
+    void save();
+
+    // Load or save the runtime bookkeeping. Loading does nothing for a
+    // legacy container whose details were read by load.
+    void load_details();
+    void save_details();
+
+    // The bundle config is written once by create and parsed on demand.
+    // Create passes the config's entry in the state database's config store
+    // together with the config text and, if it was read, the members
+    // returned by read_config. The stored files are linked into the state
+    // directory and the details record the entry's hash so that remove_all
+    // can release it.
+    void save_config(const nlohmann::json& config);
+    void save_config(const config_store::entry& entry,
+                     std::string_view text,
+                     const nlohmann::json* config);
+    const nlohmann::json& config() const;
+
+    // The compiled bundle config. This is loaded from the compiled copy kept
+    // with the config if possible, otherwise only the members used by the
+    // runtime are read and compiled.
+    const oci_spec& spec() const;
+
+    nlohmann::json report() const;
+
+    // The times of the lifecycle events which have happened, keyed by
+    // event name
+    nlohmann::json timings() const;
+
+    // Take the state lock, waiting for at most the lock policy's timeout.
+    // Throws lock_timeout if the lock is not taken in time.
+    locked_state lock();
+    std::optional<locked_state> try_lock();
+
+    // The process which holds the state lock or last held it, if known
+    std::optional<lock_holder> get_lock_holder() const;
+
+   private:
+    bool has_legacy_record() const;
+    bool load_legacy();
+
+    std::string_view id_;
+    status_record record_;
+    // Loaded from a legacy state.json which has not been converted yet
+    bool legacy_{false};
+    nlohmann::json details_;
+    mutable std::shared_ptr<const nlohmann::json> config_;
+    mutable std::shared_ptr<const oci_spec> spec_;
+    state_cache* cache_{nullptr};
+    state_index* index_{nullptr};
+    lock_policy lock_policy_;
+    std::filesystem::path state_dir_;
+    std::filesystem::path status_path_;
+    std::filesystem::path state_json_;
+    std::filesystem::path config_json_;
+    std::filesystem::path annotations_json_;
+    std::filesystem::path spec_path_;
+    std::filesystem::path state_lock_;
+};
+
+}  // namespace ocijail
@@ -0,0 +1,75 @@
+#include <signal.h>
+
+#include "ocijail/dispatch.h"
+#include "ocijail/serve.h"
+#include "ocijail/server.h"
+#include "ocijail/state_cache.h"
+#include "ocijail/state_index.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+namespace ocijail {
+
+static server* running_server;
+
+static void stop_server(int) {
+    if (running_server) {
+        running_server->stop();
+    }
+}
+
+void serve::init(main_app& app) {
+    app.add_command(std::shared_ptr<serve>{new serve{app}});
+}
+
+serve::serve(main_app& app) : app_(app) {
+    auto sub = app.add_subcommand(
+        "serve",
+        "Run a daemon which accepts start, state, kill, delete and list "
+        "requests on a Unix domain socket using the same JSON format as "
+        "batch. "
+        "Requests for different containers are handled concurrently. "
+        "Containers must be created with the create command. If "
+        "OCIJAIL_FORWARD is set to the socket path, the start, state, "
+        "kill and delete commands are forwarded to the daemon when it is "
+        "running.");
+    sub->add_option("--socket",
+                    socket_,
+                    "Path of the socket to listen on (default: "
+                    "<root>/ocijail.sock)");
+    sub->add_option(
+           "--threads", threads_, "Number of requests to handle concurrently")
+        ->check(CLI::PositiveNumber);
+    sub->final_callback([this] { run(); });
+}
+
+void serve::run() {
+    app_.set_long_running();
+    // The cache is shared by all threads - each thread has its own
+    // dispatcher and state index mapping. Create is not safe to run among
+    // other threads so it is refused.
+    state_cache cache;
+    app_.set_state_cache(&cache);
+    fs::create_directories(app_.get_state_db());
+
+    server srv{
+        socket_.value_or(default_socket(app_)),
+        threads_,
+        [this](const json& request) {
+            thread_local dispatcher d{app_, false};
+            return d.run(request);
+        },
+        [](const json& request) { return dispatcher::container_id(request); }};
+
+    running_server = &srv;
+    ::signal(SIGINT, stop_server);
+    ::signal(SIGTERM, stop_server);
+    ::signal(SIGPIPE, SIG_IGN);
+    srv.run();
+    running_server = nullptr;
+    app_.set_state_cache(nullptr);
+}
+
+}  // namespace ocijail
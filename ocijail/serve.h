@@ -0,0 +1,27 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+
+#include "ocijail/main.h"
+
+namespace ocijail {
+
+struct serve {
+    static void init(main_app& app);
+
+    // The socket used when --socket is not given
+    static std::filesystem::path default_socket(const main_app& app) {
+        return app.get_state_db() / "ocijail.sock";
+    }
+
+   private:
+    serve(main_app& app);
+    void run();
+
+    main_app& app_;
+    std::optional<std::filesystem::path> socket_;
+    int threads_{4};
+};
+
+}  // namespace ocijail
@@ -0,0 +1,385 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#include <system_error>
+
+#include "ocijail/server.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+namespace ocijail {
+
+// How long the accept loop waits before calling the idle callback
+static constexpr int IDLE_INTERVAL_MS = 1000;
+
+// Connections which don't complete a request within this time of starting
+// it are dropped
+static constexpr auto REQUEST_TIMEOUT = std::chrono::seconds{30};
+
+static sockaddr_un socket_address(const fs::path& path) {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.native().size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error{"socket path too long: " + path.native()};
+    }
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+static bool is_listening(const fs::path& path) {
+    auto addr = socket_address(path);
+    auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::system_error{errno, std::system_category(), "socket"};
+    }
+    auto res =
+        ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    ::close(fd);
+    return res;
+}
+
+// Read one newline-terminated line. Returns false on end of file.
+static bool read_line(int fd, std::string& buf, std::string& line) {
+    for (;;) {
+        auto i = buf.find('\n');
+        if (i != std::string::npos) {
+            line = buf.substr(0, i);
+            buf.erase(0, i + 1);
+            return true;
+        }
+        char tmp[4096];
+        auto n = ::read(fd, tmp, sizeof(tmp));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf.append(tmp, n);
+    }
+}
+
+// Write to a socket, without raising SIGPIPE if the peer has gone away
+static bool write_all(int fd, std::string_view data) {
+    while (data.size() > 0) {
+        auto n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data = data.substr(n);
+    }
+    return true;
+}
+
+server::server(const fs::path& path,
+               int nthreads,
+               handler_fn handler,
+               key_fn key)
+    : path_(path), handler_(std::move(handler)), key_(std::move(key)) {
+    auto addr = socket_address(path_);
+    listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+        throw std::system_error{errno, std::system_category(), "socket"};
+    }
+
+    // Replace a socket left behind by a previous server, unless it is still
+    // running.
+    if (fs::exists(fs::symlink_status(path_))) {
+        if (is_listening(path_)) {
+            ::close(listen_fd_);
+            throw std::runtime_error{"server already running on " +
+                                     path_.native()};
+        }
+        fs::remove(path_);
+    }
+    if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) <
+            0 ||
+        ::listen(listen_fd_, 128) < 0) {
+        auto saved_errno = errno;
+        ::close(listen_fd_);
+        throw std::system_error{
+            saved_errno, std::system_category(), "listen " + path_.native()};
+    }
+    if (::pipe(stop_pipe_) < 0 || ::pipe(wake_pipe_) < 0) {
+        auto saved_errno = errno;
+        ::close(listen_fd_);
+        throw std::system_error{saved_errno, std::system_category(), "pipe"};
+    }
+    for (auto fd : {stop_pipe_[0], stop_pipe_[1]}) {
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    // Neither end of the wake pipe may block - a full pipe will wake the
+    // accept loop anyway
+    for (auto fd : wake_pipe_) {
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        ::fcntl(fd, F_SETFL, O_NONBLOCK);
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        threads_.emplace_back([this] { worker(); });
+    }
+}
+
+server::~server() {
+    {
+        std::lock_guard lk{mutex_};
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) {
+        t.join();
+    }
+    for (auto& conn : idle_conns_) {
+        ::close(conn->fd);
+    }
+    for (auto& conn : returned_) {
+        ::close(conn->fd);
+    }
+    ::close(listen_fd_);
+    ::close(stop_pipe_[0]);
+    ::close(stop_pipe_[1]);
+    ::close(wake_pipe_[0]);
+    ::close(wake_pipe_[1]);
+    fs::remove(path_);
+}
+
+void server::stop() {
+    char ch = 0;
+    ::write(stop_pipe_[1], &ch, 1);
+}
+
+void server::run() {
+    std::vector<pollfd> fds;
+    for (;;) {
+        {
+            std::lock_guard lk{mutex_};
+            for (auto& conn : returned_) {
+                idle_conns_.push_back(std::move(conn));
+            }
+            returned_.clear();
+        }
+        fds.clear();
+        fds.push_back({listen_fd_, POLLIN, 0});
+        fds.push_back({stop_pipe_[0], POLLIN, 0});
+        fds.push_back({wake_pipe_[0], POLLIN, 0});
+        for (auto& conn : idle_conns_) {
+            fds.push_back({conn->fd, POLLIN, 0});
+        }
+        auto n = ::poll(fds.data(), fds.size(), IDLE_INTERVAL_MS);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error{errno, std::system_category(), "poll"};
+        }
+        if (fds[1].revents) {
+            return;
+        }
+        if (fds[2].revents) {
+            char tmp[64];
+            while (::read(wake_pipe_[0], tmp, sizeof(tmp)) > 0) {
+            }
+        }
+
+        // Hand readable connections to the workers and drop those which
+        // have not finished a request in time
+        auto now = std::chrono::steady_clock::now();
+        std::vector<connection_ptr> still_idle;
+        for (size_t i = 0; i < idle_conns_.size(); i++) {
+            auto& conn = idle_conns_[i];
+            if (fds[3 + i].revents) {
+                submit([this, conn] { serve_request(conn); });
+            } else if (conn->deadline && now >= *conn->deadline) {
+                ::close(conn->fd);
+            } else {
+                still_idle.push_back(std::move(conn));
+            }
+        }
+        idle_conns_ = std::move(still_idle);
+
+        if (fds[0].revents) {
+            auto fd = ::accept(listen_fd_, nullptr, nullptr);
+            if (fd >= 0) {
+                ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+                idle_conns_.push_back(
+                    std::make_shared<connection>(connection{fd, {}, {}}));
+            }
+        } else if (n == 0 && idle_) {
+            idle_();
+        }
+    }
+}
+
+void server::worker() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock lk{mutex_};
+            cv_.wait(lk, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+void server::submit(std::function<void()> task) {
+    {
+        std::lock_guard lk{mutex_};
+        tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+// Run fn now unless another request with the same key is running, in which
+// case queue it to be run by that request's thread when it finishes.
+void server::execute(const std::optional<std::string>& key,
+                     std::function<void()> fn) {
+    if (!key) {
+        fn();
+        return;
+    }
+    {
+        std::lock_guard lk{mutex_};
+        auto it = busy_.find(*key);
+        if (it != busy_.end()) {
+            it->second.push_back(std::move(fn));
+            return;
+        }
+        busy_[*key];
+    }
+    for (;;) {
+        fn();
+        std::lock_guard lk{mutex_};
+        auto it = busy_.find(*key);
+        if (it->second.empty()) {
+            busy_.erase(it);
+            return;
+        }
+        fn = std::move(it->second.front());
+        it->second.pop_front();
+    }
+}
+
+// Hand a connection back to the accept loop to wait for its next request
+void server::watch(connection_ptr conn) {
+    if (conn->buf.empty()) {
+        conn->deadline.reset();
+    } else if (!conn->deadline) {
+        conn->deadline = std::chrono::steady_clock::now() + REQUEST_TIMEOUT;
+    }
+    {
+        std::lock_guard lk{mutex_};
+        returned_.push_back(std::move(conn));
+    }
+    char ch = 0;
+    ::write(wake_pipe_[1], &ch, 1);
+}
+
+// Serve the next request if it has already been read, otherwise wait for it
+void server::next_request(connection_ptr conn) {
+    if (conn->buf.find('\n') != std::string::npos) {
+        submit([this, conn] { serve_request(conn); });
+    } else {
+        watch(std::move(conn));
+    }
+}
+
+// Read what has arrived on a connection without waiting and answer a
+// request if one is complete. Otherwise the connection goes back to the
+// accept loop.
+void server::serve_request(connection_ptr conn) {
+    auto fd = conn->fd;
+    for (;;) {
+        char tmp[4096];
+        auto n = ::recv(fd, tmp, sizeof(tmp), MSG_DONTWAIT);
+        if (n > 0) {
+            conn->buf.append(tmp, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        // End of file or an error - answer a request we already have
+        if (conn->buf.find('\n') == std::string::npos) {
+            ::close(fd);
+            return;
+        }
+        break;
+    }
+    auto i = conn->buf.find('\n');
+    if (i == std::string::npos) {
+        watch(std::move(conn));
+        return;
+    }
+    auto line = conn->buf.substr(0, i);
+    conn->buf.erase(0, i + 1);
+    conn->deadline.reset();
+
+    json request;
+    std::optional<std::string> key;
+    try {
+        request = json::parse(line);
+        key = key_(request);
+    } catch (const std::exception& e) {
+        json res;
+        res["status"] = 1;
+        res["error"] = e.what();
+        write_all(fd, res.dump() + "\n");
+        ::close(fd);
+        return;
+    }
+
+    // Requests for a key may be handed to another thread so we carry the
+    // connection along with the request.
+    execute(key, [this, conn, request = std::move(request)] {
+        json res;
+        try {
+            res = handler_(request);
+        } catch (const std::exception& e) {
+            res["status"] = 1;
+            res["error"] = e.what();
+        }
+        if (!write_all(conn->fd, res.dump() + "\n")) {
+            ::close(conn->fd);
+            return;
+        }
+        next_request(conn);
+    });
+}
+
+std::optional<json> call_server(const fs::path& path, const json& request) {
+    auto addr = socket_address(path);
+    auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::system_error{errno, std::system_category(), "socket"};
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        ::close(fd);
+        return std::nullopt;
+    }
+    std::string buf, line;
+    if (!write_all(fd, request.dump() + "\n") || !read_line(fd, buf, line)) {
+        ::close(fd);
+        throw std::runtime_error{"lost connection to " + path.native()};
+    }
+    ::close(fd);
+    return json::parse(line);
+}
+
+}  // namespace ocijail
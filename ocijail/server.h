@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+namespace ocijail {
+
+// A server which accepts JSON requests, one per line, on a Unix domain
+// socket and writes one JSON response per line. Requests are handled on a
+// pool of threads. Requests with the same key, typically a container id,
+// are handled one at a time in the order they arrived while requests for
+// different keys run concurrently.
+//
+// A connection may send any number of requests - each is answered before
+// the next is read. Between requests, connections are watched by the accept
+// loop so that idle clients don't occupy a thread.
+class server {
+   public:
+    using handler_fn = std::function<nlohmann::json(const nlohmann::json&)>;
+    using key_fn =
+        std::function<std::optional<std::string>(const nlohmann::json&)>;
+
+    server(const std::filesystem::path& path,
+           int nthreads,
+           handler_fn handler,
+           key_fn key);
+    server(const server&) = delete;
+    ~server();
+
+    // Accept connections until stop is called
+    void run();
+
+    // Stop accepting connections. Safe to call from any thread or from a
+    // signal handler.
+    void stop();
+
+    // Called periodically by the accept loop while idle
+    void set_idle_callback(std::function<void()> callback) {
+        idle_ = std::move(callback);
+    }
+
+   private:
+    struct connection {
+        int fd;
+        // Data read but not yet handled
+        std::string buf;
+        // When a partially read request must be complete by, if there is one
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+    };
+    using connection_ptr = std::shared_ptr<connection>;
+
+    void worker();
+    void submit(std::function<void()> task);
+    void serve_request(connection_ptr conn);
+    void next_request(connection_ptr conn);
+    void watch(connection_ptr conn);
+    void execute(const std::optional<std::string>& key,
+                 std::function<void()> fn);
+
+    std::filesystem::path path_;
+    handler_fn handler_;
+    key_fn key_;
+    std::function<void()> idle_;
+    int listen_fd_{-1};
+    int stop_pipe_[2]{-1, -1};
+    // Written to when a connection is handed back to the accept loop
+    int wake_pipe_[2]{-1, -1};
+    // Connections waiting for a request, only used by the accept loop
+    std::vector<connection_ptr> idle_conns_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_{false};
+    // Keys with a request in progress, with any requests waiting for them
+    std::map<std::string, std::deque<std::function<void()>>> busy_;
+    // Connections handed back to the accept loop
+    std::vector<connection_ptr> returned_;
+    std::vector<std::thread> threads_;
+};
+
+// Send a request to a server and return its response. Returns nothing if no
+// server is listening on the socket.
+std::optional<nlohmann::json> call_server(const std::filesystem::path& path,
+                                          const nlohmann::json& request);
+
+}  // namespace ocijail
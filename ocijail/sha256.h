@@ -0,0 +1,32 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace ocijail {
+
+// A small SHA-256 implementation for naming content in the state database.
+// This avoids a dependency on a crypto library for the one place where we
+// need a collision-resistant hash.
+class sha256 {
+   public:
+    sha256();
+
+    void update(std::string_view data);
+    std::array<uint8_t, 32> digest();
+
+    // Return the lower-case hex digest of some data
+    static std::string hex(std::string_view data);
+
+   private:
+    void transform(const uint8_t* block);
+
+    std::array<uint32_t, 8> h_;
+    std::array<uint8_t, 64> buf_;
+    size_t buflen_{0};
+    uint64_t total_{0};
+};
+
+}  // namespace ocijail
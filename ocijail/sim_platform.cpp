@@ -0,0 +1,404 @@
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+#include <thread>
+
+#include "ocijail/sim_platform.h"
+
+namespace ocijail {
+
+namespace {
+
+// The largest jid the kernel allocates
+constexpr int MAX_JID = 999999;
+
+// The wait status of a process which exited with status 1
+constexpr int EXIT_FAILURE_STATUS = 1 << 8;
+
+// The name/value pairs of a parameter list
+std::map<std::string, iovec*, std::less<>> parse_params(iovec* iov,
+                                                        unsigned niov) {
+    std::map<std::string, iovec*, std::less<>> res;
+    for (unsigned i = 0; i + 1 < niov; i += 2) {
+        auto name = static_cast<const char*>(iov[i].iov_base);
+        if (name) {
+            res[std::string{name, strnlen(name, iov[i].iov_len)}] =
+                &iov[i + 1];
+        }
+    }
+    return res;
+}
+
+std::string to_string(const iovec* value) {
+    if (!value->iov_base) {
+        return {};
+    }
+    return std::string{static_cast<const char*>(value->iov_base),
+                       value->iov_len};
+}
+
+// A string parameter without its terminating null
+std::string to_name(const iovec* value) {
+    auto s = static_cast<const char*>(value->iov_base);
+    return s ? std::string{s, strnlen(s, value->iov_len)} : std::string{};
+}
+
+int to_int(const iovec* value) {
+    int32_t res = 0;
+    if (value->iov_base && value->iov_len == sizeof(res)) {
+        std::memcpy(&res, value->iov_base, sizeof(res));
+    }
+    return res;
+}
+
+void copy_out(iovec* value, std::string_view data) {
+    if (!value->iov_base) {
+        return;
+    }
+    auto n = std::min(value->iov_len, data.size());
+    std::memcpy(value->iov_base, data.data(), n);
+    std::memset(static_cast<char*>(value->iov_base) + n,
+                0,
+                value->iov_len - n);
+}
+
+// Fail a jail call, setting errmsg as the kernel does
+template <typename Params>
+int fail(Params& params, int error, const std::string& msg) {
+    if (auto it = params.find("errmsg"); it != params.end()) {
+        copy_out(it->second, std::string_view{msg.c_str(), msg.size() + 1});
+    }
+    errno = error;
+    return -1;
+}
+
+int fail(int error) {
+    errno = error;
+    return -1;
+}
+
+std::string jail_not_found(int jid, const std::string& name) {
+    if (jid) {
+        return "jail " + std::to_string(jid) + " not found";
+    }
+    return "jail \"" + name + "\" not found";
+}
+
+}  // namespace
+
+int sim_platform::begin(sim_op op) {
+    std::chrono::microseconds latency;
+    int error = 0;
+    {
+        std::lock_guard lk{mutex_};
+        auto i = size_t(op);
+        calls_[i]++;
+        latency = latency_[i];
+        auto& f = faults_[i];
+        if (f.count > 0) {
+            if (f.skip > 0) {
+                f.skip--;
+            } else {
+                f.count--;
+                error = f.error;
+            }
+        }
+    }
+    if (latency.count() > 0) {
+        std::this_thread::sleep_for(latency);
+    }
+    return error;
+}
+
+sim_platform::jail_entry* sim_platform::find_jail(int jid) {
+    auto it = jails_.find(jid);
+    return it != jails_.end() ? &it->second : nullptr;
+}
+
+sim_platform::jail_entry* sim_platform::find_jail(const std::string& name) {
+    for (auto& [jid, j] : jails_) {
+        if (j.name == name) {
+            return &j;
+        }
+    }
+    return nullptr;
+}
+
+int sim_platform::allocate_jid() {
+    for (int i = 0; i < MAX_JID; i++) {
+        last_jid_ = last_jid_ >= MAX_JID ? 1 : last_jid_ + 1;
+        if (!jails_.contains(last_jid_)) {
+            return last_jid_;
+        }
+    }
+    return -1;
+}
+
+int sim_platform::jail_set(iovec* iov, unsigned niov, int flags) {
+    auto params = parse_params(iov, niov);
+    if (auto error = begin(sim_op::SET_JAIL)) {
+        return fail(params, error, strerror(error));
+    }
+    std::lock_guard lk{mutex_};
+    if (!(flags & (JAIL_CREATE | JAIL_UPDATE))) {
+        return fail(params, EINVAL, "no valid operation (create or update)");
+    }
+    int jid = 0;
+    std::string name;
+    if (auto it = params.find("jid"); it != params.end()) {
+        jid = to_int(it->second);
+    }
+    if (auto it = params.find("name"); it != params.end()) {
+        name = to_name(it->second);
+    }
+    auto j = jid ? find_jail(jid) : !name.empty() ? find_jail(name) : nullptr;
+    if (j) {
+        if (!(flags & JAIL_UPDATE)) {
+            return fail(params,
+                        EEXIST,
+                        "jail " + std::to_string(j->jid) + " already exists");
+        }
+    } else {
+        if (!(flags & JAIL_CREATE)) {
+            return fail(params, ENOENT, jail_not_found(jid, name));
+        }
+        // Nested jails are named after their parent
+        if (auto dot = name.rfind('.'); dot != std::string::npos) {
+            auto parent = name.substr(0, dot);
+            if (!find_jail(parent)) {
+                return fail(params, ENOENT, jail_not_found(0, parent));
+            }
+        }
+        if (jid == 0) {
+            jid = allocate_jid();
+            if (jid < 0) {
+                return fail(params, EAGAIN, "no free jail IDs");
+            }
+        }
+        j = &jails_[jid];
+        j->jid = jid;
+        j->name = name.empty() ? std::to_string(jid) : name;
+    }
+    for (auto& [key, value] : params) {
+        if (key != "jid" && key != "name" && key != "errmsg") {
+            j->params[key] = to_string(value);
+        }
+    }
+    return j->jid;
+}
+
+int sim_platform::jail_get(iovec* iov, unsigned niov, int flags) {
+    auto params = parse_params(iov, niov);
+    if (auto error = begin(sim_op::GET_JAIL)) {
+        return fail(params, error, strerror(error));
+    }
+    std::lock_guard lk{mutex_};
+    jail_entry* j = nullptr;
+    int jid = 0;
+    std::string name;
+    if (auto it = params.find("jid"); it != params.end()) {
+        jid = to_int(it->second);
+    }
+    if (auto it = params.find("name"); it != params.end()) {
+        name = to_name(it->second);
+    }
+    if (jid) {
+        j = find_jail(jid);
+    } else if (!name.empty()) {
+        j = find_jail(name);
+    } else if (auto it = params.find("lastjid"); it != params.end()) {
+        auto next = jails_.upper_bound(to_int(it->second));
+        if (next == jails_.end()) {
+            return fail(params, ENOENT, "no jail after " +
+                                            std::to_string(to_int(it->second)));
+        }
+        j = &next->second;
+    } else {
+        return fail(params, ENOENT, "no jail specified");
+    }
+    if (!j) {
+        return fail(params, ENOENT, jail_not_found(jid, name));
+    }
+    for (auto& [key, value] : params) {
+        if (key == "errmsg" || key == "lastjid") {
+            continue;
+        }
+        if (key == "jid") {
+            int32_t id = j->jid;
+            copy_out(value, std::string_view{reinterpret_cast<char*>(&id),
+                                             sizeof(id)});
+        } else if (key == "name") {
+            copy_out(value,
+                     std::string_view{j->name.c_str(), j->name.size() + 1});
+        } else if (auto it = j->params.find(key); it != j->params.end()) {
+            copy_out(value, it->second);
+        } else {
+            copy_out(value, {});
+        }
+    }
+    return j->jid;
+}
+
+int sim_platform::jail_attach(int jid) {
+    if (auto error = begin(sim_op::ATTACH_JAIL)) {
+        return fail(error);
+    }
+    std::lock_guard lk{mutex_};
+    if (!find_jail(jid)) {
+        return fail(EINVAL);
+    }
+    return 0;
+}
+
+int sim_platform::jail_remove(int jid) {
+    if (auto error = begin(sim_op::REMOVE_JAIL)) {
+        return fail(error);
+    }
+    std::lock_guard lk{mutex_};
+    auto j = find_jail(jid);
+    if (!j) {
+        return fail(EINVAL);
+    }
+    // Removing a jail also removes the jails nested in it
+    auto prefix = j->name + ".";
+    std::erase_if(jails_, [&](auto& entry) {
+        return entry.second.name.starts_with(prefix);
+    });
+    jails_.erase(jid);
+    return 0;
+}
+
+int sim_platform::nmount(iovec* iov, unsigned niov, int flags) {
+    if (auto error = begin(sim_op::MOUNT)) {
+        return fail(error);
+    }
+    std::lock_guard lk{mutex_};
+    mount_entry m;
+    m.flags = unsigned(flags);
+    for (auto& [key, value] : parse_params(iov, niov)) {
+        if (key == "fstype") {
+            m.fstype = to_name(value);
+        } else if (key == "fspath") {
+            m.fspath = to_name(value);
+        } else {
+            m.options[key] = to_name(value);
+        }
+    }
+    if (m.fstype.empty() || m.fspath.empty()) {
+        return fail(EINVAL);
+    }
+    if (m.flags & MNT_UPDATE) {
+        auto it = std::find_if(mounts_.rbegin(), mounts_.rend(), [&](auto& e) {
+            return e.fspath == m.fspath;
+        });
+        if (it == mounts_.rend()) {
+            return fail(EINVAL);
+        }
+        it->flags = m.flags & ~MNT_UPDATE;
+        for (auto& [key, value] : m.options) {
+            it->options[key] = value;
+        }
+        return 0;
+    }
+    // The mount point and a nullfs target are looked up on the host
+    if (::access(m.fspath.c_str(), F_OK) < 0) {
+        return -1;
+    }
+    if (auto it = m.options.find("target"); it != m.options.end()) {
+        if (::access(it->second.c_str(), F_OK) < 0) {
+            return -1;
+        }
+    }
+    mounts_.push_back(std::move(m));
+    return 0;
+}
+
+int sim_platform::unmount(const char* path, int flags) {
+    if (auto error = begin(sim_op::UNMOUNT)) {
+        return fail(error);
+    }
+    std::lock_guard lk{mutex_};
+    std::string_view fspath{path};
+    auto it = std::find_if(mounts_.rbegin(), mounts_.rend(), [&](auto& e) {
+        return e.fspath == fspath;
+    });
+    if (it == mounts_.rend()) {
+        return fail(EINVAL);
+    }
+    // Mounts made later beneath this one keep it busy, even when forced
+    auto prefix = std::string{fspath} + "/";
+    if (std::any_of(mounts_.rbegin(), it, [&](auto& e) {
+            return e.fspath.starts_with(prefix);
+        })) {
+        return fail(EBUSY);
+    }
+    mounts_.erase(std::next(it).base());
+    return 0;
+}
+
+int sim_platform::devfs(char* const argv[]) {
+    if (auto error = begin(sim_op::DEVFS)) {
+        return fail(error);
+    }
+    std::lock_guard lk{mutex_};
+    std::string mountpoint;
+    std::string rule;
+    for (int i = 1; argv[i]; i++) {
+        std::string_view arg{argv[i]};
+        if (arg == "-m" && argv[i + 1]) {
+            mountpoint = argv[++i];
+        } else {
+            rule += rule.empty() ? "" : " ";
+            rule += arg;
+        }
+    }
+    auto it = std::find_if(mounts_.rbegin(), mounts_.rend(), [&](auto& e) {
+        return e.fspath == mountpoint && e.fstype == "devfs";
+    });
+    if (it == mounts_.rend()) {
+        return EXIT_FAILURE_STATUS;
+    }
+    it->devfs_rules.push_back(std::move(rule));
+    return 0;
+}
+
+void sim_platform::set_latency(sim_op op, std::chrono::microseconds latency) {
+    std::lock_guard lk{mutex_};
+    latency_[size_t(op)] = latency;
+}
+
+void sim_platform::inject_fault(sim_op op,
+                                int error,
+                                unsigned skip,
+                                unsigned count) {
+    std::lock_guard lk{mutex_};
+    faults_[size_t(op)] = {error, skip, count};
+}
+
+void sim_platform::clear_faults() {
+    std::lock_guard lk{mutex_};
+    faults_ = {};
+}
+
+unsigned sim_platform::calls(sim_op op) const {
+    std::lock_guard lk{mutex_};
+    return calls_[size_t(op)];
+}
+
+std::vector<sim_platform::jail_entry> sim_platform::jails() const {
+    std::lock_guard lk{mutex_};
+    std::vector<jail_entry> res;
+    for (auto& [jid, j] : jails_) {
+        res.push_back(j);
+    }
+    return res;
+}
+
+std::vector<sim_platform::mount_entry> sim_platform::mounts() const {
+    std::lock_guard lk{mutex_};
+    return mounts_;
+}
+
+}  // namespace ocijail
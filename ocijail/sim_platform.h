@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ocijail/platform.h"
+
+namespace ocijail {
+
+// The operations of sim_platform, for latencies, faults and call counts
+enum class sim_op {
+    SET_JAIL,
+    GET_JAIL,
+    ATTACH_JAIL,
+    REMOVE_JAIL,
+    MOUNT,
+    UNMOUNT,
+    DEVFS,
+    NUM_OPS,
+};
+
+constexpr size_t NUM_SIM_OPS = size_t(sim_op::NUM_OPS);
+
+// A platform which models jails and the mount table in memory, so that the
+// runtime's whole lifecycle can be run, measured and fault tested on any
+// host. Jails get jids and names as the kernel allocates them, keep their
+// parameters and can be nested by name. Mounts stack on their mount points
+// and can't be unmounted while something is mounted beneath them. Nothing
+// is done to the host: attaching to a jail leaves the process where it is.
+//
+// The model belongs to the process which uses it. A child sees the model
+// as it was when it forked, and its changes are not seen by its parent, so
+// this suits drivers which run commands in-process, such as benchmarks and
+// tests.
+class sim_platform : public platform {
+   public:
+    struct jail_entry {
+        int jid;
+        std::string name;
+        // Parameter values as passed to jail_set
+        std::map<std::string, std::string> params;
+    };
+
+    struct mount_entry {
+        std::string fstype;
+        std::string fspath;
+        uint64_t flags;
+        // The other options passed to nmount, e.g. target for nullfs
+        std::map<std::string, std::string> options;
+        // The arguments to each devfs rule applied to the mount
+        std::vector<std::string> devfs_rules;
+    };
+
+    int jail_set(iovec* iov, unsigned niov, int flags) override;
+    int jail_get(iovec* iov, unsigned niov, int flags) override;
+    int jail_attach(int jid) override;
+    int jail_remove(int jid) override;
+    int nmount(iovec* iov, unsigned niov, int flags) override;
+    int unmount(const char* path, int flags) override;
+    int devfs(char* const argv[]) override;
+
+    // Delay each call of op by the given time, modelling the kernel's cost
+    void set_latency(sim_op op, std::chrono::microseconds latency);
+
+    // Make count calls of op fail with error, after skip calls succeed
+    void inject_fault(sim_op op,
+                      int error,
+                      unsigned skip = 0,
+                      unsigned count = 1);
+    void clear_faults();
+
+    // The number of calls of op, including those which failed
+    unsigned calls(sim_op op) const;
+
+    std::vector<jail_entry> jails() const;
+    std::vector<mount_entry> mounts() const;
+
+   private:
+    struct fault {
+        int error{0};
+        unsigned skip{0};
+        unsigned count{0};
+    };
+
+    // Count a call, wait for its latency and return the error to fail it
+    // with, if any
+    int begin(sim_op op);
+    jail_entry* find_jail(int jid);
+    jail_entry* find_jail(const std::string& name);
+    int allocate_jid();
+
+    mutable std::mutex mutex_;
+    std::array<std::chrono::microseconds, NUM_SIM_OPS> latency_{};
+    std::array<fault, NUM_SIM_OPS> faults_{};
+    std::array<unsigned, NUM_SIM_OPS> calls_{};
+    std::map<int, jail_entry> jails_;
+    int last_jid_{0};
+    std::vector<mount_entry> mounts_;
+};
+
+}  // namespace ocijail
@@ -0,0 +1,829 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <algorithm>
+#include <concepts>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_set>
+
+#include "ocijail/spec.h"
+
+using nlohmann::json;
+
+namespace ocijail {
+
+void malformed_config(std::string_view message) {
+    std::stringstream ss;
+    ss << "create: malformed config: " << message;
+    throw std::runtime_error(ss.str());
+}
+
+const char* const hook_phase_names[NUM_HOOK_PHASES] = {
+    "prestart",
+    "createRuntime",
+    "createContainer",
+    "startContainer",
+    "poststart",
+    "poststop",
+};
+
+oci_version parse_version(std::string_view ociver) {
+    std::vector<std::string_view> parts;
+    auto tmp = ociver;
+    // Trim off any -rc.x or -dev suffix first
+    auto i = tmp.find_first_of("-");
+    if (i != std::string_view::npos) {
+        auto suffix = tmp.substr(i + 1);
+        if (suffix.substr(0, 3) != "rc." && suffix != "dev") {
+            throw std::runtime_error("malformed ociVersion " +
+                                     std::string(ociver));
+        }
+        tmp = tmp.substr(0, i);
+    }
+    while (tmp.size() > 0) {
+        auto i = tmp.find_first_of(".");
+        if (i != std::string_view::npos) {
+            parts.push_back(tmp.substr(0, i));
+            tmp = tmp.substr(i + 1);
+        } else {
+            parts.push_back(tmp);
+            tmp = "";
+        }
+    }
+    if (parts.size() != 3) {
+        throw std::runtime_error("malformed ociVersion " + std::string(ociver));
+    }
+    return oci_version{
+        std::string{parts[0]}, std::string{parts[1]}, std::string{parts[2]}};
+}
+
+// Look up an optional field, returning nullptr if it is absent
+static const json* field(const json& j, const char* key) {
+    auto it = j.find(key);
+    return it == j.end() ? nullptr : &*it;
+}
+
+static void copy_strings(const json& j,
+                         std::vector<std::string>& out,
+                         const char* not_array,
+                         const char* not_strings) {
+    if (!j.is_array()) {
+        malformed_config(not_array);
+    }
+    out.reserve(j.size());
+    for (auto& s : j) {
+        if (!s.is_string()) {
+            malformed_config(not_strings);
+        }
+        out.push_back(s.get_ref<const std::string&>());
+    }
+}
+
+process_spec compile_process(const json& process_json) {
+    process_spec res;
+    if (!process_json.is_object()) {
+        malformed_config("process must be an object");
+    }
+
+    auto cwd = field(process_json, "cwd");
+    if (!cwd) {
+        malformed_config("no process.cwd");
+    }
+    if (!cwd->is_string()) {
+        malformed_config("process.cwd must be a string");
+    }
+    res.cwd = cwd->get_ref<const std::string&>();
+
+    auto args = field(process_json, "args");
+    if (!args) {
+        malformed_config("no process.args");
+    }
+    copy_strings(*args,
+                 res.args,
+                 "process.args must be an array",
+                 "process.args must be an array of strings");
+    if (res.args.size() == 0) {
+        malformed_config("process.args must have at least one element");
+    }
+
+    auto user = field(process_json, "user");
+    if (user && !user->is_null()) {
+        if (!user->is_object()) {
+            malformed_config("process.user must be an object");
+        }
+        auto uid = field(*user, "uid");
+        if (!uid || !uid->is_number()) {
+            malformed_config("process.user.uid must be a number");
+        }
+        res.uid = *uid;
+        auto gid = field(*user, "gid");
+        if (!gid || !gid->is_number()) {
+            malformed_config("process.user.gid must be a number");
+        }
+        res.gid = *gid;
+        if (auto umask = field(*user, "umask")) {
+            if (!umask->is_number()) {
+                malformed_config("process.user.umask must be a number");
+            }
+            res.umask = *umask;
+        }
+        res.gids.push_back(res.gid);
+        if (auto gids = field(*user, "additionalGids")) {
+            if (!gids->is_array()) {
+                malformed_config(
+                    "process.user.additionalGids must be an array");
+            }
+            for (auto& gid : *gids) {
+                if (!gid.is_number()) {
+                    malformed_config(
+                        "process.user.additionalGids must be an array of "
+                        "numbers");
+                }
+                res.gids.push_back(gid);
+            }
+        }
+    } else {
+        res.gids.push_back(res.gid);
+    }
+
+    if (auto env = field(process_json, "env")) {
+        copy_strings(*env,
+                     res.env,
+                     "process.env must be an array",
+                     "process.env must be an array of strings");
+    }
+
+    if (auto terminal = field(process_json, "terminal")) {
+        if (!terminal->is_boolean()) {
+            malformed_config("process.terminal must be a boolean");
+        }
+        res.terminal = *terminal;
+    }
+    return res;
+}
+
+static void compile_mounts(const json& config_mounts,
+                           std::vector<mount_spec>& mounts) {
+    if (!config_mounts.is_array()) {
+        malformed_config("mounts must be an array");
+    }
+    mounts.reserve(config_mounts.size());
+    for (auto& mount : config_mounts) {
+        if (!mount.is_object()) {
+            malformed_config("mounts must be an array of objects");
+        }
+        auto& m = mounts.emplace_back();
+        auto destination = field(mount, "destination");
+        if (!destination || !destination->is_string()) {
+            malformed_config("mount destination must be a string");
+        }
+        m.destination = destination->get_ref<const std::string&>();
+        if (auto source = field(mount, "source")) {
+            if (!source->is_string()) {
+                malformed_config("if present, mount source must be a string");
+            }
+            m.source = source->get_ref<const std::string&>();
+        }
+        m.type = "nullfs";
+        if (auto type = field(mount, "type")) {
+            if (!type->is_string()) {
+                malformed_config("if present, mount type must be a string");
+            }
+            // TODO: stop mapping "bind" when podman syncs with buildah
+            // fixes to avoid using it on FreeBSD.
+            auto& t = type->get_ref<const std::string&>();
+            if (t != "bind") {
+                m.type = t;
+            }
+        }
+        if (auto options = field(mount, "options")) {
+            if (!options->is_array()) {
+                malformed_config("if present, mount options must be an array");
+            }
+            m.options.reserve(options->size());
+            for (auto& opt : *options) {
+                if (!opt.is_string()) {
+                    malformed_config(
+                        "if present, mount options must be an array of "
+                        "strings");
+                }
+                std::string_view s = opt.get_ref<const std::string&>();
+                auto sep = s.find('=');
+                if (sep == std::string_view::npos) {
+                    m.options.push_back({std::string{s}, {}});
+                } else {
+                    m.options.push_back({std::string{s.substr(0, sep)},
+                                         std::string{s.substr(sep + 1)}});
+                }
+            }
+        }
+    }
+}
+
+static void compile_hooks(const json& config_hooks,
+                          std::array<std::vector<hook_spec>, NUM_HOOK_PHASES>&
+                              hooks) {
+    if (!config_hooks.is_object()) {
+        malformed_config("hooks must be an object");
+    }
+    for (unsigned phase = 0; phase < NUM_HOOK_PHASES; phase++) {
+        auto a = field(config_hooks, hook_phase_names[phase]);
+        if (!a) {
+            continue;
+        }
+        if (!a->is_array()) {
+            malformed_config("hook lists must be arrays");
+        }
+        hooks[phase].reserve(a->size());
+        for (auto& hook : *a) {
+            auto path = hook.is_object() ? field(hook, "path") : nullptr;
+            if (!path) {
+                malformed_config("hook must have a path property");
+            }
+            if (!path->is_string()) {
+                malformed_config("hook.path must be a string");
+            }
+            auto& h = hooks[phase].emplace_back();
+            h.path = path->get_ref<const std::string&>();
+            if (auto args = field(hook, "args")) {
+                copy_strings(*args,
+                             h.args.emplace(),
+                             "hook.args must be an array",
+                             "hook.args elements must be strings");
+            }
+            if (auto env = field(hook, "env")) {
+                copy_strings(*env,
+                             h.env.emplace(),
+                             "hook.env must be an array",
+                             "hook.env elements must be strings");
+            }
+            if (auto timeout = field(hook, "timeout")) {
+                if (!timeout->is_number()) {
+                    malformed_config("hook.timeout must be a number");
+                }
+                h.timeout = *timeout;
+            }
+        }
+    }
+}
+
+static ns_mode parse_ns(const std::string& key, const json& value) {
+    if (value.is_string()) {
+        auto& val = value.get_ref<const std::string&>();
+        if (val == "new") {
+            return ns_mode::NEW;
+        } else if (val == "inherit") {
+            return ns_mode::INHERIT;
+        } else if (val == "disable") {
+            return ns_mode::DISABLED;
+        }
+        throw std::runtime_error("bad value for " + key + ": " + val);
+    }
+    throw std::runtime_error("bad value for " + key + ": " + value.dump());
+}
+
+// Parse a comma-separated list of addresses into packed in_addr or in6_addr
+// values
+template <int AF, typename ADDR>
+static std::vector<uint8_t> parse_addrs(const json& value,
+                                        const char* annotation) {
+    if (!value.is_string()) {
+        throw std::runtime_error(std::string{"bad value for "} + annotation +
+                                 ": " + value.dump());
+    }
+    std::string_view list = value.get_ref<const std::string&>();
+    std::vector<uint8_t> addrs;
+    std::string token;
+    while (list.size() > 0) {
+        auto end = list.find(',');
+        token = list.substr(0, end);
+        if (!token.empty()) {
+            ADDR addr{};
+            if (inet_pton(AF, token.c_str(), &addr) != 1) {
+                throw std::runtime_error(std::string{"bad value for "} +
+                                         annotation + ": " + token);
+            }
+            auto* p = reinterpret_cast<uint8_t*>(&addr);
+            addrs.insert(addrs.end(), p, p + sizeof(addr));
+        }
+        list = end == std::string_view::npos ? "" : list.substr(end + 1);
+    }
+    return addrs;
+}
+
+static void compile_annotations(const json& config_annotations,
+                                annotation_spec& res) {
+    // Only parameters known to the FreeBSD jail subsystem are accepted;
+    // unknown parameters are reported and ignored. The kernel remains the
+    // final authority and will reject any parameter it does not recognise.
+    static const std::unordered_set<std::string_view> known_allow_params = {
+        "allow.adjtime",       "allow.chflags",
+        "allow.extattr",       "allow.mlock",
+        "allow.mount",         "allow.mount.devfs",
+        "allow.mount.fdescfs", "allow.mount.nullfs",
+        "allow.mount.procfs",  "allow.mount.tmpfs",
+        "allow.mount.zfs",     "allow.nfsd",
+        "allow.quotas",        "allow.raw_sockets",
+        "allow.read_msgbuf",   "allow.reserved_ports",
+        "allow.routing",       "allow.set_hostname",
+        "allow.setaudit",      "allow.settime",
+        "allow.socket_af",     "allow.suser",
+        "allow.sysvipc",       "allow.unprivileged_parent_tampering",
+        "allow.unprivileged_proc_debug",
+    };
+    static constexpr std::string_view allow_prefix = "org.freebsd.jail.allow.";
+
+    if (!config_annotations.is_object()) {
+        malformed_config("annotations must be an object");
+    }
+    const json* ip4_addr = nullptr;
+    const json* ip6_addr = nullptr;
+    const json* ip6_add = nullptr;
+    for (auto& [key, value] : config_annotations.items()) {
+        if (key == "org.freebsd.parentJail") {
+            if (!value.is_string()) {
+                malformed_config("org.freebsd.parentJail must be a string");
+            }
+            res.parent_jail = value.get_ref<const std::string&>();
+        } else if (key == "org.freebsd.jail.vnet") {
+            res.vnet = parse_ns(key, value);
+        } else if (key == "org.freebsd.jail.sysvmsg") {
+            res.sysvmsg = parse_ns(key, value);
+        } else if (key == "org.freebsd.jail.sysvsem") {
+            res.sysvsem = parse_ns(key, value);
+        } else if (key == "org.freebsd.jail.sysvshm") {
+            res.sysvshm = parse_ns(key, value);
+        } else if (key == "org.freebsd.jail.ip4.addr") {
+            ip4_addr = &value;
+        } else if (key == "org.freebsd.jail.ip6.addr") {
+            ip6_addr = &value;
+        } else if (key == "org.freebsd.jail.ip6.add") {
+            ip6_add = &value;
+        } else if (key.starts_with(allow_prefix) && value.is_string()) {
+            auto param = "allow." + key.substr(allow_prefix.size());
+            auto& val = value.get_ref<const std::string&>();
+            if (!known_allow_params.count(param)) {
+                res.unknown_allow.push_back(key);
+            } else if (val == "true" || val == "1") {
+                res.allow_params.push_back(std::move(param));
+            }
+        }
+    }
+
+    if (res.vnet == ns_mode::DISABLED) {
+        throw std::runtime_error(
+            "bad value for org.freebsd.jail.vnet: disable");
+    }
+    if (res.vnet == ns_mode::INHERIT) {
+        if (ip4_addr) {
+            res.ip4_addrs = parse_addrs<AF_INET, in_addr>(
+                *ip4_addr, "org.freebsd.jail.ip4.addr");
+        }
+        if (!ip6_addr) {
+            ip6_addr = ip6_add;
+        }
+        if (ip6_addr) {
+            res.ip6_addrs = parse_addrs<AF_INET6, in6_addr>(
+                *ip6_addr, "org.freebsd.jail.ip6.addr");
+        }
+    }
+}
+
+oci_spec oci_spec::compile(const json& config) {
+    oci_spec res;
+    if (!config.is_object()) {
+        malformed_config("config must be an object");
+    }
+
+    auto version = field(config, "ociVersion");
+    if (!version) {
+        malformed_config("no ociVersion");
+    }
+    if (!version->is_string()) {
+        malformed_config("ociVersion must be a string");
+    }
+    // Allow 1.0.x, 1.1.x and 1.2.x
+    auto& ver = version->get_ref<const std::string&>();
+    res.version = parse_version(ver);
+    if (res.version.major != "1" ||
+        !(res.version.minor == "0" || res.version.minor == "1" ||
+          res.version.minor == "2")) {
+        throw std::runtime_error{"create: unsupported OCI version " + ver};
+    }
+
+    auto process = field(config, "process");
+    if (!process) {
+        malformed_config("no process");
+    }
+    res.process = compile_process(*process);
+
+    if (auto root = field(config, "root")) {
+        if (!root->is_object()) {
+            malformed_config("root must be an object");
+        }
+        if (auto path = field(*root, "path")) {
+            if (!path->is_string()) {
+                malformed_config("root.path must be a string");
+            }
+            res.root_path = path->get_ref<const std::string&>();
+        }
+        if (auto readonly = field(*root, "readonly")) {
+            if (!readonly->is_boolean()) {
+                malformed_config("root.readonly must be a boolean");
+            }
+            res.root_readonly = *readonly;
+        }
+    }
+
+    if (auto hostname = field(config, "hostname")) {
+        if (!hostname->is_string()) {
+            malformed_config("hostname must be a string");
+        }
+        res.hostname = hostname->get_ref<const std::string&>();
+    }
+
+    if (auto mounts = field(config, "mounts"); mounts && !mounts->is_null()) {
+        compile_mounts(*mounts, res.mounts);
+    }
+
+    if (auto hooks = field(config, "hooks"); hooks && !hooks->is_null()) {
+        compile_hooks(*hooks, res.hooks);
+    }
+
+    if (auto annotations = field(config, "annotations")) {
+        compile_annotations(*annotations, res.annotations);
+    }
+
+    return res;
+}
+
+namespace {
+
+// A SAX handler which builds a json value for the members of the config used
+// by compile and skips everything else without allocating.
+class config_reader : public json::json_sax_t {
+   public:
+    json& result() { return root_; }
+
+    bool null() override { return add(nullptr); }
+    bool boolean(bool val) override { return add(val); }
+    bool number_integer(number_integer_t val) override { return add(val); }
+    bool number_unsigned(number_unsigned_t val) override { return add(val); }
+    bool number_float(number_float_t val, const string_t&) override {
+        return add(val);
+    }
+    bool string(string_t& val) override { return add(val); }
+    bool binary(binary_t& val) override { return add(json::binary(val)); }
+
+    bool start_object(std::size_t) override {
+        if (skipping()) {
+            skip_++;
+        } else {
+            stack_.push_back(insert(json::object()));
+        }
+        return true;
+    }
+    bool end_object() override {
+        if (skip_ > 0) {
+            skip_--;
+        } else {
+            stack_.pop_back();
+        }
+        return true;
+    }
+    bool start_array(std::size_t) override {
+        if (skipping()) {
+            skip_++;
+        } else {
+            stack_.push_back(insert(json::array()));
+        }
+        return true;
+    }
+    bool end_array() override { return end_object(); }
+
+    bool key(string_t& val) override {
+        if (skip_ > 0) {
+            return true;
+        }
+        if (stack_.size() == 1) {
+            top_key_ = val;
+            skip_next_ = !used(top_members, val);
+        } else if (stack_.size() == 2 && top_key_ == "process") {
+            skip_next_ = !used(process_members, val);
+        }
+        key_ = val;
+        return true;
+    }
+
+    bool parse_error(std::size_t,
+                     const std::string&,
+                     const nlohmann::detail::exception& ex) override {
+        if (auto pe = dynamic_cast<const json::parse_error*>(&ex)) {
+            throw *pe;
+        }
+        throw std::runtime_error(ex.what());
+    }
+
+   private:
+    static constexpr std::string_view top_members[] = {
+        "annotations",
+        "hooks",
+        "hostname",
+        "mounts",
+        "ociVersion",
+        "process",
+        "root",
+    };
+    static constexpr std::string_view process_members[] = {
+        "args",
+        "cwd",
+        "env",
+        "terminal",
+        "user",
+    };
+
+    static bool used(const auto& members, std::string_view key) {
+        return std::find(std::begin(members), std::end(members), key) !=
+               std::end(members);
+    }
+
+    // Returns true if the next value should not be stored, either because
+    // it is inside a skipped container or because its key is unused.
+    bool skipping() {
+        if (skip_ > 0) {
+            return true;
+        }
+        return std::exchange(skip_next_, false);
+    }
+
+    template <typename T>
+    bool add(T&& val) {
+        if (!skipping()) {
+            insert(json(std::forward<T>(val)));
+        }
+        return true;
+    }
+
+    json* insert(json&& val) {
+        if (stack_.empty()) {
+            root_ = std::move(val);
+            return &root_;
+        }
+        auto& parent = *stack_.back();
+        if (parent.is_array()) {
+            parent.push_back(std::move(val));
+            return &parent.back();
+        }
+        auto& obj = parent.get_ref<json::object_t&>();
+        return &obj.insert_or_assign(key_, std::move(val)).first->second;
+    }
+
+    json root_;
+    std::vector<json*> stack_;
+    std::string key_;
+    std::string top_key_;
+    int skip_{0};
+    bool skip_next_{false};
+};
+
+}  // namespace
+
+json read_config(std::istream& in) {
+    config_reader reader;
+    json::sax_parse(in, &reader);
+    return std::move(reader.result());
+}
+
+json read_config(std::string_view text) {
+    config_reader reader;
+    json::sax_parse(text, &reader);
+    return std::move(reader.result());
+}
+
+// The members of each compiled type, in encoding order. The same function is
+// used with a const value for encoding and a mutable one for decoding.
+template <typename S, typename T>
+concept either = std::same_as<std::remove_const_t<S>, T>;
+
+template <typename F, either<oci_version> S>
+static void members(F& f, S& s) {
+    f(s.major);
+    f(s.minor);
+    f(s.patch);
+}
+
+template <typename F, either<process_spec> S>
+static void members(F& f, S& s) {
+    f(s.cwd);
+    f(s.args);
+    f(s.env);
+    f(s.uid);
+    f(s.gid);
+    f(s.gids);
+    f(s.umask);
+    f(s.terminal);
+}
+
+template <typename F, either<mount_spec::option> S>
+static void members(F& f, S& s) {
+    f(s.key);
+    f(s.value);
+}
+
+template <typename F, either<mount_spec> S>
+static void members(F& f, S& s) {
+    f(s.destination);
+    f(s.source);
+    f(s.type);
+    f(s.options);
+}
+
+template <typename F, either<hook_spec> S>
+static void members(F& f, S& s) {
+    f(s.path);
+    f(s.args);
+    f(s.env);
+    f(s.timeout);
+}
+
+template <typename F, either<annotation_spec> S>
+static void members(F& f, S& s) {
+    f(s.parent_jail);
+    f(s.vnet);
+    f(s.sysvmsg);
+    f(s.sysvsem);
+    f(s.sysvshm);
+    f(s.ip4_addrs);
+    f(s.ip6_addrs);
+    f(s.allow_params);
+    f(s.unknown_allow);
+}
+
+template <typename F, either<oci_spec> S>
+static void members(F& f, S& s) {
+    f(s.version);
+    f(s.process);
+    f(s.root_path);
+    f(s.root_readonly);
+    f(s.hostname);
+    f(s.mounts);
+    f(s.hooks);
+    f(s.annotations);
+}
+
+// Identifies the encoding. Change the version when changing any of the
+// compiled types.
+static constexpr uint32_t SPEC_MAGIC = 0x6f637370;  // "ocsp"
+static constexpr uint32_t SPEC_VERSION = 1;
+
+namespace {
+
+template <typename T>
+concept scalar = std::is_arithmetic_v<T> || std::is_enum_v<T>;
+
+class encoder {
+   public:
+    std::string out;
+
+    template <scalar T>
+    void operator()(const T& val) {
+        out.append(reinterpret_cast<const char*>(&val), sizeof(val));
+    }
+    void operator()(const std::string& val) {
+        (*this)(uint32_t(val.size()));
+        out.append(val);
+    }
+    template <typename T>
+    void operator()(const std::vector<T>& val) {
+        (*this)(uint32_t(val.size()));
+        for (auto& v : val) {
+            (*this)(v);
+        }
+    }
+    template <typename T>
+    void operator()(const std::optional<T>& val) {
+        (*this)(bool(val));
+        if (val) {
+            (*this)(*val);
+        }
+    }
+    template <typename T, size_t N>
+    void operator()(const std::array<T, N>& val) {
+        for (auto& v : val) {
+            (*this)(v);
+        }
+    }
+    template <typename T>
+    requires std::is_class_v<T>
+    void operator()(const T& val) {
+        members(*this, val);
+    }
+};
+
+// Throws std::out_of_range if the data is truncated
+class decoder {
+   public:
+    decoder(std::string_view in) : in_(in) {}
+
+    bool done() const { return in_.empty(); }
+
+    template <scalar T>
+    void operator()(T& val) {
+        std::memcpy(&val, take(sizeof(val)).data(), sizeof(val));
+    }
+    void operator()(std::string& val) {
+        uint32_t n;
+        (*this)(n);
+        val = take(n);
+    }
+    template <typename T>
+    void operator()(std::vector<T>& val) {
+        uint32_t n;
+        (*this)(n);
+        val.clear();
+        // Each element takes at least one byte so this bounds the
+        // allocation by the size of the data
+        val.reserve(std::min<size_t>(n, in_.size()));
+        for (uint32_t i = 0; i < n; i++) {
+            (*this)(val.emplace_back());
+        }
+    }
+    template <typename T>
+    void operator()(std::optional<T>& val) {
+        bool present;
+        (*this)(present);
+        if (present) {
+            (*this)(val.emplace());
+        } else {
+            val.reset();
+        }
+    }
+    template <typename T, size_t N>
+    void operator()(std::array<T, N>& val) {
+        for (auto& v : val) {
+            (*this)(v);
+        }
+    }
+    template <typename T>
+    requires std::is_class_v<T>
+    void operator()(T& val) {
+        members(*this, val);
+    }
+
+   private:
+    std::string_view take(size_t n) {
+        if (n > in_.size()) {
+            throw std::out_of_range("truncated spec");
+        }
+        auto res = in_.substr(0, n);
+        in_ = in_.substr(n);
+        return res;
+    }
+
+    std::string_view in_;
+};
+
+}  // namespace
+
+std::string oci_spec::encode() const {
+    encoder e;
+    e(SPEC_MAGIC);
+    e(SPEC_VERSION);
+    e(*this);
+    return std::move(e.out);
+}
+
+std::optional<oci_spec> oci_spec::decode(std::string_view data) {
+    decoder d{data};
+    try {
+        uint32_t magic, version;
+        d(magic);
+        d(version);
+        if (magic != SPEC_MAGIC || version != SPEC_VERSION) {
+            return std::nullopt;
+        }
+        oci_spec res;
+        d(res);
+        if (!d.done()) {
+            return std::nullopt;
+        }
+        return res;
+    } catch (const std::out_of_range&) {
+        return std::nullopt;
+    }
+}
+
+uint32_t oci_spec::hook_mask() const {
+    uint32_t mask = 0;
+    for (unsigned phase = 0; phase < NUM_HOOK_PHASES; phase++) {
+        if (!hooks[phase].empty()) {
+            mask |= 1u << phase;
+        }
+    }
+    return mask;
+}
+
+}  // namespace ocijail
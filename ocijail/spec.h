@@ -0,0 +1,138 @@
+#pragma once
+
+#include <sys/types.h>
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+namespace ocijail {
+
+// Report a problem with the bundle config by throwing an error
+void malformed_config(std::string_view message);
+
+struct oci_version {
+    std::string major;
+    std::string minor;
+    std::string patch;
+};
+
+oci_version parse_version(std::string_view ociver);
+
+// The container process, from either process in the bundle config or the
+// process json given to exec
+struct process_spec {
+    std::string cwd;
+    std::vector<std::string> args;
+    std::vector<std::string> env;
+    uid_t uid{0};
+    gid_t gid{0};
+    // The primary gid followed by any additional gids
+    std::vector<gid_t> gids;
+    mode_t umask{077};
+    bool terminal{false};
+};
+
+struct mount_spec {
+    struct option {
+        std::string key;
+        // Empty if the option has no '='
+        std::string value;
+    };
+
+    std::string destination;
+    // Empty if the mount has no source
+    std::string source;
+    // Defaults to nullfs. The Linux-style "bind" type is also mapped to
+    // nullfs.
+    std::string type;
+    std::vector<option> options;
+};
+
+struct hook_spec {
+    std::string path;
+    std::optional<std::vector<std::string>> args;
+    std::optional<std::vector<std::string>> env;
+    std::optional<int> timeout;
+};
+
+// The hook phases, in the order used for runtime_state::hook_mask
+enum hook_phase : unsigned {
+    PRESTART,
+    CREATE_RUNTIME,
+    CREATE_CONTAINER,
+    START_CONTAINER,
+    POSTSTART,
+    POSTSTOP,
+    NUM_HOOK_PHASES,
+};
+
+extern const char* const hook_phase_names[NUM_HOOK_PHASES];
+
+// Values for the org.freebsd.jail.{vnet,sysvmsg,sysvsem,sysvshm}
+// annotations
+enum class ns_mode {
+    DISABLED,
+    NEW,
+    INHERIT,
+};
+
+// The jail settings requested by annotations
+struct annotation_spec {
+    std::optional<std::string> parent_jail;
+    ns_mode vnet{ns_mode::INHERIT};
+    std::optional<ns_mode> sysvmsg;
+    std::optional<ns_mode> sysvsem;
+    std::optional<ns_mode> sysvshm;
+    // Packed in_addr and in6_addr values, only if vnet is inherited
+    std::optional<std::vector<uint8_t>> ip4_addrs;
+    std::optional<std::vector<uint8_t>> ip6_addrs;
+    // Enabled jail parameters, e.g. allow.mlock
+    std::vector<std::string> allow_params;
+    // Annotations for allow parameters unknown to the jail subsystem
+    std::vector<std::string> unknown_allow;
+};
+
+// The bundle config, validated and converted to the form used by the
+// runtime. Compiling reads each field once and does not touch the
+// filesystem, so it can be used for both the config given to create and the
+// copy kept in the container state.
+struct oci_spec {
+    oci_version version;
+    process_spec process;
+    std::optional<std::string> root_path;
+    bool root_readonly{false};
+    std::optional<std::string> hostname;
+    std::vector<mount_spec> mounts;
+    std::array<std::vector<hook_spec>, NUM_HOOK_PHASES> hooks;
+    annotation_spec annotations;
+
+    // Validate a bundle config, throwing an error if it is malformed
+    static oci_spec compile(const nlohmann::json& config);
+
+    // Convert to and from a compact binary form which can be stored with
+    // the config and loaded without validating again. Decoding returns
+    // nullopt if the data is truncated or was written by a different version
+    // of the encoding.
+    std::string encode() const;
+    static std::optional<oci_spec> decode(std::string_view data);
+
+    // Return a bitmask of the phases which have at least one hook
+    uint32_t hook_mask() const;
+};
+
+process_spec compile_process(const nlohmann::json& process);
+
+// Parse a bundle config, keeping only the members which oci_spec::compile
+// reads. The rest of the document is checked for syntax but never stored so
+// that large sections such as linux do not cost memory. Throws
+// nlohmann::json::parse_error if the document is not valid json.
+nlohmann::json read_config(std::istream& in);
+nlohmann::json read_config(std::string_view text);
+
+}  // namespace ocijail
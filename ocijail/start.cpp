@@ -15,7 +15,7 @@ using nlohmann::json;
 namespace ocijail {
 
 void start::init(main_app& app) {
-    static start instance{app};
+    app.add_command(std::shared_ptr<start>{new start{app}});
 }
 
 start::start(main_app& app) : app_(app) {
@@ -27,39 +27,44 @@ start::start(main_app& app) : app_(app) {
 }
 
 void start::run() {
+    app_.recorder().set_id(id_);
+    auto requested = lifecycle_time::now();
     auto state = app_.get_runtime_state(id_);
     auto lk = state.lock();
     state.load();
 
-    if (state["status"] != "created") {
+    if (state.status() != container_status::CREATED) {
         std::stringstream ss;
-        ss << "start: container not in \"created\" state (currently "
-           << state["status"] << ")";
+        ss << "start: container not in \"created\" state (currently \""
+           << to_string(state.status()) << "\")";
         throw std::runtime_error(ss.str());
     }
-    state["status"] = "running";
+    state.set_status(container_status::RUNNING);
+    state.set_time(START_REQUESTED, requested);
     state.save();
 
-    auto& config_hooks = state["config"]["hooks"];
-    hook::run_hooks(app_, config_hooks, "prestart", state);
+    hook::run_hooks(app_, PRESTART, state);
 
-    auto start_wait = state.get_state_dir() / "start_wait";
-    auto fd = ::open(start_wait.c_str(), O_RDWR);
-    char ch = 0;
-    if (fd < 0) {
-        throw std::system_error{
-            errno, std::system_category(), "open start fifo"};
+    {
+        flight_phase phase{flight_op::START_SIGNAL};
+        auto start_wait = state.get_state_dir() / "start_wait";
+        auto fd = ::open(start_wait.c_str(), O_RDWR);
+        char ch = 0;
+        if (fd < 0) {
+            throw std::system_error{
+                errno, std::system_category(), "open start fifo"};
+        }
+        auto n = ::write(fd, &ch, 1);
+        if (n < 0) {
+            throw std::system_error{
+                errno, std::system_category(), "write to start fifo"};
+        }
+        ::close(fd);
     }
-    auto n = ::write(fd, &ch, 1);
-    if (n < 0) {
-        throw std::system_error{
-            errno, std::system_category(), "write to start fifo"};
-    }
-    ::close(fd);
 
     // Somehow sync with executing the container process before
     // running poststart hooks?
-    hook::run_hooks(app_, config_hooks, "poststart", state);
+    hook::run_hooks(app_, POSTSTART, state);
 }
 
 }  // namespace ocijail
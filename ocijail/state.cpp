@@ -3,7 +3,9 @@
 
 #include "nlohmann/json.hpp"
 
-#include "state.h"
+#include "ocijail/state.h"
+#include "ocijail/state_index.h"
+#include "ocijail/timing_log.h"
 
 namespace fs = std::filesystem;
 
@@ -12,7 +14,7 @@ using nlohmann::json;
 namespace ocijail {
 
 void state::init(main_app& app) {
-    static state instance{app};
+    app.add_command(std::shared_ptr<state>{new state{app}});
 }
 
 state::state(main_app& app) : app_(app) {
@@ -20,18 +22,39 @@ state::state(main_app& app) : app_(app) {
         "state", "Get the state of the container with the given id");
     sub->add_option("container-id", id_, "Unique identifier for the container")
         ->required();
+    sub->add_flag("--timings",
+                  timings_,
+                  "Show the times of the container's lifecycle events");
     sub->final_callback([this] { run(); });
 }
 
 void state::run() {
+    // Readers don't need the state lock - the status record is always
+    // published atomically. Use the state index if it has the container,
+    // otherwise read the container's status record.
     auto state = app_.get_runtime_state(id_);
-    auto lk = state.lock();
-    state.load();
+    auto entry = app_.get_state_index().lookup(id_);
+    if (entry) {
+        state.set_record(entry->record);
+    } else {
+        // The timings of a deleted container are kept in the timing log
+        if (timings_ && !state.exists()) {
+            if (auto logged = timing_log{app_.get_state_db()}.find(id_)) {
+                app_.out() << *logged;
+                return;
+            }
+        }
+        state.load();
+    }
 
     // update state
     state.check_status();
 
-    std::cout << state.report();
+    if (timings_) {
+        app_.out() << timing_log::entry(state);
+    } else {
+        app_.out() << state.report();
+    }
 }
 
 }  // namespace ocijail
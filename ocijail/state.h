@@ -15,6 +15,7 @@ struct state {
 
     main_app& app_;
     std::string id_;
+    bool timings_{false};
 };
 
 }  // namespace ocijail
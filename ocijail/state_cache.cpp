@@ -0,0 +1,62 @@
+#include "ocijail/state_cache.h"
+
+namespace ocijail {
+
+std::optional<status_record> state_cache::get_record(std::string_view id,
+                                                     const file_stamp& stamp) {
+    std::lock_guard lk{mutex_};
+    auto it = entries_.find(id);
+    if (it != entries_.end() && it->second.record_stamp == stamp) {
+        stats_.hits++;
+        return it->second.record;
+    }
+    stats_.misses++;
+    return std::nullopt;
+}
+
+void state_cache::put_record(std::string_view id,
+                             const file_stamp& stamp,
+                             const status_record& record) {
+    std::lock_guard lk{mutex_};
+    auto& e = entries_[std::string{id}];
+    e.record_stamp = stamp;
+    e.record = record;
+}
+
+std::shared_ptr<const nlohmann::json> state_cache::get_config(
+    std::string_view id,
+    const file_stamp& stamp) {
+    std::lock_guard lk{mutex_};
+    auto it = entries_.find(id);
+    if (it != entries_.end() && it->second.config &&
+        it->second.config_stamp == stamp) {
+        stats_.hits++;
+        return it->second.config;
+    }
+    stats_.misses++;
+    return nullptr;
+}
+
+void state_cache::put_config(std::string_view id,
+                             const file_stamp& stamp,
+                             std::shared_ptr<const nlohmann::json> config) {
+    std::lock_guard lk{mutex_};
+    auto& e = entries_[std::string{id}];
+    e.config_stamp = stamp;
+    e.config = std::move(config);
+}
+
+void state_cache::erase(std::string_view id) {
+    std::lock_guard lk{mutex_};
+    auto it = entries_.find(id);
+    if (it != entries_.end()) {
+        entries_.erase(it);
+    }
+}
+
+state_cache::stats state_cache::get_stats() {
+    std::lock_guard lk{mutex_};
+    return stats_;
+}
+
+}  // namespace ocijail
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/runtime_state.h"
+
+namespace ocijail {
+
+// Identifies one version of a state file. Files are never modified in place
+// so a new version always has a different inode. We include the
+// modification time in case an inode number is reused.
+struct file_stamp {
+    dev_t dev{0};
+    ino_t ino{0};
+    time_t mtime_sec{0};
+    long mtime_nsec{0};
+
+    static file_stamp of(const struct ::stat& st) {
+        return {st.st_dev, st.st_ino, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+    }
+    bool operator==(const file_stamp&) const = default;
+};
+
+// An in-memory cache of container state for long-running processes. Each
+// state file is published by renaming a new copy over the old one so a
+// cached copy is current as long as the file's stamp is unchanged. This lets
+// us validate an entry with a stat instead of reading and parsing the file.
+// The cache is updated on each save, making it write-through.
+//
+// All methods are safe to call from multiple threads.
+class state_cache {
+   public:
+    std::optional<status_record> get_record(std::string_view id,
+                                            const file_stamp& stamp);
+    void put_record(std::string_view id,
+                    const file_stamp& stamp,
+                    const status_record& record);
+
+    std::shared_ptr<const nlohmann::json> get_config(std::string_view id,
+                                                     const file_stamp& stamp);
+    void put_config(std::string_view id,
+                    const file_stamp& stamp,
+                    std::shared_ptr<const nlohmann::json> config);
+
+    void erase(std::string_view id);
+
+    struct stats {
+        size_t hits{0};
+        size_t misses{0};
+    };
+    stats get_stats();
+
+   private:
+    struct entry {
+        file_stamp record_stamp;
+        status_record record;
+        file_stamp config_stamp;
+        std::shared_ptr<const nlohmann::json> config;
+    };
+
+    std::mutex mutex_;
+    std::map<std::string, entry, std::less<>> entries_;
+    stats stats_;
+};
+
+}  // namespace ocijail
@@ -0,0 +1,421 @@
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <system_error>
+
+#include "ocijail/state_index.h"
+
+namespace fs = std::filesystem;
+
+namespace ocijail {
+
+// Readers give up on a slot which stays locked for this many attempts - this
+// can only happen if a writer crashed part way through an update.
+static constexpr int MAX_READ_ATTEMPTS = 10000;
+
+static uint64_t hash_id(std::string_view id) {
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325;
+    for (auto ch : id) {
+        h ^= uint8_t(ch);
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+state_index::index_lock::index_lock(const fs::path& path) {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd_ < 0) {
+        throw std::system_error(
+            errno, std::system_category(), "opening index lock");
+    }
+    if (::flock(fd_, LOCK_EX) < 0) {
+        auto saved_errno = errno;
+        ::close(fd_);
+        throw std::system_error(
+            saved_errno, std::system_category(), "locking index lock");
+    }
+}
+
+state_index::index_lock::~index_lock() {
+    ::close(fd_);
+}
+
+state_index::state_index(const fs::path& root)
+    : root_(root),
+      index_path_(root / "index"),
+      lock_path_(root / "index.lock") {}
+
+state_index::~state_index() {
+    unmap();
+}
+
+// Take the index lock to change the index, creating the state root if
+// nothing has been written to it yet.
+state_index::index_lock state_index::lock_for_write() {
+    try {
+        return index_lock{lock_path_};
+    } catch (const std::system_error& e) {
+        if (e.code() != std::errc::no_such_file_or_directory) {
+            throw;
+        }
+    }
+    fs::create_directories(root_);
+    return index_lock{lock_path_};
+}
+
+// Map the index file. Returns false if the state root doesn't exist.
+bool state_index::map() {
+    fd_ = ::open(index_path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd_ < 0) {
+        if (errno == ENOENT) {
+            return false;
+        }
+        throw std::system_error(
+            errno, std::system_category(), "opening " + index_path_.native());
+    }
+    struct ::stat st;
+    if (::fstat(fd_, &st) < 0) {
+        throw std::system_error(
+            errno, std::system_category(), "stat " + index_path_.native());
+    }
+    if (st.st_size < off_t(sizeof(header))) {
+        return true;
+    }
+    auto p = ::mmap(
+        nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+        throw std::system_error(
+            errno, std::system_category(), "mapping " + index_path_.native());
+    }
+    base_ = p;
+    size_ = st.st_size;
+    return true;
+}
+
+void state_index::unmap() {
+    if (base_) {
+        ::munmap(base_, size_);
+        base_ = nullptr;
+        size_ = 0;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool state_index::valid() const {
+    if (!base_) {
+        return false;
+    }
+    auto h = static_cast<const header*>(base_);
+    return h->magic == MAGIC && h->version == VERSION && h->nslots > 0 &&
+           size_ == sizeof(header) + h->nslots * sizeof(slot) &&
+           h->retired.load(std::memory_order_acquire) == 0;
+}
+
+// Make sure we have mapped the current, valid index. If the index is missing
+// or corrupt, rebuild it. Returns false if there is no state root.
+bool state_index::ensure_current(bool locked) {
+    while (!valid()) {
+        unmap();
+        if (!map()) {
+            return false;
+        }
+        if (valid()) {
+            break;
+        }
+        if (locked) {
+            rebuild_locked(DEFAULT_SLOTS);
+        } else {
+            index_lock lk{lock_path_};
+            unmap();
+            map();
+            if (!valid()) {
+                rebuild_locked(DEFAULT_SLOTS);
+            }
+        }
+    }
+    return true;
+}
+
+// Changes made through the mapping are not visible to file change
+// notifications so we update the index timestamps to let watchers know that
+// something changed.
+void state_index::touch() {
+    ::futimens(fd_, nullptr);
+}
+
+state_index::slot* state_index::slots() const {
+    return reinterpret_cast<slot*>(static_cast<char*>(base_) + sizeof(header));
+}
+
+bool state_index::read_slot(const slot& s, slot_state& state, entry* e) const {
+    for (int i = 0; i < MAX_READ_ATTEMPTS; i++) {
+        auto seq1 = s.seq.load(std::memory_order_acquire);
+        if (seq1 & 1) {
+            ::sched_yield();
+            continue;
+        }
+        state = s.state;
+        if (e && state == USED) {
+            e->id.assign(s.id, strnlen(s.id, ID_MAX));
+            std::memcpy(&e->record, &s.record, sizeof(status_record));
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto seq2 = s.seq.load(std::memory_order_relaxed);
+        if (seq1 == seq2) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void state_index::write_slot(slot& s,
+                             slot_state state,
+                             std::string_view id,
+                             const status_record& record) {
+    auto seq = s.seq.load(std::memory_order_relaxed);
+    s.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.state = state;
+    std::memset(s.id, 0, ID_MAX);
+    std::memcpy(s.id, id.data(), id.size());
+    std::memcpy(&s.record, &record, sizeof(status_record));
+    s.seq.store(seq + 2, std::memory_order_release);
+}
+
+// Only called by writers holding the index lock so we can read slots
+// directly.
+state_index::slot* state_index::find_slot(std::string_view id,
+                                          bool for_insert) {
+    auto h = static_cast<header*>(base_);
+    auto mask = h->nslots - 1;
+    auto start = hash_id(id) & mask;
+    slot* free_slot = nullptr;
+    for (uint32_t i = 0; i < h->nslots; i++) {
+        auto& s = slots()[(start + i) & mask];
+        if (s.state == EMPTY) {
+            if (!for_insert) {
+                return nullptr;
+            }
+            return free_slot ? free_slot : &s;
+        }
+        if (s.state == REMOVED) {
+            if (!free_slot) {
+                free_slot = &s;
+            }
+        } else if (id == std::string_view{s.id, strnlen(s.id, ID_MAX)}) {
+            return &s;
+        }
+    }
+    return for_insert ? free_slot : nullptr;
+}
+
+std::optional<state_index::entry> state_index::lookup(std::string_view id) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!ensure_current(false)) {
+            return std::nullopt;
+        }
+        auto h = static_cast<header*>(base_);
+        auto mask = h->nslots - 1;
+        auto start = hash_id(id) & mask;
+        bool ok = true;
+        for (uint32_t i = 0; i < h->nslots; i++) {
+            entry e;
+            slot_state state;
+            if (!read_slot(slots()[(start + i) & mask], state, &e)) {
+                ok = false;
+                break;
+            }
+            if (state == EMPTY) {
+                return std::nullopt;
+            }
+            if (state == USED && e.id == id) {
+                return e;
+            }
+        }
+        if (ok) {
+            return std::nullopt;
+        }
+        // A writer died while updating a slot
+        index_lock lk{lock_path_};
+        rebuild_locked(h->nslots);
+    }
+    return std::nullopt;
+}
+
+std::vector<state_index::entry> state_index::entries() {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!ensure_current(false)) {
+            return {};
+        }
+        auto h = static_cast<header*>(base_);
+        std::vector<entry> res;
+        bool ok = true;
+        for (uint32_t i = 0; i < h->nslots; i++) {
+            entry e;
+            slot_state state;
+            if (!read_slot(slots()[i], state, &e)) {
+                ok = false;
+                break;
+            }
+            if (state == USED) {
+                res.push_back(std::move(e));
+            }
+        }
+        if (ok) {
+            return res;
+        }
+        index_lock lk{lock_path_};
+        rebuild_locked(h->nslots);
+    }
+    return {};
+}
+
+void state_index::update(std::string_view id, const status_record& record) {
+    if (id.size() >= ID_MAX) {
+        throw std::runtime_error("container id too long: " + std::string{id});
+    }
+    auto lk = lock_for_write();
+    ensure_current(true);
+    auto h = static_cast<header*>(base_);
+    auto s = find_slot(id, true);
+    if (!s) {
+        rebuild_locked(2 * h->nslots);
+        h = static_cast<header*>(base_);
+        s = find_slot(id, true);
+    }
+    if (s->state != USED) {
+        if (s->state == REMOVED) {
+            h->removed--;
+        }
+        h->used++;
+    }
+    write_slot(*s, USED, id, record);
+    touch();
+
+    // Keep the table at most three quarters full, counting removed slots
+    // since they lengthen probe sequences.
+    if (4 * (h->used + h->removed) > 3 * h->nslots) {
+        rebuild_locked(2 * h->used > h->nslots ? 2 * h->nslots : h->nslots);
+    }
+}
+
+void state_index::remove(std::string_view id) {
+    auto lk = lock_for_write();
+    ensure_current(true);
+    auto h = static_cast<header*>(base_);
+    auto s = find_slot(id, false);
+    if (s) {
+        write_slot(*s, REMOVED, id, s->record);
+        h->used--;
+        h->removed++;
+        touch();
+    }
+}
+
+void state_index::rebuild() {
+    auto lk = lock_for_write();
+    rebuild_locked(valid() ? static_cast<header*>(base_)->nslots
+                           : DEFAULT_SLOTS);
+}
+
+void state_index::rebuild_locked(uint32_t nslots) {
+    std::vector<entry> found;
+    for (const auto& it : fs::directory_iterator{root_}) {
+        if (!it.is_directory()) {
+            continue;
+        }
+        auto id = it.path().filename().native();
+        if (id.size() >= ID_MAX) {
+            continue;
+        }
+        runtime_state state{it.path(), id};
+        try {
+            state.load();
+        } catch (const std::exception&) {
+            // Being created or deleted, or not a container
+            continue;
+        }
+        found.push_back(entry{id, state.record()});
+    }
+    while (2 * found.size() > nslots) {
+        nslots *= 2;
+    }
+
+    // Build the new index in a temporary file and rename it into place so
+    // that readers see either the old or the new index.
+    auto tmp_path = index_path_;
+    tmp_path += ".new";
+    auto size = sizeof(header) + nslots * sizeof(slot);
+    auto fd = ::open(
+        tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw std::system_error(
+            errno, std::system_category(), "opening " + tmp_path.native());
+    }
+    if (::ftruncate(fd, size) < 0) {
+        auto saved_errno = errno;
+        ::close(fd);
+        throw std::system_error(
+            saved_errno, std::system_category(), "sizing " + tmp_path.native());
+    }
+    auto p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        throw std::system_error(
+            errno, std::system_category(), "mapping " + tmp_path.native());
+    }
+    auto old_base = base_;
+    auto old_size = size_;
+    auto old_fd = fd_;
+    base_ = p;
+    size_ = size;
+    fd_ = -1;
+    auto h = static_cast<header*>(base_);
+    h->magic = MAGIC;
+    h->version = VERSION;
+    h->nslots = nslots;
+    h->used = 0;
+    h->removed = 0;
+    for (auto& e : found) {
+        auto s = find_slot(e.id, true);
+        write_slot(*s, USED, e.id, e.record);
+        h->used++;
+    }
+
+    // Go back to the old mapping whether or not the new index was
+    // published, so that a failed rename doesn't leave us updating a file
+    // which nobody else will read.
+    auto renamed = ::rename(tmp_path.c_str(), index_path_.c_str()) == 0;
+    auto saved_errno = errno;
+    ::munmap(p, size);
+    base_ = old_base;
+    size_ = old_size;
+    fd_ = old_fd;
+    if (!renamed) {
+        ::unlink(tmp_path.c_str());
+        throw std::system_error(saved_errno,
+                                std::system_category(),
+                                "renaming " + tmp_path.native());
+    }
+
+    // Tell anyone still using the old index to switch to the new one.
+    if (base_ && size_ >= sizeof(header)) {
+        static_cast<header*>(base_)->retired.store(1,
+                                                   std::memory_order_release);
+    }
+    unmap();
+    if (!map()) {
+        throw std::system_error(
+            ENOENT, std::system_category(), "opening " + index_path_.native());
+    }
+}
+
+}  // namespace ocijail
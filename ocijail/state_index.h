@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ocijail/runtime_state.h"
+
+namespace ocijail {
+
+// A shared index of all containers in the state database. This is a file
+// under the state root which is mapped into memory and holds a copy of each
+// container's status record in a fixed-size slot, found by hashing the
+// container id. The per-container state directories remain authoritative -
+// the index is rebuilt from them if it is missing or corrupt.
+//
+// Writers serialize using a lock file next to the index. Readers don't take
+// any lock - each slot is protected by a sequence counter which lets readers
+// detect and retry reads which overlap an update.
+class state_index {
+   public:
+    static constexpr uint32_t MAGIC = 0x6f636978;  // "ocix"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t ID_MAX = 256;
+    static constexpr uint32_t DEFAULT_SLOTS = 1024;
+
+    struct entry {
+        std::string id;
+        status_record record;
+    };
+
+    // An index for the given state root. The index is mapped, and rebuilt
+    // if necessary, when it is first used. The state root is only created
+    // when the index is changed - until then it has no entries.
+    state_index(const std::filesystem::path& root);
+    state_index(const state_index&) = delete;
+    ~state_index();
+
+    std::optional<entry> lookup(std::string_view id);
+    std::vector<entry> entries();
+
+    void update(std::string_view id, const status_record& record);
+    void remove(std::string_view id);
+
+    // Discard the index contents and rebuild from the per-container state
+    // directories.
+    void rebuild();
+
+   private:
+    enum slot_state : uint32_t {
+        EMPTY = 0,
+        USED = 1,
+        REMOVED = 2,
+    };
+
+    struct header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t nslots;
+        // Set when a rebuild has replaced this file with a new one
+        std::atomic<uint32_t> retired;
+        // Only accessed by writers, under the index lock
+        uint32_t used;
+        uint32_t removed;
+    };
+
+    struct slot {
+        // Odd while the slot is being updated
+        std::atomic<uint32_t> seq;
+        slot_state state;
+        char id[ID_MAX];
+        status_record record;
+    };
+
+    struct index_lock {
+        index_lock(const std::filesystem::path& path);
+        ~index_lock();
+        int fd_;
+    };
+
+    index_lock lock_for_write();
+    bool map();
+    void unmap();
+    bool valid() const;
+    bool ensure_current(bool locked);
+    void touch();
+    slot* slots() const;
+    slot* find_slot(std::string_view id, bool for_insert);
+    bool read_slot(const slot& s, slot_state& state, entry* e) const;
+    void write_slot(slot& s,
+                    slot_state state,
+                    std::string_view id,
+                    const status_record& record);
+    void rebuild_locked(uint32_t nslots);
+
+    std::filesystem::path root_;
+    std::filesystem::path index_path_;
+    std::filesystem::path lock_path_;
+    int fd_{-1};
+    void* base_{nullptr};
+    size_t size_{0};
+};
+
+}  // namespace ocijail
@@ -0,0 +1,76 @@
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <system_error>
+
+#include "ocijail/timing_log.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+namespace ocijail {
+
+json timing_log::entry(const runtime_state& state) {
+    json res;
+    res["id"] = state.get_id();
+    res["status"] = to_string(state.status());
+    res["timings"] = state.timings();
+    return res;
+}
+
+void timing_log::append(const json& entry) {
+    fs::create_directories(dir_);
+    auto fd = ::open(
+        path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "opening " + path_.native()};
+    }
+    auto text = entry.dump() + "\n";
+    auto n = ::write(fd, text.data(), text.size());
+    auto saved_errno = errno;
+    struct ::stat st;
+    auto full = ::fstat(fd, &st) == 0 && st.st_size >= off_t(MAX_SIZE);
+    if (full && ::flock(fd, LOCK_EX) == 0) {
+        // Other processes may also have found the log full. Whoever gets
+        // the lock first rotates it - the others find that the log has
+        // already been replaced, so a new log is never moved aside over
+        // the one just rotated.
+        struct ::stat current;
+        if (::stat(path_.c_str(), &current) == 0 &&
+            current.st_dev == st.st_dev && current.st_ino == st.st_ino) {
+            ::rename(path_.c_str(), old_path_.c_str());
+        }
+    }
+    ::close(fd);
+    if (n != static_cast<ssize_t>(text.size())) {
+        throw std::system_error{
+            saved_errno, std::system_category(), "writing " + path_.native()};
+    }
+}
+
+std::optional<json> timing_log::find(std::string_view id) const {
+    for (auto& path : {path_, old_path_}) {
+        std::ifstream in{path};
+        std::optional<json> found;
+        std::string line;
+        while (std::getline(in, line)) {
+            auto entry = json::parse(line, nullptr, false);
+            // A torn line fails to parse and is skipped
+            if (entry.is_object() && entry.contains("id") &&
+                entry["id"].is_string() &&
+                entry["id"].get_ref<const std::string&>() == id) {
+                found = std::move(entry);
+            }
+        }
+        if (found) {
+            return found;
+        }
+    }
+    return std::nullopt;
+}
+
+}  // namespace ocijail
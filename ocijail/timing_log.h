@@ -0,0 +1,41 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/runtime_state.h"
+
+namespace ocijail {
+
+// The lifecycle timings of deleted containers. A container's timings are
+// kept in its status record until it is deleted, after which delete appends
+// them here so that they can still be read. Each entry is a line of JSON,
+// appended with a single write. When the log grows too large it is moved
+// aside, replacing the previous one, so at most two logs are kept.
+class timing_log {
+   public:
+    static constexpr size_t MAX_SIZE = 1 << 20;
+
+    explicit timing_log(const std::filesystem::path& root)
+        : dir_(root / ".timings"),
+          path_(dir_ / "log"),
+          old_path_(dir_ / "log.1") {}
+
+    // A container's id, status and timings, as reported by state --timings
+    static nlohmann::json entry(const runtime_state& state);
+
+    void append(const nlohmann::json& entry);
+
+    // Find the most recent entry for a container
+    std::optional<nlohmann::json> find(std::string_view id) const;
+
+   private:
+    std::filesystem::path dir_;
+    std::filesystem::path path_;
+    std::filesystem::path old_path_;
+};
+
+}  // namespace ocijail
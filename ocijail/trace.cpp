@@ -0,0 +1,152 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <functional>
+#include <system_error>
+#include <thread>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/spec.h"
+#include "ocijail/trace.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+namespace ocijail {
+
+static std::string span_name(const flight_recorder& rec,
+                             const flight_event& ev) {
+    auto op = static_cast<flight_op>(ev.op);
+    if (ev.kind == flight_event::ERROR) {
+        return "error";
+    }
+    if (op == flight_op::COMMAND && !rec.command().empty()) {
+        return std::string{rec.command()};
+    }
+    if (op == flight_op::HOOKS && ev.arg >= 0 && ev.arg < NUM_HOOK_PHASES) {
+        return hook_phase_names[ev.arg];
+    }
+    return to_string(op);
+}
+
+static json trace_event(const flight_recorder& rec,
+                        const flight_event& ev,
+                        int pid,
+                        int tid) {
+    json res;
+    auto op = static_cast<flight_op>(ev.op);
+    res["name"] = span_name(rec, ev);
+    res["cat"] = is_call(op) ? "syscall" : "phase";
+    res["pid"] = pid;
+    res["tid"] = tid;
+    // Timestamps are microseconds since the epoch so that spans from
+    // separate commands line up
+    auto ts = [&](uint64_t t) { return (rec.wall_time() + t) / 1000.0; };
+    json args = json::object();
+    switch (ev.kind) {
+    case flight_event::BEGIN:
+        res["ph"] = "B";
+        res["ts"] = ts(ev.time);
+        if (op == flight_op::COMMAND && !rec.id().empty()) {
+            args["id"] = rec.id();
+        } else if (op == flight_op::MOUNTS) {
+            args["prepare_only"] = ev.arg != 0;
+        }
+        break;
+    case flight_event::END:
+        res["ph"] = "E";
+        res["ts"] = ts(ev.time);
+        if (op == flight_op::COMMAND) {
+            args["status"] = ev.arg;
+        }
+        break;
+    case flight_event::CALL:
+        res["ph"] = "X";
+        res["ts"] = ts(ev.time - ev.duration);
+        res["dur"] = ev.duration / 1000.0;
+        args["result"] = ev.arg;
+        break;
+    default:
+        res["ph"] = "i";
+        res["s"] = "t";
+        res["ts"] = ts(ev.time);
+        break;
+    }
+    if (ev.error) {
+        args["errno"] = ev.error;
+        args["error"] = std::generic_category().message(ev.error);
+    }
+    if (!args.empty()) {
+        res["args"] = args;
+    }
+    return res;
+}
+
+// Create a trace file holding just the opening bracket, unless another
+// process creates it first. Threads of the daemon may also race to create
+// it, so the temporary file is named for the thread.
+static void create_trace(const fs::path& path) {
+    auto tmp_path = path;
+    tmp_path += ".new-" + std::to_string(::getpid()) + "-" +
+                std::to_string(
+                    std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    auto fd = ::open(
+        tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "creating " + tmp_path.native()};
+    }
+    auto n = ::write(fd, "[\n", 2);
+    auto saved_errno = errno;
+    ::close(fd);
+    if (n != 2) {
+        ::unlink(tmp_path.c_str());
+        throw std::system_error{saved_errno,
+                                std::system_category(),
+                                "writing " + tmp_path.native()};
+    }
+
+    // If another process linked its file first, we append to that one
+    if (::link(tmp_path.c_str(), path.c_str()) < 0 && errno != EEXIST) {
+        saved_errno = errno;
+        ::unlink(tmp_path.c_str());
+        throw std::system_error{
+            saved_errno, std::system_category(), "creating " + path.native()};
+    }
+    ::unlink(tmp_path.c_str());
+}
+
+void append_trace(const fs::path& path,
+                  const flight_recorder& rec,
+                  const std::vector<flight_event>& events) {
+    // The file only ever appears with its opening bracket: it is written to
+    // a temporary file which is linked into place, so that a concurrent
+    // command can't append before the bracket is written.
+    auto fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0 && errno == ENOENT) {
+        create_trace(path);
+        fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "opening " + path.native()};
+    }
+    std::string text;
+    int pid = ::getpid();
+    int tid = std::hash<std::thread::id>{}(std::this_thread::get_id()) &
+              0x7fffffff;
+    for (auto& ev : events) {
+        text += trace_event(rec, ev, pid, tid).dump();
+        text += ",\n";
+    }
+    auto n = ::write(fd, text.data(), text.size());
+    auto saved_errno = errno;
+    ::close(fd);
+    if (n != static_cast<ssize_t>(text.size())) {
+        throw std::system_error{
+            saved_errno, std::system_category(), "writing " + path.native()};
+    }
+}
+
+}  // namespace ocijail
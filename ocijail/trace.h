@@ -0,0 +1,22 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include "ocijail/recorder.h"
+
+namespace ocijail {
+
+// Append events taken from a recorder to a file of Chrome trace events,
+// which can be loaded into a trace viewer such as Perfetto. Phases become
+// nested spans and system calls become complete spans, on a track for the
+// calling process and thread.
+//
+// The file uses the JSON array format without the closing bracket, which
+// trace viewers accept, so that processes can append to it independently.
+// Each call appends its events with a single write.
+void append_trace(const std::filesystem::path& path,
+                  const flight_recorder& rec,
+                  const std::vector<flight_event>& events);
+
+}  // namespace ocijail
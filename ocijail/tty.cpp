@@ -50,6 +50,7 @@ void send_pty_control_fd(std::filesystem::path socket_name, int control_fd) {
     if (sock_fd < 0) {
         throw std::system_error{errno, std::system_category(), "socket"};
     }
+#ifdef __FreeBSD__
     auto dir = socket_name.parent_path();
     auto sock = socket_name.filename();
     auto dir_fd = ::open(dir.c_str(), O_RDONLY | O_CLOEXEC, 0);
@@ -68,6 +69,22 @@ void send_pty_control_fd(std::filesystem::path socket_name, int control_fd) {
             errno, std::system_category(), "connectat " + sock.native()};
     }
     ::close(dir_fd);
+#else
+    // Without connectat, the whole path must fit
+    sockaddr_un sun{};
+    sun.sun_family = AF_UNIX;
+    if (socket_name.native().size() >= sizeof(sun.sun_path)) {
+        throw std::system_error{ENAMETOOLONG,
+                                std::system_category(),
+                                "connect " + socket_name.native()};
+    }
+    socket_name.native().copy(sun.sun_path, sizeof(sun.sun_path) - 1);
+    if (::connect(
+            sock_fd, reinterpret_cast<sockaddr*>(&sun), sizeof(sun)) < 0) {
+        throw std::system_error{
+            errno, std::system_category(), "connect " + socket_name.native()};
+    }
+#endif
 
     // Send over our pty descriptor using a CMSG
     char zero = 0;
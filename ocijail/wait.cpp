@@ -0,0 +1,47 @@
+#include <sys/wait.h>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/kqueue.h"
+#include "ocijail/monitor.h"
+#include "ocijail/wait.h"
+
+namespace fs = std::filesystem;
+
+using nlohmann::json;
+
+namespace ocijail {
+
+void wait::init(main_app& app) {
+    app.add_command(std::shared_ptr<wait>{new wait{app}});
+}
+
+wait::wait(main_app& app) : app_(app) {
+    auto sub = app.add_subcommand(
+        "wait",
+        "Wait for the container with the given id to stop and print its exit "
+        "status");
+    sub->add_option("container-id", id_, "Unique identifier for the container")
+        ->required();
+    sub->final_callback([this] { run(); });
+}
+
+void wait::run() {
+    app_.set_long_running();
+    auto state = app_.get_runtime_state(id_);
+    kqueue_event_source source;
+    auto wait_status = wait_exit(state, source);
+
+    json res;
+    res["id"] = id_;
+    if (wait_status) {
+        if (WIFEXITED(*wait_status)) {
+            res["exitStatus"] = WEXITSTATUS(*wait_status);
+        } else if (WIFSIGNALED(*wait_status)) {
+            res["exitSignal"] = WTERMSIG(*wait_status);
+        }
+    }
+    app_.out() << res << "\n";
+}
+
+}  // namespace ocijail
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "ocijail/main.h"
+
+namespace ocijail {
+
+struct wait {
+    static void init(main_app& app);
+
+   private:
+    wait(main_app& app);
+    void run();
+
+    main_app& app_;
+    std::string id_;
+};
+
+}  // namespace ocijail
@@ -0,0 +1,149 @@
+// Tests for the content-addressed config store: entries are shared between
+// containers with the same config, their compiled form is reused and they are
+// removed when the last container using them is deleted.
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/config_store.h"
+#include "ocijail/runtime_state.h"
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+using nlohmann::json;
+
+static std::string config_text(std::string_view hostname) {
+    json config = {
+        {"ociVersion", "1.0.2"},
+        {"process", {{"args", {"sh"}}, {"cwd", "/"}}},
+        {"hostname", hostname},
+        {"annotations", {{"io.example", "value"}}},
+        {"hooks", {{"poststop", {{{"path", "/bin/true"}}}}}},
+    };
+    return config.dump();
+}
+
+static nlink_t links(const fs::path& path) {
+    struct ::stat st;
+    if (::stat(path.c_str(), &st) < 0) {
+        return 0;
+    }
+    return st.st_nlink;
+}
+
+// Add a config to the store in the same way as create
+static config_store::entry add(config_store& store,
+                               std::string_view text,
+                               const fs::path& state_dir) {
+    auto entry = store.find(text);
+    if (!entry.spec) {
+        entry.spec = std::make_shared<const oci_spec>(
+            oci_spec::compile(read_config(text)));
+    }
+    fs::create_directories(state_dir);
+    store.add(entry, text, state_dir);
+    return entry;
+}
+
+static void test_sharing(const fs::path& root) {
+    config_store store{root};
+    auto text = config_text("a");
+
+    auto first = store.find(text);
+    CHECK(first.hash.size() == 64);
+    CHECK(!first.spec);
+    CHECK(!first.stored);
+
+    add(store, text, root / "a");
+    auto entry_dir = root / ".configs" / first.hash;
+    CHECK(fs::is_regular_file(entry_dir / "spec"));
+    CHECK(fs::is_regular_file(root / "a" / "config.json"));
+    CHECK(fs::is_regular_file(root / "a" / "annotations.json"));
+
+    // A second container with the same config loads the compiled form
+    auto second = store.find(text);
+    CHECK(second.hash == first.hash);
+    CHECK(second.stored);
+    CHECK(second.spec && second.spec->hostname == "a");
+    add(store, text, root / "b");
+    CHECK(links(entry_dir / "config.json") == 3);
+
+    // A different config gets its own entry
+    auto other = add(store, config_text("b"), root / "c");
+    CHECK(other.hash != first.hash);
+
+    // The entry stays until no container uses it
+    fs::remove_all(root / "a");
+    store.release(first.hash);
+    CHECK(fs::exists(entry_dir));
+    fs::remove_all(root / "b");
+    store.release(first.hash);
+    CHECK(!fs::exists(entry_dir));
+    CHECK(fs::exists(root / ".configs" / other.hash));
+
+    // Hashes which don't name an entry are ignored
+    store.release("../c");
+    CHECK(fs::exists(root / "c"));
+}
+
+static void test_stale_spec(const fs::path& root) {
+    config_store store{root};
+    auto text = config_text("stale");
+    auto entry = add(store, text, root / "a");
+    auto spec_path = root / ".configs" / entry.hash / "spec";
+
+    // A compiled form written by a different version is replaced
+    fs::remove(root / "a" / "spec");
+    fs::remove(spec_path);
+    std::ofstream{spec_path} << "not a spec";
+    CHECK(!store.find(text).spec);
+    add(store, text, root / "b");
+    CHECK(store.find(text).stored);
+}
+
+static void test_runtime_state(const fs::path& root) {
+    config_store store{root};
+    auto text = config_text("state");
+    auto entry = store.find(text);
+    auto config = read_config(text);
+    entry.spec = std::make_shared<const oci_spec>(oci_spec::compile(config));
+
+    {
+        runtime_state state{root / "state", "state"};
+        auto lk = state.create();
+        state.save_config(entry, text, &config);
+        state.save_details();
+        state.save();
+        CHECK(state.flags() & status_record::HAS_ANNOTATIONS);
+    }
+    auto entry_dir = root / ".configs" / entry.hash;
+    CHECK(links(entry_dir / "config.json") == 2);
+
+    runtime_state state{root / "state", "state"};
+    state.load();
+    CHECK(state.spec().hostname == "state");
+    CHECK(state.spec().hook_mask() == 1u << POSTSTOP);
+    CHECK(state.config()["annotations"]["io.example"] == "value");
+
+    // Deleting the container releases the entry
+    state.load_details();
+    state.remove_all();
+    CHECK(!fs::exists(entry_dir));
+}
+
+int main(int argc, char** argv) {
+    auto root = testing::scratch_dir("config_store");
+    test_sharing(root / "sharing");
+    test_stale_spec(root / "stale");
+    test_runtime_state(root / "state");
+    fs::remove_all(root);
+    return testing::finish();
+}
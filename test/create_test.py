@@ -6,8 +6,13 @@ import os.path
 import socket
 import subprocess
 import tempfile
+import time
 import unittest
 
+# Creating a container with a small config currently makes about a thousand
+# heap allocations, most of them while setting up the command line parser
+ALLOCATION_LIMIT = 3000
+
 class test_create(unittest.TestCase):
     "Parameter validation tests for create"
 
@@ -379,6 +384,138 @@ class test_create(unittest.TestCase):
             c["annotations"] = {name: "inherit"}
             self.check_good_config(c)
 
+    def test_json_log(self):
+        # JSON log records carry the level of the message
+        with tempfile.TemporaryDirectory() as dir:
+            log = os.path.join(dir, "log.json")
+            bundle_dir = os.path.join(dir, "bundle")
+            os.mkdir(bundle_dir)
+            c = self.config()
+            c["annotations"] = {"org.freebsd.jail.allow.nonexistent": "true"}
+            with open(os.path.join(bundle_dir, "config.json"), "w") as f:
+                json.dump(c, f)
+            args = ["ocijail/ocijail", "--testing=validation",
+                    "--log-format=json", "--log", log]
+            res = subprocess.run(
+                args=args + ["create", "--bundle", bundle_dir, "my_id"])
+            self.assertEqual(res.returncode, 0)
+            res = subprocess.run(
+                args=args + ["create", "--bundle", dir, "my_id"],
+                stderr=subprocess.DEVNULL)
+            self.assertNotEqual(res.returncode, 0)
+            with open(log) as f:
+                records = [json.loads(line) for line in f]
+        self.assertEqual([r["level"] for r in records], ["info", "error"])
+
+    def test_stats(self):
+        # --stats reports the allocations made by the command on stderr
+        with tempfile.TemporaryDirectory() as bundle_dir:
+            with open(os.path.join(bundle_dir, "config.json"), "w") as f:
+                json.dump(self.config(), f)
+            res = subprocess.run(
+                args=["ocijail/ocijail", "--testing=validation", "--stats",
+                      "create", "--bundle", bundle_dir, "my_id"],
+                stderr=subprocess.PIPE)
+        self.assertEqual(res.returncode, 0)
+        stats = json.loads(res.stderr.decode().splitlines()[-1])
+        self.assertEqual(stats["command"], "create")
+        self.assertGreater(stats["allocations"], 0)
+        self.assertGreaterEqual(stats["bytes"], stats["allocations"])
+
+        # The jail parameters come from the arena, which is small enough to
+        # not need the heap
+        self.assertGreater(stats["arena_allocations"], 0)
+        self.assertEqual(stats["arena_reserved"], 0)
+
+        # Catch large regressions in the number of allocations made to
+        # validate a small config
+        self.assertLess(stats["allocations"], ALLOCATION_LIMIT)
+
+    def test_trace(self):
+        # --trace appends spans to a file of Chrome trace events. The file
+        # has no closing bracket so that processes can append to it.
+        with tempfile.TemporaryDirectory() as dir:
+            trace = os.path.join(dir, "trace.json")
+            bundle_dir = os.path.join(dir, "bundle")
+            os.mkdir(bundle_dir)
+            with open(os.path.join(bundle_dir, "config.json"), "w") as f:
+                json.dump(self.config(), f)
+            for i in range(2):
+                res = subprocess.run(
+                    args=["ocijail/ocijail", "--testing=validation",
+                          "--trace", trace,
+                          "create", "--bundle", bundle_dir, "my_id"])
+                self.assertEqual(res.returncode, 0)
+            with open(trace) as f:
+                text = f.read()
+        events = json.loads(text.rstrip().rstrip(",") + "]")
+        spans = [(e["name"], e["ph"]) for e in events]
+        self.assertEqual(spans, 2 * [("create", "B"), ("config", "B"),
+                                     ("config", "E"), ("create", "E")])
+        self.assertEqual(events[0]["args"]["id"], "my_id")
+        self.assertLessEqual(events[1]["ts"], events[2]["ts"])
+
+    def test_missing_root(self):
+        # Failing to find a container in a missing state database leaves
+        # no trace of it
+        with tempfile.TemporaryDirectory() as dir:
+            root = os.path.join(dir, "state")
+            res = subprocess.run(
+                args=["ocijail/ocijail", "--root", root, "state", "my_id"],
+                stderr=subprocess.DEVNULL)
+            self.assertNotEqual(res.returncode, 0)
+            self.assertFalse(os.path.exists(root))
+
+            # Nor is a flight record saved for it once the database exists
+            os.mkdir(root)
+            res = subprocess.run(
+                args=["ocijail/ocijail", "--root", root, "state", "my_id"],
+                stderr=subprocess.DEVNULL)
+            self.assertNotEqual(res.returncode, 0)
+            self.assertFalse(os.path.exists(os.path.join(root, ".flight")))
+
+    def request(self, path, request):
+        with socket.socket(socket.AF_UNIX) as s:
+            s.connect(path)
+            s.sendall((json.dumps(request) + "\n").encode())
+            return json.loads(s.makefile().readline())
+
+    def test_serve_refuses_create(self):
+        # The daemon can't create containers, however the request is
+        # written. Only global options may come before the command.
+        with tempfile.TemporaryDirectory() as dir:
+            path = os.path.join(dir, "ocijail.sock")
+            daemon = subprocess.Popen(
+                args=["ocijail/ocijail", "--root", os.path.join(dir, "state"),
+                      "serve", "--socket", path],
+                stderr=subprocess.DEVNULL)
+            try:
+                for i in range(100):
+                    if os.path.exists(path):
+                        break
+                    time.sleep(0.05)
+                requests = [
+                    {"command": "create", "args": ["--bundle", dir, "c1"]},
+                    {"command": "start",
+                     "options": ["create", "--bundle", dir],
+                     "args": []},
+                    {"command": "state",
+                     "options": ["--testing=validation", "create"],
+                     "args": ["--bundle", dir, "c1"]},
+                    {"command": "state", "options": ["--log"], "args": []},
+                ]
+                for request in requests:
+                    res = self.request(path, request)
+                    self.assertNotEqual(res["status"], 0)
+                    self.assertTrue(res["error"].startswith("request: "))
+                res = self.request(path, {"command": "state",
+                                          "options": ["--log-level", "debug"],
+                                          "args": ["c1"]})
+                self.assertEqual(res["error"], "container c1 not found")
+            finally:
+                daemon.terminate()
+                daemon.wait()
+
 
 if __name__ == "__main__":
     unittest.main()
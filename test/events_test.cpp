@@ -0,0 +1,179 @@
+// Tests for the container event stream, using a stand-in event source which
+// lets the test decide when notifications are delivered. This runs on any
+// platform - the kqueue source is only used by the runtime itself.
+
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/event_stream.h"
+#include "ocijail/runtime_state.h"
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+using nlohmann::json;
+
+// Every call to wait returns immediately with whatever the test queued.
+class fake_event_source : public event_source {
+   public:
+    void watch_path(const fs::path& path) override { paths.insert(path); }
+    void unwatch_path(const fs::path& path) override { paths.erase(path); }
+    void watch_process(pid_t pid) override { processes.insert(pid); }
+    notification wait() override {
+        notification res;
+        res.changed = true;
+        res.exits = std::move(exits);
+        exits.clear();
+        return res;
+    }
+
+    std::set<fs::path> paths;
+    std::set<pid_t> processes;
+    std::vector<process_exit> exits;
+};
+
+// Return the events written since the last call
+static std::vector<json> take_events(std::stringstream& out) {
+    std::vector<json> res;
+    std::string line;
+    while (std::getline(out, line)) {
+        res.push_back(json::parse(line));
+    }
+    out.clear();
+    out.str("");
+    return res;
+}
+
+static void save_status(runtime_state& state, container_status status) {
+    auto lk = state.lock();
+    state.set_status(status);
+    state.save();
+}
+
+int main(int argc, char** argv) {
+    auto root = testing::scratch_dir("events");
+
+    // A container which exists before we start is not reported
+    runtime_state existing{root / "existing", "existing"};
+    {
+        auto lk = existing.create();
+        existing.set_status(container_status::RUNNING);
+        existing.set_pid(100);
+        existing.save();
+    }
+
+    fake_event_source source;
+    std::stringstream out;
+    event_stream stream{root, source, out};
+    stream.start();
+    CHECK(take_events(out).empty());
+    CHECK(source.paths.contains(root / "index"));
+    CHECK(source.processes.contains(100));
+
+    runtime_state state{root / "c1", "c1"};
+    {
+        auto lk = state.create();
+        state.set_status(container_status::CREATED);
+        state.set_pid(200);
+        state.save();
+    }
+    stream.step();
+    auto events = take_events(out);
+    CHECK(events.size() == 1);
+    CHECK(events[0]["type"] == "create");
+    CHECK(events[0]["id"] == "c1");
+    CHECK(events[0]["status"] == "created");
+    CHECK(events[0]["pid"] == 200);
+    CHECK(events[0].contains("time"));
+    CHECK(source.processes.contains(200));
+
+    // Nothing changed
+    stream.step();
+    CHECK(take_events(out).empty());
+
+    save_status(state, container_status::RUNNING);
+    stream.step();
+    events = take_events(out);
+    CHECK(events.size() == 1);
+    CHECK(events[0]["type"] == "start");
+    CHECK(events[0]["status"] == "running");
+
+    // The process exit is reported with its status, before anything notices
+    // and records it in the state database.
+    source.exits.push_back({200, 3 << 8});
+    stream.step();
+    events = take_events(out);
+    CHECK(events.size() == 1);
+    CHECK(events[0]["type"] == "stop");
+    CHECK(events[0]["status"] == "stopped");
+    CHECK(events[0]["exitStatus"] == 3);
+
+    // Recording the stopped status doesn't repeat the event
+    save_status(state, container_status::STOPPED);
+    stream.step();
+    CHECK(take_events(out).empty());
+
+    state.remove_all();
+    stream.step();
+    events = take_events(out);
+    CHECK(events.size() == 1);
+    CHECK(events[0]["type"] == "delete");
+    CHECK(events[0]["id"] == "c1");
+
+    // Deleting a container whose stop we never saw reports both
+    existing.remove_all();
+    stream.step();
+    events = take_events(out);
+    CHECK(events.size() == 2);
+    CHECK(events[0]["type"] == "stop");
+    CHECK(events[0]["id"] == "existing");
+    CHECK(!events[0].contains("exitStatus"));
+    CHECK(events[1]["type"] == "delete");
+
+    // Filtering by id
+    std::stringstream filtered_out;
+    fake_event_source filtered_source;
+    event_stream filtered{root, filtered_source, filtered_out, "c3"};
+    filtered.start();
+    for (auto id : {"c2", "c3"}) {
+        runtime_state s{root / id, id};
+        auto lk = s.create();
+        s.set_status(container_status::CREATED);
+        s.set_pid(300);
+        s.save();
+    }
+    filtered.step();
+    events = take_events(filtered_out);
+    CHECK(events.size() == 1);
+    CHECK(events[0]["id"] == "c3");
+
+    // A missing state root is created so that it can be watched
+    std::stringstream new_out;
+    fake_event_source new_source;
+    event_stream fresh{root / "new", new_source, new_out};
+    fresh.start();
+    CHECK(fs::is_directory(root / "new"));
+    CHECK(new_source.paths.contains(root / "new"));
+    {
+        runtime_state s{root / "new" / "c4", "c4"};
+        auto lk = s.create();
+        s.set_status(container_status::CREATED);
+        s.set_pid(400);
+        s.save();
+    }
+    fresh.step();
+    events = take_events(new_out);
+    CHECK(events.size() == 1);
+    CHECK(events[0]["id"] == "c4");
+
+    fs::remove_all(root);
+    return testing::finish();
+}
@@ -0,0 +1,159 @@
+// Tests for the exec block which the create child keeps while it waits for
+// start. The RSS test forks a child holding a large config, like create's
+// child, and reports its resident size before and after it packs the
+// process and frees everything else.
+
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/exec_block.h"
+#include "ocijail/spec.h"
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+using nlohmann::json;
+
+static std::vector<std::string> strings(char* const* p) {
+    std::vector<std::string> res;
+    for (; *p; p++) {
+        res.push_back(*p);
+    }
+    return res;
+}
+
+static void test_pack() {
+    process_spec proc;
+    proc.args = {"sh", "-c", "true"};
+    proc.env = {"PATH=/bin", "HOME="};
+    proc.cwd = "/tmp";
+    proc.gids = {0, 5};
+    exec_block block{proc};
+    CHECK((strings(block.argv()) ==
+           std::vector<std::string>{"sh", "-c", "true"}));
+    CHECK((strings(block.envp()) ==
+           std::vector<std::string>{"PATH=/bin", "HOME=/"}));
+    CHECK(block.cwd() == "/tmp");
+
+    // An existing HOME is kept
+    proc.env = {"HOME=/home/user"};
+    exec_block with_home{proc};
+    CHECK((strings(with_home.envp()) ==
+           std::vector<std::string>{"HOME=/home/user"}));
+
+    // Moving the block keeps the packed pointers valid
+    auto moved = std::move(block);
+    CHECK(moved.cwd() == "/tmp");
+    CHECK(block.size() == 0);
+}
+
+static void test_hooks(const fs::path& dir) {
+    auto out = dir / "hook.out";
+    process_spec proc;
+    proc.args = {"true"};
+    hook_spec hook;
+    hook.path = "/bin/sh";
+    hook.args = {"-c", "{ cat; echo; echo $X; } > " + out.native()};
+    hook.env = {"X=from-hook"};
+    exec_block block{proc, {hook}, R"({"id":"test"})"};
+    block.run_hooks();
+
+    std::ifstream in{out};
+    std::string state, x;
+    std::getline(in, state);
+    std::getline(in, x);
+    CHECK(state == R"({"id":"test"})");
+    CHECK(x == "from-hook");
+}
+
+// The resident size of a process in kilobytes, as reported by ps
+static long rss_kb(pid_t pid) {
+    auto cmd = "ps -o rss= -p " + std::to_string(pid);
+    auto fp = ::popen(cmd.c_str(), "r");
+    if (!fp) {
+        return -1;
+    }
+    long rss = -1;
+    if (std::fscanf(fp, "%ld", &rss) != 1) {
+        rss = -1;
+    }
+    ::pclose(fp);
+    return rss;
+}
+
+static void test_rss() {
+    // A large config, parsed and compiled as create does for a new config
+    json config = {
+        {"ociVersion", "1.0.2"},
+        {"process", {{"args", {"sh"}}, {"cwd", "/"}}},
+    };
+    auto& env = config["process"]["env"];
+    auto& annotations = config["annotations"];
+    for (int i = 0; i < 100000; i++) {
+        auto s = std::to_string(i);
+        env.push_back("GENERATED_VARIABLE_" + s + "=some value for " + s);
+        annotations["io.example.generated." + s] = "annotation value " + s;
+    }
+    auto text = std::make_unique<std::string>(config.dump());
+    auto parsed = std::make_unique<json>(read_config(*text));
+    auto spec = std::make_unique<oci_spec>(oci_spec::compile(*parsed));
+    config = nullptr;
+
+    int to_parent[2], to_child[2];
+    if (::pipe(to_parent) < 0 || ::pipe(to_child) < 0) {
+        throw std::system_error{errno, std::system_category(), "pipe"};
+    }
+    char ch = 0;
+    auto pid = ::fork();
+    if (pid == 0) {
+        // Wait for the parent to measure us at each step
+        auto step = [&] {
+            ::write(to_parent[1], &ch, 1);
+            ::read(to_child[0], &ch, 1);
+        };
+        step();
+        std::optional<exec_block> block;
+        block.emplace(spec->process, spec->hooks[START_CONTAINER], "{}");
+        text.reset();
+        parsed.reset();
+        spec.reset();
+        release_free_memory();
+        step();
+        ::_exit(block->argv()[0] == std::string{"sh"} ? 0 : 1);
+    }
+
+    ::read(to_parent[0], &ch, 1);
+    auto before = rss_kb(pid);
+    ::write(to_child[1], &ch, 1);
+    ::read(to_parent[0], &ch, 1);
+    auto after = rss_kb(pid);
+    ::write(to_child[1], &ch, 1);
+    int status;
+    ::waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    std::cout << "parked child RSS: " << before << " KB before, " << after
+              << " KB after packing\n";
+    CHECK(before > 0 && after > 0);
+    CHECK(after < before / 2);
+}
+
+int main(int argc, char** argv) {
+    auto dir = testing::scratch_dir("exec_block");
+    test_pack();
+    test_hooks(dir);
+    test_rss();
+    fs::remove_all(dir);
+    return testing::finish();
+}
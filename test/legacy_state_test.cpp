@@ -0,0 +1,120 @@
+// Tests for containers created by older versions of the runtime, which keep
+// all of their state in state.json.
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/runtime_state.h"
+#include "ocijail/state_index.h"
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+using nlohmann::json;
+
+static void write_legacy(const fs::path& dir, const std::string& status) {
+    fs::create_directories(dir);
+    json legacy = {
+        {"status", status},
+        {"pid", 1234},
+        {"jid", 7},
+        {"bundle", "/bundle"},
+        {"root_path", "/bundle/root"},
+        {"root_readonly", false},
+        {"file_mount_supported", true},
+        {"remove_on_unmount", {"/bundle/root/data"}},
+        {"config",
+         {{"ociVersion", "1.0.2"},
+          {"process", {{"args", {"/bin/sh"}}, {"cwd", "/"}}},
+          {"root", {{"path", "root"}}},
+          {"annotations", {{"a", "b"}}},
+          {"hooks", {{"poststop", {{{"path", "/bin/true"}}}}}}}},
+    };
+    std::ofstream{dir / "state.json"} << legacy;
+}
+
+static void test_load(const fs::path& root) {
+    write_legacy(root / "c1", "created");
+    runtime_state state{root / "c1", "c1"};
+    CHECK(state.exists());
+    state.load();
+    CHECK(state.status() == container_status::CREATED);
+    CHECK(state.pid() == 1234);
+    CHECK(state.jid() == 7);
+    CHECK(state.bundle() == "/bundle");
+    CHECK(state.hook_mask() == 1u << POSTSTOP);
+    auto report = state.report();
+    CHECK(report["annotations"]["a"] == "b");
+    CHECK(report["annotations"]["org.freebsd.jail.jid"] == "7");
+
+    // The details come from state.json, without the status and config
+    state.load_details();
+    CHECK(state["root_path"] == "/bundle/root");
+    CHECK(state["remove_on_unmount"].size() == 1);
+    CHECK(!state.contains("status"));
+    CHECK(state.spec().hooks[POSTSTOP].size() == 1);
+
+    // Nothing is written until the container is saved
+    CHECK(!fs::exists(root / "c1" / "status"));
+
+    // An index built from the state directories includes the container
+    state_index index{root};
+    index.rebuild();
+    auto entry = index.lookup("c1");
+    CHECK(entry && entry->record.pid == 1234);
+}
+
+static void test_convert(const fs::path& root) {
+    write_legacy(root / "c2", "running");
+    {
+        runtime_state state{root / "c2", "c2"};
+        auto lk = state.lock();
+        state.load();
+        state.set_status(container_status::STOPPED);
+        state.save();
+    }
+    CHECK(fs::exists(root / "c2" / "status"));
+    CHECK(fs::exists(root / "c2" / "config.json"));
+
+    runtime_state state{root / "c2", "c2"};
+    CHECK(state.exists());
+    state.load();
+    CHECK(state.status() == container_status::STOPPED);
+    CHECK(state.report()["annotations"]["a"] == "b");
+    state.load_details();
+    CHECK(state["root_path"] == "/bundle/root");
+    CHECK(!state.contains("config"));
+    CHECK(state.config()["process"]["args"][0] == "/bin/sh");
+    state.remove_all();
+    CHECK(!state.exists());
+}
+
+static void test_not_legacy(const fs::path& root) {
+    // The details of a container being created are not a legacy record
+    fs::create_directories(root / "c3");
+    std::ofstream{root / "c3" / "state.json"} << json{{"root_path", "/"}};
+    runtime_state state{root / "c3", "c3"};
+    CHECK(!state.exists());
+    try {
+        state.load();
+        CHECK(false);
+    } catch (const std::runtime_error& e) {
+        CHECK(std::string{e.what()} == "container c3 not found");
+    }
+}
+
+int main(int argc, char** argv) {
+    auto root = testing::scratch_dir("legacy_state");
+    test_load(root);
+    test_convert(root);
+    test_not_legacy(root);
+    fs::remove_all(root);
+    return testing::finish();
+}
@@ -0,0 +1,177 @@
+// Tests for the metrics store. The concurrency test forks processes which
+// add their totals and publish the text file at the same time, and checks
+// that no update is lost and that the published file is well formed.
+
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include "ocijail/metrics.h"
+#include "ocijail/recorder.h"
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+
+// Parse the samples of a text file, checking that each family's samples are
+// together and follow its HELP and TYPE lines
+static std::map<std::string, double> parse(const std::string& text) {
+    std::map<std::string, double> samples;
+    std::set<std::string> families;
+    std::string current;
+    std::istringstream in{text};
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.starts_with("# HELP ")) {
+            auto name = line.substr(7, line.find(' ', 7) - 7);
+            CHECK(!families.contains(name));
+            families.insert(name);
+            current = name;
+            continue;
+        }
+        if (line.starts_with("# TYPE ")) {
+            CHECK(line.substr(7).starts_with(current + " "));
+            continue;
+        }
+        auto sp = line.rfind(' ');
+        auto series = line.substr(0, sp);
+        CHECK(series.starts_with(current));
+        CHECK(!samples.contains(series));
+        samples[series] = std::stod(line.substr(sp + 1));
+    }
+    return samples;
+}
+
+static std::string read_text(const fs::path& path) {
+    std::stringstream ss;
+    ss << std::ifstream{path}.rdbuf();
+    return ss.str();
+}
+
+static flight_totals create_totals() {
+    flight_totals totals;
+    totals.add(flight_op::COMMAND, 3000000, 0);
+    totals.add(flight_op::CONFIG, 200000, 0);
+    totals.add(flight_op::NMOUNT, 20000, 0);
+    totals.add(flight_op::NMOUNT, 20000, 0);
+    totals.add(flight_op::NMOUNT, 10000, ENOENT);
+    totals.add(flight_op::HOOK, 2000000000, 0);
+    totals.add(flight_op::LOCK_WAIT, 5000, 0);
+    return totals;
+}
+
+static void test_text(const fs::path& dir) {
+    auto root = dir / "text";
+    fs::create_directories(root);
+    metrics_store metrics{root};
+    metrics.add("create", 0, create_totals());
+    auto failed = create_totals();
+    failed.error = ENOENT;
+    metrics.add("create", 1, failed);
+    metrics.add("not-a-command", 0, flight_totals{});
+    metrics.publish(true);
+
+    std::ifstream in{metrics.path()};
+    std::stringstream ss;
+    ss << in.rdbuf();
+    auto samples = parse(ss.str());
+    auto create = std::string{"{command=\"create\""};
+    auto commands = "ocijail_commands_total" + create;
+    CHECK(samples[commands + ",result=\"ok\"}"] == 1);
+    CHECK(samples[commands + ",result=\"error\"}"] == 1);
+    CHECK(samples["ocijail_commands_total{command=\"other\",result=\"ok\"}"] ==
+          1);
+    CHECK(samples["ocijail_command_failures_total" + create + ",errno=\"" +
+                  std::to_string(ENOENT) + "\"}"] == 1);
+    CHECK(samples["ocijail_mounts_total" + create + "}"] == 4);
+    CHECK(samples["ocijail_syscall_errors_total" + create +
+                  ",call=\"nmount\"}"] == 2);
+
+    // Buckets are cumulative
+    auto phase = "ocijail_phase_duration_seconds_bucket" + create +
+                 ",phase=\"config\",le=";
+    CHECK(samples[phase + "\"0.001\"}"] == 2);
+    CHECK(samples[phase + "\"+Inf\"}"] == 2);
+    auto hook = "ocijail_hook_duration_seconds_bucket" + create + ",le=";
+    CHECK(samples[hook + "\"1\"}"] == 0);
+    CHECK(samples[hook + "\"2.5\"}"] == 2);
+    CHECK(samples["ocijail_hook_duration_seconds_sum" + create + "}"] == 4);
+    CHECK(samples["ocijail_hook_duration_seconds_count" + create + "}"] == 2);
+    CHECK(samples.contains("ocijail_lock_wait_seconds_count" + create + "}"));
+
+    // Hooks and lock waits are not repeated with the phases and calls
+    CHECK(!samples.contains("ocijail_phase_duration_seconds_count" + create +
+                            ",phase=\"hook\"}"));
+
+    // The text file isn't rewritten again straight away unless forced
+    auto text = ss.str();
+    metrics.add("create", 0, create_totals());
+    metrics.publish();
+    CHECK(read_text(metrics.path()) == text);
+    metrics.publish(true);
+    CHECK(read_text(metrics.path()) != text);
+}
+
+static void test_concurrent(const fs::path& dir) {
+    constexpr int PROCESSES = 8;
+    constexpr int COMMANDS = 200;
+    auto root = dir / "concurrent";
+    fs::create_directories(root);
+    std::vector<pid_t> pids;
+    for (int i = 0; i < PROCESSES; i++) {
+        auto pid = ::fork();
+        if (pid == 0) {
+            try {
+                for (int j = 0; j < COMMANDS; j++) {
+                    metrics_store metrics{root};
+                    metrics.add("start", j % 10 == 0, create_totals());
+                    metrics.publish();
+                }
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << "\n";
+                ::_exit(1);
+            }
+            ::_exit(0);
+        }
+        pids.push_back(pid);
+    }
+    for (auto pid : pids) {
+        int status;
+        ::waitpid(pid, &status, 0);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    metrics_store metrics{root};
+    metrics.publish(true);
+    std::ifstream in{metrics.path()};
+    std::stringstream ss;
+    ss << in.rdbuf();
+    auto samples = parse(ss.str());
+    auto start = std::string{"{command=\"start\""};
+    auto ok = samples["ocijail_commands_total" + start + ",result=\"ok\"}"];
+    auto failed =
+        samples["ocijail_commands_total" + start + ",result=\"error\"}"];
+    CHECK(ok == PROCESSES * COMMANDS * 9 / 10);
+    CHECK(failed == PROCESSES * COMMANDS / 10);
+    CHECK(samples["ocijail_mounts_total" + start + "}"] ==
+          2 * PROCESSES * COMMANDS);
+    CHECK(samples["ocijail_command_duration_seconds_count" + start + "}"] ==
+          PROCESSES * COMMANDS);
+    CHECK(!fs::exists(metrics.path().native() + ".new"));
+}
+
+int main(int argc, char** argv) {
+    auto dir = testing::scratch_dir("metrics");
+    test_text(dir);
+    test_concurrent(dir);
+    fs::remove_all(dir);
+    return testing::finish();
+}
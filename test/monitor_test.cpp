@@ -0,0 +1,228 @@
+// Tests for recording container exits and waiting for them, using a
+// stand-in event source in place of kqueue.
+
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "ocijail/event_stream.h"
+#include "ocijail/monitor.h"
+#include "ocijail/runtime_state.h"
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+
+// Each call to wait delivers the next queued exec and exit. An optional
+// callback runs first, to simulate other processes changing the state.
+class fake_event_source : public event_source {
+   public:
+    void watch_path(const fs::path& path) override {}
+    void unwatch_path(const fs::path& path) override {}
+    void watch_process(pid_t pid) override { watched = pid; }
+    void watch_exec(pid_t pid) override { exec_watched = pid; }
+    notification wait() override {
+        if (before_wait) {
+            before_wait();
+        }
+        notification res;
+        res.changed = true;
+        if (!execs.empty()) {
+            res.execs.push_back(execs.front());
+            execs.erase(execs.begin());
+        }
+        if (!exits.empty()) {
+            res.exits.push_back(exits.front());
+            exits.erase(exits.begin());
+        }
+        return res;
+    }
+
+    pid_t watched{-1};
+    pid_t exec_watched{-1};
+    std::vector<pid_t> execs;
+    std::vector<process_exit> exits;
+    std::function<void()> before_wait;
+};
+
+// Return the pid of a process which has exited and been reaped
+static pid_t dead_pid() {
+    auto pid = ::fork();
+    if (pid == 0) {
+        ::_exit(0);
+    }
+    int status;
+    ::waitpid(pid, &status, 0);
+    return pid;
+}
+
+static void create_container(const fs::path& root,
+                             const std::string& id,
+                             pid_t pid,
+                             uint32_t flags) {
+    runtime_state state{root / id, id};
+    auto lk = state.create();
+    state.set_status(container_status::RUNNING);
+    state.set_pid(pid);
+    state.add_flags(flags);
+    state.save();
+}
+
+int main(int argc, char** argv) {
+    auto root = testing::scratch_dir("monitor");
+
+    // The monitor records the exit status and stop time
+    {
+        create_container(root, "c1", 1000, status_record::MONITORED);
+        runtime_state state{root / "c1", "c1"};
+        fake_event_source source;
+        source.exits.push_back({999, 0});
+        source.exits.push_back({1000, 7 << 8});
+        bool ready = false;
+        monitor_exit(state, source, 1000, [&] { ready = true; });
+        CHECK(ready);
+        CHECK(source.watched == 1000);
+
+        runtime_state check{root / "c1", "c1"};
+        check.load();
+        CHECK(check.status() == container_status::STOPPED);
+        CHECK(check.exit_status() && WEXITSTATUS(*check.exit_status()) == 7);
+        CHECK(check.time(CREATE_BEGIN).wall > 0);
+        CHECK(check.time(STOP_OBSERVED).monotonic >=
+              check.time(CREATE_BEGIN).monotonic);
+        CHECK(!check.time(EXEC_CONFIRMED));
+
+        // A monitored container's record is trusted without probing
+        create_container(root, "c2", dead_pid(), status_record::MONITORED);
+        runtime_state c2{root / "c2", "c2"};
+        c2.load();
+        c2.check_status();
+        CHECK(c2.status() == container_status::RUNNING);
+        c2.check_status(true);
+        CHECK(c2.status() == container_status::STOPPED);
+        CHECK(!c2.exit_status());
+    }
+
+    // The first exec of the container process confirms that it started
+    {
+        create_container(root, "c7", 1007, status_record::MONITORED);
+        runtime_state state{root / "c7", "c7"};
+        fake_event_source source;
+        source.execs = {998, 1007, 1007};
+        source.exits.push_back({999, 0});
+        source.exits.push_back({1000, 0});
+        source.exits.push_back({1007, 0});
+        lifecycle_time first;
+        source.before_wait = [&] {
+            runtime_state check{root / "c7", "c7"};
+            check.load();
+            if (!first && check.time(EXEC_CONFIRMED)) {
+                first = check.time(EXEC_CONFIRMED);
+            }
+        };
+        monitor_exit(state, source, 1007);
+        CHECK(source.exec_watched == 1007);
+
+        runtime_state check{root / "c7", "c7"};
+        check.load();
+        auto& confirmed = check.time(EXEC_CONFIRMED);
+        CHECK(first && confirmed.monotonic == first.monotonic);
+        CHECK(confirmed.monotonic >= check.time(CREATE_BEGIN).monotonic);
+        CHECK(check.time(STOP_OBSERVED).monotonic >= confirmed.monotonic);
+
+        auto timings = check.timings();
+        CHECK(timings.size() == 3);
+        CHECK(timings["execConfirmed"]["wall"] == confirmed.wall);
+        CHECK(!timings.contains("startRequested"));
+    }
+
+    // The monitor doesn't recreate a deleted container
+    {
+        create_container(root, "c3", 1003, status_record::MONITORED);
+        runtime_state state{root / "c3", "c3"};
+        state.remove_all();
+        fake_event_source source;
+        source.exits.push_back({1003, 0});
+        monitor_exit(state, source, 1003);
+        CHECK(!fs::exists(root / "c3"));
+    }
+
+    // Waiting for a stopped container returns immediately
+    {
+        runtime_state state{root / "c1", "c1"};
+        fake_event_source source;
+        auto status = wait_exit(state, source);
+        CHECK(status && WEXITSTATUS(*status) == 7);
+        CHECK(source.watched == -1);
+    }
+
+    // The exit status from the event source is returned directly
+    {
+        create_container(root, "c4", 1004, status_record::MONITORED);
+        runtime_state state{root / "c4", "c4"};
+        fake_event_source source;
+        source.exits.push_back({1004, 3 << 8});
+        auto status = wait_exit(state, source);
+        CHECK(source.watched == 1004);
+        CHECK(status && WEXITSTATUS(*status) == 3);
+    }
+
+    // If the source doesn't know the status, use the one the monitor
+    // recorded
+    {
+        create_container(root, "c5", 1005, status_record::MONITORED);
+        runtime_state state{root / "c5", "c5"};
+        fake_event_source source;
+        source.exits.push_back({1005, std::nullopt});
+        int waits = 0;
+        source.before_wait = [&] {
+            if (++waits == 1) {
+                runtime_state monitor{root / "c5", "c5"};
+                auto lk = monitor.lock();
+                monitor.load();
+                monitor.set_exited(5 << 8);
+                monitor.save();
+            }
+        };
+        auto status = wait_exit(state, source);
+        CHECK(status && WEXITSTATUS(*status) == 5);
+    }
+
+    // If the monitor was killed, the waiter records the exit itself rather
+    // than waiting for events which will never come
+    {
+        auto pid = dead_pid();
+        create_container(root, "c8", pid, status_record::MONITORED);
+        runtime_state state{root / "c8", "c8"};
+        fake_event_source source;
+        source.exits.push_back({pid, std::nullopt});
+        int waits = 0;
+        source.before_wait = [&] { CHECK(++waits == 1); };
+        auto status = wait_exit(state, source);
+        CHECK(!status);
+        runtime_state check{root / "c8", "c8"};
+        check.load();
+        CHECK(check.status() == container_status::STOPPED);
+    }
+
+    // Without a monitor, the waiter records the exit itself
+    {
+        auto pid = dead_pid();
+        create_container(root, "c6", pid, 0);
+        runtime_state state{root / "c6", "c6"};
+        fake_event_source source;
+        source.exits.push_back({pid, std::nullopt});
+        auto status = wait_exit(state, source);
+        CHECK(!status);
+        runtime_state check{root / "c6", "c6"};
+        check.load();
+        CHECK(check.status() == container_status::STOPPED);
+    }
+
+    fs::remove_all(root);
+    return testing::finish();
+}
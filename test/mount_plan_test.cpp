@@ -0,0 +1,132 @@
+// Tests for the mount plan recorded by create: teardown undoes exactly what
+// was done, in reverse, even if the container has changed its rootfs or a
+// mount's source has gone.
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "ocijail/main.h"
+#include "ocijail/mount.h"
+#include "ocijail/runtime_state.h"
+#include "ocijail/sim_platform.h"
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+
+static std::string read_file(const fs::path& path) {
+    std::stringstream ss;
+    ss << std::ifstream{path}.rdbuf();
+    return ss.str();
+}
+
+static mount_spec nullfs(const std::string& destination,
+                         const fs::path& source) {
+    return mount_spec{destination, source, "nullfs", {{"ro", ""}}};
+}
+
+static int mount(const fs::path& path, const fs::path& target) {
+    mount_options opts;
+    opts.emplace_back("fstype", "nullfs");
+    opts.emplace_back("fspath", path.native());
+    opts.emplace_back("target", target.native());
+    return do_mount(opts, 0);
+}
+
+int main(int argc, char** argv) {
+    auto dir = testing::scratch_dir("mount_plan");
+    auto root = dir / "root";
+    auto volume = dir / "volume";
+    auto hosts = dir / "hosts";
+    fs::create_directories(root / "etc");
+    fs::create_directories(root / "real");
+    fs::create_symlink("real", root / "link");
+    fs::create_directories(volume);
+    std::ofstream{root / "etc" / "hosts"} << "original";
+    std::ofstream{hosts} << "copied";
+
+    sim_platform sim;
+    set_platform(&sim);
+    main_app app{"mount_plan_test"};
+    runtime_state state{dir / "state" / "c", "c"};
+
+    // The file mount is not supported by the kernel, so it is copied
+    sim.inject_fault(sim_op::MOUNT, ENOTDIR, 4);
+    std::vector<mount_spec> mounts = {
+        nullfs("/data", volume),
+        nullfs("/data/sub", volume),
+        nullfs("/link/x", volume),
+        mount_spec{"/tmp", "", "tmpfs", {{"size", "1m"}}},
+        nullfs("/etc/hosts", hosts),
+    };
+    mount_volumes(app, state, root, false, mounts);
+
+    auto& plan = state["mount_plan"];
+    CHECK(plan.size() == 5);
+    CHECK(plan[0]["fspath"] == (root / "data").native());
+    CHECK(plan[0]["created"].size() == 1);
+    CHECK(plan[0]["flags"] == MNT_RDONLY);
+    CHECK(plan[2]["fspath"] == (root / "real" / "x").native());
+    CHECK(plan[3]["options"][2][0] == "size");
+    CHECK(plan[4]["file_mount"] == true);
+    CHECK(plan[4]["copied"] == true);
+    CHECK(plan[4]["mounted"] == false);
+    CHECK(sim.mounts().size() == 4);
+    CHECK(read_file(root / "etc" / "hosts") == "copied");
+
+    // The container retargets a symlink and the file mount's source goes
+    // away. Teardown still undoes the mounts which were made.
+    fs::remove(root / "link");
+    fs::create_directories(root / "other" / "x");
+    fs::create_symlink("other", root / "link");
+    fs::remove(hosts);
+    unmount_volumes(state);
+    CHECK(sim.mounts().empty());
+    CHECK(!fs::exists(root / "data"));
+    CHECK(!fs::exists(root / "real" / "x"));
+    CHECK(!fs::exists(root / "tmp"));
+    CHECK(fs::exists(root / "other" / "x"));
+    CHECK(read_file(root / "etc" / "hosts") == "original");
+    CHECK(!fs::exists(root / "etc" / ".save-c"));
+
+    // A failed mount undoes the mounts before it
+    runtime_state failed{dir / "state" / "d", "d"};
+    sim.inject_fault(sim_op::MOUNT, EPERM, 1);
+    try {
+        mount_volumes(app, failed, root, false, mounts);
+        CHECK(false);
+    } catch (const std::system_error& e) {
+        CHECK(e.code().value() == EPERM);
+    }
+    CHECK(sim.mounts().empty());
+    CHECK(!fs::exists(root / "data"));
+
+    // Containers created by older versions only recorded the paths they
+    // created, which are removed after the mounts are undone
+    runtime_state legacy{dir / "state" / "e", "e"};
+    fs::create_directories(root / "data" / "sub");
+    legacy["file_mount_supported"] = true;
+    legacy["remove_on_unmount"] = {root / "data" / "sub", root / "data"};
+    std::vector<mount_spec> legacy_mounts = {
+        nullfs("/data", volume),
+        nullfs("/data/sub", volume),
+    };
+    CHECK(mount(root / "data", volume) == 0);
+    CHECK(mount(root / "data" / "sub", volume) == 0);
+    plan_legacy_mounts(app, legacy, root, legacy_mounts);
+    CHECK(legacy["mount_plan"].size() == 3);
+    unmount_volumes(legacy);
+    CHECK(sim.mounts().empty());
+    CHECK(!fs::exists(root / "data"));
+
+    set_platform(nullptr);
+    fs::remove_all(dir);
+    return testing::finish();
+}
@@ -0,0 +1,144 @@
+#! /usr/bin/env python
+
+# Record invocations with OCIJAIL_RECORD and replay them. Commands use
+# validation mode and missing containers so that the test can run without
+# root.
+
+import json
+import os
+import os.path
+import subprocess
+import tempfile
+import unittest
+
+cmd = "ocijail/ocijail"
+replay = "bench/replay"
+
+class test_record(unittest.TestCase):
+    "Recording and replaying invocations"
+
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.trace = os.path.join(self.dir.name, "trace.jsonl")
+        self.root = os.path.join(self.dir.name, "state")
+        self.bundle = os.path.join(self.dir.name, "bundle")
+        os.mkdir(self.bundle)
+        with open(os.path.join(self.bundle, "config.json"), "w") as f:
+            json.dump({
+                "ociVersion": "1.0.2",
+                "process": {
+                    "args": ["sh"],
+                    "cwd": "/",
+                    "env": ["PATH=/bin:/usr/bin", "TOKEN=secret"],
+                },
+                "root": {
+                    "path": "/tmp"
+                },
+                "annotations": {
+                    "io.podman.password": "secret"
+                }
+            }, f)
+
+    def tearDown(self):
+        self.dir.cleanup()
+
+    def run_recorded(self, *args):
+        env = dict(os.environ)
+        env["OCIJAIL_RECORD"] = self.trace
+        return subprocess.run([cmd, "--root", self.root] + list(args),
+                              env=env, stdout=subprocess.DEVNULL,
+                              stderr=subprocess.DEVNULL)
+
+    def records(self):
+        with open(self.trace) as f:
+            return [json.loads(line) for line in f]
+
+    def test_record(self):
+        self.run_recorded("--testing=validation", "create",
+                          "--bundle", self.bundle, "c1")
+        self.run_recorded("state", "missing")
+        records = self.records()
+        self.assertEqual(len(records), 2)
+
+        create, state = records
+        self.assertEqual(create["args"],
+                         ["--root", self.root, "--testing=validation",
+                          "create", "--bundle", self.bundle, "c1"])
+        self.assertEqual(create["status"], 0)
+        self.assertGreater(create["duration"], 0)
+        self.assertLessEqual(create["start"], state["start"])
+        self.assertEqual(create["cwd"], os.getcwd())
+
+        # Secrets are removed from the config
+        config = create["config"]
+        self.assertEqual(config["process"]["env"], ["PATH=", "TOKEN="])
+        self.assertEqual(config["annotations"],
+                         {"io.podman.password": ""})
+        self.assertEqual(config["process"]["args"], ["sh"])
+
+        self.assertEqual(state["args"], ["--root", self.root,
+                                         "state", "missing"])
+        self.assertNotEqual(state["status"], 0)
+        self.assertNotIn("config", state)
+
+    def test_batch(self):
+        # Batch is recorded as one invocation without the inputs of the
+        # commands it runs
+        request = {"command": "create",
+                   "options": ["--testing=validation"],
+                   "args": ["--bundle", self.bundle, "c1"]}
+        env = dict(os.environ)
+        env["OCIJAIL_RECORD"] = self.trace
+        subprocess.run([cmd, "--root", self.root, "batch"], env=env,
+                       input=(2 * (json.dumps(request) + "\n")).encode(),
+                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        records = self.records()
+        self.assertEqual(len(records), 1)
+        self.assertEqual(records[0]["args"], ["--root", self.root, "batch"])
+        self.assertNotIn("config", records[0])
+
+    def test_not_recorded(self):
+        env = dict(os.environ)
+        env.pop("OCIJAIL_RECORD", None)
+        subprocess.run([cmd, "--root", self.root, "state", "missing"],
+                       env=env, stderr=subprocess.DEVNULL)
+        self.assertFalse(os.path.exists(self.trace))
+
+    def test_replay(self):
+        for i in range(4):
+            self.run_recorded("--testing=validation", "create",
+                              "--bundle", self.bundle, f"c{i}")
+            self.run_recorded("state", f"c{i}")
+
+        # Replay against another state database, recording the replay
+        replay_root = os.path.join(self.dir.name, "replay")
+        replay_trace = os.path.join(self.dir.name, "replay.jsonl")
+        res = subprocess.run([replay, "--ocijail", cmd, "--root",
+                              replay_root, "--record", replay_trace,
+                              "--speed", "10", "--json", self.trace],
+                             stdout=subprocess.PIPE, check=True)
+        report = json.loads(res.stdout)
+        self.assertEqual(report["invocations"], 8)
+        self.assertEqual(report["commands"]["create"]["count"], 4)
+        self.assertEqual(report["commands"]["state"]["count"], 4)
+        self.assertEqual(report["commands"]["create"]["status_mismatches"],
+                         0)
+        self.assertEqual(report["commands"]["state"]["status_mismatches"],
+                         0)
+
+        # The replay used the new state database and a bundle made from
+        # the recorded config
+        with open(replay_trace) as f:
+            replayed = [json.loads(line) for line in f]
+        self.assertEqual(len(replayed), 8)
+        for r in replayed:
+            self.assertEqual(r["args"][:2],
+                             ["--root", os.path.abspath(replay_root)])
+            if "create" in r["args"]:
+                bundle = r["args"][r["args"].index("--bundle") + 1]
+                self.assertNotEqual(bundle, self.bundle)
+                self.assertEqual(r["config"]["process"]["env"],
+                                 ["PATH=", "TOKEN="])
+
+if __name__ == '__main__':
+    unittest.main()
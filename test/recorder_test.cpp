@@ -0,0 +1,236 @@
+// Tests for the flight recorder: recording phases and calls, wrapping the
+// ring, saving and reading dumps, pruning old ones and writing traces.
+
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/recorder.h"
+#include "ocijail/spec.h"
+#include "ocijail/trace.h"
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+using nlohmann::json;
+
+static void test_record() {
+    CHECK(flight_recorder::current() == nullptr);
+    flight_recorder rec;
+    CHECK(flight_recorder::current() == &rec);
+    {
+        flight_phase phase{flight_op::MOUNTS, 1};
+        auto res = recorded(flight_op::NMOUNT, [] {
+            errno = ENOENT;
+            return -1;
+        });
+        CHECK(res == -1);
+        CHECK(errno == ENOENT);
+        recorded(flight_op::FORK, [] { return 42; });
+    }
+    try {
+        flight_phase phase{flight_op::HOOKS};
+        errno = EPERM;
+        throw std::runtime_error{"hook failed"};
+    } catch (const std::exception&) {
+    }
+
+    auto events = rec.events();
+    CHECK(events.size() == 6);
+    CHECK(events[0].kind == flight_event::BEGIN);
+    CHECK(events[0].op == uint16_t(flight_op::MOUNTS));
+    CHECK(events[0].arg == 1);
+    CHECK(events[1].kind == flight_event::CALL);
+    CHECK(events[1].op == uint16_t(flight_op::NMOUNT));
+    CHECK(events[1].error == ENOENT);
+    CHECK(events[1].arg == -1);
+    CHECK(events[2].error == 0);
+    CHECK(events[2].arg == 42);
+    CHECK(events[3].kind == flight_event::END);
+    CHECK(events[3].error == 0);
+    CHECK(events[3].duration >= events[1].duration);
+    CHECK(events[5].kind == flight_event::END);
+    CHECK(events[5].op == uint16_t(flight_op::HOOKS));
+    CHECK(events[5].error == EPERM);
+
+    // A nested recorder is current until it goes away
+    {
+        flight_recorder nested;
+        CHECK(flight_recorder::current() == &nested);
+    }
+    CHECK(flight_recorder::current() == &rec);
+}
+
+static void test_wrap() {
+    flight_recorder rec;
+    auto n = flight_recorder::CAPACITY + 10;
+    for (size_t i = 0; i < n; i++) {
+        rec.begin(flight_op::CONFIG, i);
+    }
+    auto events = rec.events();
+    CHECK(events.size() == flight_recorder::CAPACITY);
+    CHECK(rec.dropped() == 10);
+    CHECK(events.front().arg == 10);
+    CHECK(events.back().arg == int64_t(n - 1));
+}
+
+static void test_save(const fs::path& dir) {
+    flight_recorder rec;
+    rec.set_command("create");
+    rec.set_id("test-container");
+    rec.begin(flight_op::COMMAND);
+    auto start = rec.now();
+    rec.call(flight_op::JAIL_SET, start, -1, EEXIST);
+    rec.error(EEXIST);
+    auto path = rec.save(dir, 1);
+    CHECK(path.parent_path() == dir);
+
+    auto dump = read_flight_dump(path);
+    CHECK(dump.header.pid == ::getpid());
+    CHECK(dump.header.status == 1);
+    CHECK(std::string{dump.header.command} == "create");
+    CHECK(std::string{dump.header.id} == "test-container");
+    CHECK(dump.events.size() == 3);
+    CHECK(dump.events[1].op == uint16_t(flight_op::JAIL_SET));
+    CHECK(dump.events[1].error == EEXIST);
+
+    std::stringstream ss;
+    print_flight_dump(ss, dump);
+    auto text = ss.str();
+    CHECK(text.find("create test-container: pid ") != std::string::npos);
+    CHECK(text.find("call  jail_set") != std::string::npos);
+    CHECK(text.find("errno " + std::to_string(EEXIST)) != std::string::npos);
+
+    // Anything else is rejected
+    auto bad = dir / "bad.flight";
+    std::ofstream{bad} << "not a dump";
+    bool threw = false;
+    try {
+        read_flight_dump(bad);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    fs::remove(bad);
+}
+
+static void test_prune(const fs::path& dir) {
+    auto prune_dir = dir / "prune";
+    fs::path first;
+    for (int i = 0; i < 40; i++) {
+        flight_recorder rec;
+        auto path = rec.save(prune_dir, 0);
+        if (i == 0) {
+            first = path;
+        }
+    }
+    auto count = std::distance(fs::directory_iterator{prune_dir},
+                               fs::directory_iterator{});
+    CHECK(count == 32);
+    CHECK(!fs::exists(first));
+}
+
+static void test_trace(const fs::path& dir) {
+    auto path = dir / "trace.json";
+    flight_recorder rec;
+    rec.set_command("create");
+    rec.keep_events();
+    rec.begin(flight_op::COMMAND);
+    {
+        flight_phase phase{flight_op::HOOKS, CREATE_RUNTIME};
+        recorded(flight_op::FORK, [] { return 42; });
+    }
+    append_trace(path, rec, rec.take_events());
+    CHECK(rec.take_events().empty());
+
+    // A long running command keeps a bounded number of events
+    {
+        flight_recorder busy;
+        busy.keep_events();
+        for (size_t i = 0; i <= flight_recorder::MAX_KEPT; i++) {
+            busy.begin(flight_op::HOOKS);
+        }
+        CHECK(busy.take_events().size() == flight_recorder::MAX_KEPT);
+    }
+
+    // A second process appends to the same file
+    rec.error(ENOENT);
+    rec.end(flight_op::COMMAND, 0, 0, 1);
+    append_trace(path, rec, rec.take_events());
+
+    // The file is an unterminated JSON array
+    std::ifstream in{path};
+    std::stringstream ss;
+    ss << in.rdbuf();
+    auto text = ss.str();
+    CHECK(text.starts_with("[\n"));
+    CHECK(text.ends_with(",\n"));
+    text.resize(text.size() - 2);
+    auto trace = json::parse(text + "]");
+    CHECK(trace.size() == 6);
+    CHECK(trace[0]["name"] == "create");
+    CHECK(trace[0]["ph"] == "B");
+    CHECK(trace[1]["name"] == "createRuntime");
+    CHECK(trace[2]["name"] == "fork");
+    CHECK(trace[2]["ph"] == "X");
+    CHECK(trace[2]["args"]["result"] == 42);
+    CHECK(trace[2]["ts"] >= trace[1]["ts"]);
+    CHECK(trace[3]["ph"] == "E");
+    CHECK(trace[4]["ph"] == "i");
+    CHECK(trace[4]["name"] == "error");
+    CHECK(trace[4]["args"]["errno"] == ENOENT);
+    CHECK(trace[5]["name"] == "create");
+    CHECK(trace[5]["ph"] == "E");
+    CHECK(trace[5]["args"]["status"] == 1);
+    CHECK(trace[5]["pid"] == ::getpid());
+
+    // Only one of several processes starting a trace writes the header
+    auto shared = dir / "shared.json";
+    std::vector<pid_t> children;
+    for (int i = 0; i < 8; i++) {
+        auto pid = ::fork();
+        if (pid == 0) {
+            flight_recorder child;
+            child.keep_events();
+            child.begin(flight_op::COMMAND);
+            append_trace(shared, child, child.take_events());
+            ::_exit(0);
+        }
+        children.push_back(pid);
+    }
+    for (auto pid : children) {
+        ::waitpid(pid, nullptr, 0);
+    }
+    std::ifstream shared_in{shared};
+    std::string line;
+    std::getline(shared_in, line);
+    CHECK(line == "[");
+    int headers = 1, events = 0;
+    while (std::getline(shared_in, line)) {
+        (line == "[" ? headers : events)++;
+    }
+    CHECK(headers == 1);
+    CHECK(events == 8);
+}
+
+int main(int argc, char** argv) {
+    auto dir = testing::scratch_dir("recorder");
+    test_record();
+    test_wrap();
+    test_save(dir);
+    test_prune(dir);
+    test_trace(dir);
+    fs::remove_all(dir);
+    return testing::finish();
+}
@@ -0,0 +1,40 @@
+// Add containers to a state database as create leaves them, so that tests
+// which run commands against existing containers don't need root.
+//
+// usage: seed_state root pid id...
+
+#include <cstdlib>
+#include <iostream>
+
+#include "ocijail/runtime_state.h"
+
+using namespace ocijail;
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "usage: seed_state root pid id...\n";
+        return 2;
+    }
+    std::filesystem::path root{argv[1]};
+    int pid = std::atoi(argv[2]);
+    try {
+        for (int i = 3; i < argc; i++) {
+            std::string_view id{argv[i]};
+            runtime_state state{root / id, id};
+            state["root_path"] = "/tmp";
+            state["root_readonly"] = false;
+            state.set_bundle(root);
+            state.set_status(container_status::RUNNING);
+            auto lk = state.create();
+            state.save_config(nlohmann::json{{"ociVersion", "1.0.2"}});
+            state.set_jid(1);
+            state.set_pid(pid);
+            state.save_details();
+            state.save();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "seed_state: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
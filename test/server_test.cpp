@@ -0,0 +1,226 @@
+// Tests for the daemon's request server and the write-through state cache.
+// The handler is a stand-in for the jail and mount backed commands which
+// only manipulates container state, so this runs on any platform.
+
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/runtime_state.h"
+#include "ocijail/server.h"
+#include "ocijail/state_cache.h"
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+using nlohmann::json;
+
+// Implements a few lifecycle operations directly on the container state
+class backend {
+   public:
+    backend(const fs::path& root) : root_(root) {}
+
+    json handle(const json& request) {
+        std::string id = request["id"];
+        std::string command = request["command"];
+        enter(id);
+        json res;
+        res["status"] = 0;
+        runtime_state state{root_ / id, id};
+        state.set_cache(&cache_);
+        if (command == "create") {
+            auto lk = state.create();
+            state.set_pid(0);
+            state.save_config(json{{"hostname", id}});
+            state.save();
+        } else if (command == "increment") {
+            // A read-modify-write which loses updates unless requests for
+            // the same container are serialized.
+            state.load();
+            auto pid = state.pid();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            state.set_pid(pid + 1);
+            state.save();
+        } else if (command == "state") {
+            state.load();
+            res["output"] = state.report();
+            res["output"]["hostname"] = state.config()["hostname"];
+        } else if (command == "delete") {
+            state.remove_all();
+        } else {
+            res["status"] = 1;
+            res["error"] = "unknown command " + command;
+        }
+        leave(id);
+        return res;
+    }
+
+    state_cache cache_;
+    std::atomic<int> max_active_{0};
+    std::atomic<int> overlaps_{0};
+
+   private:
+    void enter(const std::string& id) {
+        std::lock_guard lk{mutex_};
+        if (active_[id]++ > 0) {
+            overlaps_++;
+        }
+        int total = 0;
+        for (auto& [_, n] : active_) {
+            total += n;
+        }
+        if (total > max_active_) {
+            max_active_ = total;
+        }
+    }
+
+    void leave(const std::string& id) {
+        std::lock_guard lk{mutex_};
+        active_[id]--;
+    }
+
+    fs::path root_;
+    std::mutex mutex_;
+    std::map<std::string, int> active_;
+};
+
+static json call(const fs::path& socket,
+                 const std::string& command,
+                 const std::string& id) {
+    auto res = call_server(socket, json{{"command", command}, {"id", id}});
+    if (!res) {
+        throw std::runtime_error{"no server"};
+    }
+    return *res;
+}
+
+// Connect to the server without sending anything
+static int connect_idle(const fs::path& socket) {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socket.c_str(), sizeof(addr.sun_path) - 1);
+    auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        throw std::system_error{errno, std::system_category(), "connect"};
+    }
+    return fd;
+}
+
+int main(int argc, char** argv) {
+    auto root = testing::scratch_dir("server");
+    auto socket = root / "test.sock";
+    CHECK(!call_server(socket, json::object()));
+
+    backend b{root};
+    server srv{socket,
+               8,
+               [&](const json& request) { return b.handle(request); },
+               [](const json& request) -> std::optional<std::string> {
+                   if (request.contains("id")) {
+                       return request["id"];
+                   }
+                   return std::nullopt;
+               }};
+    std::thread server_thread{[&] { srv.run(); }};
+
+    constexpr int CLIENTS = 8;
+    constexpr int INCREMENTS = 50;
+    CHECK(call(socket, "create", "shared")["status"] == 0);
+    std::vector<std::thread> clients;
+    for (int i = 0; i < CLIENTS; i++) {
+        clients.emplace_back([&, i] {
+            auto id = "c" + std::to_string(i);
+            CHECK(call(socket, "create", id)["status"] == 0);
+            for (int j = 0; j < INCREMENTS; j++) {
+                CHECK(call(socket, "increment", "shared")["status"] == 0);
+                CHECK(call(socket, "increment", id)["status"] == 0);
+            }
+            auto res = call(socket, "state", id);
+            CHECK(res["output"]["pid"] == INCREMENTS);
+            CHECK(res["output"]["hostname"] == id);
+            CHECK(call(socket, "delete", id)["status"] == 0);
+        });
+    }
+    for (auto& t : clients) {
+        t.join();
+    }
+
+    // Requests for one container never overlapped but requests for
+    // different containers did.
+    CHECK(b.overlaps_ == 0);
+    CHECK(b.max_active_ > 1);
+    CHECK(call(socket, "state", "shared")["output"]["pid"] ==
+          CLIENTS * INCREMENTS);
+
+    // Saves update the cache so loads should be answered from it
+    auto stats = b.cache_.get_stats();
+    CHECK(stats.hits > stats.misses);
+
+    // A change made without the cache is noticed
+    {
+        runtime_state state{root / "shared", "shared"};
+        auto lk = state.lock();
+        state.load();
+        state.set_pid(12345);
+        state.save();
+    }
+    CHECK(call(socket, "state", "shared")["output"]["pid"] == 12345);
+
+    // Idle connections, including ones part way through a request, don't
+    // occupy the worker threads
+    std::vector<int> idle;
+    for (int i = 0; i < 16; i++) {
+        idle.push_back(connect_idle(socket));
+        if (i % 2) {
+            ::write(idle.back(), "{\"command\"", 10);
+        }
+    }
+    CHECK(call(socket, "state", "shared")["status"] == 0);
+
+    // Requests sent together on one connection are each answered
+    {
+        auto fd = idle.front();
+        std::string req = json{{"command", "state"}, {"id", "shared"}}.dump();
+        req = req + "\n" + req + "\n";
+        CHECK(::write(fd, req.data(), req.size()) == ssize_t(req.size()));
+        std::string buf;
+        while (std::count(buf.begin(), buf.end(), '\n') < 2) {
+            char tmp[4096];
+            auto n = ::read(fd, tmp, sizeof(tmp));
+            if (n <= 0) {
+                break;
+            }
+            buf.append(tmp, n);
+        }
+        CHECK(std::count(buf.begin(), buf.end(), '\n') == 2);
+    }
+    for (auto fd : idle) {
+        ::close(fd);
+    }
+
+    // Malformed requests get an error response
+    CHECK(call(socket, "bogus", "shared")["status"] == 1);
+
+    srv.stop();
+    server_thread.join();
+
+    fs::remove_all(root);
+    return testing::finish();
+}
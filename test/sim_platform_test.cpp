@@ -0,0 +1,228 @@
+// Tests for the simulated platform, driven through the runtime's jail and
+// mount code: jid allocation, parameters, nested jails, the mount table,
+// devfs rules, latencies and fault injection.
+
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "ocijail/jail.h"
+#include "ocijail/mount.h"
+#include "ocijail/sim_platform.h"
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+
+static int create_jail(const std::string& name) {
+    jail::config jconf;
+    jconf.set("name", name);
+    jconf.set("host.hostname", std::string{"test"});
+    jconf.set("enforce_statfs", 1u);
+    jconf.set("persist");
+    return jail::create(jconf).jid();
+}
+
+static void test_jails(sim_platform& sim) {
+    auto a = create_jail("a");
+    auto b = create_jail("b");
+    CHECK(a == 1);
+    CHECK(b == 2);
+
+    // Names are unique
+    try {
+        create_jail("a");
+        CHECK(false);
+    } catch (const std::system_error& e) {
+        CHECK(e.code().value() == EEXIST);
+        CHECK(std::string{e.what()}.find("already exists") !=
+              std::string::npos);
+    }
+
+    // Parameters can be read back and updated
+    auto j = jail::find("a");
+    CHECK(j.jid() == a);
+    CHECK(j.get<uint32_t>("enforce_statfs") == 1);
+    j.set("enforce_statfs", 2u);
+    CHECK(j.get<uint32_t>("enforce_statfs") == 2);
+    // Strings are kept with their terminating null, as passed
+    CHECK(sim.jails()[0].params["host.hostname"] == std::string("test", 5));
+
+    // Flags and limits read back as numbers, as create does for a parent
+    // jail
+    CHECK(!j.get<bool>("allow.chflags"));
+    j.set("children.max", 4u);
+    CHECK(j.get<uint32_t>("children.max") == 4);
+
+    // Nested jails need their parent and go with it
+    try {
+        create_jail("missing.child");
+        CHECK(false);
+    } catch (const std::system_error& e) {
+        CHECK(e.code().value() == ENOENT);
+    }
+    auto child = create_jail("a.child");
+    CHECK(child == 3);
+    jail::find(a).attach();
+    jail::find(a).remove();
+    CHECK(sim.jails().size() == 1);
+    CHECK(sim.jails()[0].name == "b");
+    try {
+        jail::find("a.child");
+        CHECK(false);
+    } catch (const std::system_error& e) {
+        CHECK(e.code().value() == ENOENT);
+    }
+    try {
+        jail::find(child).attach();
+        CHECK(false);
+    } catch (const std::system_error& e) {
+        CHECK(e.code().value() == EINVAL);
+    }
+
+    // Removing a removed jail is not an error and jids are not reused
+    // until they wrap
+    jail::find(a).remove();
+    CHECK(create_jail("c") == 4);
+    jail::find("b").remove();
+    jail::find("c").remove();
+    CHECK(sim.jails().empty());
+}
+
+static int mount(const std::string& type,
+                 const fs::path& path,
+                 const fs::path& target = {},
+                 int flags = 0) {
+    mount_options opts;
+    opts.emplace_back("fstype", type);
+    opts.emplace_back("fspath", path.native());
+    if (!target.empty()) {
+        opts.emplace_back("target", target.native());
+    }
+    return do_mount(opts, flags);
+}
+
+static void test_mounts(sim_platform& sim, const fs::path& dir) {
+    auto root = dir / "root";
+    auto volume = dir / "volume";
+    fs::create_directories(root / "data");
+    fs::create_directories(root / "dev");
+    fs::create_directories(volume);
+
+    // The mount point and target must exist
+    CHECK(mount("nullfs", root / "missing", volume) == -1);
+    CHECK(errno == ENOENT);
+    CHECK(mount("nullfs", root / "data", dir / "missing") == -1);
+    CHECK(errno == ENOENT);
+
+    CHECK(mount("nullfs", root, root, MNT_RDONLY) == 0);
+    CHECK(mount("nullfs", root / "data", volume) == 0);
+    CHECK(mount("devfs", root / "dev") == 0);
+    auto mounts = sim.mounts();
+    CHECK(mounts.size() == 3);
+    CHECK(mounts[0].flags & MNT_RDONLY);
+    CHECK(mounts[1].options["target"] == volume.native());
+
+    // Updating a mount changes its flags
+    CHECK(mount("nullfs", root, {}, MNT_UPDATE) == 0);
+    CHECK(!(sim.mounts()[0].flags & MNT_RDONLY));
+
+    // devfs rules only apply to devfs mounts
+    std::string dev = root / "dev";
+    char* rule[] = {const_cast<char*>("devfs"),
+                    const_cast<char*>("-m"),
+                    dev.data(),
+                    const_cast<char*>("rule"),
+                    const_cast<char*>("apply"),
+                    const_cast<char*>("hide"),
+                    nullptr};
+    CHECK(current_platform().devfs(rule) == 0);
+    CHECK(sim.mounts()[2].devfs_rules.size() == 1);
+    CHECK(sim.mounts()[2].devfs_rules[0] == "rule apply hide");
+    std::string data = root / "data";
+    rule[2] = data.data();
+    CHECK(current_platform().devfs(rule) != 0);
+
+    // The root is busy until the mounts beneath it are gone
+    CHECK(do_unmount(root, MNT_FORCE) == -1);
+    CHECK(errno == EBUSY);
+    CHECK(do_unmount(root / "dev", 0) == 0);
+    CHECK(do_unmount(root / "data", 0) == 0);
+    CHECK(do_unmount(root / "data", 0) == -1);
+    CHECK(errno == EINVAL);
+    CHECK(do_unmount(root, 0) == 0);
+    CHECK(sim.mounts().empty());
+}
+
+static void test_faults(sim_platform& sim) {
+    // The second create fails, then creates succeed again
+    sim.inject_fault(sim_op::SET_JAIL, ENOMEM, 1);
+    auto a = create_jail("a");
+    try {
+        create_jail("b");
+        CHECK(false);
+    } catch (const std::system_error& e) {
+        CHECK(e.code().value() == ENOMEM);
+    }
+    auto b = create_jail("b");
+    CHECK(sim.jails().size() == 2);
+
+    sim.inject_fault(sim_op::UNMOUNT, EBUSY, 0, 2);
+    CHECK(do_unmount("/", 0) == -1);
+    CHECK(errno == EBUSY);
+    CHECK(do_unmount("/", 0) == -1);
+    CHECK(errno == EBUSY);
+    CHECK(do_unmount("/", 0) == -1);
+    CHECK(errno == EINVAL);
+
+    sim.inject_fault(sim_op::REMOVE_JAIL, EPERM, 0, 10);
+    sim.clear_faults();
+    jail::find(a).remove();
+    jail::find(b).remove();
+    CHECK(sim.calls(sim_op::REMOVE_JAIL) == 2);
+}
+
+static void test_latency(sim_platform& sim) {
+    sim.set_latency(sim_op::GET_JAIL, std::chrono::milliseconds{20});
+    auto start = std::chrono::steady_clock::now();
+    try {
+        jail::find("missing");
+    } catch (const std::system_error&) {
+    }
+    CHECK(std::chrono::steady_clock::now() - start >=
+          std::chrono::milliseconds{20});
+    sim.set_latency(sim_op::GET_JAIL, {});
+}
+
+static void test_signal_names() {
+    auto& p = current_platform();
+    CHECK(std::string{p.signal_name(SIGTERM)} == "TERM");
+    CHECK(std::string{p.signal_name(SIGKILL)} == "KILL");
+}
+
+int main(int argc, char** argv) {
+    auto dir = testing::scratch_dir("sim_platform");
+    {
+        sim_platform sim;
+        set_platform(&sim);
+        test_jails(sim);
+    }
+    {
+        sim_platform sim;
+        set_platform(&sim);
+        test_mounts(sim, dir);
+        test_faults(sim);
+        test_latency(sim);
+        test_signal_names();
+    }
+    set_platform(nullptr);
+    fs::remove_all(dir);
+    return testing::finish();
+}
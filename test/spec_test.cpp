@@ -0,0 +1,131 @@
+// Tests for reading and compiling bundle configs. Validation errors are
+// covered by create_test.py - this checks that read_config keeps exactly the
+// members which compile needs and that the compiled form matches the config.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/spec.h"
+#include "test/test_util.h"
+
+using namespace ocijail;
+using nlohmann::json;
+
+static json config() {
+    return json::parse(R"({
+        "ociVersion": "1.1.0",
+        "process": {
+            "args": ["sh", "-c", "true"],
+            "cwd": "/",
+            "env": ["PATH=/bin", "EMPTY"],
+            "user": {"uid": 1, "gid": 2, "umask": 18,
+                     "additionalGids": [3]},
+            "capabilities": {"bounding": ["CAP_CHOWN"]},
+            "rlimits": [{"type": "RLIMIT_NOFILE", "hard": 1, "soft": 1}]
+        },
+        "root": {"path": "rootfs", "readonly": true},
+        "hostname": "test",
+        "mounts": [
+            {"destination": "/dev", "type": "devfs",
+             "options": ["ruleset=4", "rule=path null unhide"]},
+            {"destination": "/data", "type": "bind", "source": "/var/data",
+             "options": ["ro"]}
+        ],
+        "hooks": {
+            "createRuntime": [{"path": "/bin/hook", "args": ["hook", "1"]}],
+            "poststop": [{"path": "/bin/hook", "timeout": 5}]
+        },
+        "annotations": {
+            "org.freebsd.jail.ip4.addr": "10.0.0.1,10.0.0.2",
+            "org.freebsd.jail.allow.mlock": "true",
+            "org.freebsd.jail.allow.bogus": "true",
+            "io.example": "value"
+        },
+        "linux": {"namespaces": [{"type": "pid"}], "seccomp": {}},
+        "vm": null
+    })");
+}
+
+static void test_read_config() {
+    std::istringstream in{config().dump()};
+    auto res = read_config(in);
+
+    CHECK(!res.contains("linux"));
+    CHECK(!res.contains("vm"));
+    CHECK(!res["process"].contains("capabilities"));
+    CHECK(!res["process"].contains("rlimits"));
+    CHECK(res["process"]["user"] == config()["process"]["user"]);
+    CHECK(res["mounts"] == config()["mounts"]);
+    CHECK(res["hooks"] == config()["hooks"]);
+    CHECK(res["annotations"] == config()["annotations"]);
+
+    // Compiling the filtered config gives the same result as the whole
+    // config
+    auto spec = oci_spec::compile(res);
+    auto full = oci_spec::compile(config());
+    CHECK(spec.process.env == full.process.env);
+    CHECK(spec.mounts.size() == full.mounts.size());
+    CHECK(spec.hook_mask() == full.hook_mask());
+
+    // Syntax errors in skipped members are still reported
+    std::istringstream bad{R"({"ociVersion": "1.0.2", "linux": {"a": [}})"};
+    bool threw = false;
+    try {
+        read_config(bad);
+    } catch (const json::parse_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+static void test_compile() {
+    auto spec = oci_spec::compile(config());
+
+    CHECK(spec.version.major == "1" && spec.version.minor == "1");
+    CHECK(spec.process.args.size() == 3);
+    CHECK(spec.process.uid == 1);
+    CHECK(spec.process.gid == 2);
+    CHECK(spec.process.umask == 18);
+    CHECK((spec.process.gids == std::vector<gid_t>{2, 3}));
+    CHECK(spec.root_path == "rootfs");
+    CHECK(spec.root_readonly);
+    CHECK(spec.hostname == "test");
+
+    CHECK(spec.mounts.size() == 2);
+    auto& devfs = spec.mounts[0];
+    CHECK(devfs.type == "devfs");
+    CHECK(devfs.source.empty());
+    CHECK(devfs.options.size() == 2);
+    CHECK(devfs.options[0].key == "ruleset");
+    CHECK(devfs.options[0].value == "4");
+    CHECK(devfs.options[1].key == "rule");
+    CHECK(devfs.options[1].value == "path null unhide");
+    auto& data = spec.mounts[1];
+    CHECK(data.type == "nullfs");
+    CHECK(data.source == "/var/data");
+    CHECK(data.options[0].key == "ro");
+    CHECK(data.options[0].value.empty());
+
+    CHECK(spec.hook_mask() == (1u << CREATE_RUNTIME | 1u << POSTSTOP));
+    CHECK(spec.hooks[CREATE_RUNTIME][0].args->size() == 2);
+    CHECK(!spec.hooks[CREATE_RUNTIME][0].env);
+    CHECK(spec.hooks[POSTSTOP][0].timeout == 5);
+
+    auto& annotations = spec.annotations;
+    CHECK(annotations.vnet == ns_mode::INHERIT);
+    CHECK(annotations.ip4_addrs && annotations.ip4_addrs->size() == 8);
+    CHECK(!annotations.ip6_addrs);
+    CHECK((annotations.allow_params ==
+           std::vector<std::string>{"allow.mlock"}));
+    CHECK((annotations.unknown_allow ==
+           std::vector<std::string>{"org.freebsd.jail.allow.bogus"}));
+}
+
+int main(int argc, char** argv) {
+    test_read_config();
+    test_compile();
+    return testing::finish();
+}
@@ -0,0 +1,104 @@
+// Tests for the shared container index: lookups, growth, removal and
+// rebuilding from the per-container state when the index is lost or
+// corrupted.
+
+#include <stdlib.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "ocijail/runtime_state.h"
+#include "ocijail/state_index.h"
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+
+static void create_container(const fs::path& root,
+                             const std::string& id,
+                             int pid) {
+    runtime_state state{root / id, id};
+    auto lk = state.create();
+    state.set_pid(pid);
+    state.set_jid(pid + 1);
+    state.set_bundle("/bundles/" + id);
+    state.save();
+}
+
+int main(int argc, char** argv) {
+    auto root = testing::scratch_dir("state_index");
+    constexpr int N = 3000;
+
+    // Reading a state root which doesn't exist yet doesn't create it
+    {
+        state_index index{root / "missing"};
+        CHECK(index.entries().empty());
+        CHECK(!index.lookup("c1"));
+        CHECK(!fs::exists(root / "missing"));
+    }
+
+    // Enough containers to force the index to grow a few times
+    for (int i = 0; i < N; i++) {
+        create_container(root, "c" + std::to_string(i), i);
+    }
+    {
+        state_index index{root};
+        CHECK(index.entries().size() == N);
+        auto e = index.lookup("c1234");
+        CHECK(e && e->record.pid == 1234 && e->record.jid == 1235);
+        CHECK(e && std::string{e->record.bundle} == "/bundles/c1234");
+        CHECK(!index.lookup("missing"));
+    }
+
+    // Removed containers disappear from the index
+    for (int i = 0; i < N; i += 2) {
+        std::string id = "c" + std::to_string(i);
+        runtime_state{root / id, id}.remove_all();
+    }
+    {
+        state_index index{root};
+        CHECK(index.entries().size() == N / 2);
+        CHECK(!index.lookup("c1234"));
+        CHECK(index.lookup("c1235"));
+    }
+
+    // A missing index is rebuilt from the state directories
+    fs::remove(root / "index");
+    {
+        state_index index{root};
+        CHECK(index.entries().size() == N / 2);
+        CHECK(index.lookup("c2999"));
+    }
+
+    // So is a corrupt one
+    std::ofstream{root / "index"} << "garbage";
+    {
+        state_index index{root};
+        CHECK(index.entries().size() == N / 2);
+        auto e = index.lookup("c1");
+        CHECK(e && e->record.pid == 1);
+    }
+
+    // If the rebuilt index can't be renamed into place, the old one is
+    // kept and the temporary file removed
+    {
+        state_index index{root};
+        CHECK(index.lookup("c1"));
+        fs::remove(root / "index");
+        fs::create_directories(root / "index" / "busy");
+        bool threw = false;
+        try {
+            index.rebuild();
+        } catch (const std::system_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+        CHECK(!fs::exists(root / "index.new"));
+        CHECK(index.lookup("c1"));
+    }
+
+    fs::remove_all(root);
+    return testing::finish();
+}
@@ -0,0 +1,114 @@
+// Tests for container state locks: recording the holder, timing out and
+// recording wait and hold times. Locks taken through separate opens of the
+// lock file exclude each other even within one process.
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "ocijail/recorder.h"
+#include "ocijail/runtime_state.h"
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+using namespace std::chrono;
+
+static runtime_state state_for(const fs::path& root,
+                               std::string_view command,
+                               unsigned timeout = 0) {
+    runtime_state state{root / "c1", "c1"};
+    state.set_lock_policy({timeout, command});
+    return state;
+}
+
+static void test_holder(const fs::path& root) {
+    auto state = state_for(root, "a-very-long-command-name");
+    auto before = lifecycle_time::now().wall;
+    auto lk = state.create();
+    auto holder = state.get_lock_holder();
+    CHECK(holder);
+    CHECK(holder->pid == ::getpid());
+    CHECK(std::string{holder->command} == "a-very-long-com");
+    CHECK(holder->since >= before);
+}
+
+static void test_timeout(const fs::path& root) {
+    flight_recorder rec;
+    auto holder = state_for(root, "delete");
+    auto lk = holder.lock();
+
+    auto waiter = state_for(root, "start", 50);
+    auto start = steady_clock::now();
+    bool timed_out = false;
+    try {
+        waiter.lock();
+    } catch (const lock_timeout& e) {
+        timed_out = true;
+        std::string what{e.what()};
+        CHECK(e.code().value() == ETIMEDOUT);
+        CHECK(what.find("state lock of container c1 held by pid " +
+                        std::to_string(::getpid()) + " (delete) for ") !=
+              std::string::npos);
+    }
+    auto waited = steady_clock::now() - start;
+    CHECK(timed_out);
+    CHECK(waited >= milliseconds{50});
+    CHECK(waited < seconds{5});
+
+    auto events = rec.events();
+    CHECK(!events.empty());
+    auto& wait = events.back();
+    CHECK(wait.op == uint16_t(flight_op::LOCK_WAIT));
+    CHECK(wait.error == ETIMEDOUT);
+    CHECK(wait.duration >= 50000000);
+
+    lk.unlock();
+    auto& totals = rec.totals();
+    auto& hold = totals.ops[size_t(flight_op::LOCK_HOLD)];
+    CHECK(hold.count == 1);
+    CHECK(hold.sum >= 50000000);
+    CHECK(totals.ops[size_t(flight_op::LOCK_WAIT)].count == 2);
+    CHECK(totals.ops[size_t(flight_op::LOCK_WAIT)].errors == 1);
+
+    // A waiter gets the lock when it is released in time
+    std::promise<void> locked;
+    std::thread other{[&] {
+        auto state = state_for(root, "exec");
+        auto lk = state.lock();
+        locked.set_value();
+        std::this_thread::sleep_for(milliseconds{20});
+    }};
+    locked.get_future().wait();
+    auto patient = state_for(root, "kill", 5000);
+    auto lk2 = patient.lock();
+    other.join();
+    CHECK(std::string{patient.get_lock_holder()->command} == "kill");
+
+    // Taking the lock again also times out
+    lk2.unlock();
+    auto lk3 = waiter.lock();
+    lk3.unlock();
+    auto lk4 = holder.lock();
+    bool relock_timed_out = false;
+    try {
+        lk3.lock();
+    } catch (const lock_timeout&) {
+        relock_timed_out = true;
+    }
+    CHECK(relock_timed_out);
+}
+
+int main(int argc, char** argv) {
+    auto root = testing::scratch_dir("state_lock");
+    test_holder(root);
+    test_timeout(root);
+    fs::remove_all(root);
+    return testing::finish();
+}
@@ -0,0 +1,116 @@
+// Stress test for lock-free reads of the container status record. A writer
+// repeatedly publishes new status records while several readers load them
+// without taking the state lock. Every record written by the writer is
+// internally consistent so any mismatch seen by a reader means that it
+// observed a torn update.
+
+#include <stdlib.h>
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ocijail/runtime_state.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+
+static constexpr int ITERATIONS = 10000;
+static constexpr int READERS = 8;
+
+// A long bundle path makes the record span more than one page so that a
+// non-atomic update would be likely to be observed half-written.
+static std::string bundle_for(int i) {
+    auto s = "/bundles/" + std::to_string(i) + "/";
+    while (s.size() < PATH_MAX - 16) {
+        s += std::to_string(i % 10);
+    }
+    return s;
+}
+
+static fs::path scratch_dir() {
+    // Prefer a tmpfs so that we measure the publication protocol rather than
+    // the disk.
+    std::string base = "/tmp";
+    if (auto p = ::getenv("TEST_TMPDIR")) {
+        base = p;
+    }
+    if (fs::is_directory("/dev/shm")) {
+        base = "/dev/shm";
+    }
+    auto tmpl = base + "/state_stress.XXXXXX";
+    if (::mkdtemp(tmpl.data()) == nullptr) {
+        throw std::system_error{errno, std::system_category(), "mkdtemp"};
+    }
+    return tmpl;
+}
+
+int main(int argc, char** argv) {
+    auto root = scratch_dir();
+    std::string id = "stress";
+    auto dir = root / id;
+
+    runtime_state writer{dir, id};
+    auto lk = writer.create();
+    writer.set_pid(0);
+    writer.set_jid(0);
+    writer.set_bundle(bundle_for(0));
+    writer.save();
+
+    std::atomic<bool> done{false};
+    std::atomic<int> torn{0};
+    std::atomic<int> failed{0};
+    std::atomic<long> reads{0};
+    std::vector<std::thread> readers;
+    for (int i = 0; i < READERS; i++) {
+        readers.emplace_back([&] {
+            uint64_t last_generation = 0;
+            while (!done) {
+                runtime_state reader{dir, id};
+                try {
+                    reader.load();
+                } catch (const std::exception& e) {
+                    std::cerr << "load failed: " << e.what() << "\n";
+                    failed++;
+                    continue;
+                }
+                reads++;
+                auto i = reader.pid();
+                if (reader.jid() != i ||
+                    reader.bundle().native() != bundle_for(i) ||
+                    reader.generation() != uint64_t(i) + 1 ||
+                    reader.status() != (i % 2 ? container_status::RUNNING
+                                              : container_status::CREATED)) {
+                    torn++;
+                }
+                if (reader.generation() < last_generation) {
+                    std::cerr << "generation went backwards\n";
+                    torn++;
+                }
+                last_generation = reader.generation();
+            }
+        });
+    }
+
+    for (int i = 1; i < ITERATIONS; i++) {
+        writer.set_pid(i);
+        writer.set_jid(i);
+        writer.set_bundle(bundle_for(i));
+        writer.set_status(i % 2 ? container_status::RUNNING
+                                : container_status::CREATED);
+        writer.save();
+    }
+    done = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+    lk.unlock();
+    fs::remove_all(root);
+
+    std::cout << reads << " reads, " << torn << " torn, " << failed
+              << " failed\n";
+    return (torn == 0 && failed == 0) ? 0 : 1;
+}
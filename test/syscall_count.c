@@ -0,0 +1,312 @@
+// A library for LD_PRELOAD which counts a process' calls to the C library
+// wrappers of common system calls. When the process exits, the counts are
+// written as a JSON object to the file named by OCIJAIL_SYSCALL_COUNTS.
+//
+// Only the process which loaded the library reports its counts - both
+// variables are removed from the environment so that processes started
+// with exec are not counted, and forked children don't write the file.
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CALLS(X) \
+    X(access)    \
+    X(close)     \
+    X(fcntl)     \
+    X(flock)     \
+    X(fstat)     \
+    X(fstatat)   \
+    X(fsync)     \
+    X(ftruncate) \
+    X(kill)      \
+    X(lstat)     \
+    X(mkdir)     \
+    X(mmap)      \
+    X(munmap)    \
+    X(open)      \
+    X(openat)    \
+    X(pread)     \
+    X(pwrite)    \
+    X(read)      \
+    X(readlink)  \
+    X(rename)    \
+    X(rmdir)     \
+    X(sigaction) \
+    X(stat)      \
+    X(unlink)    \
+    X(write)
+
+#define ENUM(name) CALL_##name,
+enum { CALLS(ENUM) NUM_CALLS };
+
+#define NAME(name) #name,
+static const char* const call_names[NUM_CALLS] = {CALLS(NAME)};
+
+static unsigned long counts[NUM_CALLS];
+static char* output;
+static pid_t owner;
+
+static void count(int call) {
+    __atomic_fetch_add(&counts[call], 1, __ATOMIC_RELAXED);
+}
+
+// Look up the next definition of a function, i.e. the C library's
+#define REAL(name)                                       \
+    static __typeof__(&name) real;                       \
+    if (!real) {                                         \
+        real = (__typeof__(&name))dlsym(RTLD_NEXT, #name); \
+    }
+
+__attribute__((constructor)) static void init(void) {
+    owner = getpid();
+    const char* path = getenv("OCIJAIL_SYSCALL_COUNTS");
+    if (path) {
+        output = strdup(path);
+    }
+    unsetenv("OCIJAIL_SYSCALL_COUNTS");
+    unsetenv("LD_PRELOAD");
+}
+
+__attribute__((destructor)) static void report(void) {
+    if (!output || getpid() != owner) {
+        return;
+    }
+    // Take a copy so that the report's own calls are not included
+    unsigned long snapshot[NUM_CALLS];
+    memcpy(snapshot, counts, sizeof(snapshot));
+    FILE* f = fopen(output, "w");
+    if (!f) {
+        return;
+    }
+    fprintf(f, "{");
+    for (int i = 0; i < NUM_CALLS; i++) {
+        fprintf(f, "%s\"%s\": %lu", i ? ", " : "", call_names[i], snapshot[i]);
+    }
+    fprintf(f, "}\n");
+    fclose(f);
+}
+
+int access(const char* path, int mode) {
+    REAL(access);
+    count(CALL_access);
+    return real(path, mode);
+}
+
+int close(int fd) {
+    REAL(close);
+    count(CALL_close);
+    return real(fd);
+}
+
+int fcntl(int fd, int cmd, ...) {
+    REAL(fcntl);
+    va_list ap;
+    va_start(ap, cmd);
+    intptr_t arg = va_arg(ap, intptr_t);
+    va_end(ap);
+    count(CALL_fcntl);
+    return real(fd, cmd, arg);
+}
+
+int flock(int fd, int op) {
+    REAL(flock);
+    count(CALL_flock);
+    return real(fd, op);
+}
+
+int fstat(int fd, struct stat* sb) {
+    REAL(fstat);
+    count(CALL_fstat);
+    return real(fd, sb);
+}
+
+int fstatat(int dirfd, const char* path, struct stat* sb, int flags) {
+    REAL(fstatat);
+    count(CALL_fstatat);
+    return real(dirfd, path, sb, flags);
+}
+
+int fsync(int fd) {
+    REAL(fsync);
+    count(CALL_fsync);
+    return real(fd);
+}
+
+int ftruncate(int fd, off_t length) {
+    REAL(ftruncate);
+    count(CALL_ftruncate);
+    return real(fd, length);
+}
+
+int kill(pid_t pid, int sig) {
+    REAL(kill);
+    count(CALL_kill);
+    return real(pid, sig);
+}
+
+int lstat(const char* path, struct stat* sb) {
+    REAL(lstat);
+    count(CALL_lstat);
+    return real(path, sb);
+}
+
+int mkdir(const char* path, mode_t mode) {
+    REAL(mkdir);
+    count(CALL_mkdir);
+    return real(path, mode);
+}
+
+void* mmap(void* addr, size_t len, int prot, int flags, int fd, off_t off) {
+    REAL(mmap);
+    count(CALL_mmap);
+    return real(addr, len, prot, flags, fd, off);
+}
+
+int munmap(void* addr, size_t len) {
+    REAL(munmap);
+    count(CALL_munmap);
+    return real(addr, len);
+}
+
+int open(const char* path, int flags, ...) {
+    REAL(open);
+    va_list ap;
+    va_start(ap, flags);
+    int mode = (flags & O_CREAT) ? va_arg(ap, int) : 0;
+    va_end(ap);
+    count(CALL_open);
+    return real(path, flags, mode);
+}
+
+int openat(int dirfd, const char* path, int flags, ...) {
+    REAL(openat);
+    va_list ap;
+    va_start(ap, flags);
+    int mode = (flags & O_CREAT) ? va_arg(ap, int) : 0;
+    va_end(ap);
+    count(CALL_openat);
+    return real(dirfd, path, flags, mode);
+}
+
+ssize_t pread(int fd, void* buf, size_t n, off_t off) {
+    REAL(pread);
+    count(CALL_pread);
+    return real(fd, buf, n, off);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t n, off_t off) {
+    REAL(pwrite);
+    count(CALL_pwrite);
+    return real(fd, buf, n, off);
+}
+
+ssize_t read(int fd, void* buf, size_t n) {
+    REAL(read);
+    count(CALL_read);
+    return real(fd, buf, n);
+}
+
+ssize_t readlink(const char* path, char* buf, size_t n) {
+    REAL(readlink);
+    count(CALL_readlink);
+    return real(path, buf, n);
+}
+
+int rename(const char* from, const char* to) {
+    REAL(rename);
+    count(CALL_rename);
+    return real(from, to);
+}
+
+int rmdir(const char* path) {
+    REAL(rmdir);
+    count(CALL_rmdir);
+    return real(path);
+}
+
+int sigaction(int sig, const struct sigaction* act, struct sigaction* old) {
+    REAL(sigaction);
+    count(CALL_sigaction);
+    return real(sig, act, old);
+}
+
+int stat(const char* path, struct stat* sb) {
+    REAL(stat);
+    count(CALL_stat);
+    return real(path, sb);
+}
+
+int unlink(const char* path) {
+    REAL(unlink);
+    count(CALL_unlink);
+    return real(path);
+}
+
+ssize_t write(int fd, const void* buf, size_t n) {
+    REAL(write);
+    count(CALL_write);
+    return real(fd, buf, n);
+}
+
+#ifdef __linux__
+// With glibc, C++ code built for large files calls the 64 bit variants
+// directly
+
+int fstat64(int fd, struct stat64* sb) {
+    REAL(fstat64);
+    count(CALL_fstat);
+    return real(fd, sb);
+}
+
+int fstatat64(int dirfd, const char* path, struct stat64* sb, int flags) {
+    REAL(fstatat64);
+    count(CALL_fstatat);
+    return real(dirfd, path, sb, flags);
+}
+
+int lstat64(const char* path, struct stat64* sb) {
+    REAL(lstat64);
+    count(CALL_lstat);
+    return real(path, sb);
+}
+
+int open64(const char* path, int flags, ...) {
+    REAL(open64);
+    va_list ap;
+    va_start(ap, flags);
+    int mode = (flags & O_CREAT) ? va_arg(ap, int) : 0;
+    va_end(ap);
+    count(CALL_open);
+    return real(path, flags, mode);
+}
+
+int openat64(int dirfd, const char* path, int flags, ...) {
+    REAL(openat64);
+    va_list ap;
+    va_start(ap, flags);
+    int mode = (flags & O_CREAT) ? va_arg(ap, int) : 0;
+    va_end(ap);
+    count(CALL_openat);
+    return real(dirfd, path, flags, mode);
+}
+
+int stat64(const char* path, struct stat64* sb) {
+    REAL(stat64);
+    count(CALL_stat);
+    return real(path, sb);
+}
+#endif
@@ -0,0 +1,114 @@
+#! /usr/bin/env python
+
+# Count the system calls made by commands which don't need root, using an
+# LD_PRELOAD library which counts calls to the C library's wrappers, and
+# check the counts against the budgets in syscall_budget.json. Most of the
+# runtime's overheads are extra system calls, so an unexpected increase
+# should be looked at, even if it is not yet slow. After an intended
+# change, update the budgets with the counts reported by this test. Each
+# call's budget is its measured count and the totals allow a couple of
+# calls of slack.
+
+import json
+import os
+import os.path
+import signal
+import subprocess
+import sys
+import tempfile
+import unittest
+
+cmd = "ocijail/ocijail"
+preload = os.path.abspath("test/syscall_count.so")
+seed = "test/seed_state"
+budget_path = "test/syscall_budget.json"
+
+# The number of containers in the state database
+CONTAINERS = 10
+
+class test_syscalls(unittest.TestCase):
+    "System call budgets for state, list, kill and create"
+
+    @classmethod
+    def setUpClass(cls):
+        with open(budget_path) as f:
+            cls.budgets = json.load(f)
+        cls.dir = tempfile.TemporaryDirectory()
+        cls.root = os.path.join(cls.dir.name, "state")
+        cls.bundle = os.path.join(cls.dir.name, "bundle")
+        os.mkdir(cls.bundle)
+        with open(os.path.join(cls.bundle, "config.json"), "w") as f:
+            json.dump({
+                "ociVersion": "1.0.2",
+                "process": {
+                    "args": ["sh"],
+                    "cwd": "/",
+                },
+                "root": {
+                    "path": "/tmp"
+                },
+                "mounts": [
+                    {
+                        "destination": "/data",
+                        "type": "nullfs",
+                        "source": "/tmp",
+                        "options": ["ro"],
+                    }
+                ]
+            }, f)
+
+        # The containers' process, which kill sends a harmless signal to
+        cls.proc = subprocess.Popen(["sleep", "600"])
+        ids = [f"c{i}" for i in range(CONTAINERS)]
+        subprocess.run([seed, cls.root, str(cls.proc.pid)] + ids, check=True)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.proc.kill()
+        cls.proc.wait()
+        cls.dir.cleanup()
+
+    def count(self, *args):
+        counts_path = os.path.join(self.dir.name, "counts.json")
+        env = dict(os.environ)
+        env["LD_PRELOAD"] = preload
+        env["OCIJAIL_SYSCALL_COUNTS"] = counts_path
+        res = subprocess.run([cmd, "--root", self.root] + list(args),
+                             env=env, stdout=subprocess.DEVNULL)
+        self.assertEqual(res.returncode, 0)
+        with open(counts_path) as f:
+            counts = json.load(f)
+        os.unlink(counts_path)
+        counts["total"] = sum(counts.values())
+        return counts
+
+    def check(self, name, *args):
+        # Run twice so that the counts don't include creating the state
+        # database's shared files. The second run also finds the metrics
+        # text file freshly written by the first and leaves it alone.
+        self.count(*args)
+        counts = self.count(*args)
+        used = ", ".join(f"{k}={v}" for k, v in sorted(counts.items())
+                         if v > 0 and k != "total")
+        print(f"{name}: {counts['total']} calls: {used}", file=sys.stderr)
+        for call, budget in self.budgets[name].items():
+            self.assertLessEqual(
+                counts.get(call, 0), budget,
+                f"{name} made {counts.get(call, 0)} {call} calls, "
+                f"budget {budget}")
+
+    def test_state(self):
+        self.check("state", "state", "c0")
+
+    def test_list(self):
+        self.check("list", "list")
+
+    def test_kill(self):
+        self.check("kill", "kill", "c0", str(int(signal.SIGCONT)))
+
+    def test_create(self):
+        self.check("create", "--testing=validation",
+                   "create", "--bundle", self.bundle, "new")
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,34 @@
+#include <stdlib.h>
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+namespace ocijail::testing {
+
+int failures = 0;
+
+fs::path scratch_dir(std::string_view name) {
+    std::string base = "/tmp";
+    if (auto p = ::getenv("TEST_TMPDIR")) {
+        base = p;
+    }
+    auto tmpl = base + "/" + std::string{name} + ".XXXXXX";
+    if (::mkdtemp(tmpl.data()) == nullptr) {
+        throw std::system_error{errno, std::system_category(), "mkdtemp"};
+    }
+    return tmpl;
+}
+
+int finish() {
+    if (failures > 0) {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    return 0;
+}
+
+}  // namespace ocijail::testing
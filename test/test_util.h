@@ -0,0 +1,29 @@
+#pragma once
+
+#include <filesystem>
+#include <iostream>
+#include <string_view>
+
+namespace ocijail::testing {
+
+// The number of checks which have failed
+extern int failures;
+
+// Create an empty directory for a test under $TEST_TMPDIR, or /tmp if that
+// isn't set. The name is used as a prefix for the directory's name.
+std::filesystem::path scratch_dir(std::string_view name);
+
+// Report any failed checks and return the test's exit status
+int finish();
+
+}  // namespace ocijail::testing
+
+// Record a failure without stopping the test
+#define CHECK(cond)                                                   \
+    do {                                                              \
+        if (!(cond)) {                                                \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " << #cond \
+                      << " failed\n";                                 \
+            ::ocijail::testing::failures++;                           \
+        }                                                             \
+    } while (0)
@@ -0,0 +1,103 @@
+// Tests for the log of deleted containers' lifecycle timings.
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "ocijail/runtime_state.h"
+#include "ocijail/timing_log.h"
+#include "test/test_util.h"
+
+namespace fs = std::filesystem;
+
+using namespace ocijail;
+using nlohmann::json;
+
+static void test_entry(const fs::path& root) {
+    runtime_state state{root / "c1", "c1"};
+    auto lk = state.create();
+    state.set_time(START_REQUESTED, {100, 200});
+    state.set_time(DELETE_DONE);
+    auto entry = timing_log::entry(state);
+    CHECK(entry["id"] == "c1");
+    CHECK(entry["status"] == "created");
+    CHECK(entry["timings"].size() == 3);
+    CHECK(entry["timings"]["createBegin"]["wall"] > 0);
+    CHECK(entry["timings"]["startRequested"]["wall"] == 100);
+    CHECK(entry["timings"]["startRequested"]["monotonic"] == 200);
+    CHECK(entry["timings"]["deleteDone"]["monotonic"] >=
+          entry["timings"]["createBegin"]["monotonic"]);
+    state.remove_all();
+}
+
+static void test_find(const fs::path& root) {
+    timing_log log{root};
+    CHECK(!log.find("c1"));
+    log.append({{"id", "c1"}, {"n", 1}});
+    log.append({{"id", "c2"}, {"n", 2}});
+    log.append({{"id", "c1"}, {"n", 3}});
+
+    // A torn line is skipped
+    std::ofstream{root / ".timings" / "log", std::ios::app} << "{\"id\": \"c";
+    log.append({{"id", "c3"}, {"n", 4}});
+
+    CHECK(log.find("c1") && (*log.find("c1"))["n"] == 3);
+    CHECK(log.find("c2") && (*log.find("c2"))["n"] == 2);
+    CHECK(!log.find("c4"));
+}
+
+static void test_rotate(const fs::path& root) {
+    timing_log log{root / "rotate"};
+    auto padding = std::string(1000, 'x');
+    auto n = timing_log::MAX_SIZE / padding.size() + 10;
+    for (size_t i = 0; i < n; i++) {
+        log.append({{"id", "c" + std::to_string(i)}, {"padding", padding}});
+    }
+    auto dir = root / "rotate" / ".timings";
+    CHECK(fs::file_size(dir / "log.1") >= timing_log::MAX_SIZE);
+    CHECK(fs::file_size(dir / "log") < timing_log::MAX_SIZE);
+
+    // Entries are found in either log
+    CHECK(log.find("c0"));
+    CHECK(log.find("c" + std::to_string(n - 1)));
+}
+
+static void test_concurrent_rotate(const fs::path& root) {
+    // Appenders which find the log full at the same time rotate it once,
+    // so the previous log is never replaced by a nearly empty one.
+    constexpr int THREADS = 8;
+    auto padding = std::string(1000, 'x');
+    auto n = 3 * timing_log::MAX_SIZE / padding.size() / THREADS;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&, t] {
+            timing_log log{root / "concurrent"};
+            for (size_t i = 0; i < n; i++) {
+                auto id = "c" + std::to_string(t) + "-" + std::to_string(i);
+                log.append({{"id", id}, {"padding", padding}});
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto dir = root / "concurrent" / ".timings";
+    CHECK(fs::file_size(dir / "log.1") >= timing_log::MAX_SIZE);
+}
+
+int main(int argc, char** argv) {
+    auto root = testing::scratch_dir("timing_log");
+    test_entry(root);
+    test_find(root);
+    test_rotate(root);
+    test_concurrent_rotate(root);
+    fs::remove_all(root);
+    return testing::finish();
+}